@@ -0,0 +1,617 @@
+/*
+ * Host benchmarks for the catalog and listing path.
+ *
+ * Generates a synthetic library, then times the firmware's own code on it:
+ * EPUB metadata parsing, a first scan that indexes every book and a rescan
+ * that finds them all unchanged, paging through /list-files with rows
+ * rendered as the handler renders them, a filtered page and a full-text
+ * search (checking that pages sent in batches match one streamed pass),
+ * and a verified copy through the copy engine. Every phase also
+ * checks its result, so the run doubles as a regression test.
+ *
+ * Results print as "name value unit" lines. --save writes them to a file;
+ * --baseline compares against one and fails when a tracked figure is worse
+ * by more than --tolerance percent. Baselines only mean something on the
+ * machine that wrote them.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+#include "catalog.h"
+#include "copy_engine.h"
+#include "epub_meta.h"
+#include "json_stream.h"
+#include "listing.h"
+#include "scanner.h"
+
+#include "host_metrics.h"
+#include "synth_library.h"
+#include "unishox1.h"
+
+// The firmware's /list-files chunk and the web UI's page size
+#define BENCH_LIST_CHUNK_SIZE 4096
+#define BENCH_LIST_PAGE_SIZE  50
+#define BENCH_FILTER_TEXT     "lighthouse"
+#define BENCH_SEARCH_TEXT     "secret journey"
+#define BENCH_DEFAULT_COPY_MIB 64
+#define BENCH_DEFAULT_TOLERANCE 25
+#define BENCH_MAX_METRICS     16
+// Single-page timings are the best of this many runs; one run is mostly noise
+#define BENCH_REPEATS         5
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    double value;
+    bool higher_is_better;
+    bool tracked;           // Compared against a baseline; setup steps are not
+} metric_t;
+
+typedef struct {
+    uint32_t books;
+    uint32_t copy_mib;
+    const char *dir;
+    const char *baseline;
+    const char *save;
+    double tolerance;
+    bool keep;
+} bench_args_t;
+
+static metric_t g_metrics[BENCH_MAX_METRICS];
+static size_t g_metric_count;
+static int g_failures;
+
+static void record(const char *name, const char *unit, double value, bool higher_is_better, bool tracked) {
+    if (g_metric_count < BENCH_MAX_METRICS) {
+        g_metrics[g_metric_count++] = (metric_t){ name, unit, value, higher_is_better, tracked };
+    }
+    printf("%-24s %12.1f %s\n", name, value, unit);
+}
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        g_failures++;
+    }
+}
+
+static double per_second(uint64_t count, int64_t us) {
+    return us > 0 ? (double)count * 1000000.0 / (double)us : 0;
+}
+
+// --- Parse ---
+static void bench_parse(const bench_args_t *args, const synth_library_config_t *lib) {
+    epub_metadata_t meta;
+    uint32_t mismatched = 0;
+    int64_t elapsed = 0;
+    for (uint32_t i = 0; i < lib->books; i++) {
+        char name[256], path[1024], expected[EPUB_META_TITLE_MAX];
+        synth_library_book_name(lib, i, name, sizeof(name));
+        snprintf(path, sizeof(path), "%s/%s", args->dir, name);
+        int64_t start = esp_timer_get_time();
+        esp_err_t ret = epub_read_metadata(path, &meta);
+        elapsed += esp_timer_get_time() - start;
+        synth_library_book_title(lib, i, expected, sizeof(expected));
+        if (ret != ESP_OK || strcmp(meta.title, expected) != 0 || meta.author[0] == '\0' ||
+            meta.description[0] == '\0' || strcmp(meta.cover, "OEBPS/images/cover.jpg") != 0) {
+            mismatched++;
+        }
+    }
+    record("parse", "books/s", per_second(lib->books, elapsed), true, true);
+    check(mismatched == 0, "parsed metadata does not match the generated books");
+}
+
+// --- Index ---
+// The scanner's walk: every directory entry is stat'ed, books are synced in
+// batches that commit and release the catalog lock.
+static esp_err_t scan(const char *dir, catalog_sync_stats_t *stats, int64_t *us) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return ESP_FAIL;
+    }
+    int64_t start = esp_timer_get_time();
+    catalog_sync_t *sync;
+    esp_err_t ret = catalog_sync_begin(CATALOG_VOLUME_SD, &sync);
+    if (ret != ESP_OK) {
+        closedir(d);
+        return ret;
+    }
+    uint32_t batch_files = 0, batch_parses = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!catalog_is_book_file(de->d_name)) {
+            continue;
+        }
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        bool parsed = false;
+        catalog_sync_file(sync, dir, de->d_name, st.st_size, st.st_mtime, &parsed);
+        batch_files++;
+        if (parsed) batch_parses++;
+        if (batch_files >= SCANNER_BATCH_FILES || batch_parses >= SCANNER_BATCH_PARSES) {
+            catalog_sync_yield(sync);
+            batch_files = 0;
+            batch_parses = 0;
+        }
+    }
+    closedir(d);
+    ret = catalog_sync_finish(sync, true, stats);
+    *us = esp_timer_get_time() - start;
+    return ret;
+}
+
+static void bench_index(const bench_args_t *args, const synth_library_config_t *lib) {
+    catalog_sync_stats_t stats;
+    int64_t us;
+    esp_err_t ret = scan(args->dir, &stats, &us);
+    record("index", "books/s", per_second(lib->books, us), true, true);
+    check(ret == ESP_OK && stats.parsed == lib->books, "first scan did not index every book");
+
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < BENCH_REPEATS && ret == ESP_OK; i++) {
+        ret = scan(args->dir, &stats, &us);
+        check(ret == ESP_OK && stats.unchanged == lib->books && stats.parsed == 0,
+              "rescan did not find every book unchanged");
+        best = us < best ? us : best;
+    }
+    record("rescan", "books/s", per_second(lib->books, best), true, true);
+}
+
+// --- List ---
+typedef struct {
+    uint64_t bytes;
+    uint32_t rows;
+    char last[128];     // Name of the last row, which the next page continues after
+} list_sink_t;
+
+static esp_err_t count_flush(void *ctx, const char *data, size_t len) {
+    (void)data;
+    ((list_sink_t *)ctx)->bytes += len;
+    return ESP_OK;
+}
+
+static bool count_rendered(const catalog_entry_t *entry, void *ctx) {
+    json_stream_t *js = ctx;
+    list_sink_t *sink = js->ctx;
+    sink->rows++;
+    strlcpy(sink->last, entry->name, sizeof(sink->last));
+    return listing_add_entry(entry, js);
+}
+
+// One /list-files page as the handler produces it: count, query, render.
+static esp_err_t render_page(catalog_query_t *query, catalog_row_cb_t row, list_sink_t *sink, uint32_t *total) {
+    char chunk[BENCH_LIST_CHUNK_SIZE];
+    esp_err_t ret = catalog_count(query, total);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    json_stream_t js;
+    json_stream_init(&js, chunk, sizeof(chunk), count_flush, sink);
+    json_stream_begin_array(&js);
+    ret = catalog_query(query, row, &js);
+    json_stream_end_array(&js);
+    esp_err_t flushed = json_stream_finish(&js);
+    return ret != ESP_OK ? ret : flushed;
+}
+
+static bool count_row(const catalog_entry_t *entry, void *ctx) {
+    (void)entry;
+    (*(uint32_t *)ctx)++;
+    return true;
+}
+
+// Best of BENCH_REPEATS renders of one page; `sink` and `total` hold the last
+static int64_t time_page(catalog_query_t *query, list_sink_t *sink, uint32_t *total, esp_err_t *ret) {
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < BENCH_REPEATS; i++) {
+        *sink = (list_sink_t){ 0 };
+        int64_t start = esp_timer_get_time();
+        *ret = render_page(query, count_rendered, sink, total);
+        int64_t us = esp_timer_get_time() - start;
+        best = us < best ? us : best;
+    }
+    return best;
+}
+
+// The same for a page of bare rows from `query` or, if it is NULL, `search`
+static int64_t time_rows(const catalog_query_t *query, const catalog_search_t *search, uint32_t *rows,
+                         esp_err_t *ret) {
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < BENCH_REPEATS; i++) {
+        *rows = 0;
+        int64_t start = esp_timer_get_time();
+        *ret = query ? catalog_query(query, count_row, rows) : catalog_search(search, count_row, rows);
+        int64_t us = esp_timer_get_time() - start;
+        best = us < best ? us : best;
+    }
+    return best;
+}
+
+// Collects a response in memory
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} capture_t;
+
+static esp_err_t capture_flush(void *ctx, const char *data, size_t len) {
+    capture_t *c = ctx;
+    if (c->len + len > c->cap) {
+        size_t cap = (c->len + len) * 2;
+        char *grown = realloc(c->data, cap);
+        if (!grown) {
+            return ESP_ERR_NO_MEM;
+        }
+        c->data = grown;
+        c->cap = cap;
+    }
+    memcpy(c->data + c->len, data, len);
+    c->len += len;
+    return ESP_OK;
+}
+
+// The handlers send pages in batches rendered with the catalog lock held.
+// Whatever the buffer size, down to one too small for a single row, they must
+// send the bytes of one pass streamed from `query` or, if it is NULL, `search`.
+static void check_batched(const catalog_query_t *query, const catalog_search_t *search) {
+    static const size_t caps[] = { BENCH_LIST_CHUNK_SIZE, 512, 64 };
+    char chunk[BENCH_LIST_CHUNK_SIZE];
+    capture_t direct = { 0 };
+    json_stream_t js;
+    json_stream_init(&js, chunk, sizeof(chunk), capture_flush, &direct);
+    json_stream_begin_array(&js);
+    esp_err_t ret = query ? catalog_query(query, listing_add_entry, &js)
+                          : catalog_search(search, listing_add_search_entry, &js);
+    json_stream_end_array(&js);
+    check(json_stream_finish(&js) == ESP_OK, "could not capture a page");
+    // Batches of a search each get a step budget, so only a complete one compares
+    if (ret == ESP_OK) {
+        for (size_t i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
+            capture_t batched = { 0 };
+            char *buf = malloc(caps[i]);
+            esp_err_t sent = query ? listing_send_page(query, buf, caps[i], capture_flush, &batched)
+                                   : listing_send_search(search, buf, caps[i], capture_flush, &batched);
+            check(sent == ESP_OK && batched.len == direct.len && memcmp(batched.data, direct.data, direct.len) == 0,
+                  "page sent in batches differs from the streamed one");
+            free(batched.data);
+            free(buf);
+        }
+    }
+    free(direct.data);
+}
+
+static void bench_list(const synth_library_config_t *lib) {
+    catalog_query_t query = { .volume = CATALOG_VOLUME_SD, .sort = CATALOG_SORT_TITLE,
+                              .limit = BENCH_LIST_PAGE_SIZE };
+    list_sink_t sink;
+    uint32_t total = 0;
+    esp_err_t ret;
+    record("list_first_page", "us", (double)time_page(&query, &sink, &total, &ret), false, true);
+    check(ret == ESP_OK && total == lib->books, "listing total does not match the library");
+    check_batched(&query, NULL);
+
+    // Each page continues after the last row of the one before
+    sink = (list_sink_t){ 0 };
+    char after[sizeof(sink.last)] = "";
+    query.after = after;
+    uint32_t pages = 0;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t seen = 0; seen < total && ret == ESP_OK; seen += BENCH_LIST_PAGE_SIZE) {
+        ret = render_page(&query, count_rendered, &sink, &total);
+        strlcpy(after, sink.last, sizeof(after));
+        pages++;
+    }
+    int64_t us = esp_timer_get_time() - start;
+    record("list", "rows/s", per_second(sink.rows, us), true, true);
+    record("list_page_bytes", "bytes", pages ? (double)sink.bytes / pages : 0, false, false);
+    check(ret == ESP_OK && sink.rows == lib->books, "paging did not return every row once");
+
+    // Both descending sort and a different key take another index path. Walk
+    // all of it, keeping the cursor halfway down for the page timed below.
+    query = (catalog_query_t){ .volume = CATALOG_VOLUME_SD, .sort = CATALOG_SORT_AUTHOR, .descending = true,
+                               .limit = BENCH_LIST_PAGE_SIZE, .after = after };
+    char middle[sizeof(sink.last)] = "";
+    uint32_t deep_rows = 0;
+    after[0] = '\0';
+    sink = (list_sink_t){ 0 };
+    for (uint32_t seen = 0; seen < total && ret == ESP_OK; seen += BENCH_LIST_PAGE_SIZE) {
+        ret = render_page(&query, count_rendered, &sink, &total);
+        strlcpy(after, sink.last, sizeof(after));
+        if (!middle[0] && sink.rows >= lib->books / 2) {
+            strlcpy(middle, after, sizeof(middle));
+            deep_rows = lib->books - sink.rows;
+        }
+    }
+    check(ret == ESP_OK && sink.rows == lib->books, "descending paging did not return every row once");
+    query.after = middle;
+    record("list_deep_page", "us", (double)time_page(&query, &sink, &total, &ret), false, true);
+    check(ret == ESP_OK && sink.rows == (deep_rows < BENCH_LIST_PAGE_SIZE ? deep_rows : BENCH_LIST_PAGE_SIZE),
+          "page in the middle of the listing is short");
+    check_batched(&query, NULL);
+
+    uint32_t rows;
+    query = (catalog_query_t){ .volume = CATALOG_VOLUME_SD, .sort = CATALOG_SORT_TITLE,
+                               .limit = BENCH_LIST_PAGE_SIZE, .filter = BENCH_FILTER_TEXT };
+    record("filter_page", "us", (double)time_rows(&query, NULL, &rows, &ret), false, true);
+    check(ret == ESP_OK && rows > 0, "filtered page found nothing");
+
+    catalog_search_t search = { .text = BENCH_SEARCH_TEXT, .volume = CATALOG_VOLUME_SD };
+    record("search_page", "us", (double)time_rows(NULL, &search, &rows, &ret), false, true);
+    // A search cut short by its step budget still returns a first page
+    check((ret == ESP_OK || ret == ESP_ERR_TIMEOUT) && rows > 0, "search found nothing");
+    check_batched(NULL, &search);
+}
+
+// --- Description codec ---
+// Descriptions are stored compressed only if they decode to exactly their
+// own length, so the bounded decoder must fit text whose last multi-byte
+// character ends the output. It must still refuse one byte less.
+static void check_codec(void) {
+    static const char *const samples[] = {
+        "Un roman \xc3\xa9" "crit en caf\xc3\xa9.",
+        "Une histoire en fran\xc3\xa7" "ais\xc3\xa9",
+        "\xe6\x9b\xb8\xe5\xba\xab\xe3\x81\xae\xe6\x9c\xac\xe3\x80\x82",
+        "Plain ASCII text with a final stop.",
+    };
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        const char *text = samples[i];
+        int len = (int)strlen(text);
+        char packed[256];
+        char plain[256];
+        int packed_len = unishox1_compress(text, len, packed, NULL);
+        // The codec is lossy on some input; only text it restores can be checked
+        int full = unishox1_decompress(packed, packed_len, plain, NULL);
+        if (full != len || memcmp(plain, text, len) != 0) {
+            continue;
+        }
+        check(unishox1_decompress_n(packed, packed_len, plain, len, NULL) == len && memcmp(plain, text, len) == 0,
+              "description does not decode into its own length");
+        check(unishox1_decompress_n(packed, packed_len, plain, len - 1, NULL) == -1,
+              "description decodes into less room than it needs");
+    }
+}
+
+// --- Copy ---
+static esp_err_t file_crc(const char *path, uint32_t *crc) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    static uint8_t buf[64 * 1024];
+    size_t got;
+    *crc = 0;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) {
+        *crc = esp_rom_crc32_le(*crc, buf, got);
+    }
+    fclose(f);
+    return ESP_OK;
+}
+
+static esp_err_t write_copy_source(const char *path, uint32_t mib) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    static uint32_t block[64 * 1024 / sizeof(uint32_t)];
+    uint32_t x = 0x12345678;
+    bool ok = true;
+    for (uint32_t i = 0; i < mib * 16 && ok; i++) {
+        for (size_t j = 0; j < sizeof(block) / sizeof(block[0]); j++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            block[j] = x;
+        }
+        ok = fwrite(block, 1, sizeof(block), f) == sizeof(block);
+    }
+    return fclose(f) == 0 && ok ? ESP_OK : ESP_FAIL;
+}
+
+static void bench_copy(const bench_args_t *args) {
+    if (args->copy_mib == 0) {
+        return;
+    }
+    char source[1024], dest[1024];
+    snprintf(source, sizeof(source), "%s/BENCHCPY.SRC", args->dir);
+    snprintf(dest, sizeof(dest), "%s/BENCHCPY.DST", args->dir);
+    if (write_copy_source(source, args->copy_mib) != ESP_OK) {
+        check(false, "could not write the copy source");
+        return;
+    }
+
+    // The transfer queue's settings, minus DMA alignment which means nothing here
+    copy_engine_config_t config = COPY_ENGINE_DEFAULT_CONFIG();
+    config.verify = true;
+    config.preallocate = true;
+    transfer_progress_t progress = { 0 };
+    uint64_t read_before, write_before, read_after, write_after;
+    host_metrics_io(&read_before, &write_before);
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = copy_engine_copy(source, dest, &config, &progress, NULL);
+    int64_t us = esp_timer_get_time() - start;
+    host_metrics_io(&read_after, &write_after);
+
+    uint64_t bytes = (uint64_t)args->copy_mib * 1024 * 1024;
+    record("copy", "MiB/s", per_second(args->copy_mib, us), true, true);
+    uint32_t src_crc = 0, dst_crc = 1;
+    file_crc(source, &src_crc);
+    file_crc(dest, &dst_crc);
+    check(ret == ESP_OK && progress.bytes_transferred == bytes && src_crc == dst_crc,
+          "copy failed or the destination differs");
+    check(write_after - write_before == bytes, "copy engine wrote an unexpected byte count");
+    remove(source);
+    remove(dest);
+}
+
+// --- Baselines ---
+static void save_results(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        g_failures++;
+        return;
+    }
+    for (size_t i = 0; i < g_metric_count; i++) {
+        fprintf(f, "%s %.1f %s\n", g_metrics[i].name, g_metrics[i].value, g_metrics[i].unit);
+    }
+    fclose(f);
+}
+
+static void compare_baseline(const char *path, double tolerance) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot read baseline %s: %s\n", path, strerror(errno));
+        g_failures++;
+        return;
+    }
+    char name[64], unit[32];
+    double base;
+    printf("\nAgainst %s (tolerance %.0f%%):\n", path, tolerance);
+    while (fscanf(f, "%63s %lf %31s", name, &base, unit) == 3) {
+        for (size_t i = 0; i < g_metric_count; i++) {
+            const metric_t *m = &g_metrics[i];
+            if (!m->tracked || strcmp(m->name, name) != 0 || base <= 0) {
+                continue;
+            }
+            // Positive change is always an improvement
+            double change = (m->higher_is_better ? m->value / base - 1 : base / m->value - 1) * 100;
+            bool regressed = change < -tolerance;
+            printf("%-24s %+8.1f%%%s\n", m->name, change, regressed ? "  REGRESSION" : "");
+            if (regressed) {
+                g_failures++;
+            }
+        }
+    }
+    fclose(f);
+}
+
+// --- Setup ---
+static void remove_tree(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            remove(path);
+        }
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--books N] [--copy-mib N] [--dir DIR] [--keep]\n"
+            "       [--save FILE] [--baseline FILE] [--tolerance PCT]\n", prog);
+    exit(2);
+}
+
+static void parse_args(int argc, char **argv, bench_args_t *args) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--keep") == 0) {
+            args->keep = true;
+            continue;
+        }
+        if (!value) {
+            usage(argv[0]);
+        }
+        if (strcmp(arg, "--books") == 0) {
+            args->books = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--copy-mib") == 0) {
+            args->copy_mib = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--dir") == 0) {
+            args->dir = value;
+        } else if (strcmp(arg, "--save") == 0) {
+            args->save = value;
+        } else if (strcmp(arg, "--baseline") == 0) {
+            args->baseline = value;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            args->tolerance = strtod(value, NULL);
+        } else {
+            usage(argv[0]);
+        }
+        i++;
+    }
+    if (args->books == 0) {
+        usage(argv[0]);
+    }
+}
+
+int main(int argc, char **argv) {
+    synth_library_config_t lib = SYNTH_LIBRARY_DEFAULT_CONFIG();
+    bench_args_t args = { .books = lib.books, .copy_mib = BENCH_DEFAULT_COPY_MIB,
+                          .tolerance = BENCH_DEFAULT_TOLERANCE };
+    parse_args(argc, argv, &args);
+    lib.books = args.books;
+
+    char scratch[] = "/tmp/librarian-bench-XXXXXX";
+    bool own_dir = args.dir == NULL;
+    if (own_dir) {
+        if (!mkdtemp(scratch)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        args.dir = scratch;
+    } else if (mkdir(args.dir, 0755) != 0 && errno != EEXIST) {
+        perror(args.dir);
+        return 1;
+    }
+
+    check_codec();
+
+    printf("%u books in %s\n", (unsigned)lib.books, args.dir);
+    synth_library_stats_t generated;
+    int64_t start = esp_timer_get_time();
+    if (synth_library_write(args.dir, &lib, &generated) != ESP_OK) {
+        return 1;
+    }
+    record("generate", "books/s", per_second(generated.books, esp_timer_get_time() - start), true, false);
+    record("library", "KiB", (double)generated.bytes / 1024, false, false);
+
+    char db_path[1024];
+    snprintf(db_path, sizeof(db_path), "%s/catalog.db", args.dir);
+    if (catalog_open(db_path, NULL) != ESP_OK) {
+        return 1;
+    }
+    bench_parse(&args, &lib);
+    bench_index(&args, &lib);
+    bench_list(&lib);
+    catalog_close();
+    bench_copy(&args);
+
+    if (args.save) {
+        save_results(args.save);
+    }
+    if (args.baseline) {
+        compare_baseline(args.baseline, args.tolerance);
+    }
+    if (own_dir && !args.keep) {
+        remove_tree(args.dir);
+    }
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    return 0;
+}
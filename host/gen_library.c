@@ -0,0 +1,35 @@
+/*
+ * Writes a synthetic library to a directory, e.g. to copy onto an SD card
+ * and time the firmware's scanner against the same books the host
+ * benchmarks use.
+ *
+ *   gen_library <dir> [books] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "synth_library.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <dir> [books] [seed]\n", argv[0]);
+        return 2;
+    }
+    synth_library_config_t config = SYNTH_LIBRARY_DEFAULT_CONFIG();
+    if (argc > 2) {
+        config.books = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        config.seed = (uint32_t)strtoul(argv[3], NULL, 10);
+    }
+    mkdir(argv[1], 0755);
+
+    synth_library_stats_t stats;
+    if (synth_library_write(argv[1], &config, &stats) != ESP_OK) {
+        return 1;
+    }
+    printf("Wrote %u books, %llu bytes, to %s\n", (unsigned)stats.books, (unsigned long long)stats.bytes, argv[1]);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// sqlite3/esp32.cpp includes this but uses nothing from it
+
+#endif // HOST_ARDUINO_H
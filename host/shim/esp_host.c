@@ -0,0 +1,79 @@
+/*
+ * ESP-IDF services the firmware modules call, on libc, for the host build.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:                return "ESP_OK";
+    case ESP_FAIL:              return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC:   return "ESP_ERR_INVALID_CRC";
+    default:                    return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    (void)caps;
+    void *ptr = NULL;
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    return (uint32_t)crc32(crc, buf, len);
+}
+
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *out_total_bytes, uint64_t *out_free_bytes) {
+    struct statvfs st;
+    if (statvfs(base_path, &st) != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *out_total_bytes = (uint64_t)st.f_blocks * st.f_frsize;
+    *out_free_bytes = (uint64_t)st.f_bavail * st.f_frsize;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_create_contiguous_file(const char *base_path, const char *full_path, uint64_t size,
+                                             bool alloc_now) {
+    (void)base_path;
+    (void)alloc_now;
+    int fd = open(full_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    // Extends the file to `size` like f_expand() does; the bytes read as zeros
+    int rc = size > 0 ? posix_fallocate(fd, 0, (off_t)size) : 0;
+    close(fd);
+    if (rc != 0) {
+        unlink(full_path);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,17 @@
+#ifndef HOST_ESP_HTTP_SERVER_H
+#define HOST_ESP_HTTP_SERVER_H
+
+#include "esp_err.h"
+
+// Only the types metrics.h names; nothing on the host serves HTTP
+typedef void *httpd_handle_t;
+typedef struct httpd_req httpd_req_t;
+
+typedef struct {
+    const char *uri;
+    int method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    void *user_ctx;
+} httpd_uri_t;
+
+#endif // HOST_ESP_HTTP_SERVER_H
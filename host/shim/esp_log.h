@@ -0,0 +1,21 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdio.h>
+
+// Benchmarks time the code, not the console: only warnings and errors are
+// printed unless HOST_LOG_VERBOSE is defined.
+#define HOST_LOG(level, tag, fmt, ...) fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define HOST_LOG_NONE(tag, fmt, ...)   do { if (0) fprintf(stderr, fmt, ##__VA_ARGS__); (void)(tag); } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG("W", tag, fmt, ##__VA_ARGS__)
+#ifdef HOST_LOG_VERBOSE
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG("I", tag, fmt, ##__VA_ARGS__)
+#else
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG_NONE(tag, fmt, ##__VA_ARGS__)
+#endif
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG_NONE(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG_NONE(tag, fmt, ##__VA_ARGS__)
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_SPI_FLASH_H
+#define HOST_ESP_SPI_FLASH_H
+
+// sqlite3/esp32.cpp includes this but uses nothing from it
+
+#endif // HOST_ESP_SPI_FLASH_H
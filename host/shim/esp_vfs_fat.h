@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_VFS_FAT_H
+#define HOST_ESP_VFS_FAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Space on the filesystem holding `base_path`, from statvfs()
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *out_total_bytes, uint64_t *out_free_bytes);
+
+// Creates `full_path` with `size` bytes reserved through posix_fallocate()
+esp_err_t esp_vfs_fat_create_contiguous_file(const char *base_path, const char *full_path, uint64_t size,
+                                             bool alloc_now);
+
+#endif // HOST_ESP_VFS_FAT_H
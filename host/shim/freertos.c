@@ -0,0 +1,239 @@
+/*
+ * FreeRTOS tasks, queues and semaphores on pthreads, for the host build.
+ *
+ * Only what the firmware modules built here call is provided, with the same
+ * blocking semantics: a full queue blocks the sender, an empty one the
+ * receiver, each for at most the given number of ticks.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct host_task {
+    TaskFunction_t fn;
+    void *arg;
+    UBaseType_t priority;
+    BaseType_t core_id;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;             // length * item_size bytes; NULL for semaphores
+};
+
+static __thread struct host_task *t_self;
+static struct host_task g_main_task = { .priority = 1, .core_id = 0 };
+
+// --- Tasks ---
+static struct host_task *self(void) {
+    return t_self ? t_self : &g_main_task;
+}
+
+static void *task_trampoline(void *arg) {
+    t_self = arg;
+    t_self->fn(t_self->arg);
+    // A FreeRTOS task must not return; treat it like vTaskDelete(NULL)
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t core_id) {
+    (void)name;
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (!task) {
+        return pdFAIL;
+    }
+    *task = (struct host_task){ .fn = fn, .arg = arg, .priority = priority,
+                                .core_id = core_id == tskNO_AFFINITY ? 0 : core_id };
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // Host code paths use more stack than the firmware sizes allow for
+    size_t stack = stack_depth < 64 * 1024 ? 64 * 1024 : stack_depth;
+    pthread_attr_setstacksize(&attr, stack);
+    pthread_t thread;
+    int rc = pthread_create(&thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    if (created) {
+        *created = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != NULL && task != t_self) {
+        abort();    // Deleting another task is not supported here
+    }
+    free(t_self);
+    t_self = NULL;
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return self();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    return (task ? task : self())->priority;
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+    (task ? task : self())->priority = priority;
+}
+
+BaseType_t xTaskGetCoreID(TaskHandle_t task) {
+    return (task ? task : self())->core_id;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// --- Queues ---
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (!q || length == 0) {
+        free(q);
+        return NULL;
+    }
+    if (item_size > 0 && !(q->items = malloc((size_t)length * item_size))) {
+        free(q);
+        return NULL;
+    }
+    q->length = length;
+    q->item_size = item_size;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->not_empty, &attr);
+    pthread_cond_init(&q->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    if (!q) {
+        return;
+    }
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    free(q);
+}
+
+// Waits on `cond` until `ready` holds or `wait` ticks have passed; called
+// with the queue locked.
+static bool wait_for(struct host_queue *q, pthread_cond_t *cond, bool (*ready)(const struct host_queue *),
+                     TickType_t wait) {
+    if (ready(q)) {
+        return true;
+    }
+    if (wait == 0) {
+        return false;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += wait / 1000;
+    deadline.tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (!ready(q)) {
+        int rc = wait == portMAX_DELAY ? pthread_cond_wait(cond, &q->lock)
+                                       : pthread_cond_timedwait(cond, &q->lock, &deadline);
+        if (rc == ETIMEDOUT) {
+            return ready(q);
+        }
+    }
+    return true;
+}
+
+static bool has_space(const struct host_queue *q) {
+    return q->count < q->length;
+}
+
+static bool has_item(const struct host_queue *q) {
+    return q->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait) {
+    pthread_mutex_lock(&q->lock);
+    if (!wait_for(q, &q->not_full, has_space, wait)) {
+        pthread_mutex_unlock(&q->lock);
+        return pdFALSE;
+    }
+    if (q->items) {
+        memcpy(q->items + (size_t)((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait) {
+    pthread_mutex_lock(&q->lock);
+    if (!wait_for(q, &q->not_empty, has_item, wait)) {
+        pthread_mutex_unlock(&q->lock);
+        return pdFALSE;
+    }
+    if (q->items) {
+        memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+    }
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+// --- Semaphores ---
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    if (sem) {
+        xSemaphoreGive(sem);
+    }
+    return sem;
+}
@@ -0,0 +1,16 @@
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+
+#include "freertos/queue.h"
+
+// As in FreeRTOS, a semaphore is a queue of zero-sized items: one waiting
+// item means it can be taken.
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+#define xSemaphoreTake(sem, wait) xQueueReceive(sem, NULL, wait)
+#define xSemaphoreGive(sem)       xQueueSend(sem, NULL, 0)
+#define vSemaphoreDelete(sem)     vQueueDelete(sem)
+
+#endif // HOST_FREERTOS_SEMPHR_H
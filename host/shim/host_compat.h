@@ -0,0 +1,22 @@
+#ifndef HOST_COMPAT_H
+#define HOST_COMPAT_H
+
+// Included ahead of every source in the host build for the newlib
+// extensions the firmware relies on that older glibc lacks.
+#include <stddef.h>
+#include <string.h>
+
+#ifndef HAVE_STRLCPY
+static inline size_t host_strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy host_strlcpy
+#endif
+
+#endif // HOST_COMPAT_H
@@ -0,0 +1,9 @@
+#ifndef HOST_METRICS_H
+#define HOST_METRICS_H
+
+#include <stdint.h>
+
+// Bytes the copy engine has reported through metrics_count_io() so far
+void host_metrics_io(uint64_t *read_bytes, uint64_t *write_bytes);
+
+#endif // HOST_METRICS_H
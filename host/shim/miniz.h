@@ -0,0 +1,38 @@
+#ifndef HOST_MINIZ_H
+#define HOST_MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The miniz ZIP reader calls epub_meta.c makes, implemented on zlib. Entries
+// are stored or deflated; names are matched case-insensitively like miniz
+// does without MZ_ZIP_FLAG_CASE_SENSITIVE.
+typedef unsigned int mz_uint;
+typedef uint32_t mz_uint32;
+typedef uint64_t mz_uint64;
+typedef int mz_bool;
+
+typedef void *(*mz_alloc_func)(void *opaque, size_t items, size_t size);
+typedef void (*mz_free_func)(void *opaque, void *address);
+typedef void *(*mz_realloc_func)(void *opaque, void *address, size_t items, size_t size);
+typedef size_t (*mz_file_write_func)(void *opaque, mz_uint64 file_ofs, const void *buf, size_t n);
+
+typedef struct {
+    mz_alloc_func m_pAlloc;
+    mz_free_func m_pFree;
+    mz_realloc_func m_pRealloc;
+    void *m_pAlloc_opaque;
+    struct mz_zip_internal_state *m_pState;
+} mz_zip_archive;
+
+mz_bool mz_zip_reader_init_file(mz_zip_archive *zip, const char *filename, mz_uint32 flags);
+mz_bool mz_zip_reader_end(mz_zip_archive *zip);
+mz_uint mz_zip_reader_get_num_files(mz_zip_archive *zip);
+// Returns the length of the name plus its terminator
+mz_uint mz_zip_reader_get_filename(mz_zip_archive *zip, mz_uint index, char *filename, mz_uint size);
+int mz_zip_reader_locate_file(mz_zip_archive *zip, const char *name, const char *comment, mz_uint flags);
+// Stops, returning false, as soon as `callback` consumes less than it was given
+mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *zip, mz_uint index, mz_file_write_func callback,
+                                          void *opaque, mz_uint flags);
+
+#endif // HOST_MINIZ_H
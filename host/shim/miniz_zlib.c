@@ -0,0 +1,290 @@
+/*
+ * Enough of miniz's ZIP reader for epub_meta.c, on zlib.
+ *
+ * The central directory is read once when the archive is opened; entries
+ * are then inflated in fixed-size chunks into the caller's callback, the
+ * way miniz streams them on the device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "miniz.h"
+
+#define EOCD_SIG            0x06054b50
+#define CENTRAL_SIG         0x02014b50
+#define LOCAL_SIG           0x04034b50
+#define EOCD_SIZE           22
+#define CENTRAL_HEADER_SIZE 46
+#define LOCAL_HEADER_SIZE   30
+// End of central directory plus the longest comment it may be followed by
+#define EOCD_SEARCH         (EOCD_SIZE + 0xFFFF)
+#define CHUNK_SIZE          (32 * 1024)
+
+#define METHOD_STORED  0
+#define METHOD_DEFLATE 8
+
+typedef struct {
+    char *name;
+    mz_uint method;
+    uint64_t comp_size;
+    uint64_t size;
+    uint64_t local_offset;
+} zip_entry_t;
+
+struct mz_zip_internal_state {
+    FILE *fp;
+    zip_entry_t *entries;
+    mz_uint count;
+    char *names;                // Every entry name, NUL-terminated, back to back
+};
+
+static uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void *zip_alloc(mz_zip_archive *zip, size_t size) {
+    return zip->m_pAlloc ? zip->m_pAlloc(zip->m_pAlloc_opaque, 1, size) : malloc(size);
+}
+
+static void zip_free(mz_zip_archive *zip, void *ptr) {
+    if (zip->m_pFree) {
+        zip->m_pFree(zip->m_pAlloc_opaque, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+// Locates the end of central directory record; returns false if there is none.
+static int find_eocd(FILE *fp, uint8_t *eocd) {
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    long file_size = ftell(fp);
+    long span = file_size < EOCD_SEARCH ? file_size : EOCD_SEARCH;
+    if (span < EOCD_SIZE) {
+        return 0;
+    }
+    uint8_t *tail = malloc((size_t)span);
+    int found = 0;
+    if (tail && fseek(fp, file_size - span, SEEK_SET) == 0 && fread(tail, 1, (size_t)span, fp) == (size_t)span) {
+        for (long i = span - EOCD_SIZE; i >= 0; i--) {
+            if (rd32(tail + i) == EOCD_SIG) {
+                memcpy(eocd, tail + i, EOCD_SIZE);
+                found = 1;
+                break;
+            }
+        }
+    }
+    free(tail);
+    return found;
+}
+
+mz_bool mz_zip_reader_init_file(mz_zip_archive *zip, const char *filename, mz_uint32 flags) {
+    (void)flags;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    uint8_t eocd[EOCD_SIZE];
+    if (!find_eocd(fp, eocd)) {
+        fclose(fp);
+        return 0;
+    }
+    mz_uint count = rd16(eocd + 10);
+    uint32_t dir_size = rd32(eocd + 12);
+    uint32_t dir_offset = rd32(eocd + 16);
+
+    struct mz_zip_internal_state *st = zip_alloc(zip, sizeof(*st));
+    uint8_t *dir = malloc(dir_size ? dir_size : 1);
+    if (!st || !dir || fseek(fp, dir_offset, SEEK_SET) != 0 || fread(dir, 1, dir_size, fp) != dir_size) {
+        free(dir);
+        if (st) {
+            zip_free(zip, st);
+        }
+        fclose(fp);
+        return 0;
+    }
+    memset(st, 0, sizeof(*st));
+    st->fp = fp;
+    st->entries = zip_alloc(zip, (count ? count : 1) * sizeof(zip_entry_t));
+    // Names never take more room than the directory records they come from
+    st->names = zip_alloc(zip, dir_size + count + 1);
+    zip->m_pState = st;
+    if (!st->entries || !st->names) {
+        free(dir);
+        mz_zip_reader_end(zip);
+        return 0;
+    }
+
+    size_t pos = 0;
+    size_t names_used = 0;
+    for (mz_uint i = 0; i < count; i++) {
+        if (pos + CENTRAL_HEADER_SIZE > dir_size || rd32(dir + pos) != CENTRAL_SIG) {
+            break;
+        }
+        const uint8_t *h = dir + pos;
+        size_t name_len = rd16(h + 28);
+        size_t record = CENTRAL_HEADER_SIZE + name_len + rd16(h + 30) + rd16(h + 32);
+        if (pos + record > dir_size) {
+            break;
+        }
+        zip_entry_t *e = &st->entries[st->count++];
+        e->method = rd16(h + 10);
+        e->comp_size = rd32(h + 20);
+        e->size = rd32(h + 24);
+        e->local_offset = rd32(h + 42);
+        e->name = st->names + names_used;
+        memcpy(e->name, h + CENTRAL_HEADER_SIZE, name_len);
+        e->name[name_len] = '\0';
+        names_used += name_len + 1;
+        pos += record;
+    }
+    free(dir);
+    return 1;
+}
+
+mz_bool mz_zip_reader_end(mz_zip_archive *zip) {
+    struct mz_zip_internal_state *st = zip->m_pState;
+    if (!st) {
+        return 0;
+    }
+    if (st->fp) {
+        fclose(st->fp);
+    }
+    if (st->entries) {
+        zip_free(zip, st->entries);
+    }
+    if (st->names) {
+        zip_free(zip, st->names);
+    }
+    zip_free(zip, st);
+    zip->m_pState = NULL;
+    return 1;
+}
+
+mz_uint mz_zip_reader_get_num_files(mz_zip_archive *zip) {
+    return zip->m_pState ? zip->m_pState->count : 0;
+}
+
+mz_uint mz_zip_reader_get_filename(mz_zip_archive *zip, mz_uint index, char *filename, mz_uint size) {
+    struct mz_zip_internal_state *st = zip->m_pState;
+    if (!st || index >= st->count) {
+        if (size > 0) {
+            filename[0] = '\0';
+        }
+        return 0;
+    }
+    size_t len = strlen(st->entries[index].name);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(filename, st->entries[index].name, n);
+        filename[n] = '\0';
+    }
+    return (mz_uint)len + 1;
+}
+
+int mz_zip_reader_locate_file(mz_zip_archive *zip, const char *name, const char *comment, mz_uint flags) {
+    (void)comment;
+    (void)flags;
+    struct mz_zip_internal_state *st = zip->m_pState;
+    for (mz_uint i = 0; st && i < st->count; i++) {
+        if (strcasecmp(st->entries[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static mz_bool extract_stored(FILE *fp, const zip_entry_t *e, uint8_t *in, mz_file_write_func callback,
+                              void *opaque) {
+    uint64_t done = 0;
+    while (done < e->size) {
+        size_t want = e->size - done < CHUNK_SIZE ? (size_t)(e->size - done) : CHUNK_SIZE;
+        if (fread(in, 1, want, fp) != want || callback(opaque, done, in, want) != want) {
+            return 0;
+        }
+        done += want;
+    }
+    return 1;
+}
+
+static mz_bool extract_deflated(FILE *fp, const zip_entry_t *e, uint8_t *in, mz_file_write_func callback,
+                                void *opaque) {
+    uint8_t *out = malloc(CHUNK_SIZE);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (!out || inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        free(out);
+        return 0;
+    }
+    uint64_t remaining = e->comp_size;
+    uint64_t written = 0;
+    int rc = Z_OK;
+    mz_bool ok = 1;
+    while (ok && rc != Z_STREAM_END) {
+        if (zs.avail_in == 0 && remaining > 0) {
+            size_t want = remaining < CHUNK_SIZE ? (size_t)remaining : CHUNK_SIZE;
+            if (fread(in, 1, want, fp) != want) {
+                ok = 0;
+                break;
+            }
+            zs.next_in = in;
+            zs.avail_in = (uInt)want;
+            remaining -= want;
+        }
+        zs.next_out = out;
+        zs.avail_out = CHUNK_SIZE;
+        rc = inflate(&zs, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END) {
+            ok = 0;
+            break;
+        }
+        size_t produced = CHUNK_SIZE - zs.avail_out;
+        if (produced > 0 && callback(opaque, written, out, produced) != produced) {
+            ok = 0;
+        }
+        written += produced;
+        if (rc == Z_OK && produced == 0 && zs.avail_in == 0 && remaining == 0) {
+            ok = 0;     // Truncated stream
+        }
+    }
+    inflateEnd(&zs);
+    free(out);
+    return ok;
+}
+
+mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *zip, mz_uint index, mz_file_write_func callback,
+                                          void *opaque, mz_uint flags) {
+    (void)flags;
+    struct mz_zip_internal_state *st = zip->m_pState;
+    if (!st || index >= st->count) {
+        return 0;
+    }
+    const zip_entry_t *e = &st->entries[index];
+    uint8_t local[LOCAL_HEADER_SIZE];
+    if (fseek(st->fp, (long)e->local_offset, SEEK_SET) != 0 ||
+        fread(local, 1, sizeof(local), st->fp) != sizeof(local) || rd32(local) != LOCAL_SIG ||
+        fseek(st->fp, rd16(local + 26) + rd16(local + 28), SEEK_CUR) != 0) {
+        return 0;
+    }
+    uint8_t *in = malloc(CHUNK_SIZE);
+    if (!in) {
+        return 0;
+    }
+    mz_bool ok = 0;
+    if (e->method == METHOD_STORED) {
+        ok = extract_stored(st->fp, e, in, callback, opaque);
+    } else if (e->method == METHOD_DEFLATE) {
+        ok = extract_deflated(st->fp, e, in, callback, opaque);
+    }
+    free(in);
+    return ok;
+}
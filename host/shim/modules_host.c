@@ -0,0 +1,53 @@
+/*
+ * Stand-ins for the firmware modules the host build does not compile:
+ * mem_pool's metadata heap (there is only one heap here) and the I/O
+ * counters of metrics, which the benchmarks read back.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_metrics.h"
+#include "mem_pool.h"
+#include "metrics.h"
+
+// --- mem_pool ---
+void *mem_pool_meta_alloc(size_t size) {
+    return malloc(size);
+}
+
+void *mem_pool_meta_realloc(void *ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+void mem_pool_meta_free(void *ptr) {
+    free(ptr);
+}
+
+// --- metrics ---
+// Every path is counted under a single mount
+static atomic_uint_fast64_t g_read_bytes;
+static atomic_uint_fast64_t g_write_bytes;
+
+int metrics_mount_for_path(const char *path) {
+    (void)path;
+    return 0;
+}
+
+void metrics_count_io(int mount, bool write, size_t bytes) {
+    if (mount < 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(write ? &g_write_bytes : &g_read_bytes, bytes, memory_order_relaxed);
+}
+
+void metrics_count_transfer(size_t bytes, int64_t us) {
+    (void)bytes;
+    (void)us;
+}
+
+void host_metrics_io(uint64_t *read_bytes, uint64_t *write_bytes) {
+    *read_bytes = atomic_load(&g_read_bytes);
+    *write_bytes = atomic_load(&g_write_bytes);
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// No PSRAM, like the boards the firmware ships on
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,394 @@
+/*
+ * Synthetic EPUB library for the host benchmarks.
+ *
+ * Every book is generated from (seed, index) alone, so a run can regenerate
+ * any book's expected metadata without keeping the library in memory, and
+ * two runs with the same config produce byte-identical files. The OPF uses
+ * the constructs real books have and the parser has to cope with: namespaced
+ * Dublin Core elements, entities, markup in the description, and a cover
+ * found through properties="cover-image".
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "esp_log.h"
+
+#include "synth_library.h"
+
+static const char *TAG = "synth_library";
+
+// Entries in one book: mimetype, container.xml, the OPF and a chapter
+#define BOOK_ENTRIES 4
+// Every entry is dated 2024-01-01 00:00, in MS-DOS format
+#define ZIP_DOS_TIME 0
+#define ZIP_DOS_DATE (((2024 - 1980) << 9) | (1 << 5) | 1)
+
+static const char *const ADJECTIVES[] = {
+    "Silent", "Crimson", "Hidden", "Last", "Winter", "Broken", "Golden", "Distant", "Hollow", "Burning",
+    "Forgotten", "Iron", "Quiet", "Northern", "Wandering", "Glass", "Secret", "Restless", "Pale", "Sunken",
+};
+static const char *const NOUNS[] = {
+    "Garden", "River", "Orchard", "Lighthouse", "Archive", "Harbour", "Kingdom", "Library", "Clockmaker",
+    "Mountain", "Voyage", "Letters", "Cartographer", "Tide", "Empire", "Lantern", "Forest", "Station",
+    "Apprentice", "Ember",
+};
+static const char *const PLACES[] = {
+    "Ashford", "the Marsh", "Kelvara", "the Salt Coast", "Old Verren", "the High Pass", "Morrow", "Lindqvist",
+};
+static const char *const FIRST_NAMES[] = {
+    "Ada", "Jonah", "Mira", "Tomasz", "Ines", "Rafael", "Yuki", "Eleanor", "Kwame", "Sofia", "Henrik", "Leila",
+    "Émile", "Zoë", "Nikolai", "Priya",
+};
+static const char *const LAST_NAMES[] = {
+    "Hart", "Okafor", "Lindgren", "Moreau", "Castellano", "Whitfield", "Nakamura", "Brennan", "Adeyemi",
+    "Kowalski", "Ferreira", "Thorne", "Haddad", "Brontë", "Ivanova", "Sandoval",
+};
+static const char *const WORDS[] = {
+    "the", "a", "of", "and", "river", "night", "letter", "city", "found", "long", "secret", "family", "across",
+    "years", "storm", "winter", "house", "journey", "between", "memory", "war", "island", "quiet", "light",
+    "keeper", "north", "promise", "stranger", "summer", "map", "song", "lost",
+};
+static const char *const LANGUAGES[] = { "en", "en-GB", "fr", "de", "es", "it", "nl", "sv" };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// --- Random Source ---
+// splitmix64 seeded from (seed, index): each book is independent of the others
+typedef struct {
+    uint64_t state;
+} rng_t;
+
+static uint64_t rng_next(rng_t *r) {
+    uint64_t z = (r->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint32_t rng_below(rng_t *r, uint32_t n) {
+    return (uint32_t)(rng_next(r) % n);
+}
+
+static rng_t book_rng(const synth_library_config_t *config, uint32_t index) {
+    rng_t r = { .state = ((uint64_t)config->seed << 32) ^ index };
+    rng_next(&r);
+    return r;
+}
+
+// --- Book Fields ---
+typedef struct {
+    char title[160];            // As the OPF spells it, entities escaped
+    char title_plain[160];      // As the parser returns it
+    char first[32];
+    char last[32];
+    const char *language;
+} book_fields_t;
+
+static void book_fields(const synth_library_config_t *config, uint32_t index, book_fields_t *f) {
+    rng_t r = book_rng(config, index);
+    const char *adj = ADJECTIVES[rng_below(&r, COUNT(ADJECTIVES))];
+    const char *noun = NOUNS[rng_below(&r, COUNT(NOUNS))];
+    const char *place = PLACES[rng_below(&r, COUNT(PLACES))];
+    const char *other = NOUNS[rng_below(&r, COUNT(NOUNS))];
+    switch (rng_below(&r, 4)) {
+    case 0:
+        snprintf(f->title, sizeof(f->title), "The %s %s of %s", adj, noun, place);
+        snprintf(f->title_plain, sizeof(f->title_plain), "%s", f->title);
+        break;
+    case 1:
+        snprintf(f->title, sizeof(f->title), "%s &amp; %s", noun, other);
+        snprintf(f->title_plain, sizeof(f->title_plain), "%s & %s", noun, other);
+        break;
+    case 2:
+        snprintf(f->title, sizeof(f->title), "%s %s", adj, noun);
+        snprintf(f->title_plain, sizeof(f->title_plain), "%s", f->title);
+        break;
+    default:
+        snprintf(f->title, sizeof(f->title), "A %s in %s", noun, place);
+        snprintf(f->title_plain, sizeof(f->title_plain), "%s", f->title);
+        break;
+    }
+    snprintf(f->first, sizeof(f->first), "%s", FIRST_NAMES[rng_below(&r, COUNT(FIRST_NAMES))]);
+    snprintf(f->last, sizeof(f->last), "%s", LAST_NAMES[rng_below(&r, COUNT(LAST_NAMES))]);
+    f->language = LANGUAGES[rng_below(&r, COUNT(LANGUAGES))];
+}
+
+void synth_library_book_title(const synth_library_config_t *config, uint32_t index, char *title, size_t size) {
+    book_fields_t f;
+    book_fields(config, index, &f);
+    snprintf(title, size, "%s", f.title_plain);
+}
+
+// Titles repeat across a large library; the index keeps every filename unique
+void synth_library_book_name(const synth_library_config_t *config, uint32_t index, char *name, size_t size) {
+    book_fields_t f;
+    book_fields(config, index, &f);
+    char title[160];
+    size_t n = 0;
+    for (const char *p = f.title_plain; *p && n + 1 < sizeof(title); p++) {
+        title[n++] = *p == '&' ? '+' : *p;
+    }
+    title[n] = '\0';
+    snprintf(name, size, "%s - %s (%05u).epub", f.last, title, (unsigned)index);
+}
+
+// --- Text Buffer ---
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} text_t;
+
+static void text_printf(text_t *t, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int need = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (need < 0) {
+        return;
+    }
+    if (t->len + need + 1 > t->cap) {
+        size_t cap = t->cap ? t->cap : 1024;
+        while (cap < t->len + need + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(t->data, cap);
+        if (!grown) {
+            return;
+        }
+        t->data = grown;
+        t->cap = cap;
+    }
+    va_start(args, fmt);
+    vsnprintf(t->data + t->len, t->cap - t->len, fmt, args);
+    va_end(args);
+    t->len += need;
+}
+
+static void text_words(text_t *t, rng_t *r, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        text_printf(t, i == 0 ? "%s" : " %s", WORDS[rng_below(r, COUNT(WORDS))]);
+    }
+}
+
+static void build_opf(const synth_library_config_t *config, uint32_t index, const book_fields_t *f, text_t *t) {
+    rng_t r = book_rng(config, index ^ 0x80000000u);
+    text_printf(t,
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<package xmlns=\"http://www.idpf.org/2007/opf\" version=\"3.0\" unique-identifier=\"uid\">\n"
+                "  <metadata xmlns:dc=\"http://purl.org/dc/elements/1.1/\">\n"
+                "    <dc:identifier id=\"uid\">urn:uuid:%08x-0000-4000-8000-%012llx</dc:identifier>\n"
+                "    <dc:title>%s</dc:title>\n"
+                "    <dc:creator opf:role=\"aut\">%s %s</dc:creator>\n"
+                "    <dc:language>%s</dc:language>\n"
+                "    <dc:description>&lt;p&gt;",
+                (unsigned)index, (unsigned long long)rng_next(&r) & 0xFFFFFFFFFFFFull, f->title, f->first,
+                f->last, f->language);
+    text_words(t, &r, 20 + rng_below(&r, 40));
+    text_printf(t, ".&lt;/p&gt;&lt;p&gt;&lt;em&gt;");
+    text_words(t, &r, 10 + rng_below(&r, 20));
+    text_printf(t,
+                "&lt;/em&gt;&lt;/p&gt;</dc:description>\n"
+                "    <meta property=\"dcterms:modified\">2024-01-01T00:00:00Z</meta>\n"
+                "  </metadata>\n"
+                "  <manifest>\n"
+                "    <item id=\"nav\" href=\"nav.xhtml\" media-type=\"application/xhtml+xml\" properties=\"nav\"/>\n"
+                "    <item id=\"cover-image\" href=\"images/cover.jpg\" media-type=\"image/jpeg\""
+                " properties=\"cover-image\"/>\n"
+                "    <item id=\"ch1\" href=\"text/ch1.xhtml\" media-type=\"application/xhtml+xml\"/>\n"
+                "  </manifest>\n"
+                "  <spine>\n"
+                "    <itemref idref=\"ch1\"/>\n"
+                "  </spine>\n"
+                "</package>\n");
+}
+
+static void build_chapter(const synth_library_config_t *config, uint32_t index, text_t *t) {
+    rng_t r = book_rng(config, index ^ 0x40000000u);
+    text_printf(t, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<html xmlns=\"http://www.w3.org/1999/xhtml\"><body>\n");
+    while (t->len < config->chapter_bytes) {
+        text_printf(t, "<p>");
+        text_words(t, &r, 40);
+        text_printf(t, ".</p>\n");
+    }
+    text_printf(t, "</body></html>\n");
+}
+
+// --- ZIP Writer ---
+typedef struct {
+    const char *name;
+    const char *data;
+    size_t len;
+    bool deflate;
+    // Filled in while writing
+    uint32_t crc;
+    uint32_t stored_len;
+    uint32_t offset;
+} zip_item_t;
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+// Raw deflate of `item` into `out`, which must hold deflateBound() bytes
+static bool deflate_item(const zip_item_t *item, uint8_t *out, size_t out_cap, size_t *out_len) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    zs.next_in = (Bytef *)item->data;
+    zs.avail_in = (uInt)item->len;
+    zs.next_out = out;
+    zs.avail_out = (uInt)out_cap;
+    int rc = deflate(&zs, Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+static esp_err_t write_zip(const char *path, zip_item_t *items, size_t count, uint64_t *bytes) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+    bool ok = true;
+    uint32_t pos = 0;
+    for (size_t i = 0; i < count && ok; i++) {
+        zip_item_t *item = &items[i];
+        const uint8_t *body = (const uint8_t *)item->data;
+        size_t body_len = item->len;
+        uint8_t *packed = NULL;
+        item->crc = (uint32_t)crc32(0, (const Bytef *)item->data, (uInt)item->len);
+        if (item->deflate) {
+            size_t cap = compressBound((uLong)item->len) + 16;
+            packed = malloc(cap);
+            if (!packed || !deflate_item(item, packed, cap, &body_len)) {
+                free(packed);
+                ok = false;
+                break;
+            }
+            body = packed;
+        }
+        item->stored_len = (uint32_t)body_len;
+        item->offset = pos;
+
+        size_t name_len = strlen(item->name);
+        uint8_t h[30] = { 0 };
+        put32(h, 0x04034b50);
+        put16(h + 4, 20);
+        put16(h + 8, item->deflate ? 8 : 0);
+        put16(h + 10, ZIP_DOS_TIME);
+        put16(h + 12, ZIP_DOS_DATE);
+        put32(h + 14, item->crc);
+        put32(h + 18, item->stored_len);
+        put32(h + 22, (uint32_t)item->len);
+        put16(h + 26, (uint16_t)name_len);
+        ok = fwrite(h, 1, sizeof(h), fp) == sizeof(h) && fwrite(item->name, 1, name_len, fp) == name_len &&
+             fwrite(body, 1, body_len, fp) == body_len;
+        pos += sizeof(h) + name_len + body_len;
+        free(packed);
+    }
+
+    uint32_t dir_start = pos;
+    for (size_t i = 0; i < count && ok; i++) {
+        const zip_item_t *item = &items[i];
+        size_t name_len = strlen(item->name);
+        uint8_t h[46] = { 0 };
+        put32(h, 0x02014b50);
+        put16(h + 4, 20);
+        put16(h + 6, 20);
+        put16(h + 10, item->deflate ? 8 : 0);
+        put16(h + 12, ZIP_DOS_TIME);
+        put16(h + 14, ZIP_DOS_DATE);
+        put32(h + 16, item->crc);
+        put32(h + 20, item->stored_len);
+        put32(h + 24, (uint32_t)item->len);
+        put16(h + 28, (uint16_t)name_len);
+        put32(h + 42, item->offset);
+        ok = fwrite(h, 1, sizeof(h), fp) == sizeof(h) && fwrite(item->name, 1, name_len, fp) == name_len;
+        pos += sizeof(h) + name_len;
+    }
+
+    uint8_t eocd[22] = { 0 };
+    put32(eocd, 0x06054b50);
+    put16(eocd + 8, (uint16_t)count);
+    put16(eocd + 10, (uint16_t)count);
+    put32(eocd + 12, pos - dir_start);
+    put32(eocd + 16, dir_start);
+    ok = ok && fwrite(eocd, 1, sizeof(eocd), fp) == sizeof(eocd);
+    pos += sizeof(eocd);
+
+    if (fclose(fp) != 0 || !ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        remove(path);
+        return ESP_FAIL;
+    }
+    *bytes = pos;
+    return ESP_OK;
+}
+
+// --- Library ---
+static const char CONTAINER_XML[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<container version=\"1.0\" xmlns=\"urn:oasis:names:tc:opendocument:xmlns:container\">\n"
+    "  <rootfiles>\n"
+    "    <rootfile full-path=\"OEBPS/content.opf\" media-type=\"application/oebps-package+xml\"/>\n"
+    "  </rootfiles>\n"
+    "</container>\n";
+
+esp_err_t synth_library_write(const char *dir, const synth_library_config_t *config, synth_library_stats_t *stats) {
+    synth_library_stats_t totals = { 0 };
+    text_t opf = { 0 }, chapter = { 0 };
+    esp_err_t ret = ESP_OK;
+    for (uint32_t i = 0; i < config->books && ret == ESP_OK; i++) {
+        book_fields_t f;
+        book_fields(config, i, &f);
+        opf.len = 0;
+        chapter.len = 0;
+        build_opf(config, i, &f, &opf);
+        build_chapter(config, i, &chapter);
+        if (!opf.data || !chapter.data) {
+            ret = ESP_ERR_NO_MEM;
+            break;
+        }
+
+        // mimetype goes first and uncompressed, as the EPUB container requires
+        zip_item_t items[BOOK_ENTRIES] = {
+            { .name = "mimetype", .data = "application/epub+zip", .len = 20 },
+            { .name = "META-INF/container.xml", .data = CONTAINER_XML, .len = sizeof(CONTAINER_XML) - 1,
+              .deflate = config->deflate },
+            { .name = "OEBPS/content.opf", .data = opf.data, .len = opf.len, .deflate = config->deflate },
+            { .name = "OEBPS/text/ch1.xhtml", .data = chapter.data, .len = chapter.len,
+              .deflate = config->deflate },
+        };
+        char name[256];
+        char path[1024];
+        synth_library_book_name(config, i, name, sizeof(name));
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        uint64_t bytes = 0;
+        ret = write_zip(path, items, BOOK_ENTRIES, &bytes);
+        if (ret == ESP_OK) {
+            totals.books++;
+            totals.bytes += bytes;
+        }
+    }
+    free(opf.data);
+    free(chapter.data);
+    if (stats) {
+        *stats = totals;
+    }
+    return ret;
+}
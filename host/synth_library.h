@@ -0,0 +1,41 @@
+#ifndef SYNTH_LIBRARY_H
+#define SYNTH_LIBRARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// A synthetic library: `books` small but well-formed EPUBs with container.xml,
+// an OPF carrying every field epub_meta.c extracts, a cover reference and one
+// chapter. Titles, authors and descriptions are drawn from a seeded generator,
+// so the same config always writes the same bytes.
+typedef struct {
+    uint32_t books;
+    uint32_t seed;
+    size_t chapter_bytes;       // Text in each book's chapter, before compression
+    bool deflate;               // Deflate the XML entries, as real EPUBs do; false stores them
+} synth_library_config_t;
+
+#define SYNTH_LIBRARY_DEFAULT_CONFIG() { \
+    .books = 10000,                      \
+    .seed = 1,                           \
+    .chapter_bytes = 8 * 1024,           \
+    .deflate = true,                     \
+}
+
+typedef struct {
+    uint32_t books;
+    uint64_t bytes;             // Total size of the files written
+} synth_library_stats_t;
+
+// Writes the library into the existing directory `dir`. `stats` may be NULL.
+esp_err_t synth_library_write(const char *dir, const synth_library_config_t *config, synth_library_stats_t *stats);
+
+// Filename of book `index`, e.g. "Author - Title (00042).epub"
+void synth_library_book_name(const synth_library_config_t *config, uint32_t index, char *name, size_t size);
+
+// Title book `index` carries in its OPF, as epub_read_metadata() returns it
+void synth_library_book_title(const synth_library_config_t *config, uint32_t index, char *title, size_t size);
+
+#endif // SYNTH_LIBRARY_H
@@ -0,0 +1,270 @@
+/*
+ * On-device benchmark suite.
+ *
+ * Everything the librarian spends its time on, measured the way the firmware
+ * actually does it: raw sequential throughput and small-file operations on
+ * each volume, a pipelined copy through the copy engine, and catalog and
+ * /list-files latency against synthetic rows in the live database. Results
+ * are plain numbers so builds can be compared run against run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "bench.h"
+#include "json_stream.h"
+
+static const char *TAG = "bench";
+
+static const uint32_t BLOCK_SIZES[BENCH_BLOCK_SIZE_COUNT] = BENCH_BLOCK_SIZES;
+
+// Sector alignment for the sweep buffer; also satisfies the SPI and USB DMA
+#define BENCH_BUFFER_ALIGN 512
+// Rendered listings are counted and thrown away in chunks of this size
+#define BENCH_LIST_CHUNK_SIZE 1024
+#define BENCH_SEARCH_TEXT "secret journey"
+
+static void volume_path(const bench_volume_t *volume, const char *name, char *path, size_t len) {
+    snprintf(path, len, "%s/%s", volume->root, name);
+}
+
+// Allocates the largest sweep block that fits, so smaller sizes can share it.
+static uint8_t *alloc_sweep_buffer(size_t *size) {
+    for (int i = BENCH_BLOCK_SIZE_COUNT - 1; i >= 0; i--) {
+        uint8_t *buf = storage_io_alloc(BLOCK_SIZES[i], BENCH_BUFFER_ALIGN);
+        if (buf) {
+            *size = BLOCK_SIZES[i];
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+// The sequential file of the last block size is left behind for the copy.
+static void bench_volume(const bench_config_t *config, const bench_volume_t *volume, bench_volume_result_t *out) {
+    out->name = volume->name;
+    storage_io_geometry_t geometry;
+    if (volume->drive && storage_io_get_geometry(volume->drive, &geometry) == ESP_OK) {
+        out->cluster_size = geometry.cluster_size;
+    }
+
+    char path[64];
+    volume_path(volume, BENCH_SEQ_FILE, path, sizeof(path));
+    size_t buf_size = 0;
+    uint8_t *buf = alloc_sweep_buffer(&buf_size);
+    if (!buf) {
+        out->result = ESP_ERR_NO_MEM;
+        return;
+    }
+    for (size_t i = 0; i < BENCH_BLOCK_SIZE_COUNT && BLOCK_SIZES[i] <= buf_size; i++) {
+        storage_io_bench_pattern_t *pattern = &out->sequential[out->sequential_count];
+        esp_err_t ret = storage_io_measure_sequential(path, config->sequential_bytes, buf, BLOCK_SIZES[i], true,
+                                                      pattern);
+        if (ret != ESP_OK) {
+            out->result = ret;
+            break;
+        }
+        pattern->aligned = true;
+        out->sequential_count++;
+    }
+    heap_caps_free(buf);
+
+    volume_path(volume, BENCH_DIR, path, sizeof(path));
+    esp_err_t ret = storage_io_measure_small_files(path, config->small_files, BENCH_SMALL_FILE_BYTES,
+                                                   &out->small_files);
+    if (out->result == ESP_OK) {
+        out->result = ret;
+    }
+}
+
+static void bench_copy(const bench_config_t *config, bench_copy_result_t *out) {
+    const bench_volume_t *source = &config->volumes[0];
+    const bench_volume_t *dest = &config->volumes[config->volume_count - 1];
+    out->source = source->name;
+    out->destination = dest->name;
+    out->bytes = config->sequential_bytes;
+
+    char source_path[64], dest_path[64];
+    volume_path(source, BENCH_SEQ_FILE, source_path, sizeof(source_path));
+    volume_path(dest, BENCH_COPY_FILE, dest_path, sizeof(dest_path));
+
+    // A fresh copy every time, whatever the transfer queue would skip or resume
+    copy_engine_config_t copy_config = config->copy_config;
+    copy_config.skip_identical = false;
+    copy_config.resume = false;
+    remove(dest_path);
+
+    transfer_progress_t progress = { 0 };
+    int64_t start = esp_timer_get_time();
+    out->result = copy_engine_copy(source_path, dest_path, &copy_config, &progress, NULL);
+    out->us = esp_timer_get_time() - start;
+    out->block_size = copy_config.block_size;
+    if (out->result == ESP_OK && out->us > 0) {
+        out->kbps = (uint32_t)((uint64_t)out->bytes * 1000000 / 1024 / out->us);
+    } else if (out->result != ESP_OK) {
+        ESP_LOGE(TAG, "Copy benchmark failed: %s", progress.error_msg);
+    }
+    remove(dest_path);
+}
+
+static bool count_row(const catalog_entry_t *entry, void *ctx) {
+    (*(uint32_t *)ctx)++;
+    return true;
+}
+
+// Passes rows on to `row` and keeps the last name, which the next page of
+// the listing continues after
+typedef struct {
+    catalog_row_cb_t row;
+    void *ctx;
+    char last[128];
+} page_cursor_t;
+
+static bool cursor_row(const catalog_entry_t *entry, void *ctx) {
+    page_cursor_t *cursor = ctx;
+    strlcpy(cursor->last, entry->name, sizeof(cursor->last));
+    return cursor->row(entry, cursor->ctx);
+}
+
+static esp_err_t discard_flush(void *ctx, const char *data, size_t len) {
+    *(uint32_t *)ctx += len;
+    return ESP_OK;
+}
+
+// One /list-files page as the handler produces it: count, query, render.
+static esp_err_t render_list_page(const bench_config_t *config, catalog_query_t *query, char *chunk,
+                                  uint32_t *bytes, page_cursor_t *cursor) {
+    uint32_t total;
+    esp_err_t ret = catalog_count(query, &total);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    json_stream_t js;
+    json_stream_init(&js, chunk, BENCH_LIST_CHUNK_SIZE, discard_flush, bytes);
+    json_stream_begin_array(&js);
+    cursor->row = config->list_row;
+    cursor->ctx = &js;
+    ret = catalog_query(query, cursor_row, cursor);
+    json_stream_end_array(&js);
+    esp_err_t flushed = json_stream_finish(&js);
+    return ret != ESP_OK ? ret : flushed;
+}
+
+static esp_err_t time_catalog(const bench_config_t *config, bench_catalog_result_t *out) {
+    catalog_query_t query = { .volume = CATALOG_VOLUME_BENCH, .sort = CATALOG_SORT_TITLE,
+                              .limit = CATALOG_BENCH_PAGE_SIZE };
+    uint32_t total = 0, rows = 0;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = catalog_count(&query, &total);
+    out->count_us = esp_timer_get_time() - start;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // Each page continues after the last row of the one before
+    page_cursor_t cursor = { .row = count_row, .ctx = &rows };
+    uint32_t pages = 0;
+    start = esp_timer_get_time();
+    query.after = cursor.last;
+    for (uint32_t seen = 0; seen < total && ret == ESP_OK; seen += CATALOG_BENCH_PAGE_SIZE) {
+        ret = catalog_query(&query, cursor_row, &cursor);
+        pages++;
+    }
+    out->page_us = pages ? (esp_timer_get_time() - start) / pages : 0;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    query.after = NULL;
+    query.filter = "secret";
+    start = esp_timer_get_time();
+    ret = catalog_query(&query, count_row, &rows);
+    out->filter_us = esp_timer_get_time() - start;
+    query.filter = NULL;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    catalog_search_t search = { .text = BENCH_SEARCH_TEXT, .volume = CATALOG_VOLUME_BENCH };
+    start = esp_timer_get_time();
+    ret = catalog_search(&search, count_row, &rows);
+    out->search_us = esp_timer_get_time() - start;
+    if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT) {
+        return ret;
+    }
+    ESP_LOGD(TAG, "Catalog benchmark visited %u rows", (unsigned)rows);
+
+    char *chunk = malloc(BENCH_LIST_CHUNK_SIZE);
+    if (!chunk) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t bytes = 0;
+    pages = 0;
+    int64_t elapsed = 0;
+    ret = ESP_OK;
+    cursor.last[0] = '\0';
+    query.after = cursor.last;
+    for (uint32_t seen = 0; seen < total && ret == ESP_OK; seen += CATALOG_BENCH_PAGE_SIZE) {
+        start = esp_timer_get_time();
+        ret = render_list_page(config, &query, chunk, &bytes, &cursor);
+        int64_t us = esp_timer_get_time() - start;
+        if (pages == 0) {
+            out->list_first_us = us;
+        }
+        elapsed += us;
+        pages++;
+    }
+    free(chunk);
+    if (pages > 0) {
+        out->list_page_us = elapsed / pages;
+        out->list_page_bytes = bytes / pages;
+    }
+    return ret;
+}
+
+static void bench_catalog(const bench_config_t *config, bench_catalog_result_t *out) {
+    out->books = config->books;
+    int64_t start = esp_timer_get_time();
+    out->result = catalog_bench_populate(CATALOG_VOLUME_BENCH, config->books);
+    out->populate_us = esp_timer_get_time() - start;
+    if (out->result == ESP_OK) {
+        out->result = time_catalog(config, out);
+    }
+    catalog_bench_clear(CATALOG_VOLUME_BENCH);
+}
+
+esp_err_t bench_run_suite(const bench_config_t *config, bench_result_t *out) {
+    if (config->volume_count == 0 || config->volume_count > BENCH_MAX_VOLUMES || config->sequential_bytes == 0 ||
+        !config->list_row) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(out, 0, sizeof(*out));
+    out->volume_count = config->volume_count;
+    out->sequential_bytes = config->sequential_bytes;
+
+    for (size_t i = 0; i < config->volume_count; i++) {
+        bench_volume(config, &config->volumes[i], &out->volumes[i]);
+        ESP_LOGI(TAG, "%s: %s", config->volumes[i].name, esp_err_to_name(out->volumes[i].result));
+    }
+
+    // The first volume's sequential file is the copy source
+    if (out->volumes[0].sequential_count > 0) {
+        bench_copy(config, &out->copy);
+    } else {
+        out->copy.result = ESP_ERR_INVALID_STATE;
+    }
+    for (size_t i = 0; i < config->volume_count; i++) {
+        char path[64];
+        volume_path(&config->volumes[i], BENCH_SEQ_FILE, path, sizeof(path));
+        remove(path);
+    }
+
+    bench_catalog(config, &out->catalog);
+    ESP_LOGI(TAG, "Copy %s -> %s: %u KiB/s; /list-files page: %lld us", out->copy.source, out->copy.destination,
+             (unsigned)out->copy.kbps, (long long)out->catalog.list_page_us);
+    return ESP_OK;
+}
@@ -0,0 +1,94 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "catalog.h"
+#include "copy_engine.h"
+#include "storage_io.h"
+
+// Block sizes of the sequential read/write sweep: the FAT sector, the old copy
+// buffer, and two sizes a copy block is typically rounded to.
+#define BENCH_BLOCK_SIZES      { 512, 4 * 1024, 32 * 1024, 64 * 1024 }
+#define BENCH_BLOCK_SIZE_COUNT 4
+#define BENCH_MAX_VOLUMES      2
+
+// Bytes in each small file of the IOPS pass
+#define BENCH_SMALL_FILE_BYTES 1024
+
+typedef struct {
+    const char *name;       // Catalog volume name, e.g. CATALOG_VOLUME_SD
+    const char *root;       // Mount point
+    const char *drive;      // FatFs drive, used for the cluster size; may be NULL
+} bench_volume_t;
+
+typedef struct {
+    // Mounted volumes to measure. The first one is the copy source.
+    bench_volume_t volumes[BENCH_MAX_VOLUMES];
+    size_t volume_count;
+    uint32_t sequential_bytes;
+    uint32_t small_files;
+    uint32_t books;
+    // Copy settings used for the end-to-end copy, as the transfer queue uses them
+    copy_engine_config_t copy_config;
+    // Renders one listing row into the json_stream_t passed as `ctx`, the way
+    // /list-files does, so listing times include serialising the response.
+    catalog_row_cb_t list_row;
+} bench_config_t;
+
+typedef struct {
+    const char *name;
+    esp_err_t result;
+    uint32_t cluster_size;      // 0 if unknown
+    storage_io_bench_pattern_t sequential[BENCH_BLOCK_SIZE_COUNT];
+    size_t sequential_count;    // Sizes that fit in the buffer that could be allocated
+    storage_io_small_files_t small_files;
+} bench_volume_result_t;
+
+typedef struct {
+    esp_err_t result;
+    const char *source;
+    const char *destination;
+    uint32_t bytes;
+    uint32_t block_size;    // Configured ring slot size
+    int64_t us;
+    uint32_t kbps;
+} bench_copy_result_t;
+
+typedef struct {
+    esp_err_t result;
+    uint32_t books;
+    int64_t populate_us;    // Inserting the books in one transaction
+    int64_t count_us;       // catalog_count() for the whole volume
+    int64_t page_us;        // Mean catalog_query() page sorted by title, rows not rendered
+    int64_t filter_us;      // One filtered page (substring match on every column)
+    int64_t search_us;      // First page of a full-text search
+    int64_t list_first_us;  // First /list-files page, counted and rendered
+    int64_t list_page_us;   // Mean /list-files page over the whole volume
+    uint32_t list_page_bytes;   // Mean rendered page size
+} bench_catalog_result_t;
+
+typedef struct {
+    bench_volume_result_t volumes[BENCH_MAX_VOLUMES];
+    size_t volume_count;
+    uint32_t sequential_bytes;
+    bench_copy_result_t copy;
+    bench_catalog_result_t catalog;
+} bench_result_t;
+
+// Scratch names (8.3) created in each volume's root and removed afterwards
+#define BENCH_SEQ_FILE  "BENCHSEQ.TMP"
+#define BENCH_COPY_FILE "BENCHCPY.TMP"
+#define BENCH_DIR       "BENCHDIR"
+
+// Runs the whole suite on the calling task: the sequential sweep and the
+// small-file pass on every volume, a copy from the first volume to the last
+// (the same volume if only one is given), and catalog and listing latency on
+// `books` synthetic rows. Takes from tens of seconds to minutes; nothing else
+// should use the volumes meanwhile. Parts that fail record their error and
+// the rest still run.
+esp_err_t bench_run_suite(const bench_config_t *config, bench_result_t *out);
+
+#endif // BENCH_H
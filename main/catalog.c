@@ -0,0 +1,2063 @@
+/*
+ * Persistent library catalog.
+ *
+ * Book metadata is cached in an SQLite database on the SD card so that file
+ * listings do not have to open and parse every EPUB on each request. Rows are
+ * keyed by (volume, name) and carry the size and mtime that were seen when the
+ * file was last parsed; a sync only re-parses files whose size or mtime changed.
+ * Syncs are fed file by file by the background scanner and committed in
+ * batches, so the lock is never held for a whole volume.
+ *
+ * Every file is also hashed (SHA-256) by a background pass after each scan.
+ * Files with the same hash are the same book, whatever they are called: a
+ * transfer can skip a book the destination already has under another name,
+ * and redundant copies on a volume can be merged into one file. The names
+ * that were merged away stay in the catalog as aliases of the file that was
+ * kept, so they are still listed, searched and downloadable. Since the files
+ * behind them are gone, aliases are also written to a manifest beside the
+ * database and imported again whenever the catalog is rebuilt.
+ *
+ * Long text fields are stored compressed with the unishox1c()/unishox1d() SQL
+ * functions registered by the sqlite3 component. Listings only decompress the
+ * rows of the page being returned.
+ *
+ * The bundled sqlite3 component is built with SQLITE_THREADSAFE=0, so every
+ * access to the database goes through g_catalog_lock.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sqlite3.h"
+
+#include "catalog.h"
+
+// Bump this whenever the schema changes. The catalog is a cache of what is on
+// disk, so an old database is simply dropped and rebuilt.
+#define CATALOG_SCHEMA_VERSION 9
+
+static const char *TAG = "catalog";
+
+static sqlite3 *g_db = NULL;
+static SemaphoreHandle_t g_catalog_lock = NULL;
+static char g_aliases_path[128];    // Empty when aliases are not persisted
+
+static const char *SCHEMA_SQL =
+    "CREATE TABLE IF NOT EXISTS books ("
+    "  id     INTEGER PRIMARY KEY,"
+    "  volume TEXT NOT NULL,"
+    "  name   TEXT NOT NULL,"
+    "  size   INTEGER NOT NULL,"
+    "  mtime  INTEGER NOT NULL,"
+    "  title  TEXT,"
+    "  author TEXT,"
+    "  description BLOB,"   // unishox1c() output; short text is kept as-is
+    "  language   TEXT,"
+    "  identifier TEXT,"    // dc:identifier, usually an ISBN or UUID
+    "  cover      TEXT,"    // Path of the cover image inside the EPUB
+    "  thumb      INTEGER," // Thumbnail cache key; NULL until generated, -1 if it failed
+    "  hash       BLOB,"    // SHA-256 of the file; NULL until hashed, empty if it could not be read
+    "  alias_of   TEXT,"    // Set when the content lives in that other file on the volume
+    "  seen   INTEGER NOT NULL DEFAULT 0,"
+    "  UNIQUE (volume, name)"
+    ");"
+    "CREATE INDEX IF NOT EXISTS books_by_title ON books (volume, title COLLATE NOCASE, name);"
+    "CREATE INDEX IF NOT EXISTS books_by_author ON books (volume, author COLLATE NOCASE, title COLLATE NOCASE, name);"
+    "CREATE INDEX IF NOT EXISTS books_needing_thumb ON books (volume) WHERE thumb IS NULL AND cover IS NOT NULL;"
+    "CREATE INDEX IF NOT EXISTS books_by_hash ON books (volume, hash);"
+    "CREATE INDEX IF NOT EXISTS books_needing_hash ON books (volume) WHERE hash IS NULL AND alias_of IS NULL;"
+    // Full-text index over books, kept in step by the triggers below. It is an
+    // external-content table, so the text itself is only stored once. FTS5
+    // reads content through the view, which sees descriptions decompressed.
+    "CREATE VIEW IF NOT EXISTS books_text (id, title, author, description) AS"
+    "  SELECT id, title, author, unishox1d(description) FROM books;"
+    "CREATE VIRTUAL TABLE IF NOT EXISTS books_fts USING fts5("
+    "  title, author, description,"
+    "  content='books_text', content_rowid='id', tokenize='unicode61 remove_diacritics 2'"
+    ");"
+    "CREATE TRIGGER IF NOT EXISTS books_fts_insert AFTER INSERT ON books BEGIN"
+    "  INSERT INTO books_fts (rowid, title, author, description)"
+    "  VALUES (new.id, new.title, new.author, unishox1d(new.description));"
+    "END;"
+    "CREATE TRIGGER IF NOT EXISTS books_fts_delete AFTER DELETE ON books BEGIN"
+    "  INSERT INTO books_fts (books_fts, rowid, title, author, description)"
+    "  VALUES ('delete', old.id, old.title, old.author, unishox1d(old.description));"
+    "END;"
+    "CREATE TRIGGER IF NOT EXISTS books_fts_update AFTER UPDATE OF title, author, description ON books BEGIN"
+    "  INSERT INTO books_fts (books_fts, rowid, title, author, description)"
+    "  VALUES ('delete', old.id, old.title, old.author, unishox1d(old.description));"
+    "  INSERT INTO books_fts (rowid, title, author, description)"
+    "  VALUES (new.id, new.title, new.author, unishox1d(new.description));"
+    "END;"
+    // Metadata imported from a Calibre library, keyed by the book's filename
+    "CREATE TABLE IF NOT EXISTS calibre ("
+    "  volume TEXT NOT NULL,"
+    "  name   TEXT NOT NULL COLLATE NOCASE,"
+    "  title  TEXT,"
+    "  author TEXT,"
+    "  description BLOB,"   // Compressed like books.description
+    "  PRIMARY KEY (volume, name)"
+    ") WITHOUT ROWID;";
+
+// --- Helpers ---
+static esp_err_t exec_sql(const char *sql) {
+    char *err_msg = NULL;
+    if (sqlite3_exec(g_db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+        ESP_LOGE(TAG, "SQL error: %s (%s)", err_msg ? err_msg : "unknown", sql);
+        sqlite3_free(err_msg);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void catalog_lock(void) {
+    xSemaphoreTake(g_catalog_lock, portMAX_DELAY);
+}
+
+static void catalog_unlock(void) {
+    xSemaphoreGive(g_catalog_lock);
+}
+
+bool catalog_is_book_file(const char *name) {
+    return strstr(name, ".epub") || strstr(name, ".mobi") || strstr(name, ".pdf") || strstr(name, ".txt");
+}
+
+static const char *CALIBRE_LOOKUP_SQL = "SELECT title, author, unishox1d(description) FROM calibre WHERE volume = ?1 AND name = ?2;";
+
+// Fills in the displayed title/author for a file. Books covered by an imported
+// Calibre library take its metadata; otherwise EPUBs are parsed and every
+// other format falls back to the filename. Must be called with the lock held.
+static void resolve_metadata(sqlite3_stmt *calibre_lookup, const char *volume, const char *full_path,
+                             const char *name, epub_metadata_t *meta) {
+    meta->title[0] = '\0';
+    meta->author[0] = '\0';
+    meta->description[0] = '\0';
+    meta->language[0] = '\0';
+    meta->identifier[0] = '\0';
+    meta->cover[0] = '\0';
+    if (calibre_lookup) {
+        sqlite3_reset(calibre_lookup);
+        sqlite3_bind_text(calibre_lookup, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(calibre_lookup, 2, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(calibre_lookup) == SQLITE_ROW) {
+            const char *title = (const char *)sqlite3_column_text(calibre_lookup, 0);
+            const char *author = (const char *)sqlite3_column_text(calibre_lookup, 1);
+            if (title) strlcpy(meta->title, title, sizeof(meta->title));
+            if (author) strlcpy(meta->author, author, sizeof(meta->author));
+            const char *description = (const char *)sqlite3_column_text(calibre_lookup, 2);
+            if (description) strlcpy(meta->description, description, sizeof(meta->description));
+        }
+        sqlite3_reset(calibre_lookup);
+        if (meta->title[0] != '\0') {
+            return;
+        }
+    }
+
+    if (strstr(name, ".epub")) {
+        epub_read_metadata(full_path, meta);
+        if (meta->title[0] == '\0') strlcpy(meta->title, name, sizeof(meta->title));
+        if (meta->author[0] == '\0') strlcpy(meta->author, "Unknown", sizeof(meta->author));
+    } else {
+        strlcpy(meta->title, name, sizeof(meta->title));
+        meta->author[0] = '\0';
+    }
+}
+
+// --- Alias Manifest ---
+// One line per alias: volume, name, the file it was merged into, size and
+// hash in hex, separated by tabs. Merges append to it before they remove
+// anything; it is rewritten from the catalog when aliases are dropped.
+
+static void hash_to_hex(const uint8_t *hash, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < CATALOG_HASH_SIZE; i++) {
+        hex[i * 2] = digits[hash[i] >> 4];
+        hex[i * 2 + 1] = digits[hash[i] & 0x0f];
+    }
+    hex[CATALOG_HASH_SIZE * 2] = '\0';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool hex_to_hash(const char *hex, uint8_t *hash) {
+    for (int i = 0; i < CATALOG_HASH_SIZE; i++) {
+        int hi = hex_digit(hex[i * 2]);
+        int lo = hi < 0 ? -1 : hex_digit(hex[i * 2 + 1]);
+        if (lo < 0) {
+            return false;
+        }
+        hash[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return hex[CATALOG_HASH_SIZE * 2] == '\0';
+}
+
+// Where the manifest is written before it replaces the old one
+static void aliases_temp_path(char *path, size_t size) {
+    const char *ext = strrchr(g_aliases_path, '.');
+    size_t base = ext && !strchr(ext, '/') ? (size_t)(ext - g_aliases_path) : strlen(g_aliases_path);
+    snprintf(path, size, "%.*s.tmp", (int)base, g_aliases_path);
+}
+
+// Writes and syncs one line. Returns false if it may not have reached the card.
+static bool aliases_write_line(FILE *f, const char *volume, const char *name, const char *alias_of, int64_t size,
+                               const uint8_t *hash) {
+    char hex[CATALOG_HASH_SIZE * 2 + 1];
+    hash_to_hex(hash, hex);
+    return fprintf(f, "%s\t%s\t%s\t%lld\t%s\n", volume, name, alias_of, (long long)size, hex) > 0;
+}
+
+static bool aliases_close(FILE *f) {
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+// Records an alias about to be created. Must be called with the lock held.
+static esp_err_t aliases_append(const char *volume, const char *name, const char *alias_of, int64_t size,
+                                const uint8_t *hash) {
+    if (g_aliases_path[0] == '\0') {
+        return ESP_OK;
+    }
+    FILE *f = fopen(g_aliases_path, "a");
+    if (!f) {
+        ESP_LOGE(TAG, "Can't open alias manifest %s", g_aliases_path);
+        return ESP_FAIL;
+    }
+    bool ok = aliases_write_line(f, volume, name, alias_of, size, hash);
+    return aliases_close(f) && ok ? ESP_OK : ESP_FAIL;
+}
+
+// Replaces the manifest with the aliases the catalog holds now. FAT cannot
+// rename over a file, so a crash can leave only the new copy under the temp
+// name; aliases_import() looks there too. Must be called with the lock held.
+static esp_err_t aliases_rewrite(void) {
+    if (g_aliases_path[0] == '\0') {
+        return ESP_OK;
+    }
+    char temp_path[sizeof(g_aliases_path) + 4];
+    aliases_temp_path(temp_path, sizeof(temp_path));
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "SELECT volume, name, alias_of, size, hash FROM books WHERE alias_of IS NOT NULL;",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return ESP_FAIL;
+    }
+    FILE *f = fopen(temp_path, "w");
+    if (!f) {
+        sqlite3_finalize(stmt);
+        ESP_LOGE(TAG, "Can't write alias manifest %s", temp_path);
+        return ESP_FAIL;
+    }
+    bool ok = true;
+    while (ok && sqlite3_step(stmt) == SQLITE_ROW) {
+        if (sqlite3_column_bytes(stmt, 4) != CATALOG_HASH_SIZE) {
+            continue;
+        }
+        ok = aliases_write_line(f, (const char *)sqlite3_column_text(stmt, 0),
+                                (const char *)sqlite3_column_text(stmt, 1),
+                                (const char *)sqlite3_column_text(stmt, 2), sqlite3_column_int64(stmt, 3),
+                                sqlite3_column_blob(stmt, 4));
+    }
+    sqlite3_finalize(stmt);
+    if (!aliases_close(f) || !ok) {
+        remove(temp_path);
+        return ESP_FAIL;
+    }
+    remove(g_aliases_path);
+    return rename(temp_path, g_aliases_path) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+// Brings back aliases a rebuilt catalog has lost. They get their metadata from
+// the file they stand for once a sync has indexed it (ALIAS_FILL_SQL). Names
+// already in the catalog are left alone. Called from catalog_open().
+static void aliases_import(void) {
+    if (g_aliases_path[0] == '\0') {
+        return;
+    }
+    FILE *f = fopen(g_aliases_path, "r");
+    if (!f) {
+        char temp_path[sizeof(g_aliases_path) + 4];
+        aliases_temp_path(temp_path, sizeof(temp_path));
+        if (rename(temp_path, g_aliases_path) != 0 || !(f = fopen(g_aliases_path, "r"))) {
+            return;
+        }
+    }
+    sqlite3_stmt *insert;
+    if (sqlite3_prepare_v2(g_db,
+                           "INSERT INTO books (volume, name, size, mtime, alias_of, hash) VALUES (?1, ?2, ?4, 0, ?3, ?5) "
+                           "ON CONFLICT (volume, name) DO NOTHING;",
+                           -1, &insert, NULL) != SQLITE_OK) {
+        fclose(f);
+        return;
+    }
+    exec_sql("BEGIN;");
+    uint32_t imported = 0;
+    char line[400];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *field[5];
+        char *save = NULL;
+        int n = 0;
+        for (char *tok = strtok_r(line, "\t", &save); tok && n < 5; tok = strtok_r(NULL, "\t", &save)) {
+            field[n++] = tok;
+        }
+        uint8_t hash[CATALOG_HASH_SIZE];
+        if (n != 5 || !hex_to_hash(field[4], hash)) {
+            continue;
+        }
+        sqlite3_reset(insert);
+        for (int i = 0; i < 3; i++) {
+            sqlite3_bind_text(insert, i + 1, field[i], -1, SQLITE_STATIC);
+        }
+        sqlite3_bind_int64(insert, 4, strtoll(field[3], NULL, 10));
+        sqlite3_bind_blob(insert, 5, hash, CATALOG_HASH_SIZE, SQLITE_STATIC);
+        if (sqlite3_step(insert) == SQLITE_DONE) {
+            imported += sqlite3_changes(g_db);
+        }
+    }
+    sqlite3_finalize(insert);
+    exec_sql("COMMIT;");
+    fclose(f);
+    if (imported > 0) {
+        ESP_LOGI(TAG, "Restored %u alias(es) from %s", (unsigned)imported, g_aliases_path);
+    }
+}
+
+// --- Lifecycle ---
+esp_err_t catalog_open(const char *db_path, const char *aliases_path) {
+    if (g_db) {
+        return ESP_OK;
+    }
+    if (!g_catalog_lock) {
+        g_catalog_lock = xSemaphoreCreateMutex();
+        if (!g_catalog_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (sqlite3_open(db_path, &g_db) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Can't open catalog %s: %s", db_path, sqlite3_errmsg(g_db));
+        sqlite3_close(g_db);
+        g_db = NULL;
+        return ESP_FAIL;
+    }
+
+    // The catalog can always be rebuilt from the files on disk, so trade
+    // crash safety for fewer writes: keep the rollback journal in RAM.
+    exec_sql("PRAGMA journal_mode=MEMORY;");
+    exec_sql("PRAGMA temp_store=MEMORY;");
+
+    int version = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "PRAGMA user_version;", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    if (version != CATALOG_SCHEMA_VERSION) {
+        ESP_LOGI(TAG, "Catalog schema %d != %d, rebuilding", version, CATALOG_SCHEMA_VERSION);
+        exec_sql("DROP TABLE IF EXISTS books_fts;");
+        exec_sql("DROP VIEW IF EXISTS books_text;");
+        exec_sql("DROP TABLE IF EXISTS books;");
+        exec_sql("DROP TABLE IF EXISTS calibre;");
+    }
+
+    char version_sql[48];
+    snprintf(version_sql, sizeof(version_sql), "PRAGMA user_version=%d;", CATALOG_SCHEMA_VERSION);
+    if (exec_sql(SCHEMA_SQL) != ESP_OK || exec_sql(version_sql) != ESP_OK) {
+        sqlite3_close(g_db);
+        g_db = NULL;
+        return ESP_FAIL;
+    }
+
+    // A benchmark cut short by a reset leaves its synthetic rows behind
+    exec_sql("DELETE FROM books WHERE volume = '" CATALOG_VOLUME_BENCH "';");
+    strlcpy(g_aliases_path, aliases_path ? aliases_path : "", sizeof(g_aliases_path));
+    aliases_import();
+
+    ESP_LOGI(TAG, "Catalog opened at %s", db_path);
+    return ESP_OK;
+}
+
+void catalog_close(void) {
+    if (!g_db) {
+        return;
+    }
+    catalog_lock();
+    sqlite3_close(g_db);
+    g_db = NULL;
+    catalog_unlock();
+}
+
+esp_err_t catalog_set_cache_size(uint32_t kib) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char sql[40];
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size=-%u;", (unsigned)kib);
+    catalog_lock();
+    esp_err_t ret = exec_sql(sql);
+    catalog_unlock();
+    return ret;
+}
+
+// --- Indexing ---
+// Inserts or refreshes one row. Must be called with the lock held.
+static void bind_optional_text(sqlite3_stmt *stmt, int index, const char *text) {
+    if (text[0] != '\0') {
+        sqlite3_bind_text(stmt, index, text, -1, SQLITE_TRANSIENT);
+    } else {
+        sqlite3_bind_null(stmt, index);
+    }
+}
+
+static esp_err_t upsert_file(sqlite3_stmt *upsert, sqlite3_stmt *calibre_lookup, const char *volume,
+                             const char *full_path, const char *name, int64_t size, int64_t mtime, int64_t seen) {
+    epub_metadata_t meta;
+    resolve_metadata(calibre_lookup, volume, full_path, name, &meta);
+
+    sqlite3_reset(upsert);
+    sqlite3_bind_text(upsert, 1, volume, -1, SQLITE_STATIC);
+    sqlite3_bind_text(upsert, 2, name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(upsert, 3, size);
+    sqlite3_bind_int64(upsert, 4, mtime);
+    sqlite3_bind_text(upsert, 5, meta.title, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(upsert, 6, meta.author, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(upsert, 7, seen);
+    bind_optional_text(upsert, 8, meta.description);
+    bind_optional_text(upsert, 9, meta.language);
+    bind_optional_text(upsert, 10, meta.identifier);
+    bind_optional_text(upsert, 11, meta.cover);
+    if (sqlite3_step(upsert) != SQLITE_DONE) {
+        ESP_LOGE(TAG, "Failed to index %s: %s", name, sqlite3_errmsg(g_db));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static const char *UPSERT_SQL =
+    "INSERT INTO books (volume, name, size, mtime, title, author, seen, description, language, identifier, cover) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, unishox1c(?8), ?9, ?10, ?11) "
+    "ON CONFLICT (volume, name) DO UPDATE SET size = ?3, mtime = ?4, title = ?5, author = ?6, seen = ?7, "
+    "description = excluded.description, language = ?9, identifier = ?10, cover = ?11, thumb = NULL, "
+    "hash = NULL, alias_of = NULL;";
+
+// Aliases only describe files other rows stand for, so syncs never compare
+// them against the disk
+static const char *LOOKUP_SQL = "SELECT size, mtime FROM books WHERE volume = ?1 AND name = ?2 AND alias_of IS NULL;";
+
+// An alias outlives its file only as long as the file still has the content
+// the alias was merged for; once it is gone or rewritten the alias goes too.
+// A file whose hash is NULL has not been hashed since it last changed, which
+// is no evidence either way, so its aliases wait for the next sync.
+static const char *ORPHANS_SQL =
+    "DELETE FROM books WHERE volume = ?1 AND alias_of IS NOT NULL AND NOT EXISTS ("
+    "  SELECT 1 FROM books t WHERE t.volume = ?1 AND t.name = books.alias_of AND t.alias_of IS NULL"
+    "  AND (t.hash IS NULL OR t.hash = books.hash));";
+
+// Aliases restored from the manifest take the metadata of their file. A file
+// titled by its name (no EPUB metadata) gives the alias its own name instead.
+static const char *ALIAS_FILL_SQL =
+    "UPDATE books SET title = iif(t.title = t.name, books.name, t.title), author = t.author, description = t.description, language = t.language, "
+    "  identifier = t.identifier, thumb = t.thumb "
+    "FROM books t WHERE books.volume = ?1 AND books.alias_of IS NOT NULL AND books.title IS NULL "
+    "  AND t.volume = ?1 AND t.name = books.alias_of AND t.alias_of IS NULL AND t.title IS NOT NULL;";
+
+// State of one incremental sync. Every row touched is stamped with a new
+// generation number; anything left with an older stamp once the whole volume
+// has been walked was deleted from disk.
+struct catalog_sync {
+    const char *volume;
+    int64_t seen;
+    bool in_batch;              // Lock held and a transaction open
+    sqlite3_stmt *lookup;
+    sqlite3_stmt *touch;
+    sqlite3_stmt *upsert;
+    sqlite3_stmt *sweep;
+    sqlite3_stmt *orphans;
+    sqlite3_stmt *alias_fill;
+    sqlite3_stmt *calibre;
+    catalog_sync_stats_t stats;
+};
+
+static void sync_free(catalog_sync_t *sync) {
+    sqlite3_finalize(sync->lookup);
+    sqlite3_finalize(sync->touch);
+    sqlite3_finalize(sync->upsert);
+    sqlite3_finalize(sync->sweep);
+    sqlite3_finalize(sync->orphans);
+    sqlite3_finalize(sync->alias_fill);
+    sqlite3_finalize(sync->calibre);
+    free(sync);
+}
+
+// Takes the lock and opens a transaction for the next batch, if needed.
+static esp_err_t sync_enter(catalog_sync_t *sync) {
+    if (sync->in_batch) {
+        return ESP_OK;
+    }
+    catalog_lock();
+    if (exec_sql("BEGIN;") != ESP_OK) {
+        catalog_unlock();
+        return ESP_FAIL;
+    }
+    sync->in_batch = true;
+    return ESP_OK;
+}
+
+// Ends the current batch and releases the lock.
+static esp_err_t sync_leave(catalog_sync_t *sync) {
+    if (!sync->in_batch) {
+        return ESP_OK;
+    }
+    esp_err_t ret = exec_sql("COMMIT;");
+    if (ret != ESP_OK) {
+        exec_sql("ROLLBACK;");
+    }
+    sync->in_batch = false;
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_sync_begin(const char *volume, catalog_sync_t **out) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_sync_t *sync = calloc(1, sizeof(*sync));
+    if (!sync) {
+        return ESP_ERR_NO_MEM;
+    }
+    sync->volume = volume;
+    sync->seen = 1;
+
+    catalog_lock();
+    sqlite3_stmt *gen = NULL;
+    if (sqlite3_prepare_v2(g_db, "SELECT COALESCE(MAX(seen), 0) + 1 FROM books WHERE volume = ?1;", -1, &gen, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(gen, 1, volume, -1, SQLITE_STATIC);
+        if (sqlite3_step(gen) == SQLITE_ROW) {
+            sync->seen = sqlite3_column_int64(gen, 0);
+        }
+        sqlite3_finalize(gen);
+    }
+
+    bool prepared =
+        sqlite3_prepare_v2(g_db, LOOKUP_SQL, -1, &sync->lookup, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, "UPDATE books SET seen = ?3 WHERE volume = ?1 AND name = ?2;", -1, &sync->touch, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, UPSERT_SQL, -1, &sync->upsert, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, "DELETE FROM books WHERE volume = ?1 AND seen <> ?2 AND alias_of IS NULL;", -1, &sync->sweep, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, ORPHANS_SQL, -1, &sync->orphans, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, ALIAS_FILL_SQL, -1, &sync->alias_fill, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(g_db, CALIBRE_LOOKUP_SQL, -1, &sync->calibre, NULL) == SQLITE_OK;
+    if (!prepared) {
+        ESP_LOGE(TAG, "Failed to prepare sync statements: %s", sqlite3_errmsg(g_db));
+    }
+    catalog_unlock();
+
+    if (!prepared) {
+        sync_free(sync);
+        return ESP_FAIL;
+    }
+    *out = sync;
+    return ESP_OK;
+}
+
+esp_err_t catalog_sync_file(catalog_sync_t *sync, const char *dir_path, const char *name, int64_t size, int64_t mtime,
+                            bool *parsed) {
+    if (parsed) *parsed = false;
+    if (sync_enter(sync) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    sqlite3_reset(sync->lookup);
+    sqlite3_bind_text(sync->lookup, 1, sync->volume, -1, SQLITE_STATIC);
+    sqlite3_bind_text(sync->lookup, 2, name, -1, SQLITE_STATIC);
+    bool is_current = sqlite3_step(sync->lookup) == SQLITE_ROW &&
+                      sqlite3_column_int64(sync->lookup, 0) == size &&
+                      sqlite3_column_int64(sync->lookup, 1) == mtime;
+    sqlite3_reset(sync->lookup);
+
+    if (is_current) {
+        sqlite3_reset(sync->touch);
+        sqlite3_bind_text(sync->touch, 1, sync->volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(sync->touch, 2, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(sync->touch, 3, sync->seen);
+        sqlite3_step(sync->touch);
+        sync->stats.unchanged++;
+        return ESP_OK;
+    }
+
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, name);
+    esp_err_t ret = upsert_file(sync->upsert, sync->calibre, sync->volume, full_path, name, size, mtime, sync->seen);
+    if (ret == ESP_OK) {
+        sync->stats.parsed++;
+        if (parsed) *parsed = true;
+    }
+    return ret;
+}
+
+esp_err_t catalog_sync_yield(catalog_sync_t *sync) {
+    return sync_leave(sync);
+}
+
+esp_err_t catalog_sync_finish(catalog_sync_t *sync, bool complete, catalog_sync_stats_t *stats) {
+    esp_err_t ret = sync_enter(sync);
+    if (ret == ESP_OK) {
+        // A walk that was cut short has not seen every file, so nothing may be swept
+        if (complete) {
+            sqlite3_bind_text(sync->sweep, 1, sync->volume, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(sync->sweep, 2, sync->seen);
+            sqlite3_step(sync->sweep);
+            sync->stats.removed = sqlite3_changes(g_db);
+            sqlite3_bind_text(sync->orphans, 1, sync->volume, -1, SQLITE_STATIC);
+            sqlite3_step(sync->orphans);
+            int orphans = sqlite3_changes(g_db);
+            sync->stats.removed += orphans;
+            if (orphans > 0 && aliases_rewrite() != ESP_OK) {
+                ESP_LOGW(TAG, "Failed to rewrite alias manifest; dropped aliases return on a rebuild");
+            }
+        }
+        sqlite3_bind_text(sync->alias_fill, 1, sync->volume, -1, SQLITE_STATIC);
+        sqlite3_step(sync->alias_fill);
+        ret = sync_leave(sync);
+    }
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Synced %s: %u parsed, %u unchanged, %u removed%s", sync->volume,
+                 (unsigned)sync->stats.parsed, (unsigned)sync->stats.unchanged,
+                 (unsigned)sync->stats.removed, complete ? "" : " (incomplete)");
+    }
+    if (stats) {
+        *stats = sync->stats;
+    }
+    sync_free(sync);
+    return ret;
+}
+
+esp_err_t catalog_update_file(const char *volume, const char *dir_path, const char *name) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!catalog_is_book_file(name)) {
+        return ESP_OK;
+    }
+
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, name);
+    struct stat st;
+    if (stat(full_path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    catalog_lock();
+    // A transfer that skipped an identical file reports it like a copy
+    sqlite3_stmt *lookup = NULL;
+    bool unchanged = false;
+    if (sqlite3_prepare_v2(g_db, LOOKUP_SQL, -1, &lookup, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(lookup, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(lookup, 2, name, -1, SQLITE_STATIC);
+        unchanged = sqlite3_step(lookup) == SQLITE_ROW && sqlite3_column_int64(lookup, 0) == st.st_size &&
+                    sqlite3_column_int64(lookup, 1) == st.st_mtime;
+        sqlite3_finalize(lookup);
+    }
+    if (unchanged) {
+        catalog_unlock();
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *upsert = NULL;
+    sqlite3_stmt *gen = NULL;
+    int64_t seen = 1;
+    // Keep the current generation so the next sync does not sweep this row.
+    if (sqlite3_prepare_v2(g_db, "SELECT COALESCE(MAX(seen), 1) FROM books WHERE volume = ?1;", -1, &gen, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(gen, 1, volume, -1, SQLITE_STATIC);
+        if (sqlite3_step(gen) == SQLITE_ROW) {
+            seen = sqlite3_column_int64(gen, 0);
+        }
+        sqlite3_finalize(gen);
+    }
+    sqlite3_stmt *calibre = NULL;
+    if (sqlite3_prepare_v2(g_db, CALIBRE_LOOKUP_SQL, -1, &calibre, NULL) != SQLITE_OK) {
+        calibre = NULL;
+    }
+    if (sqlite3_prepare_v2(g_db, UPSERT_SQL, -1, &upsert, NULL) == SQLITE_OK) {
+        ret = upsert_file(upsert, calibre, volume, full_path, name, st.st_size, st.st_mtime, seen);
+    }
+    sqlite3_finalize(upsert);
+    sqlite3_finalize(calibre);
+    catalog_unlock();
+    return ret;
+}
+
+// --- Calibre Import ---
+// Page cache for the Calibre connection, in KiB (passed to PRAGMA cache_size)
+#define CALIBRE_CACHE_KB "64"
+
+// One row per book file; multiple authors are joined the way Calibre shows them.
+static const char *CALIBRE_SELECT_SQL =
+    "SELECT d.name || '.' || lower(d.format), b.title, "
+    "  (SELECT group_concat(a.name, ' & ') FROM books_authors_link bal "
+    "   JOIN authors a ON a.id = bal.author WHERE bal.book = b.id), "
+    "  (SELECT substr(c.text, 1, 2048) FROM comments c WHERE c.book = b.id) "
+    "FROM data d JOIN books b ON b.id = d.book "
+    "WHERE d.format IN ('EPUB', 'MOBI', 'PDF', 'TXT');";
+
+static const char *CALIBRE_COUNT_SQL =
+    "SELECT COUNT(*) FROM data WHERE format IN ('EPUB', 'MOBI', 'PDF', 'TXT');";
+
+// Applies imported metadata to books that are already indexed.
+static const char *CALIBRE_APPLY_SQL =
+    "UPDATE books SET title = c.title, author = COALESCE(c.author, books.author), "
+    "  description = COALESCE(c.description, books.description) "
+    "FROM calibre c WHERE books.volume = ?1 AND c.volume = ?1 AND c.name = books.name AND c.title IS NOT NULL;";
+
+// Ends the current import batch and releases the lock; the Calibre connection
+// and its statements stay open for the next one.
+static esp_err_t import_leave(void) {
+    esp_err_t ret = exec_sql("COMMIT;");
+    if (ret != ESP_OK) {
+        exec_sql("ROLLBACK;");
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// Takes the lock again and opens the next batch's transaction.
+static esp_err_t import_enter(void) {
+    catalog_lock();
+    if (exec_sql("BEGIN;") != ESP_OK) {
+        catalog_unlock();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t catalog_import_calibre(const char *volume, const char *calibre_db_path,
+                                 catalog_import_progress_cb_t progress, void *ctx) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The sqlite3 build is single-threaded, so even the second connection
+    // must only be used with the catalog lock held.
+    catalog_lock();
+
+    sqlite3 *src = NULL;
+    sqlite3_stmt *count = NULL, *select = NULL, *clear = NULL, *insert = NULL, *apply = NULL;
+    esp_err_t ret = ESP_FAIL;
+    bool locked = true;
+    uint32_t total = 0, done = 0;
+    int applied = 0;
+
+    if (sqlite3_open_v2(calibre_db_path, &src, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Can't open Calibre database %s: %s", calibre_db_path, sqlite3_errmsg(src));
+        goto cleanup;
+    }
+    // Calibre libraries use 1-4 KB pages; the default 1 KB page cache would
+    // re-read interior b-tree pages for every row of the join.
+    sqlite3_exec(src, "PRAGMA cache_size=-" CALIBRE_CACHE_KB ";", NULL, NULL, NULL);
+
+    if (sqlite3_prepare_v2(src, CALIBRE_COUNT_SQL, -1, &count, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(src, CALIBRE_SELECT_SQL, -1, &select, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Not a Calibre library: %s", sqlite3_errmsg(src));
+        goto cleanup;
+    }
+    if (sqlite3_step(count) == SQLITE_ROW) {
+        total = (uint32_t)sqlite3_column_int64(count, 0);
+    }
+
+    if (sqlite3_prepare_v2(g_db, "DELETE FROM calibre WHERE volume = ?1;", -1, &clear, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(g_db, "INSERT OR REPLACE INTO calibre (volume, name, title, author, description) VALUES (?1, ?2, ?3, ?4, unishox1c(?5));", -1, &insert, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(g_db, CALIBRE_APPLY_SQL, -1, &apply, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare import statements: %s", sqlite3_errmsg(g_db));
+        goto cleanup;
+    }
+    catalog_unlock();
+    locked = false;
+
+    if (progress && !progress(0, total, ctx)) {
+        ret = ESP_ERR_INVALID_STATE;
+        goto cleanup;
+    }
+    if (import_enter() != ESP_OK) {
+        goto cleanup;
+    }
+    locked = true;
+
+    // A fresh import replaces whatever the previous one left behind
+    sqlite3_bind_text(clear, 1, volume, -1, SQLITE_STATIC);
+    sqlite3_step(clear);
+
+    uint32_t batch_rows = 0;
+    while (sqlite3_step(select) == SQLITE_ROW) {
+        const unsigned char *name = sqlite3_column_text(select, 0);
+        if (!name) {
+            continue;
+        }
+        sqlite3_reset(insert);
+        sqlite3_bind_text(insert, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(insert, 2, (const char *)name, -1, SQLITE_STATIC);
+        sqlite3_bind_value(insert, 3, sqlite3_column_value(select, 1));
+        sqlite3_bind_value(insert, 4, sqlite3_column_value(select, 2));
+        // Calibre comments are HTML; keep the plain text the size EPUBs get
+        const char *comments = (const char *)sqlite3_column_text(select, 3);
+        if (comments) {
+            char description[EPUB_META_DESC_MAX];
+            epub_strip_markup(description, sizeof(description), comments);
+            sqlite3_bind_text(insert, 5, description, -1, SQLITE_TRANSIENT);
+        } else {
+            sqlite3_bind_null(insert, 5);
+        }
+        if (sqlite3_step(insert) != SQLITE_DONE) {
+            ESP_LOGW(TAG, "Failed to import %s: %s", name, sqlite3_errmsg(g_db));
+        }
+        sqlite3_reset(insert);
+        done++;
+
+        // Commit the batch and let listings, scans and transfers in. The
+        // select on the read-only Calibre connection stays positioned.
+        if (++batch_rows >= CATALOG_IMPORT_BATCH_ROWS) {
+            batch_rows = 0;
+            locked = false;
+            if (import_leave() != ESP_OK) {
+                goto cleanup;
+            }
+            if (progress && !progress(done, total, ctx)) {
+                ESP_LOGI(TAG, "Calibre import for %s stopped after %u entries", volume, (unsigned)done);
+                ret = ESP_ERR_INVALID_STATE;
+                goto cleanup;
+            }
+            vTaskDelay(1);
+            if (import_enter() != ESP_OK) {
+                goto cleanup;
+            }
+            locked = true;
+        }
+    }
+
+    sqlite3_bind_text(apply, 1, volume, -1, SQLITE_STATIC);
+    sqlite3_step(apply);
+    applied = sqlite3_changes(g_db);
+
+    locked = false;
+    if (import_leave() == ESP_OK) {
+        ret = ESP_OK;
+        ESP_LOGI(TAG, "Imported %u Calibre entries for %s, %d indexed books updated",
+                 (unsigned)done, volume, applied);
+    }
+    if (progress) progress(done, total, ctx);
+
+cleanup:
+    if (!locked) {
+        catalog_lock();
+    }
+    sqlite3_finalize(count);
+    sqlite3_finalize(select);
+    sqlite3_finalize(clear);
+    sqlite3_finalize(insert);
+    sqlite3_finalize(apply);
+    sqlite3_close(src);
+    catalog_unlock();
+    return ret;
+}
+
+// --- Queries ---
+void catalog_parse_sort(const char *key, catalog_sort_t *sort, bool *descending) {
+    *sort = CATALOG_SORT_NAME;
+    *descending = false;
+    if (!key || !*key) {
+        return;
+    }
+    if (*key == '-') {
+        *descending = true;
+        key++;
+    }
+    if (strcmp(key, "title") == 0) *sort = CATALOG_SORT_TITLE;
+    else if (strcmp(key, "author") == 0) *sort = CATALOG_SORT_AUTHOR;
+    else if (strcmp(key, "size") == 0) *sort = CATALOG_SORT_SIZE;
+    else if (strcmp(key, "mtime") == 0) *sort = CATALOG_SORT_MTIME;
+}
+
+// A listing is ordered by its sort key and then by the keys after it, down to
+// the filename, which is unique on a volume. That order is total, so a page
+// can seek straight past the last row of the one before instead of counting
+// its way there with OFFSET. Every key runs in the same direction so the seek
+// is a range on the index.
+typedef struct {
+    const char *column;     // As it appears in ORDER BY and comparisons
+    int cursor_col;         // Column of its value in CURSOR_SQL
+    bool nullable;
+} sort_key_t;
+
+#define SORT_KEYS_MAX 3
+
+// Sort key values of the row a page continues after
+static const char *CURSOR_SQL = "SELECT title, author, size, mtime FROM books WHERE volume = ?1 AND name = ?2;";
+
+static const sort_key_t KEY_TITLE  = { "title COLLATE NOCASE", 0, true };
+static const sort_key_t KEY_AUTHOR = { "author COLLATE NOCASE", 1, true };
+static const sort_key_t KEY_SIZE   = { "size", 2, false };
+static const sort_key_t KEY_MTIME  = { "mtime", 3, false };
+static const sort_key_t KEY_NAME   = { "name", -1, false };    // Bound from the query itself
+
+// Column lists are fixed strings chosen from the enum, never user input.
+static size_t sort_keys(catalog_sort_t sort, const sort_key_t **keys) {
+    size_t n = 0;
+    switch (sort) {
+        case CATALOG_SORT_TITLE:  keys[n++] = &KEY_TITLE; break;
+        case CATALOG_SORT_AUTHOR: keys[n++] = &KEY_AUTHOR; keys[n++] = &KEY_TITLE; break;
+        case CATALOG_SORT_SIZE:   keys[n++] = &KEY_SIZE; break;
+        case CATALOG_SORT_MTIME:  keys[n++] = &KEY_MTIME; break;
+        case CATALOG_SORT_NAME:
+        default:                  break;
+    }
+    keys[n++] = &KEY_NAME;
+    return n;
+}
+
+// Appends to a statement being built in `sql`; output past the end is dropped
+// and caught by the prepare.
+static void sql_append(char *sql, size_t size, const char *fmt, ...) {
+    size_t used = strlen(sql);
+    if (used + 1 >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(sql + used, size - used, fmt, args);
+    va_end(args);
+}
+
+static void append_order(char *sql, size_t size, const sort_key_t **keys, size_t n, bool descending) {
+    for (size_t i = 0; i < n; i++) {
+        sql_append(sql, size, "%s%s%s", i ? ", " : "", keys[i]->column, descending ? " DESC" : "");
+    }
+}
+
+// Rows that sort after the cursor from key `i` on, given which of the cursor's
+// values are NULL. NULLs sort first, so they come before every value going up
+// and after every value going down. The cursor value of key i is bound to ?(3+i).
+static void append_after(char *sql, size_t size, const sort_key_t **keys, size_t n, size_t i,
+                         const bool *is_null, bool descending) {
+    const char *col = keys[i]->column;
+    int param = 3 + (int)i;
+    if (i == n - 1) {
+        sql_append(sql, size, "%s %c ?%d", col, descending ? '<' : '>', param);
+        return;
+    }
+    if (is_null[i]) {
+        sql_append(sql, size, descending ? "(%s IS NULL AND " : "(%s IS NOT NULL OR ", col);
+    } else {
+        sql_append(sql, size, "(%s %c ?%d OR ", col, descending ? '<' : '>', param);
+        if (descending && keys[i]->nullable) {
+            sql_append(sql, size, "%s IS NULL OR ", col);
+        }
+        sql_append(sql, size, "%s = ?%d AND ", col, param);
+    }
+    append_after(sql, size, keys, n, i + 1, is_null, descending);
+    sql_append(sql, size, ")");
+}
+
+// Binds the volume to ?1 and, when a filter is given, a LIKE pattern to ?2.
+static void bind_filter(sqlite3_stmt *stmt, const catalog_query_t *query) {
+    sqlite3_bind_text(stmt, 1, query->volume, -1, SQLITE_STATIC);
+    if (query->filter && *query->filter) {
+        // Escape LIKE wildcards so the filter is matched literally
+        char pattern[132];
+        size_t n = 0;
+        pattern[n++] = '%';
+        for (const char *p = query->filter; *p && n < sizeof(pattern) - 3; p++) {
+            if (*p == '%' || *p == '_' || *p == '\\') pattern[n++] = '\\';
+            pattern[n++] = *p;
+        }
+        pattern[n++] = '%';
+        pattern[n] = '\0';
+        sqlite3_bind_text(stmt, 2, pattern, -1, SQLITE_TRANSIENT);
+    }
+}
+
+// NULL (not generated yet) and -1 (failed) both mean there is no thumbnail
+static int64_t column_thumb(sqlite3_stmt *stmt, int col) {
+    return sqlite3_column_type(stmt, col) == SQLITE_INTEGER ? sqlite3_column_int64(stmt, col) : -1;
+}
+
+#define FILTER_SQL " AND (name LIKE ?2 ESCAPE '\\' OR title LIKE ?2 ESCAPE '\\' OR author LIKE ?2 ESCAPE '\\')"
+
+// Where a page starts: after the row with this name, whose sort key values
+// CURSOR_SQL fetched into `values` (NULL for the first page)
+typedef struct {
+    const char *name;
+    sqlite3_stmt *values;
+    bool is_null[SORT_KEYS_MAX];
+} list_cursor_t;
+
+// Runs one pass of a listing page; `where` narrows the rows past the ones
+// chosen by volume and filter. Returns the rows visited through `rows`.
+static esp_err_t run_listing(const catalog_query_t *query, const list_cursor_t *cursor, const sort_key_t **keys,
+                             size_t n, const char *where, uint32_t limit, catalog_row_cb_t cb, void *ctx,
+                             uint32_t *rows, bool *stopped) {
+    // Descriptions are decompressed by the outer query, so only for the rows
+    // that make it into the page rather than every row the sort visits.
+    char sql[1024] = "";
+    sql_append(sql, sizeof(sql),
+               "SELECT name, size, mtime, title, author, unishox1d(description), thumb FROM ("
+               "SELECT name, size, mtime, title, author, description, thumb FROM books WHERE volume = ?1%s%s "
+               "ORDER BY ", query->filter && *query->filter ? FILTER_SQL : "", where);
+    append_order(sql, sizeof(sql), keys, n, query->descending);
+    sql_append(sql, sizeof(sql), " LIMIT %u);", (unsigned)limit);
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare listing: %s", sqlite3_errmsg(g_db));
+        return ESP_FAIL;
+    }
+    bind_filter(stmt, query);
+    if (cursor->name) {
+        for (size_t i = 0; i < n; i++) {
+            if (keys[i]->cursor_col < 0) {
+                sqlite3_bind_text(stmt, 3 + (int)i, cursor->name, -1, SQLITE_TRANSIENT);
+            } else {
+                sqlite3_bind_value(stmt, 3 + (int)i, sqlite3_column_value(cursor->values, keys[i]->cursor_col));
+            }
+        }
+    }
+
+    *rows = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        catalog_entry_t entry = {
+            .name = (const char *)sqlite3_column_text(stmt, 0),
+            .size = sqlite3_column_int64(stmt, 1),
+            .mtime = sqlite3_column_int64(stmt, 2),
+            .title = (const char *)sqlite3_column_text(stmt, 3),
+            .author = (const char *)sqlite3_column_text(stmt, 4),
+            .description = (const char *)sqlite3_column_text(stmt, 5),
+            .thumb = column_thumb(stmt, 6),
+        };
+        (*rows)++;
+        if (!cb(&entry, ctx)) {
+            *stopped = true;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return ESP_OK;
+}
+
+esp_err_t catalog_query(const catalog_query_t *query, catalog_row_cb_t cb, void *ctx) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t limit = query->limit;
+    if (limit == 0 || limit > CATALOG_QUERY_MAX_LIMIT) {
+        limit = CATALOG_QUERY_MAX_LIMIT;
+    }
+    const sort_key_t *keys[SORT_KEYS_MAX];
+    size_t n = sort_keys(query->sort, keys);
+    bool descending = query->descending;
+
+    catalog_lock();
+    list_cursor_t cursor = { .name = query->after && *query->after ? query->after : NULL };
+    if (cursor.name) {
+        if (sqlite3_prepare_v2(g_db, CURSOR_SQL, -1, &cursor.values, NULL) != SQLITE_OK) {
+            ESP_LOGE(TAG, "Failed to prepare listing cursor: %s", sqlite3_errmsg(g_db));
+            catalog_unlock();
+            return ESP_FAIL;
+        }
+        sqlite3_bind_text(cursor.values, 1, query->volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(cursor.values, 2, cursor.name, -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(cursor.values) != SQLITE_ROW) {
+            // Gone since the previous page was read; the caller starts over
+            sqlite3_finalize(cursor.values);
+            catalog_unlock();
+            return ESP_ERR_NOT_FOUND;
+        }
+        for (size_t i = 0; i < n; i++) {
+            cursor.is_null[i] = keys[i]->cursor_col >= 0 &&
+                                sqlite3_column_type(cursor.values, keys[i]->cursor_col) == SQLITE_NULL;
+        }
+    }
+
+    // The seek: a range on the leading key bounds where the index scan starts,
+    // and the full comparison then skips the rows that tie with the cursor.
+    char where[400] = "";
+    bool null_tail = false;
+    if (cursor.name) {
+        const char *col = keys[0]->column;
+        if (n == 1 || cursor.is_null[0]) {
+            sql_append(where, sizeof(where), " AND ");
+            append_after(where, sizeof(where), keys, n, 0, cursor.is_null, descending);
+        } else {
+            sql_append(where, sizeof(where), " AND %s %s ?3 AND (%s %c ?3 OR (%s = ?3 AND ",
+                       col, descending ? "<=" : ">=", col, descending ? '<' : '>', col);
+            append_after(where, sizeof(where), keys, n, 1, cursor.is_null, descending);
+            sql_append(where, sizeof(where), "))");
+            // Going down, NULLs come after every value but lie outside the
+            // range, so a second pass reads them once the range runs out
+            null_tail = descending && keys[0]->nullable;
+        }
+    }
+
+    uint32_t rows = 0, tail_rows = 0;
+    bool stopped = false;
+    esp_err_t ret = run_listing(query, &cursor, keys, n, where, limit, cb, ctx, &rows, &stopped);
+    if (ret == ESP_OK && null_tail && !stopped && rows < limit) {
+        snprintf(where, sizeof(where), " AND %s IS NULL", keys[0]->column);
+        list_cursor_t from_start = { 0 };
+        ret = run_listing(query, &from_start, keys, n, where, limit - rows, cb, ctx, &tail_rows, &stopped);
+    }
+
+    sqlite3_finalize(cursor.values);
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_count(const catalog_query_t *query, uint32_t *count) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool filtered = query->filter && *query->filter;
+    char sql[200];
+    snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM books WHERE volume = ?1%s;", filtered ? FILTER_SQL : "");
+
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        bind_filter(stmt, query);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            *count = (uint32_t)sqlite3_column_int64(stmt, 0);
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// --- Full-Text Search ---
+// Turns free text into an FTS5 query: every word becomes a quoted prefix term
+// and all terms must match. Quoting keeps user input from being parsed as FTS
+// syntax. Returns false if there is nothing to search for.
+static bool build_match_expr(const char *text, char *out, size_t out_len) {
+    size_t n = 0;
+    int terms = 0;
+    const char *p = text;
+    while (*p && terms < CATALOG_SEARCH_MAX_TERMS) {
+        // Anything that is not a letter or digit separates words; bytes of
+        // multi-byte UTF-8 characters are always part of a word.
+        while (*p && !((unsigned char)*p >= 0x80 || isalnum((unsigned char)*p))) p++;
+        const char *start = p;
+        while (*p && ((unsigned char)*p >= 0x80 || isalnum((unsigned char)*p))) p++;
+        size_t len = p - start;
+        if (len == 0) {
+            break;
+        }
+        // Room for the separator, two quotes, '*' and the terminator
+        if (n + len + 5 > out_len) {
+            break;
+        }
+        if (terms > 0) out[n++] = ' ';
+        out[n++] = '"';
+        memcpy(out + n, start, len);
+        n += len;
+        out[n++] = '"';
+        out[n++] = '*';
+        terms++;
+    }
+    out[n] = '\0';
+    return terms > 0;
+}
+
+// Aborts a search that has run for too many VM steps. Returning non-zero
+// interrupts the statement, so a pathological query cannot hold the catalog
+// lock (and the httpd task) for long.
+static int search_budget_cb(void *ctx) {
+    int *remaining = ctx;
+    return --(*remaining) <= 0;
+}
+
+// One row by id, with the columns catalog_search() returns
+static const char *ROW_BY_ID_SQL =
+    "SELECT name, size, mtime, title, author, volume, unishox1d(description), thumb FROM books WHERE id = ?1;";
+
+// Title matches weigh most, then authors, then descriptions.
+#define SEARCH_RANK "bm25(books_fts, 10.0, 5.0, 1.0)"
+#define SEARCH_VOLUME_SQL " AND b.volume = ?2"
+// Benchmark rows are only found by searching their volume explicitly
+#define SEARCH_ALL_VOLUMES_SQL " AND b.volume <> '" CATALOG_VOLUME_BENCH "'"
+
+static uint32_t search_limit(const catalog_search_t *search) {
+    if (search->limit == 0 || search->limit > CATALOG_SEARCH_MAX_LIMIT) {
+        return CATALOG_SEARCH_MAX_LIMIT;
+    }
+    return search->limit;
+}
+
+// Binds the match expression to ?1 and the optional volume to ?2.
+static void bind_search(sqlite3_stmt *stmt, const char *match, const catalog_search_t *search) {
+    sqlite3_bind_text(stmt, 1, match, -1, SQLITE_STATIC);
+    if (search->volume) {
+        sqlite3_bind_text(stmt, 2, search->volume, -1, SQLITE_STATIC);
+    }
+}
+
+esp_err_t catalog_search(const catalog_search_t *search, catalog_row_cb_t cb, void *ctx) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char match[CATALOG_SEARCH_MAX_QUERY * 2];
+    if (!search->text || !build_match_expr(search->text, match, sizeof(match))) {
+        return ESP_OK;
+    }
+
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "SELECT name, size, mtime, title, author, volume, unishox1d(description), thumb FROM ("
+             "SELECT b.name, b.size, b.mtime, b.title, b.author, b.volume, b.description, b.thumb "
+             "FROM books_fts f JOIN books b ON b.id = f.rowid "
+             "WHERE books_fts MATCH ?1%s ORDER BY " SEARCH_RANK " LIMIT %u OFFSET %u);",
+             search->volume ? SEARCH_VOLUME_SQL : SEARCH_ALL_VOLUMES_SQL, (unsigned)search_limit(search),
+             (unsigned)search->offset);
+
+    catalog_lock();
+    esp_err_t ret = ESP_OK;
+    int budget = CATALOG_SEARCH_MAX_STEPS;
+    sqlite3_progress_handler(g_db, CATALOG_SEARCH_STEP_INTERVAL, search_budget_cb, &budget);
+
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare search: %s", sqlite3_errmsg(g_db));
+        ret = ESP_FAIL;
+    } else {
+        bind_search(stmt, match, search);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            catalog_entry_t entry = {
+                .name = (const char *)sqlite3_column_text(stmt, 0),
+                .size = sqlite3_column_int64(stmt, 1),
+                .mtime = sqlite3_column_int64(stmt, 2),
+                .title = (const char *)sqlite3_column_text(stmt, 3),
+                .author = (const char *)sqlite3_column_text(stmt, 4),
+                .volume = (const char *)sqlite3_column_text(stmt, 5),
+                .description = (const char *)sqlite3_column_text(stmt, 6),
+                .thumb = column_thumb(stmt, 7),
+            };
+            if (!cb(&entry, ctx)) {
+                break;
+            }
+        }
+        if (rc == SQLITE_INTERRUPT) {
+            ESP_LOGW(TAG, "Search for '%s' exceeded its budget", search->text);
+            ret = ESP_ERR_TIMEOUT;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    sqlite3_progress_handler(g_db, 0, NULL, NULL);
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_search_count(const catalog_search_t *search, uint32_t *count) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *count = 0;
+    char match[CATALOG_SEARCH_MAX_QUERY * 2];
+    if (!search->text || !build_match_expr(search->text, match, sizeof(match))) {
+        return ESP_OK;
+    }
+
+    char sql[160];
+    snprintf(sql, sizeof(sql),
+             "SELECT COUNT(*) FROM books_fts f JOIN books b ON b.id = f.rowid WHERE books_fts MATCH ?1%s;",
+             search->volume ? SEARCH_VOLUME_SQL : SEARCH_ALL_VOLUMES_SQL);
+
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    int budget = CATALOG_SEARCH_MAX_STEPS;
+    sqlite3_progress_handler(g_db, CATALOG_SEARCH_STEP_INTERVAL, search_budget_cb, &budget);
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        bind_search(stmt, match, search);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            *count = (uint32_t)sqlite3_column_int64(stmt, 0);
+            ret = ESP_OK;
+        } else if (rc == SQLITE_INTERRUPT) {
+            ret = ESP_ERR_TIMEOUT;
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_progress_handler(g_db, 0, NULL, NULL);
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_search_ids(const catalog_search_t *search, int64_t *ids, uint32_t *count) {
+    *count = 0;
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char match[CATALOG_SEARCH_MAX_QUERY * 2];
+    if (!search->text || !build_match_expr(search->text, match, sizeof(match))) {
+        return ESP_OK;
+    }
+
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "SELECT b.id FROM books_fts f JOIN books b ON b.id = f.rowid "
+             "WHERE books_fts MATCH ?1%s ORDER BY " SEARCH_RANK " LIMIT %u OFFSET %u;",
+             search->volume ? SEARCH_VOLUME_SQL : SEARCH_ALL_VOLUMES_SQL, (unsigned)search_limit(search),
+             (unsigned)search->offset);
+
+    catalog_lock();
+    esp_err_t ret = ESP_OK;
+    int budget = CATALOG_SEARCH_MAX_STEPS;
+    sqlite3_progress_handler(g_db, CATALOG_SEARCH_STEP_INTERVAL, search_budget_cb, &budget);
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare search: %s", sqlite3_errmsg(g_db));
+        ret = ESP_FAIL;
+    } else {
+        bind_search(stmt, match, search);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            ids[(*count)++] = sqlite3_column_int64(stmt, 0);
+        }
+        if (rc == SQLITE_INTERRUPT) {
+            ESP_LOGW(TAG, "Search for '%s' exceeded its budget", search->text);
+            ret = ESP_ERR_TIMEOUT;
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_progress_handler(g_db, 0, NULL, NULL);
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_get_rows(const int64_t *ids, uint32_t count, catalog_row_cb_t cb, void *ctx, uint32_t *used) {
+    *used = 0;
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_OK;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(g_db, ROW_BY_ID_SQL, -1, &stmt, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare row lookup: %s", sqlite3_errmsg(g_db));
+        ret = ESP_FAIL;
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            sqlite3_bind_int64(stmt, 1, ids[i]);
+            // A row removed since its id was taken is skipped
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                catalog_entry_t entry = {
+                    .name = (const char *)sqlite3_column_text(stmt, 0),
+                    .size = sqlite3_column_int64(stmt, 1),
+                    .mtime = sqlite3_column_int64(stmt, 2),
+                    .title = (const char *)sqlite3_column_text(stmt, 3),
+                    .author = (const char *)sqlite3_column_text(stmt, 4),
+                    .volume = (const char *)sqlite3_column_text(stmt, 5),
+                    .description = (const char *)sqlite3_column_text(stmt, 6),
+                    .thumb = column_thumb(stmt, 7),
+                };
+                if (!cb(&entry, ctx)) {
+                    break;
+                }
+            }
+            sqlite3_reset(stmt);
+            (*used)++;
+        }
+    }
+    sqlite3_finalize(stmt);
+    catalog_unlock();
+    return ret;
+}
+
+// --- Thumbnails ---
+esp_err_t catalog_next_thumbnail_job(const char *volume, int64_t after_id, catalog_thumb_job_t *job) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "SELECT id, name, mtime, cover FROM books INDEXED BY books_needing_thumb "
+                                 "WHERE volume = ?1 AND thumb IS NULL AND cover IS NOT NULL AND id > ?2 "
+                                 "ORDER BY id LIMIT 1;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, after_id);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            job->id = sqlite3_column_int64(stmt, 0);
+            strlcpy(job->name, (const char *)sqlite3_column_text(stmt, 1), sizeof(job->name));
+            job->mtime = sqlite3_column_int64(stmt, 2);
+            strlcpy(job->cover, (const char *)sqlite3_column_text(stmt, 3), sizeof(job->cover));
+            ret = ESP_OK;
+        } else if (rc == SQLITE_DONE) {
+            ret = ESP_ERR_NOT_FOUND;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_set_thumbnail(const catalog_thumb_job_t *job, int64_t key) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    // Matching mtime skips the update if the book was replaced meanwhile; the
+    // new row is back to NULL and will be picked up again.
+    if (sqlite3_prepare_v2(g_db, "UPDATE books SET thumb = ?3 WHERE id = ?1 AND mtime = ?2;", -1, &stmt, NULL) ==
+        SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, job->id);
+        sqlite3_bind_int64(stmt, 2, job->mtime);
+        sqlite3_bind_int64(stmt, 3, key);
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// --- Content Hashes ---
+esp_err_t catalog_next_hash_job(const char *volume, catalog_hash_job_t *job) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "SELECT id, name, size, mtime FROM books INDEXED BY books_needing_hash "
+                                 "WHERE volume = ?1 AND hash IS NULL AND alias_of IS NULL LIMIT 1;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            job->id = sqlite3_column_int64(stmt, 0);
+            strlcpy(job->name, (const char *)sqlite3_column_text(stmt, 1), sizeof(job->name));
+            job->size = sqlite3_column_int64(stmt, 2);
+            job->mtime = sqlite3_column_int64(stmt, 3);
+            ret = ESP_OK;
+        } else if (rc == SQLITE_DONE) {
+            ret = ESP_ERR_NOT_FOUND;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_set_hash(const catalog_hash_job_t *job, const uint8_t *hash) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    // Like thumbnails: a book replaced while it was hashed keeps its NULL
+    if (sqlite3_prepare_v2(g_db, "UPDATE books SET hash = ?4 WHERE id = ?1 AND size = ?2 AND mtime = ?3;", -1,
+                           &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, job->id);
+        sqlite3_bind_int64(stmt, 2, job->size);
+        sqlite3_bind_int64(stmt, 3, job->mtime);
+        if (hash) {
+            sqlite3_bind_blob(stmt, 4, hash, CATALOG_HASH_SIZE, SQLITE_STATIC);
+        } else {
+            sqlite3_bind_zeroblob(stmt, 4, 0);
+        }
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_count_unhashed(const char *volume, uint32_t *count) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "SELECT COUNT(*) FROM books INDEXED BY books_needing_hash "
+                                 "WHERE volume = ?1 AND hash IS NULL AND alias_of IS NULL;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            *count = (uint32_t)sqlite3_column_int64(stmt, 0);
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// Runs a statement that yields a single name and copies it into `out`.
+// Must be called with the lock held.
+static esp_err_t step_name(sqlite3_stmt *stmt, char *out, size_t out_size) {
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        strlcpy(out, (const char *)sqlite3_column_text(stmt, 0), out_size);
+        return ESP_OK;
+    }
+    return rc == SQLITE_DONE ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+}
+
+esp_err_t catalog_copy_hash(const char *src_volume, const char *dst_volume, const char *name) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db,
+                           "UPDATE books SET hash = s.hash FROM "
+                           "(SELECT hash, size FROM books WHERE volume = ?1 AND name = ?3 AND length(hash) > 0) AS s "
+                           "WHERE books.volume = ?2 AND books.name = ?3 AND books.alias_of IS NULL "
+                           "AND books.size = s.size AND books.hash IS NULL;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, src_volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, dst_volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_find_content(const char *src_volume, const char *name, const char *dst_volume,
+                               char *existing, size_t existing_size) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    // Prefer a real file over an alias, so the caller can check it on disk
+    if (sqlite3_prepare_v2(g_db,
+                           "SELECT d.name FROM books s JOIN books d ON d.volume = ?3 AND d.hash = s.hash "
+                           "WHERE s.volume = ?1 AND s.name = ?2 AND length(s.hash) > 0 "
+                           "ORDER BY d.alias_of IS NOT NULL LIMIT 1;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, src_volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, dst_volume, -1, SQLITE_STATIC);
+        ret = step_name(stmt, existing, existing_size);
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_resolve_name(const char *volume, const char *name, char *file, size_t file_size) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, "SELECT COALESCE(alias_of, name) FROM books WHERE volume = ?1 AND name = ?2;", -1,
+                           &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        ret = step_name(stmt, file, file_size);
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// Every file whose content is also in another file on the volume, grouped by
+// hash and oldest row first within a group
+static const char *DUPLICATES_SQL =
+    "SELECT name, size, hash FROM books "
+    "WHERE volume = ?1 AND alias_of IS NULL AND hash IN ("
+    "  SELECT hash FROM books WHERE volume = ?1 AND alias_of IS NULL AND length(hash) > 0"
+    "  GROUP BY hash HAVING COUNT(*) > 1) "
+    "ORDER BY hash, id;";
+
+esp_err_t catalog_query_duplicates(const char *volume, catalog_duplicate_cb_t cb, void *ctx) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, DUPLICATES_SQL, -1, &stmt, NULL) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Failed to prepare duplicates query: %s", sqlite3_errmsg(g_db));
+        catalog_unlock();
+        return ESP_FAIL;
+    }
+    sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+
+    uint8_t last[CATALOG_HASH_SIZE];
+    catalog_duplicate_t dup = { .group = 0 };
+    bool first = true;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const void *hash = sqlite3_column_blob(stmt, 2);
+        if (sqlite3_column_bytes(stmt, 2) != CATALOG_HASH_SIZE) {
+            continue;
+        }
+        dup.keep = first || memcmp(hash, last, CATALOG_HASH_SIZE) != 0;
+        if (dup.keep && !first) {
+            dup.group++;
+        }
+        first = false;
+        memcpy(last, hash, CATALOG_HASH_SIZE);
+        dup.name = (const char *)sqlite3_column_text(stmt, 0);
+        dup.size = sqlite3_column_int64(stmt, 1);
+        if (!cb(&dup, ctx)) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    catalog_unlock();
+    return rc == SQLITE_DONE ? ESP_OK : ESP_FAIL;
+}
+
+// The next redundant file on the volume, with the oldest file of the same
+// content, which is the one that is kept
+static const char *MERGE_NEXT_SQL =
+    "SELECT d.id, d.name, d.size, d.mtime, k.id, k.name, k.size, k.mtime, d.hash FROM books d JOIN books k "
+    "  ON k.id = (SELECT MIN(id) FROM books WHERE volume = d.volume AND hash = d.hash AND alias_of IS NULL) "
+    "WHERE d.volume = ?1 AND d.alias_of IS NULL AND length(d.hash) = ?2 AND d.id <> k.id LIMIT 1;";
+
+// Only if neither row changed since the pair was picked
+static const char *MERGE_ALIAS_SQL =
+    "UPDATE books SET alias_of = ?2, cover = NULL, "
+    "  thumb = COALESCE(thumb, (SELECT thumb FROM books WHERE id = ?3)) "
+    "WHERE id = ?1 AND size = ?4 AND mtime = ?5 AND alias_of IS NULL "
+    "  AND hash = (SELECT hash FROM books WHERE id = ?3 AND name = ?2 AND alias_of IS NULL);";
+
+typedef struct {
+    int64_t dup_id, dup_size, dup_mtime;
+    int64_t keep_id, keep_size, keep_mtime;
+    char dup_name[128];
+    char keep_name[128];
+    uint8_t hash[CATALOG_HASH_SIZE];
+} merge_pair_t;
+
+// True if the file at `dir_path`/`name` is still the one the row describes
+static bool file_matches(const char *dir_path, const char *name, int64_t size, int64_t mtime) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir_path, name);
+    struct stat st;
+    return stat(path, &st) == 0 && st.st_size == size && st.st_mtime == mtime;
+}
+
+// Runs one statement on a row id under the lock
+static esp_err_t merge_exec_id(const char *sql, int64_t id) {
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, id);
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            ret = ESP_OK;
+        }
+        sqlite3_finalize(stmt);
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// Picks the next pair to merge. Returns ESP_ERR_NOT_FOUND when there is none.
+static esp_err_t merge_next(const char *volume, merge_pair_t *pair) {
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, MERGE_NEXT_SQL, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, CATALOG_HASH_SIZE);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            pair->dup_id = sqlite3_column_int64(stmt, 0);
+            strlcpy(pair->dup_name, (const char *)sqlite3_column_text(stmt, 1), sizeof(pair->dup_name));
+            pair->dup_size = sqlite3_column_int64(stmt, 2);
+            pair->dup_mtime = sqlite3_column_int64(stmt, 3);
+            pair->keep_id = sqlite3_column_int64(stmt, 4);
+            strlcpy(pair->keep_name, (const char *)sqlite3_column_text(stmt, 5), sizeof(pair->keep_name));
+            pair->keep_size = sqlite3_column_int64(stmt, 6);
+            pair->keep_mtime = sqlite3_column_int64(stmt, 7);
+            memcpy(pair->hash, sqlite3_column_blob(stmt, 8), CATALOG_HASH_SIZE);
+            ret = ESP_OK;
+        } else if (rc == SQLITE_DONE) {
+            ret = ESP_ERR_NOT_FOUND;
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (ret == ESP_FAIL) {
+        ESP_LOGE(TAG, "Failed to find duplicates: %s", sqlite3_errmsg(g_db));
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// Turns the duplicate's row into an alias and records it in the manifest, so
+// its name survives the file. Returns ESP_ERR_INVALID_STATE if either row
+// changed since merge_next().
+static esp_err_t merge_alias(const char *volume, const merge_pair_t *pair) {
+    catalog_lock();
+    esp_err_t ret = ESP_FAIL;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(g_db, MERGE_ALIAS_SQL, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, pair->dup_id);
+        sqlite3_bind_text(stmt, 2, pair->keep_name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 3, pair->keep_id);
+        sqlite3_bind_int64(stmt, 4, pair->dup_size);
+        sqlite3_bind_int64(stmt, 5, pair->dup_mtime);
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            ret = sqlite3_changes(g_db) == 1 ? ESP_OK : ESP_ERR_INVALID_STATE;
+        } else {
+            ESP_LOGE(TAG, "Failed to alias %s: %s", pair->dup_name, sqlite3_errmsg(g_db));
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (ret == ESP_OK && aliases_append(volume, pair->dup_name, pair->keep_name, pair->dup_size, pair->hash) != ESP_OK) {
+        // Without the manifest line the name could be lost, so keep the file
+        ret = ESP_FAIL;
+    }
+    catalog_unlock();
+    return ret;
+}
+
+// A cleared mtime makes the next sync parse the file again and restore its
+// cover and hash. The manifest line left behind is ignored while the file exists.
+static const char *MERGE_UNALIAS_SQL = "UPDATE books SET alias_of = NULL, mtime = 0 WHERE id = ?1;";
+
+esp_err_t catalog_merge_duplicates(const char *volume, const char *dir_path, catalog_merge_stats_t *stats) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(stats, 0, sizeof(*stats));
+    merge_pair_t pair;
+    esp_err_t ret;
+    // One pair per locked step; the files are checked and removed without the lock
+    while ((ret = merge_next(volume, &pair)) == ESP_OK) {
+        // Never delete anything on the strength of a stale hash: a file
+        // changed since it was hashed goes back to be hashed again
+        int64_t stale_id = -1;
+        if (!file_matches(dir_path, pair.keep_name, pair.keep_size, pair.keep_mtime)) {
+            stale_id = pair.keep_id;
+        } else if (!file_matches(dir_path, pair.dup_name, pair.dup_size, pair.dup_mtime)) {
+            stale_id = pair.dup_id;
+        }
+        if (stale_id >= 0) {
+            if (merge_exec_id("UPDATE books SET hash = NULL WHERE id = ?1;", stale_id) != ESP_OK) {
+                ret = ESP_FAIL;
+                break;
+            }
+            stats->stale++;
+            continue;
+        }
+
+        ret = merge_alias(volume, &pair);
+        if (ret == ESP_ERR_INVALID_STATE) {
+            // Re-synced meanwhile; its hash is NULL again until it is rehashed
+            stats->stale++;
+            continue;
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, pair.dup_name);
+        if (remove(path) != 0) {
+            ESP_LOGE(TAG, "Failed to remove duplicate %s", path);
+            merge_exec_id(MERGE_UNALIAS_SQL, pair.dup_id);
+            ret = ESP_FAIL;
+            break;
+        }
+        ESP_LOGI(TAG, "Merged %s into %s", pair.dup_name, pair.keep_name);
+        stats->merged++;
+        stats->bytes_freed += pair.dup_size;
+    }
+    return ret == ESP_ERR_NOT_FOUND ? ESP_OK : ret;
+}
+
+// --- Compression Benchmark ---
+// Words the synthetic descriptions are built from, roughly the vocabulary of
+// a publisher's blurb so the compression ratio is representative.
+static const char *const BENCH_WORDS[] = {
+    "the", "a", "of", "and", "to", "in", "her", "his", "their", "new",
+    "novel", "story", "world", "life", "family", "love", "war", "secret", "journey", "young",
+    "city", "years", "must", "when", "before", "after", "discovers", "finds", "dark", "lost",
+    "history", "author", "bestselling", "award", "winning", "mystery", "house", "friends", "past", "future",
+    "captivating", "unforgettable", "powerful", "reader", "between", "everything", "nothing", "against", "truth", "home",
+};
+#define BENCH_WORD_COUNT (sizeof(BENCH_WORDS) / sizeof(BENCH_WORDS[0]))
+
+// Small LCG so every run (and every firmware build) sees the same library.
+static uint32_t bench_rand(uint32_t *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 16;
+}
+
+// Writes a few sentences of 300-480 characters into `out`.
+static void bench_description(uint32_t *state, char *out, size_t out_len) {
+    size_t target = 300 + bench_rand(state) % 180;
+    if (target >= out_len) target = out_len - 1;
+    size_t n = 0;
+    bool sentence_start = true;
+    while (n < target) {
+        const char *word = BENCH_WORDS[bench_rand(state) % BENCH_WORD_COUNT];
+        size_t len = strlen(word);
+        if (n + len + 2 >= target) {
+            break;
+        }
+        if (n > 0) out[n++] = ' ';
+        memcpy(out + n, word, len);
+        if (sentence_start) out[n] = toupper((unsigned char)out[n]);
+        n += len;
+        sentence_start = bench_rand(state) % 12 == 0;
+        if (sentence_start) out[n++] = '.';
+    }
+    out[n++] = '.';
+    out[n] = '\0';
+}
+
+// Lets the live catalog in between two steps of a benchmark. The scratch
+// connection is only touched by the benchmark, so its statements and open
+// transaction can wait out the gap.
+static void bench_yield(void) {
+    catalog_unlock();
+    vTaskDelay(1);
+    catalog_lock();
+}
+
+// Builds the sample library in a fresh database at `path` and times a full
+// walk through it one listing page at a time. Takes the catalog lock per
+// step, never for the whole run, so listings go on meanwhile.
+static esp_err_t bench_run(const char *path, bool compressed, uint32_t books, catalog_bench_mode_t *out) {
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    esp_err_t ret = ESP_FAIL;
+    char sql[320];
+
+    catalog_lock();
+    remove(path);
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        ESP_LOGE(TAG, "Can't open benchmark database %s", path);
+        goto cleanup;
+    }
+    sqlite3_exec(db, "PRAGMA journal_mode=MEMORY;", NULL, NULL, NULL);
+    if (sqlite3_exec(db, "CREATE TABLE books (id INTEGER PRIMARY KEY, name TEXT, size INTEGER, mtime INTEGER,"
+                         " title TEXT, author TEXT, description BLOB);"
+                         "CREATE INDEX books_by_title ON books (title COLLATE NOCASE, name);", NULL, NULL, NULL) != SQLITE_OK) {
+        goto cleanup;
+    }
+
+    snprintf(sql, sizeof(sql), "INSERT INTO books (name, size, mtime, title, author, description) VALUES (?1, ?2, ?3, ?4, ?5, %s);",
+             compressed ? "unishox1c(?6)" : "?6");
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        goto cleanup;
+    }
+    uint32_t seed = 1;
+    int64_t start = esp_timer_get_time();
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    for (uint32_t i = 0; i < books; i++) {
+        if (i > 0 && i % CATALOG_BENCH_PAGE_SIZE == 0) {
+            bench_yield();
+        }
+        char name[20], title[48], description[EPUB_META_DESC_MAX];
+        snprintf(name, sizeof(name), "B%05u.EPUB", (unsigned)i);
+        snprintf(title, sizeof(title), "The %s %s", BENCH_WORDS[bench_rand(&seed) % BENCH_WORD_COUNT],
+                 BENCH_WORDS[bench_rand(&seed) % BENCH_WORD_COUNT]);
+        bench_description(&seed, description, sizeof(description));
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, 100000 + bench_rand(&seed) * 16);
+        sqlite3_bind_int64(stmt, 3, 1600000000 + i);
+        sqlite3_bind_text(stmt, 4, title, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 5, "Sample Author", -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 6, description, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            goto cleanup;
+        }
+    }
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    out->insert_us = esp_timer_get_time() - start;
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+
+    if (sqlite3_prepare_v2(db, "SELECT COALESCE(SUM(length(description)), 0) FROM books;", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        out->text_bytes = (uint32_t)sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    bench_yield();
+
+    // Reopen so the page walk starts from a cold cache, as a listing would
+    sqlite3_close(db);
+    db = NULL;
+    struct stat st;
+    out->db_bytes = stat(path, &st) == 0 ? (uint32_t)st.st_size : 0;
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        goto cleanup;
+    }
+
+    // Same shape as catalog_query(): seek and page first, then decode. The
+    // sample titles are never NULL, so the first page seeks past ('', '').
+    snprintf(sql, sizeof(sql),
+             "SELECT name, size, mtime, title, author, %s FROM ("
+             "SELECT * FROM books WHERE title COLLATE NOCASE >= ?1 "
+             "AND (title COLLATE NOCASE > ?1 OR (title COLLATE NOCASE = ?1 AND name > ?2)) "
+             "ORDER BY title COLLATE NOCASE, name LIMIT ?3);",
+             compressed ? "unishox1d(description)" : "description");
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        goto cleanup;
+    }
+    uint32_t pages = 0, rows;
+    size_t checksum = 0;
+    char last_title[64] = "", last_name[32] = "";
+    start = esp_timer_get_time();
+    do {
+        if (pages > 0) {
+            bench_yield();
+        }
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, last_title, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, last_name, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 3, CATALOG_BENCH_PAGE_SIZE);
+        rows = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char *text = sqlite3_column_text(stmt, 5);
+            checksum += text ? text[0] : 0;
+            strlcpy(last_name, (const char *)sqlite3_column_text(stmt, 0), sizeof(last_name));
+            strlcpy(last_title, (const char *)sqlite3_column_text(stmt, 3), sizeof(last_title));
+            rows++;
+        }
+        if (rows > 0) pages++;
+    } while (rows == CATALOG_BENCH_PAGE_SIZE);
+    out->page_us = pages ? (esp_timer_get_time() - start) / pages : 0;
+    ESP_LOGD(TAG, "Benchmark walk checksum %u", (unsigned)checksum);
+    ret = ESP_OK;
+
+cleanup:
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    remove(path);
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_bench_compression(const char *scratch_path, uint32_t books, catalog_bench_result_t *out) {
+    if (books == 0 || books > CATALOG_BENCH_MAX_BOOKS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(out, 0, sizeof(*out));
+    out->books = books;
+
+    esp_err_t ret = bench_run(scratch_path, false, books, &out->plain);
+    if (ret == ESP_OK) {
+        ret = bench_run(scratch_path, true, books, &out->compressed);
+    }
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Compression benchmark, %u books: %u -> %u bytes on disk, %lld -> %lld us per page",
+                 (unsigned)books, (unsigned)out->plain.db_bytes, (unsigned)out->compressed.db_bytes,
+                 (long long)out->plain.page_us, (long long)out->compressed.page_us);
+    }
+    return ret;
+}
+
+// --- Benchmark Library ---
+esp_err_t catalog_bench_populate(const char *volume, uint32_t books) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (books == 0 || books > CATALOG_BENCH_MAX_BOOKS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    catalog_bench_clear(volume);
+
+    catalog_lock();
+    sqlite3_stmt *stmt = NULL;
+    esp_err_t ret = ESP_FAIL;
+    if (sqlite3_prepare_v2(g_db,
+                           "INSERT INTO books (volume, name, size, mtime, title, author, description, seen)"
+                           " VALUES (?1, ?2, ?3, ?4, ?5, ?6, unishox1c(?7), 1);",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        catalog_unlock();
+        return ESP_FAIL;
+    }
+    uint32_t seed = 1;
+    exec_sql("BEGIN;");
+    uint32_t i;
+    for (i = 0; i < books; i++) {
+        char name[16], title[48], author[32], description[EPUB_META_DESC_MAX];
+        snprintf(name, sizeof(name), "B%05u.EPUB", (unsigned)i);
+        snprintf(title, sizeof(title), "The %s %s", BENCH_WORDS[bench_rand(&seed) % BENCH_WORD_COUNT],
+                 BENCH_WORDS[bench_rand(&seed) % BENCH_WORD_COUNT]);
+        snprintf(author, sizeof(author), "Author %u", (unsigned)(bench_rand(&seed) % 97));
+        bench_description(&seed, description, sizeof(description));
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 3, 100000 + bench_rand(&seed) * 16);
+        sqlite3_bind_int64(stmt, 4, 1600000000 + i);
+        sqlite3_bind_text(stmt, 5, title, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 6, author, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 7, description, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (i == books && exec_sql("COMMIT;") == ESP_OK) {
+        ret = ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Failed to add benchmark books: %s", sqlite3_errmsg(g_db));
+        exec_sql("ROLLBACK;");
+    }
+    catalog_unlock();
+    return ret;
+}
+
+esp_err_t catalog_bench_clear(const char *volume) {
+    if (!g_db) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    catalog_lock();
+    sqlite3_stmt *stmt = NULL;
+    esp_err_t ret = ESP_FAIL;
+    if (sqlite3_prepare_v2(g_db, "DELETE FROM books WHERE volume = ?1;", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, volume, -1, SQLITE_STATIC);
+        ret = sqlite3_step(stmt) == SQLITE_DONE ? ESP_OK : ESP_FAIL;
+    }
+    sqlite3_finalize(stmt);
+    catalog_unlock();
+    return ret;
+}
@@ -0,0 +1,275 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "epub_meta.h"
+
+// Volume names used as the catalog key prefix. They match the `type`
+// parameter accepted by /list-files.
+#define CATALOG_VOLUME_SD  "sd"
+#define CATALOG_VOLUME_USB "usb"
+
+typedef struct {
+    const char *name;
+    const char *volume;     // Only set by catalog_search()
+    int64_t size;
+    int64_t mtime;
+    const char *title;
+    const char *author;
+    const char *description;    // Plain text, NULL if the book has none
+    int64_t thumb;              // Thumbnail cache key, -1 if there is none
+} catalog_entry_t;
+
+// Called once per row by catalog_query(). Return false to stop iterating.
+typedef bool (*catalog_row_cb_t)(const catalog_entry_t *entry, void *ctx);
+
+typedef enum {
+    CATALOG_SORT_NAME,
+    CATALOG_SORT_TITLE,
+    CATALOG_SORT_AUTHOR,
+    CATALOG_SORT_SIZE,
+    CATALOG_SORT_MTIME,
+} catalog_sort_t;
+
+// Upper bound on rows returned by a single query, regardless of `limit`.
+#define CATALOG_QUERY_MAX_LIMIT 200
+
+typedef struct {
+    const char *volume;
+    const char *filter;     // Substring matched against name, title and author; NULL for all rows
+    catalog_sort_t sort;
+    bool descending;
+    const char *after;      // Name of the last row of the previous page; NULL for the first page
+    uint32_t limit;         // 0 or anything above CATALOG_QUERY_MAX_LIMIT is clamped
+} catalog_query_t;
+
+// Opens (or creates) the catalog database. The schema is recreated if it
+// was written by an incompatible firmware version. Aliases left by
+// catalog_merge_duplicates() are kept in the manifest at `aliases_path` as
+// well, and imported from it here; NULL keeps them in the database only.
+esp_err_t catalog_open(const char *db_path, const char *aliases_path);
+void catalog_close(void);
+
+// Sets the page cache of the catalog connection, in KiB.
+esp_err_t catalog_set_cache_size(uint32_t kib);
+
+// Returns true if the given filename has one of the supported e-book extensions.
+bool catalog_is_book_file(const char *name);
+
+// Incremental sync of one volume. The caller walks the directory and reports
+// every book file; each call to catalog_sync_file() joins the current batch,
+// and catalog_sync_yield() commits it and releases the catalog lock so other
+// tasks can use the catalog between batches.
+typedef struct catalog_sync catalog_sync_t;
+
+typedef struct {
+    uint32_t parsed;        // New or changed files that were opened
+    uint32_t unchanged;     // Files whose size and mtime matched
+    uint32_t removed;       // Rows dropped because the file is gone
+} catalog_sync_stats_t;
+
+esp_err_t catalog_sync_begin(const char *volume, catalog_sync_t **sync);
+
+// Records one file seen in `dir_path`. It is only opened and parsed if its
+// size or mtime differ from the stored row; `parsed` (optional) says which.
+esp_err_t catalog_sync_file(catalog_sync_t *sync, const char *dir_path, const char *name, int64_t size, int64_t mtime,
+                            bool *parsed);
+
+// Commits the work done so far and releases the catalog lock.
+esp_err_t catalog_sync_yield(catalog_sync_t *sync);
+
+// Ends the sync and frees `sync`. If `complete`, rows for files that were not
+// reported are removed. `stats` may be NULL.
+esp_err_t catalog_sync_finish(catalog_sync_t *sync, bool complete, catalog_sync_stats_t *stats);
+
+// Re-indexes a single file, e.g. after it was written by a transfer.
+esp_err_t catalog_update_file(const char *volume, const char *dir_path, const char *name);
+
+// Called by catalog_import_calibre() before the first batch, after every
+// batch and once at the end, without the catalog lock held. Return false to
+// stop the import, e.g. because the volume is about to be unmounted.
+typedef bool (*catalog_import_progress_cb_t)(uint32_t done, uint32_t total, void *ctx);
+
+// Rows committed per transaction; the catalog lock is released between batches
+#define CATALOG_IMPORT_BATCH_ROWS 50
+
+// Copies title/author for every book in a Calibre metadata.db into the catalog,
+// CATALOG_IMPORT_BATCH_ROWS at a time. Books on `volume` whose filename matches
+// a Calibre entry use that metadata instead of being parsed. Runs for as long as
+// the library is large, so call it from a background task. Returns
+// ESP_ERR_INVALID_STATE if `progress` stopped it; the batches committed by
+// then are kept until the next import replaces them.
+esp_err_t catalog_import_calibre(const char *volume, const char *calibre_db_path,
+                                 catalog_import_progress_cb_t progress, void *ctx);
+
+// Parses a sort key such as "title" or "-mtime" (leading '-' for descending).
+// Unknown keys fall back to sorting by filename.
+void catalog_parse_sort(const char *key, catalog_sort_t *sort, bool *descending);
+
+// Runs one page of a listing. `cb` is invoked for each row on the caller's
+// task while the catalog lock is held, so it should not block for long.
+// Pages seek past `after` on the index rather than skipping rows, so a deep
+// page costs the same as the first. Returns ESP_ERR_NOT_FOUND if the `after`
+// row has been removed since; start again from the first page.
+esp_err_t catalog_query(const catalog_query_t *query, catalog_row_cb_t cb, void *ctx);
+
+// Number of rows matching `query`, ignoring after/limit.
+esp_err_t catalog_count(const catalog_query_t *query, uint32_t *count);
+
+// Bounds on a full-text search: result page size, words taken from the query
+// and query length, and the SQLite VM steps (checked every STEP_INTERVAL
+// instructions) after which a search is abandoned.
+#define CATALOG_SEARCH_MAX_LIMIT      50
+#define CATALOG_SEARCH_MAX_TERMS      8
+#define CATALOG_SEARCH_MAX_QUERY      96
+#define CATALOG_SEARCH_STEP_INTERVAL  1000
+#define CATALOG_SEARCH_MAX_STEPS      2000
+
+typedef struct {
+    const char *text;       // Free text; each word is matched as a prefix
+    const char *volume;     // NULL to search every volume
+    uint32_t offset;
+    uint32_t limit;         // 0 or anything above CATALOG_SEARCH_MAX_LIMIT is clamped
+} catalog_search_t;
+
+// Ranked full-text search over title, author and description. Rows are
+// passed to `cb` best match first, with the catalog lock held.
+// Returns ESP_ERR_TIMEOUT if the search was cut short by its step budget.
+esp_err_t catalog_search(const catalog_search_t *search, catalog_row_cb_t cb, void *ctx);
+
+// Number of rows matching `search`, ignoring offset/limit.
+esp_err_t catalog_search_count(const catalog_search_t *search, uint32_t *count);
+
+// Ids of the page of rows catalog_search() would return, in the same order,
+// into `ids` (room for CATALOG_SEARCH_MAX_LIMIT). Ranking takes most of a
+// search, so a page can then be read in batches with catalog_get_rows().
+// Returns ESP_ERR_TIMEOUT, with the ids found so far, if cut short.
+esp_err_t catalog_search_ids(const catalog_search_t *search, int64_t *ids, uint32_t *count);
+
+// Passes the rows with the given ids to `cb` in that order, with the catalog
+// lock held. Ids of rows removed since are skipped. `used` is the number of
+// ids dealt with: all of them, or those before the row `cb` stopped at.
+esp_err_t catalog_get_rows(const int64_t *ids, uint32_t count, catalog_row_cb_t cb, void *ctx, uint32_t *used);
+
+// A book whose cover still needs a thumbnail.
+typedef struct {
+    int64_t id;
+    int64_t mtime;
+    char name[128];
+    char cover[EPUB_META_PATH_MAX];     // Image path inside the EPUB
+} catalog_thumb_job_t;
+
+// Picks the next book after row `after_id` (0 to start) on `volume` with a
+// cover but no thumbnail attempt yet, so a run can step past books it could
+// not read. Returns ESP_ERR_NOT_FOUND once there are none left.
+esp_err_t catalog_next_thumbnail_job(const char *volume, int64_t after_id, catalog_thumb_job_t *job);
+
+// Records the outcome of a job: the cache key of the thumbnail written for
+// it, or -1 if the cover could not be used so it is not retried.
+esp_err_t catalog_set_thumbnail(const catalog_thumb_job_t *job, int64_t key);
+
+// --- Content hashes and duplicates ---
+// SHA-256 of a book file; the same hash means the same book under any name
+#define CATALOG_HASH_SIZE 32
+
+// A book that has not been hashed yet.
+typedef struct {
+    int64_t id;
+    int64_t size;
+    int64_t mtime;
+    char name[128];
+} catalog_hash_job_t;
+
+// Picks any file on `volume` that still needs hashing.
+// Returns ESP_ERR_NOT_FOUND once there are none left.
+esp_err_t catalog_next_hash_job(const char *volume, catalog_hash_job_t *job);
+
+// Stores the file's hash, or with `hash` NULL records that it could not be
+// read so it is not retried until the file changes.
+esp_err_t catalog_set_hash(const catalog_hash_job_t *job, const uint8_t *hash);
+
+// Files on `volume` that have not been hashed yet.
+esp_err_t catalog_count_unhashed(const char *volume, uint32_t *count);
+
+// Gives `name` on `dst_volume`, just copied from `src_volume`, the source's
+// hash instead of hashing it again. A no-op if the sizes differ.
+esp_err_t catalog_copy_hash(const char *src_volume, const char *dst_volume, const char *name);
+
+// Looks for a file on `dst_volume` with the same content as `name` on
+// `src_volume` and copies its name to `existing`. Returns ESP_ERR_NOT_FOUND if
+// there is none, or if the source has not been hashed.
+esp_err_t catalog_find_content(const char *src_volume, const char *name, const char *dst_volume,
+                               char *existing, size_t existing_size);
+
+// Copies the name of the file that holds the content of `name` to `file`:
+// `name` itself, or for an alias the file it was merged into.
+// Returns ESP_ERR_NOT_FOUND if `name` is not in the catalog.
+esp_err_t catalog_resolve_name(const char *volume, const char *name, char *file, size_t file_size);
+
+typedef struct {
+    const char *name;
+    int64_t size;
+    uint32_t group;         // Files with the same content share a group, numbered from 0
+    bool keep;              // Oldest file of its group; the one a merge keeps
+} catalog_duplicate_t;
+
+// Called once per row by catalog_query_duplicates(). Return false to stop iterating.
+typedef bool (*catalog_duplicate_cb_t)(const catalog_duplicate_t *dup, void *ctx);
+
+// Lists every file on `volume` whose content is also in another file there,
+// group by group, with the catalog lock held.
+esp_err_t catalog_query_duplicates(const char *volume, catalog_duplicate_cb_t cb, void *ctx);
+
+typedef struct {
+    uint32_t merged;        // Files removed and turned into aliases
+    uint32_t stale;         // Files that changed since they were hashed; left for rehashing
+    uint64_t bytes_freed;
+} catalog_merge_stats_t;
+
+// Keeps one file of each group of duplicates on `volume` (mounted at
+// `dir_path`) and removes the others. Their names stay in the catalog as
+// aliases of the kept file, recorded in the alias manifest before each file
+// is removed. The lock is taken once per pair and released while the files
+// are checked and removed.
+esp_err_t catalog_merge_duplicates(const char *volume, const char *dir_path, catalog_merge_stats_t *stats);
+
+// One half of a compression benchmark run.
+typedef struct {
+    uint32_t db_bytes;      // Size of the database file
+    uint32_t text_bytes;    // Bytes stored in the description column
+    int64_t insert_us;      // Building the library in one transaction
+    int64_t page_us;        // Mean time to read one page, descriptions included
+} catalog_bench_mode_t;
+
+typedef struct {
+    uint32_t books;
+    catalog_bench_mode_t plain;
+    catalog_bench_mode_t compressed;
+} catalog_bench_result_t;
+
+#define CATALOG_BENCH_MAX_BOOKS  2000
+#define CATALOG_BENCH_PAGE_SIZE  50
+
+// Builds the same synthetic library of `books` rows twice in a scratch
+// database at `scratch_path`, with descriptions stored plain and compressed,
+// and compares file size and listing latency. The file is removed afterwards.
+// The catalog lock is released between steps, so the run does not stall the
+// web UI, and the timings include any wait for it.
+esp_err_t catalog_bench_compression(const char *scratch_path, uint32_t books, catalog_bench_result_t *out);
+
+// Volume the benchmark suite fills with synthetic books. Nothing lists it,
+// catalog_search() only finds its rows when asked for this volume, and
+// catalog_open() removes any a reset left behind.
+#define CATALOG_VOLUME_BENCH "bench"
+
+// Adds `books` synthetic rows to `volume` in the live catalog, so queries can
+// be timed against the real schema and indexes. Replaces any left over.
+esp_err_t catalog_bench_populate(const char *volume, uint32_t books);
+
+// Removes every row on `volume`.
+esp_err_t catalog_bench_clear(const char *volume);
+
+#endif // CATALOG_H
@@ -0,0 +1,464 @@
+/*
+ * Pipelined file copy.
+ *
+ * A single fread/fwrite loop leaves the SD card idle while the USB device is
+ * writing and vice versa. Here the calling task reads into a ring of
+ * DMA-capable blocks and a short-lived writer task drains them, so the next
+ * read overlaps the previous write. Ownership of a block is handed over by
+ * passing its index through two queues: free_q (empty blocks) and full_q
+ * (blocks waiting to be written).
+ *
+ * Both ends are plain POSIX descriptors: FatFs already buffers a sector
+ * per file, and stdio on top only adds a copy of every block through its
+ * FILE buffer. Whole-cluster blocks go from the ring straight to the driver.
+ * Before a fresh copy starts the destination must have room for the whole
+ * file, and is optionally reserved as one contiguous run of clusters so the
+ * FAT is not walked and extended for every block of a large PDF or CBZ.
+ *
+ * Optionally an up-to-date destination is left alone, an interrupted copy
+ * is continued where it stopped, and the source's CRC-32 is accumulated on
+ * the reader as blocks go by so verifying costs one read of the destination.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_vfs_fat.h"
+
+#include "copy_engine.h"
+#include "metrics.h"
+
+#define COPY_WRITER_STACK_SIZE 3072
+
+static const char *TAG = "copy_engine";
+
+typedef struct {
+    int slot;
+    size_t len;             // 0 marks the end of the stream
+} copy_block_t;
+
+typedef struct {
+    int dest;
+    uint8_t *pool;
+    size_t block_size;
+    QueueHandle_t free_q;
+    QueueHandle_t full_q;
+    SemaphoreHandle_t done;
+    transfer_progress_t *progress;
+    int dest_mount;         // metrics_mount_for_path() of the destination
+    size_t written;         // Destination offset the writer has reached
+    volatile bool write_failed;
+} copy_ctx_t;
+
+static void copy_writer_task(void *arg) {
+    copy_ctx_t *ctx = (copy_ctx_t *)arg;
+    copy_block_t blk;
+
+    while (xQueueReceive(ctx->full_q, &blk, portMAX_DELAY) == pdTRUE && blk.len > 0) {
+        // After a failure keep draining so the reader never blocks on free_q
+        if (!ctx->write_failed) {
+            uint8_t *data = ctx->pool + (size_t)blk.slot * ctx->block_size;
+            if (write(ctx->dest, data, blk.len) != (ssize_t)blk.len) {
+                ESP_LOGE(TAG, "Failed to write to destination file");
+                ctx->write_failed = true;
+            } else {
+                metrics_count_io(ctx->dest_mount, true, blk.len);
+                ctx->written += blk.len;
+                if (ctx->progress) ctx->progress->bytes_transferred += blk.len;
+            }
+        }
+        xQueueSend(ctx->free_q, &blk.slot, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(ctx->done);
+    vTaskDelete(NULL);
+}
+
+// Allocates depth * block_size bytes of DMA-capable internal RAM, halving the
+// block size until the allocation succeeds or the minimum is reached. With
+// `align` set the pool start and every slot land on that boundary.
+static uint8_t *alloc_pool(size_t *block_size, size_t depth, size_t align) {
+    size_t size = *block_size;
+    if (align > 0) {
+        size = (size + align - 1) / align * align;
+    }
+    while (size >= COPY_ENGINE_MIN_BLOCK_SIZE && (align == 0 || size % align == 0)) {
+        uint8_t *pool = align > 0
+            ? heap_caps_aligned_alloc(align, size * depth, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL)
+            : heap_caps_malloc(size * depth, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (pool) {
+            if (size != *block_size) {
+                ESP_LOGW(TAG, "Copy blocks reduced to %u bytes", (unsigned)size);
+            }
+            *block_size = size;
+            return pool;
+        }
+        size /= 2;
+    }
+    return NULL;
+}
+
+esp_err_t copy_engine_alloc_buffer(copy_engine_config_t *config) {
+    if (config->depth < 2) config->depth = 2;
+    config->buffer = alloc_pool(&config->block_size, config->depth, config->align);
+    return config->buffer ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void copy_engine_free_buffer(copy_engine_config_t *config) {
+    heap_caps_free(config->buffer);
+    config->buffer = NULL;
+}
+
+static void set_error(transfer_progress_t *progress, const char *msg) {
+    if (progress) snprintf(progress->error_msg, sizeof(progress->error_msg), "%s", msg);
+}
+
+// FatFs may return a short count; keep going until `len` bytes or EOF
+static ssize_t read_full(int fd, uint8_t *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+// VFS mount points are a single path component ("/sdcard", "/usb")
+static bool mount_base(const char *path, char *base, size_t size) {
+    const char *end = path[0] == '/' ? strchr(path + 1, '/') : NULL;
+    if (!end || (size_t)(end - path) >= size) {
+        return false;
+    }
+    memcpy(base, path, end - path);
+    base[end - path] = '\0';
+    return true;
+}
+
+// True unless the destination volume is known to be short of `needed` bytes.
+// Volumes that cannot report their free space are given the benefit of the doubt.
+static bool dest_has_room(const char *base, uint64_t needed) {
+    uint64_t total, free_bytes;
+    if (esp_vfs_fat_info(base, &total, &free_bytes) != ESP_OK) {
+        return true;
+    }
+    if (free_bytes < needed) {
+        ESP_LOGE(TAG, "%s has %llu bytes free, %llu needed", base, (unsigned long long)free_bytes,
+                 (unsigned long long)needed);
+        return false;
+    }
+    return true;
+}
+
+// Opens a fresh destination. With `preallocate`, the file is first created
+// with all of its clusters reserved in one contiguous run (f_expand) and then
+// written in place; if the volume has no contiguous run that large, the file
+// is created empty and grows as usual.
+static int open_dest(const char *base, const char *dest_path, size_t size, bool preallocate) {
+    if (preallocate && size > 0) {
+        // f_expand only works on an empty file
+        remove(dest_path);
+        if (esp_vfs_fat_create_contiguous_file(base, dest_path, size, true) == ESP_OK) {
+            int fd = open(dest_path, O_WRONLY);
+            if (fd >= 0) {
+                return fd;
+            }
+        }
+        ESP_LOGD(TAG, "No contiguous space for %s; allocating as it is written", dest_path);
+    }
+    return open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+static bool same_file(const struct stat *src, const struct stat *dst) {
+    long long diff = (long long)src->st_mtime - (long long)dst->st_mtime;
+    return src->st_size == dst->st_size && diff >= -COPY_ENGINE_MTIME_SLACK_S && diff <= COPY_ENGINE_MTIME_SLACK_S;
+}
+
+// A destination shorter than the source is taken to be an interrupted copy
+// if the bytes just before its last RESUME_CHECK boundary match the source.
+// Anything after that boundary may not have been flushed and is rewritten.
+// One as long as the source is never resumed: a preallocated copy is full
+// length from the start, and after a power cut its tail is whatever the
+// reserved clusters held before, with nothing on disk to say where it ends.
+static size_t find_resume_offset(int source, const char *dest_path, size_t src_size, size_t dst_size,
+                                 uint8_t *buf_a, uint8_t *buf_b) {
+    size_t offset = dst_size / COPY_ENGINE_RESUME_CHECK * COPY_ENGINE_RESUME_CHECK;
+    if (dst_size >= src_size || offset == 0) {
+        return 0;
+    }
+    int dest = open(dest_path, O_RDONLY);
+    if (dest < 0) {
+        return 0;
+    }
+    off_t check_at = offset - COPY_ENGINE_RESUME_CHECK;
+    bool match = lseek(dest, check_at, SEEK_SET) == check_at &&
+                 read_full(dest, buf_a, COPY_ENGINE_RESUME_CHECK) == COPY_ENGINE_RESUME_CHECK &&
+                 lseek(source, check_at, SEEK_SET) == check_at &&
+                 read_full(source, buf_b, COPY_ENGINE_RESUME_CHECK) == COPY_ENGINE_RESUME_CHECK &&
+                 memcmp(buf_a, buf_b, COPY_ENGINE_RESUME_CHECK) == 0;
+    close(dest);
+    return match ? offset : 0;
+}
+
+// CRC-32 of the first `len` bytes of `fd`, read from the start. Returns false
+// if the file is shorter.
+static bool crc_prefix(int fd, size_t len, uint32_t *crc, uint8_t *buf, size_t buf_size) {
+    *crc = 0;
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    while (len > 0) {
+        size_t chunk = len < buf_size ? len : buf_size;
+        if (read_full(fd, buf, chunk) != (ssize_t)chunk) {
+            return false;
+        }
+        *crc = esp_rom_crc32_le(*crc, buf, chunk);
+        len -= chunk;
+    }
+    return true;
+}
+
+// Reads the whole destination back and compares it with the CRC the reader
+// accumulated over the source, including any prefix a resumed copy kept.
+static bool verify_dest(const char *dest_path, uint32_t expected, uint8_t *buf, size_t buf_size) {
+    int dest = open(dest_path, O_RDONLY);
+    if (dest < 0) {
+        return false;
+    }
+    int mount = metrics_mount_for_path(dest_path);
+    uint32_t crc = 0;
+    ssize_t got = 0;
+    while ((got = read(dest, buf, buf_size)) > 0) {
+        metrics_count_io(mount, false, got);
+        crc = esp_rom_crc32_le(crc, buf, got);
+    }
+    close(dest);
+    return got == 0 && crc == expected;
+}
+
+esp_err_t copy_engine_copy(const char *source_path, const char *dest_path,
+                           const copy_engine_config_t *config,
+                           transfer_progress_t *progress, volatile bool *cancel) {
+    copy_engine_config_t cfg = COPY_ENGINE_DEFAULT_CONFIG();
+    if (config) cfg = *config;
+    if (cfg.depth < 2) cfg.depth = 2;
+
+    ESP_LOGI(TAG, "Copying from %s to %s", source_path, dest_path);
+    int source_file = open(source_path, O_RDONLY);
+    struct stat src_st;
+    if (source_file < 0 || fstat(source_file, &src_st) != 0) {
+        ESP_LOGE(TAG, "Failed to open source file: %s", source_path);
+        set_error(progress, "Failed to open source file.");
+        if (source_file >= 0) close(source_file);
+        return ESP_FAIL;
+    }
+    if (progress) {
+        progress->total_bytes = src_st.st_size;
+        progress->bytes_transferred = 0;
+        progress->skipped = false;
+        progress->resumed_from = 0;
+    }
+
+    struct stat dst_st;
+    bool have_dest = (cfg.skip_identical || cfg.resume) && stat(dest_path, &dst_st) == 0;
+    if (have_dest && cfg.skip_identical && same_file(&src_st, &dst_st)) {
+        ESP_LOGI(TAG, "Destination already up to date, skipping");
+        close(source_file);
+        if (progress) {
+            progress->bytes_transferred = src_st.st_size;
+            progress->skipped = true;
+            progress->success = true;
+        }
+        return ESP_OK;
+    }
+
+    copy_ctx_t ctx = {
+        .dest = -1,
+        .block_size = cfg.block_size,
+        .progress = progress,
+        .dest_mount = metrics_mount_for_path(dest_path),
+    };
+    int source_mount = metrics_mount_for_path(source_path);
+    ctx.pool = cfg.buffer ? cfg.buffer : alloc_pool(&ctx.block_size, cfg.depth, cfg.align);
+    ctx.free_q = xQueueCreate(cfg.depth, sizeof(int));
+    // One extra entry so the end-of-stream marker never blocks
+    ctx.full_q = xQueueCreate(cfg.depth + 1, sizeof(copy_block_t));
+    ctx.done = xSemaphoreCreateBinary();
+
+    esp_err_t ret = ESP_OK;
+    if (!ctx.pool || !ctx.free_q || !ctx.full_q || !ctx.done) {
+        ESP_LOGE(TAG, "Failed to allocate memory for copy pipeline");
+        set_error(progress, "Memory allocation failed.");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    size_t offset = 0;
+    if (have_dest && cfg.resume) {
+        offset = find_resume_offset(source_file, dest_path, src_st.st_size, dst_st.st_size,
+                                    ctx.pool, ctx.pool + ctx.block_size);
+    }
+    // Fail now rather than most of the way through. A destination that is
+    // about to be truncated gives its clusters back first.
+    char dest_base[16];
+    bool have_base = mount_base(dest_path, dest_base, sizeof(dest_base));
+    uint64_t needed = src_st.st_size - offset;
+    uint64_t reclaimed = have_dest && offset == 0 ? dst_st.st_size : 0;
+    needed = needed > reclaimed ? needed - reclaimed : 0;
+    if (have_base && !dest_has_room(dest_base, needed)) {
+        set_error(progress, "Not enough space on destination.");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+    if (offset > 0) {
+        ESP_LOGI(TAG, "Resuming at byte %u of %u", (unsigned)offset, (unsigned)src_st.st_size);
+        ctx.dest = open(dest_path, O_WRONLY);
+        if (ctx.dest >= 0 && lseek(ctx.dest, offset, SEEK_SET) != (off_t)offset) {
+            close(ctx.dest);
+            ctx.dest = -1;
+        }
+    } else {
+        ctx.dest = open_dest(dest_base, dest_path, src_st.st_size, have_base && cfg.preallocate);
+    }
+    if (ctx.dest < 0 || lseek(source_file, offset, SEEK_SET) != (off_t)offset) {
+        ESP_LOGE(TAG, "Failed to open destination file: %s", dest_path);
+        set_error(progress, "Failed to open destination file.");
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+    // A resumed copy is only verified if the part it keeps is: only one block
+    // of it was compared, so checksum the source up to the resume point too
+    uint32_t crc = 0;
+    if (cfg.verify && offset > 0 &&
+        !crc_prefix(source_file, offset, &crc, ctx.pool, ctx.block_size * cfg.depth)) {
+        set_error(progress, "Read error on source.");
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+    if (lseek(source_file, offset, SEEK_SET) != (off_t)offset) {
+        set_error(progress, "Read error on source.");
+        ret = ESP_FAIL;
+        goto cleanup;
+    }
+    ctx.written = offset;
+    if (progress) {
+        progress->bytes_transferred = offset;
+        progress->resumed_from = offset;
+    }
+
+    // The writer shares the reader's core, so a pinned transfer task keeps
+    // both halves of the copy off the networking core
+    int priority = cfg.writer_priority >= 0 ? cfg.writer_priority : (int)uxTaskPriorityGet(NULL);
+    if (xTaskCreatePinnedToCore(copy_writer_task, "copy_writer", COPY_WRITER_STACK_SIZE, &ctx, priority, NULL,
+                                xTaskGetCoreID(NULL)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start copy writer");
+        set_error(progress, "Memory allocation failed.");
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < (int)cfg.depth; i++) {
+        xQueueSend(ctx.free_q, &i, 0);
+    }
+
+    bool cancelled = false;
+    bool read_failed = false;
+    while (!ctx.write_failed) {
+        if (cancel && *cancel) {
+            cancelled = true;
+            break;
+        }
+
+        copy_block_t blk = { .len = 0 };
+        xQueueReceive(ctx.free_q, &blk.slot, portMAX_DELAY);
+        uint8_t *data = ctx.pool + (size_t)blk.slot * ctx.block_size;
+        ssize_t got = read_full(source_file, data, ctx.block_size);
+        if (got <= 0) {
+            read_failed = got < 0;
+            break;
+        }
+        blk.len = got;
+        metrics_count_io(source_mount, false, blk.len);
+        // Checksummed here, on the reader, while the writer drains the previous block
+        if (cfg.verify) {
+            crc = esp_rom_crc32_le(crc, data, blk.len);
+        }
+        xQueueSend(ctx.full_q, &blk, portMAX_DELAY);
+    }
+
+    // Tell the writer there is nothing more and wait for it to finish the backlog
+    copy_block_t end = { .slot = 0, .len = 0 };
+    xQueueSend(ctx.full_q, &end, portMAX_DELAY);
+    xSemaphoreTake(ctx.done, portMAX_DELAY);
+
+    if (cancelled) {
+        ESP_LOGW(TAG, "Transfer cancelled by user.");
+        set_error(progress, "Transfer cancelled.");
+        ret = ESP_FAIL;
+    } else if (ctx.write_failed) {
+        set_error(progress, "Write error on destination.");
+        ret = ESP_FAIL;
+    } else if (read_failed) {
+        ESP_LOGE(TAG, "Failed to read from source file");
+        set_error(progress, "Read error on source.");
+        ret = ESP_FAIL;
+    }
+
+    if (ctx.dest >= 0) {
+        // A preallocated file is full length from the start; cut it back to
+        // what was really written so a later attempt can resume from there
+        if (ret != ESP_OK && ctx.written < (size_t)src_st.st_size) {
+            ftruncate(ctx.dest, ctx.written);
+        }
+        if (close(ctx.dest) != 0 && ret == ESP_OK) {
+            set_error(progress, "Write error on destination.");
+            ret = ESP_FAIL;
+        }
+        ctx.dest = -1;
+    }
+    if (ret == ESP_OK && cfg.verify && !verify_dest(dest_path, crc, ctx.pool, ctx.block_size * cfg.depth)) {
+        ESP_LOGE(TAG, "CRC mismatch on %s", dest_path);
+        set_error(progress, "Verification failed.");
+        // The data cannot be trusted, so it must not be resumed from either
+        remove(dest_path);
+        ret = ESP_FAIL;
+    }
+    if (ret == ESP_OK && cfg.skip_identical) {
+        struct utimbuf times = { .actime = src_st.st_mtime, .modtime = src_st.st_mtime };
+        if (utime(dest_path, &times) != 0) {
+            ESP_LOGW(TAG, "Failed to set mtime on %s", dest_path);
+        }
+    }
+
+cleanup:
+    if (ctx.dest >= 0) close(ctx.dest);
+    if (ctx.done) vSemaphoreDelete(ctx.done);
+    if (ctx.full_q) vQueueDelete(ctx.full_q);
+    if (ctx.free_q) vQueueDelete(ctx.free_q);
+    if (ctx.pool != cfg.buffer) heap_caps_free(ctx.pool);
+    close(source_file);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "File copied successfully");
+        if (progress) progress->success = true;
+    } else if (cancel && *cancel && !cfg.resume) {
+        // Don't leave a truncated book behind
+        remove(dest_path);
+    }
+    return ret;
+}
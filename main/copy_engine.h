@@ -0,0 +1,98 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// --- Transfer Progress Tracking ---
+// The copy engine only touches the per-file fields (bytes, success, error);
+// the job fields are maintained by the transfer queue.
+typedef struct {
+    uint32_t job_id;          // 0 when no job is running
+    size_t file_index;        // Index of `filename` within the job
+    size_t file_count;
+    size_t files_done;
+    size_t files_failed;
+    char filename[256];
+    size_t bytes_transferred;
+    size_t total_bytes;
+    bool active;
+    bool success;
+    bool skipped;             // Destination already matched; nothing was copied
+    size_t resumed_from;      // Offset a partial destination was continued from
+    char error_msg[128];
+} transfer_progress_t;
+
+// The copy engine reads the source on the calling task while a writer task
+// drains filled blocks to the destination, so both devices stay busy.
+typedef struct {
+    size_t block_size;   // Bytes per ring slot
+    size_t depth;        // Number of ring slots (2 = double buffering)
+    int writer_priority; // Priority of the writer task; -1 to match the caller
+    // Skip the copy when the destination has the source's size and mtime.
+    // Finished copies are stamped with the source mtime so this holds next time.
+    bool skip_identical;
+    // Continue a destination left short by an earlier attempt instead of
+    // starting over, once its last COPY_ENGINE_RESUME_CHECK bytes are found
+    // to match the source. Cancelled copies are then kept rather than removed.
+    bool resume;
+    // CRC-32 the source as it streams through and compare it with the
+    // destination read back after the copy; a mismatch removes the file.
+    // A resumed copy checks the whole file, rereading the kept prefix of the
+    // source as well.
+    bool verify;
+    // When non-zero, ring slots start on this boundary (normally the sector
+    // size) and block_size is rounded to a multiple of it, so every block
+    // goes to the driver in one aligned DMA transfer instead of being staged
+    // through FatFs's sector buffer.
+    size_t align;
+    // Reserve all of a fresh destination's clusters in one contiguous run
+    // before writing. Falls back to growing the file when the volume has no
+    // run that large. A preallocated copy cut off by a power loss is left at
+    // full length, so resume starts it over.
+    bool preallocate;
+    // Ring to copy through, block_size * depth bytes from
+    // copy_engine_alloc_buffer(). NULL allocates one for each copy.
+    uint8_t *buffer;
+} copy_engine_config_t;
+
+#define COPY_ENGINE_DEFAULT_BLOCK_SIZE (32 * 1024)
+#define COPY_ENGINE_DEFAULT_DEPTH      2
+#define COPY_ENGINE_MIN_BLOCK_SIZE     (4 * 1024)
+// Bytes compared before resuming, and the granularity of resume offsets
+#define COPY_ENGINE_RESUME_CHECK       (4 * 1024)
+// FAT stores modification times with 2 second resolution
+#define COPY_ENGINE_MTIME_SLACK_S      2
+
+#define COPY_ENGINE_DEFAULT_CONFIG() {                  \
+    .block_size = COPY_ENGINE_DEFAULT_BLOCK_SIZE,       \
+    .depth = COPY_ENGINE_DEFAULT_DEPTH,                 \
+    .writer_priority = -1,                              \
+    .skip_identical = false,                            \
+    .resume = false,                                    \
+    .verify = false,                                    \
+    .align = 0,                                         \
+    .preallocate = false,                               \
+    .buffer = NULL,                                     \
+}
+
+// Copies `source_path` to `dest_path`. `progress` (optional) is updated as
+// blocks land on the destination. The copy stops as soon as `*cancel` becomes
+// true, in which case the partial destination file is removed unless
+// `config->resume` is set. Fails with ESP_ERR_NO_MEM before writing anything
+// if the destination volume does not have room for the file.
+esp_err_t copy_engine_copy(const char *source_path, const char *dest_path,
+                           const copy_engine_config_t *config,
+                           transfer_progress_t *progress, volatile bool *cancel);
+
+// Allocates a ring for `config` and stores it in config->buffer, so a batch
+// of copies reuses one DMA buffer instead of allocating one per file. May
+// reduce config->block_size when memory is short.
+esp_err_t copy_engine_alloc_buffer(copy_engine_config_t *config);
+
+// Frees config->buffer and clears it.
+void copy_engine_free_buffer(copy_engine_config_t *config);
+
+#endif // COPY_ENGINE_H
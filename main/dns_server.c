@@ -1,30 +1,61 @@
-/* Captive Portal Example
+/* Captive Portal DNS responder
 
-    This example code is in the Public Domain (or CC0 licensed, at your option.)
+    Based on the ESP-IDF captive portal example, which is in the Public
+    Domain (or CC0 licensed, at your option).
 
-    Unless required by applicable law or agreed to in writing, this
-    software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
-    CONDITIONS OF ANY KIND, either express or implied.
+    Every A query is answered with the soft-AP's address; everything else
+    gets an empty NOERROR answer so clients do not sit out a timeout before
+    falling back. When several phones join at once their connectivity
+    probes arrive in bursts, so the socket is non-blocking and drained in
+    one go per select() wakeup, the answer record is built once, nothing is
+    logged per packet, and each client is held to a token bucket.
 */
 
+#include <string.h>
 #include <sys/param.h>
+#include <fcntl.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "lwip/netdb.h"
 
+#include "dns_server.h"
+
 #define DNS_PORT (53)
-#define DNS_MAX_LEN (256)
+#define DNS_MAX_LEN (512)           // Largest plain UDP DNS message
 
 #define OPCODE_MASK (0x7800)
-#define QR_FLAG (1 << 7)
-#define QD_TYPE_A (0x0001)
+#define QR_FLAG     (0x8000)
+#define AA_FLAG     (0x0400)
+#define RD_FLAG     (0x0100)
+#define QD_TYPE_A   (0x0001)
+#define QD_TYPE_ANY (0x00FF)
+#define QD_CLASS_IN (0x0001)
 #define ANS_TTL_SEC (300)
+#define NAME_POINTER_FIRST_QUESTION (0xC00C)
+
+#define DNS_TASK_STACK_SIZE 4096
+#define DNS_TASK_PRIORITY   5
+// select() timeout; also how often idle state is looked at
+#define DNS_SELECT_TIMEOUT_MS 1000
+
+// Per-client token bucket: a phone may burst DNS_RATE_BURST queries and then
+// DNS_RATE_PER_S per second. A probe storm from one device cannot starve
+// the others; normal portal detection stays well inside it.
+#define DNS_RATE_CLIENTS 8
+#define DNS_RATE_BURST   32
+#define DNS_RATE_PER_S   16
+
+// Names answered recently; only new ones are logged
+#define DNS_NAME_CACHE_SIZE 16
 
 static const char *TAG = "dns_server";
 
@@ -39,12 +70,6 @@ typedef struct __attribute__((__packed__))
     uint16_t ar_count;
 } dns_header_t;
 
-// DNS Question Packet
-typedef struct {
-    uint16_t type;
-    uint16_t class;
-} dns_question_t;
-
 // DNS Answer Packet
 typedef struct __attribute__((__packed__))
 {
@@ -56,192 +81,256 @@ typedef struct __attribute__((__packed__))
     uint32_t ip_addr;
 } dns_answer_t;
 
-/*
-    Parse the name from the packet from the DNS name format to a regular .-seperated name
-    returns the pointer to the next part of the packet
-*/
-static char *parse_dns_name(char *raw_name, char *parsed_name, size_t parsed_name_max_len)
-{
+typedef struct {
+    uint32_t addr;          // IPv4 source, network order; 0 for a free slot
+    int64_t refilled_us;
+    uint32_t tokens;
+} dns_client_t;
 
-    char *label = raw_name;
-    char *name_itr = parsed_name;
-    int name_len = 0;
+typedef struct {
+    dns_answer_t answer;    // Prebuilt record answering the first question
+    bool answer_ready;
+    dns_client_t clients[DNS_RATE_CLIENTS];
+    uint32_t names[DNS_NAME_CACHE_SIZE];
+    size_t next_name;
+    uint32_t answered;
+    uint32_t limited;
+} dns_state_t;
+
+static dns_state_t g_dns;
+
+// --- Answer Template ---
+// The soft-AP address does not change while the portal runs, but the task
+// may start before the interface has it, so retry until it is known.
+static bool refresh_answer(void) {
+    if (g_dns.answer_ready) {
+        return true;
+    }
+    esp_netif_ip_info_t ip_info;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    if (!netif || esp_netif_get_ip_info(netif, &ip_info) != ESP_OK || ip_info.ip.addr == 0) {
+        return false;
+    }
+    g_dns.answer = (dns_answer_t){
+        .ptr_offset = htons(NAME_POINTER_FIRST_QUESTION),
+        .type = htons(QD_TYPE_A),
+        .class = htons(QD_CLASS_IN),
+        .ttl = htonl(ANS_TTL_SEC),
+        .addr_len = htons(sizeof(ip_info.ip.addr)),
+        .ip_addr = ip_info.ip.addr,
+    };
+    g_dns.answer_ready = true;
+    ESP_LOGI(TAG, "Answering A queries with " IPSTR, IP2STR(&ip_info.ip));
+    return true;
+}
 
-    do {
-        int sub_name_len = *label;
-        // (len + 1) since we are adding  a '.'
-        name_len += (sub_name_len + 1);
-        if (name_len > parsed_name_max_len) {
-            return NULL;
+// --- Rate Limiting ---
+static bool client_allowed(uint32_t addr, int64_t now) {
+    dns_client_t *slot = NULL;
+    dns_client_t *oldest = &g_dns.clients[0];
+    for (int i = 0; i < DNS_RATE_CLIENTS; i++) {
+        dns_client_t *c = &g_dns.clients[i];
+        if (c->addr == addr) {
+            slot = c;
+            break;
         }
-
-        // Copy the sub name that follows the the label
-        memcpy(name_itr, label + 1, sub_name_len);
-        name_itr[sub_name_len] = '.';
-        name_itr += (sub_name_len + 1);
-        label += sub_name_len + 1;
-    } while (*label != 0);
-
-    // Terminate the final string, replacing the last '.'
-    parsed_name[name_len - 1] = '\0';
-    // Return pointer to first char after the name
-    return label + 1;
+        if (c->refilled_us < oldest->refilled_us) {
+            oldest = c;
+        }
+    }
+    if (!slot) {
+        // New client, or one that has been quiet longest gives up its slot
+        slot = oldest;
+        *slot = (dns_client_t){ .addr = addr, .refilled_us = now, .tokens = DNS_RATE_BURST };
+    }
+    uint32_t earned = (uint32_t)((now - slot->refilled_us) * DNS_RATE_PER_S / 1000000);
+    if (earned > 0) {
+        slot->tokens = MIN(slot->tokens + earned, DNS_RATE_BURST);
+        slot->refilled_us = now;
+    }
+    if (slot->tokens == 0) {
+        return false;
+    }
+    slot->tokens--;
+    return true;
 }
 
-// Parses the DNS request and prepares a DNS response with the IP of the softAP
-static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t dns_reply_max_len)
-{
-    if (req_len > dns_reply_max_len) {
-        return -1;
+// --- Query Handling ---
+// FNV-1a over the wire-format name, case-folded like DNS compares names
+static uint32_t name_hash(const uint8_t *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
     }
+    return hash;
+}
 
-    // Prepare the reply
-    memset(dns_reply, 0, dns_reply_max_len);
-    memcpy(dns_reply, req, req_len);
-
-    // Endianess of NW packet different from chip
-    dns_header_t *header = (dns_header_t *)dns_reply;
-    ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
-             ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
+static void note_name(const uint8_t *name, size_t len) {
+    uint32_t hash = name_hash(name, len);
+    for (int i = 0; i < DNS_NAME_CACHE_SIZE; i++) {
+        if (g_dns.names[i] == hash) {
+            return;
+        }
+    }
+    g_dns.names[g_dns.next_name] = hash;
+    g_dns.next_name = (g_dns.next_name + 1) % DNS_NAME_CACHE_SIZE;
+
+    // Only new names are turned into text, for the log
+    char text[128];
+    size_t out = 0;
+    for (size_t i = 0; i < len && name[i] != 0; i += name[i] + 1) {
+        for (size_t j = 1; j <= name[i] && out + 2 < sizeof(text); j++) {
+            text[out++] = (char)name[i + j];
+        }
+        if (out + 1 < sizeof(text)) {
+            text[out++] = '.';
+        }
+    }
+    text[out > 0 ? out - 1 : 0] = '\0';
+    ESP_LOGI(TAG, "Resolving %s", text);
+}
 
-    // Not a standard query
-    if ((header->flags & OPCODE_MASK) != 0) {
+// Turns the query in `msg` into its reply in place. Returns the reply
+// length, or 0 if nothing should be sent.
+static size_t build_reply(uint8_t *msg, size_t len) {
+    if (len < sizeof(dns_header_t)) {
+        return 0;
+    }
+    dns_header_t *header = (dns_header_t *)msg;
+    uint16_t flags = ntohs(header->flags);
+    if ((flags & QR_FLAG) || (flags & OPCODE_MASK) != 0 || ntohs(header->qd_count) != 1) {
+        // Not a standard single-question query; every client we serve sends those
         return 0;
     }
 
-    // Set question response flag
-    header->flags |= QR_FLAG;
-
-    uint16_t qd_count = ntohs(header->qd_count);
-    header->an_count = htons(qd_count);
+    // Walk the question name without trusting any length in it
+    size_t pos = sizeof(dns_header_t);
+    while (pos < len && msg[pos] != 0) {
+        if ((msg[pos] & 0xC0) != 0) {
+            return 0;   // Compression is not valid in a query's question
+        }
+        pos += msg[pos] + 1;
+    }
+    if (pos + 1 + 4 > len) {
+        return 0;
+    }
+    size_t name_len = pos + 1 - sizeof(dns_header_t);
+    uint16_t qd_type = (msg[pos + 1] << 8) | msg[pos + 2];
+    uint16_t qd_class = (msg[pos + 3] << 8) | msg[pos + 4];
+    size_t question_end = pos + 5;
+
+    // Keep only the question; EDNS and other additional records are dropped
+    header->flags = htons(QR_FLAG | AA_FLAG | (flags & RD_FLAG));
+    header->an_count = 0;
+    header->ns_count = 0;
+    header->ar_count = 0;
+    size_t reply_len = question_end;
+    if ((qd_type == QD_TYPE_A || qd_type == QD_TYPE_ANY) && qd_class == QD_CLASS_IN &&
+        refresh_answer() && reply_len + sizeof(dns_answer_t) <= DNS_MAX_LEN) {
+        memcpy(msg + reply_len, &g_dns.answer, sizeof(dns_answer_t));
+        reply_len += sizeof(dns_answer_t);
+        header->an_count = htons(1);
+        note_name(msg + sizeof(dns_header_t), name_len);
+    }
+    return reply_len;
+}
 
-    int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-    if (reply_len > dns_reply_max_len) {
+static int open_socket(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
         return -1;
     }
+    struct sockaddr_in bind_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DNS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    ESP_LOGI(TAG, "Listening on port %d", DNS_PORT);
+    return sock;
+}
 
-    // Pointer to current answer and question
-    char *cur_ans_ptr = dns_reply + req_len;
-    char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-    char name[128];
-
-    // Respond to all questions with the ESP32's IP address
-    for (int i = 0; i < qd_count; i++) {
-        char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-        if (name_end_ptr == NULL) {
-            ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
-            return -1;
+// Answers everything that is waiting, then returns to select()
+static bool drain_socket(int sock) {
+    static uint8_t msg[DNS_MAX_LEN];
+    while (true) {
+        struct sockaddr_in source_addr;
+        socklen_t socklen = sizeof(source_addr);
+        int len = recvfrom(sock, msg, sizeof(msg), 0, (struct sockaddr *)&source_addr, &socklen);
+        if (len < 0) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                return true;
+            }
+            ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+            return false;
         }
-
-        dns_question_t *question = (dns_question_t *)(name_end_ptr);
-        uint16_t qd_type = ntohs(question->type);
-        uint16_t qd_class = ntohs(question->class);
-
-        ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type, qd_class, name);
-
-        if (qd_type == QD_TYPE_A) {
-            dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
-
-            answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
-            answer->type = htons(qd_type);
-            answer->class = htons(qd_class);
-            answer->ttl = htonl(ANS_TTL_SEC);
-
-            esp_netif_ip_info_t ip_info;
-            esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info);
-            ESP_LOGD(TAG, "Answer with PTR offset: 0x%X and IP 0x%X", ntohs(answer->ptr_offset), ip_info.ip.addr);
-
-            answer->addr_len = htons(sizeof(ip_info.ip.addr));
-            answer->ip_addr = ip_info.ip.addr;
+        if (!client_allowed(source_addr.sin_addr.s_addr, esp_timer_get_time())) {
+            g_dns.limited++;
+            continue;
+        }
+        size_t reply_len = build_reply(msg, len);
+        if (reply_len > 0) {
+            if (sendto(sock, msg, reply_len, 0, (struct sockaddr *)&source_addr, socklen) < 0) {
+                ESP_LOGD(TAG, "sendto failed: errno %d", errno);
+            } else {
+                g_dns.answered++;
+            }
         }
     }
-    return reply_len;
 }
 
 /*
     Sets up a socket and listen for DNS queries,
     replies to all type A queries with the IP of the softAP
 */
-void dns_server_task(void *pvParameters)
+static void dns_server_task(void *pvParameters)
 {
-    char rx_buffer[128];
-    char addr_str[128];
-    int addr_family;
-    int ip_protocol;
-
     while (1) {
-
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(DNS_PORT);
-        addr_family = AF_INET;
-        ip_protocol = IPPROTO_IP;
-        inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
-
-        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+        int sock = open_socket();
         if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-            break;
-        }
-        ESP_LOGI(TAG, "Socket created");
-
-        int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(DNS_SELECT_TIMEOUT_MS));
+            continue;
         }
-        ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
-
         while (1) {
-            ESP_LOGI(TAG, "Waiting for data");
-            struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-            socklen_t socklen = sizeof(source_addr);
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
-
-            // Error occurred during receiving
-            if (len < 0) {
-                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                close(sock);
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(sock, &readable);
+            struct timeval timeout = {
+                .tv_sec = DNS_SELECT_TIMEOUT_MS / 1000,
+                .tv_usec = (DNS_SELECT_TIMEOUT_MS % 1000) * 1000,
+            };
+            int ready = select(sock + 1, &readable, NULL, NULL, &timeout);
+            if (ready < 0) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
                 break;
             }
-            // Data received
-            else {
-                // Get the sender's ip address as string
-                if (source_addr.sin6_family == PF_INET) {
-                    inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                } else if (source_addr.sin6_family == PF_INET6) {
-                    inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                }
-
-                // Null-terminate whatever we received and treat like a string...
-                rx_buffer[len] = 0;
-
-                char reply[DNS_MAX_LEN];
-                int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN);
-
-                ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
-                if (reply_len <= 0) {
-                    ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-                } else {
-                    int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                    if (err < 0) {
-                        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                        break;
-                    }
-                }
+            if (ready == 0) {
+                refresh_answer();
+                continue;
+            }
+            if (!drain_socket(sock)) {
+                break;
             }
         }
-
-        if (sock != -1) {
-            ESP_LOGE(TAG, "Shutting down socket");
-            shutdown(sock, 0);
-            close(sock);
-        }
+        ESP_LOGW(TAG, "Restarting socket after %u answers, %u rate-limited",
+                 (unsigned)g_dns.answered, (unsigned)g_dns.limited);
+        shutdown(sock, 0);
+        close(sock);
     }
-    vTaskDelete(NULL);
 }
 
-void start_dns_server(void)
+void start_dns_server(BaseType_t core_id)
 {
-    xTaskCreate(dns_server_task, "dns_server", 4096, NULL, 5, NULL);
+    xTaskCreatePinnedToCore(dns_server_task, "dns_server", DNS_TASK_STACK_SIZE, NULL,
+                            DNS_TASK_PRIORITY, NULL, core_id);
 }
@@ -1,6 +1,9 @@
 #ifndef DNS_SERVER_H
 #define DNS_SERVER_H
 
-void start_dns_server(void);
+#include "freertos/FreeRTOS.h"
+
+// Starts the captive-portal DNS responder task, pinned to `core_id`.
+void start_dns_server(BaseType_t core_id);
 
 #endif // DNS_SERVER_H
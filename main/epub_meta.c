@@ -0,0 +1,519 @@
+/*
+ * EPUB metadata extraction.
+ *
+ * META-INF/container.xml names the package (OPF) file. Both files are
+ * inflated through miniz's extract callback and fed to a small streaming XML
+ * scanner, so neither is ever held in memory whole and every field is picked
+ * up in a single pass. Parsing stops at the end of the OPF manifest, which is
+ * the last part that carries anything we use.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "esp_log.h"
+#include "miniz.h"
+
+#include "epub_meta.h"
+#include "mem_pool.h"
+
+static const char *TAG = "epub_meta";
+
+#define CONTAINER_PATH "META-INF/container.xml"
+
+// Longest tag (name plus attributes) the scanner keeps; the rest is dropped
+#define XML_TAG_MAX  384
+// Raw text collected for one element, before entities and markup are removed
+#define XML_TEXT_MAX (EPUB_META_DESC_MAX * 2)
+
+typedef enum {
+    XML_TEXT,       // Character data
+    XML_TAG,        // Inside <...>
+    XML_COMMENT,    // Inside <!-- ... -->
+    XML_CDATA,      // Inside <![CDATA[ ... ]]>
+} xml_state_t;
+
+// Fields the OPF scanner is collecting text for
+typedef enum {
+    FIELD_NONE,
+    FIELD_TITLE,
+    FIELD_CREATOR,
+    FIELD_LANGUAGE,
+    FIELD_IDENTIFIER,
+    FIELD_DESCRIPTION,
+} opf_field_t;
+
+typedef struct opf_parser opf_parser_t;
+typedef void (*xml_tag_fn_t)(opf_parser_t *p, const char *tag, size_t len);
+
+struct opf_parser {
+    xml_state_t state;
+    xml_tag_fn_t on_tag;
+    bool done;                  // Everything needed has been seen; stop inflating
+    char tag[XML_TAG_MAX];
+    size_t tag_len;
+    char quote;                 // Quote character while inside an attribute value
+    size_t match;               // Progress through the comment/CDATA terminator
+
+    // OPF state
+    bool in_metadata;
+    bool in_manifest;
+    opf_field_t field;
+    char text[XML_TEXT_MAX];
+    size_t text_len;
+    char cover_id[64];
+    char cover_href[EPUB_META_PATH_MAX];
+    bool cover_is_image;        // cover_href came from properties="cover-image"
+    epub_metadata_t *meta;
+
+    // container.xml result
+    char opf_path[EPUB_META_PATH_MAX];
+};
+
+// --- XML Helpers ---
+// Appends the UTF-8 encoding of `cp` to `out`; returns the bytes written.
+static size_t utf8_encode(unsigned long cp, char *out) {
+    if (cp < 0x80) { out[0] = cp; return 1; }
+    if (cp < 0x800) { out[0] = 0xC0 | (cp >> 6); out[1] = 0x80 | (cp & 0x3F); return 2; }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12); out[1] = 0x80 | ((cp >> 6) & 0x3F); out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18); out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F); out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Decodes the predefined and numeric character references in place.
+static void xml_unescape(char *s) {
+    static const struct { const char *name; char c; } entities[] = {
+        { "amp;", '&' }, { "lt;", '<' }, { "gt;", '>' }, { "quot;", '"' }, { "apos;", '\'' },
+    };
+    char *q = s;
+    for (char *p = s; *p;) {
+        if (*p != '&') {
+            *q++ = *p++;
+            continue;
+        }
+        bool decoded = false;
+        if (p[1] == '#') {
+            char *end;
+            unsigned long cp = (p[2] == 'x' || p[2] == 'X') ? strtoul(p + 3, &end, 16) : strtoul(p + 2, &end, 10);
+            if (*end == ';' && cp > 0 && cp <= 0x10FFFF && end - p <= 10) {
+                // The encoding is never longer than the reference it replaces
+                q += utf8_encode(cp, q);
+                p = end + 1;
+                decoded = true;
+            }
+        } else {
+            for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+                size_t len = strlen(entities[i].name);
+                if (strncmp(p + 1, entities[i].name, len) == 0) {
+                    *q++ = entities[i].c;
+                    p += len + 1;
+                    decoded = true;
+                    break;
+                }
+            }
+        }
+        if (!decoded) {
+            *q++ = *p++;
+        }
+    }
+    *q = '\0';
+}
+
+// Copies `src` to `dst` with leading/trailing whitespace removed and inner
+// runs collapsed to single spaces.
+static void copy_trimmed(char *dst, size_t dst_len, const char *src) {
+    size_t n = 0;
+    bool space = false;
+    for (; *src && n + 1 < dst_len; src++) {
+        if (isspace((unsigned char)*src)) {
+            space = n > 0;
+            continue;
+        }
+        if (space && n + 2 < dst_len) dst[n++] = ' ';
+        space = false;
+        dst[n++] = *src;
+    }
+    dst[n] = '\0';
+}
+
+// Element name of a tag ("dc:title" -> "title", "/dc:title" -> "title").
+// Sets *closing for end tags and returns the length of the local name.
+static size_t tag_local_name(const char *tag, const char **name, bool *closing) {
+    *closing = tag[0] == '/';
+    const char *start = tag + (*closing ? 1 : 0);
+    const char *end = start;
+    while (*end && !isspace((unsigned char)*end) && *end != '/' && *end != '>') end++;
+    const char *colon = memchr(start, ':', end - start);
+    if (colon) start = colon + 1;
+    *name = start;
+    return end - start;
+}
+
+static bool name_is(const char *name, size_t len, const char *want) {
+    return strlen(want) == len && strncmp(name, want, len) == 0;
+}
+
+// Copies the value of attribute `attr` (matched on its local name) into `out`.
+static bool tag_attr(const char *tag, const char *attr, char *out, size_t out_len) {
+    size_t attr_len = strlen(attr);
+    const char *p = tag;
+    while ((p = strstr(p, attr)) != NULL) {
+        bool starts_name = p > tag && (isspace((unsigned char)p[-1]) || p[-1] == ':');
+        const char *v = p + attr_len;
+        p = v;
+        if (!starts_name) continue;
+        while (isspace((unsigned char)*v)) v++;
+        if (*v != '=') continue;
+        v++;
+        while (isspace((unsigned char)*v)) v++;
+        if (*v != '"' && *v != '\'') continue;
+        const char *end = strchr(v + 1, *v);
+        if (!end) return false;
+        size_t len = end - (v + 1);
+        if (len >= out_len) len = out_len - 1;
+        memcpy(out, v + 1, len);
+        out[len] = '\0';
+        xml_unescape(out);
+        return true;
+    }
+    return false;
+}
+
+// Collects character data for the field being read, if any.
+static void xml_text(opf_parser_t *p, char c) {
+    if (p->field != FIELD_NONE && p->text_len + 1 < sizeof(p->text)) {
+        p->text[p->text_len++] = c;
+    }
+}
+
+// Feeds one chunk of a document through the scanner. Tags are handed to
+// p->on_tag; character data is collected while p->field is set.
+static void xml_feed(opf_parser_t *p, const char *buf, size_t len) {
+    for (size_t i = 0; i < len && !p->done; i++) {
+        char c = buf[i];
+        switch (p->state) {
+            case XML_TEXT:
+                if (c == '<') {
+                    p->state = XML_TAG;
+                    p->tag_len = 0;
+                    p->quote = 0;
+                    // Markup inside a field (e.g. <p> in a description) separates words
+                    xml_text(p, ' ');
+                } else {
+                    xml_text(p, c);
+                }
+                break;
+
+            case XML_TAG:
+                if (p->quote) {
+                    if (c == p->quote) p->quote = 0;
+                } else if (c == '"' || c == '\'') {
+                    p->quote = c;
+                } else if (c == '>') {
+                    p->tag[p->tag_len] = '\0';
+                    p->state = XML_TEXT;
+                    if (p->tag[0] != '?' && p->tag[0] != '!') {
+                        p->on_tag(p, p->tag, p->tag_len);
+                    }
+                    break;
+                }
+                if (p->tag_len + 1 < sizeof(p->tag)) {
+                    p->tag[p->tag_len++] = c;
+                }
+                if (p->tag_len == 3 && memcmp(p->tag, "!--", 3) == 0) {
+                    p->state = XML_COMMENT;
+                    p->match = 0;
+                } else if (p->tag_len == 8 && memcmp(p->tag, "![CDATA[", 8) == 0) {
+                    p->state = XML_CDATA;
+                    p->match = 0;
+                }
+                break;
+
+            case XML_COMMENT:
+                // Looking for "-->"
+                if (c == '-') {
+                    if (p->match < 2) p->match++;
+                } else if (c == '>' && p->match == 2) {
+                    p->state = XML_TEXT;
+                } else {
+                    p->match = 0;
+                }
+                break;
+
+            case XML_CDATA:
+                // Looking for "]]>"; everything else is character data
+                if (c == ']') {
+                    if (p->match < 2) p->match++;
+                    else xml_text(p, ']');
+                } else if (c == '>' && p->match == 2) {
+                    p->state = XML_TEXT;
+                } else {
+                    for (; p->match > 0; p->match--) xml_text(p, ']');
+                    xml_text(p, c);
+                }
+                break;
+        }
+    }
+}
+
+static size_t xml_extract_cb(void *opaque, mz_uint64 file_ofs, const void *buf, size_t n) {
+    (void)file_ofs;
+    opf_parser_t *p = opaque;
+    xml_feed(p, buf, n);
+    // Returning short stops miniz from inflating the rest of the file
+    return p->done ? 0 : n;
+}
+
+// --- container.xml ---
+static void container_on_tag(opf_parser_t *p, const char *tag, size_t len) {
+    (void)len;
+    const char *name;
+    bool closing;
+    size_t name_len = tag_local_name(tag, &name, &closing);
+    if (!closing && name_is(name, name_len, "rootfile") &&
+        tag_attr(tag, "full-path", p->opf_path, sizeof(p->opf_path))) {
+        p->done = true;
+    }
+}
+
+// --- OPF Package ---
+static char *field_buffer(epub_metadata_t *meta, opf_field_t field, size_t *len) {
+    switch (field) {
+        case FIELD_TITLE:      *len = sizeof(meta->title); return meta->title;
+        case FIELD_CREATOR:    *len = sizeof(meta->author); return meta->author;
+        case FIELD_LANGUAGE:   *len = sizeof(meta->language); return meta->language;
+        case FIELD_IDENTIFIER: *len = sizeof(meta->identifier); return meta->identifier;
+        case FIELD_DESCRIPTION: *len = sizeof(meta->description); return meta->description;
+        default:               *len = 0; return NULL;
+    }
+}
+
+static opf_field_t field_for(const char *name, size_t len) {
+    if (name_is(name, len, "title")) return FIELD_TITLE;
+    if (name_is(name, len, "creator")) return FIELD_CREATOR;
+    if (name_is(name, len, "language")) return FIELD_LANGUAGE;
+    if (name_is(name, len, "identifier")) return FIELD_IDENTIFIER;
+    if (name_is(name, len, "description")) return FIELD_DESCRIPTION;
+    return FIELD_NONE;
+}
+
+// Stores the collected text of the element that just closed.
+static void opf_finish_field(opf_parser_t *p) {
+    size_t dst_len;
+    char *dst = field_buffer(p->meta, p->field, &dst_len);
+    p->text[p->text_len] = '\0';
+    xml_unescape(p->text);
+    if (p->field == FIELD_DESCRIPTION) {
+        // Descriptions are usually escaped HTML
+        epub_strip_markup(dst, dst_len, p->text);
+    } else {
+        copy_trimmed(dst, dst_len, p->text);
+    }
+    p->field = FIELD_NONE;
+}
+
+static void opf_on_tag(opf_parser_t *p, const char *tag, size_t len) {
+    const char *name;
+    bool closing;
+    size_t name_len = tag_local_name(tag, &name, &closing);
+    bool self_closing = len > 0 && tag[len - 1] == '/';
+
+    if (name_is(name, name_len, "metadata")) {
+        p->in_metadata = !closing;
+        return;
+    }
+    if (name_is(name, name_len, "manifest")) {
+        p->in_manifest = !closing && !self_closing;
+        if (closing) p->done = true;
+        return;
+    }
+
+    if (p->in_metadata) {
+        opf_field_t field = field_for(name, name_len);
+        if (closing) {
+            if (field != FIELD_NONE && field == p->field) {
+                opf_finish_field(p);
+            }
+        } else if (field != FIELD_NONE && !self_closing && p->field == FIELD_NONE) {
+            // Only the first of repeated elements (e.g. several creators) is kept
+            size_t dst_len;
+            char *dst = field_buffer(p->meta, field, &dst_len);
+            if (dst[0] == '\0') {
+                p->field = field;
+                p->text_len = 0;
+            }
+        } else if (!closing && name_is(name, name_len, "meta")) {
+            // EPUB 2: <meta name="cover" content="manifest-id"/>
+            char attr[16];
+            if (tag_attr(tag, "name", attr, sizeof(attr)) && strcmp(attr, "cover") == 0) {
+                tag_attr(tag, "content", p->cover_id, sizeof(p->cover_id));
+            }
+        }
+        return;
+    }
+
+    if (p->in_manifest && !closing && name_is(name, name_len, "item") && !p->cover_is_image) {
+        char value[EPUB_META_PATH_MAX];
+        // EPUB 3 marks the cover with a property, which wins over the EPUB 2 meta
+        if (tag_attr(tag, "properties", value, sizeof(value)) && strstr(value, "cover-image")) {
+            tag_attr(tag, "href", p->cover_href, sizeof(p->cover_href));
+            p->cover_is_image = true;
+        } else if (p->cover_id[0] && p->cover_href[0] == '\0' &&
+                   tag_attr(tag, "id", value, sizeof(value)) && strcmp(value, p->cover_id) == 0) {
+            tag_attr(tag, "href", p->cover_href, sizeof(p->cover_href));
+        }
+    }
+}
+
+// Resolves a manifest href against the directory of the OPF into a path
+// inside the archive, decoding %XX escapes and "." / ".." segments.
+static void resolve_href(const char *opf_path, const char *href, char *out, size_t out_len) {
+    char joined[EPUB_META_PATH_MAX * 2];
+    const char *slash = strrchr(opf_path, '/');
+    int dir_len = slash ? (int)(slash - opf_path + 1) : 0;
+    snprintf(joined, sizeof(joined), "%.*s%s", dir_len, opf_path, href);
+
+    size_t n = 0;
+    const char *p = joined;
+    while (*p && n + 1 < out_len) {
+        // At the start of a segment, handle "./" and "../"
+        if (n == 0 || out[n - 1] == '/') {
+            if (strncmp(p, "./", 2) == 0) { p += 2; continue; }
+            if (strncmp(p, "../", 3) == 0) {
+                p += 3;
+                if (n > 0) n--;
+                while (n > 0 && out[n - 1] != '/') n--;
+                continue;
+            }
+        }
+        if (*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+            char hex[3] = { p[1], p[2], '\0' };
+            out[n++] = (char)strtol(hex, NULL, 16);
+            p += 3;
+        } else if (*p == '#' || *p == '?') {
+            break;
+        } else {
+            out[n++] = *p++;
+        }
+    }
+    out[n] = '\0';
+}
+
+// Finds the package document: the container's rootfile, or failing that the
+// first .opf entry in the archive.
+static bool locate_opf(mz_zip_archive *zip, opf_parser_t *p) {
+    int index = mz_zip_reader_locate_file(zip, CONTAINER_PATH, NULL, 0);
+    if (index >= 0) {
+        p->on_tag = container_on_tag;
+        mz_zip_reader_extract_to_callback(zip, index, xml_extract_cb, p, 0);
+        if (p->opf_path[0] != '\0') {
+            return true;
+        }
+    }
+
+    mz_uint count = mz_zip_reader_get_num_files(zip);
+    for (mz_uint i = 0; i < count; i++) {
+        char name[EPUB_META_PATH_MAX];
+        mz_zip_reader_get_filename(zip, i, name, sizeof(name));
+        size_t len = strlen(name);
+        if (len > 4 && strcasecmp(name + len - 4, ".opf") == 0) {
+            strlcpy(p->opf_path, name, sizeof(p->opf_path));
+            return true;
+        }
+    }
+    return false;
+}
+
+// miniz allocates the central directory and, per extracted entry, an
+// inflater with its 32 KiB dictionary. None of it is DMA'd, so keep it out
+// of the internal heap when PSRAM is available.
+static void *zip_alloc(void *opaque, size_t items, size_t size) {
+    (void)opaque;
+    return mem_pool_meta_alloc(items * size);
+}
+
+static void *zip_realloc(void *opaque, void *address, size_t items, size_t size) {
+    (void)opaque;
+    return mem_pool_meta_realloc(address, items * size);
+}
+
+static void zip_free(void *opaque, void *address) {
+    (void)opaque;
+    mem_pool_meta_free(address);
+}
+
+esp_err_t epub_read_metadata(const char *path, epub_metadata_t *meta) {
+    memset(meta, 0, sizeof(*meta));
+
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    zip_archive.m_pAlloc = zip_alloc;
+    zip_archive.m_pRealloc = zip_realloc;
+    zip_archive.m_pFree = zip_free;
+    if (!mz_zip_reader_init_file(&zip_archive, path, 0)) {
+        ESP_LOGW(TAG, "Failed to open EPUB archive: %s", path);
+        return ESP_FAIL;
+    }
+
+    // Kept off the caller's stack; the scanner and httpd tasks both parse books
+    opf_parser_t *p = mem_pool_meta_alloc(sizeof(*p));
+    if (!p) {
+        mz_zip_reader_end(&zip_archive);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(p, 0, sizeof(*p));
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    int index;
+    if (!locate_opf(&zip_archive, p) ||
+        (index = mz_zip_reader_locate_file(&zip_archive, p->opf_path, NULL, 0)) < 0) {
+        ESP_LOGW(TAG, "No OPF found in %s", path);
+    } else {
+        p->state = XML_TEXT;
+        p->done = false;
+        p->on_tag = opf_on_tag;
+        p->meta = meta;
+        mz_zip_reader_extract_to_callback(&zip_archive, index, xml_extract_cb, p, 0);
+        if (p->cover_href[0] != '\0') {
+            resolve_href(p->opf_path, p->cover_href, meta->cover, sizeof(meta->cover));
+        }
+        ret = ESP_OK;
+    }
+
+    mem_pool_meta_free(p);
+    mz_zip_reader_end(&zip_archive);
+    return ret;
+}
+
+void epub_strip_markup(char *dst, size_t dst_len, const char *src) {
+    size_t n = 0;
+    bool in_tag = false;
+    bool pending_space = false;
+    for (const char *p = src; *p && n + 1 < dst_len; p++) {
+        if (in_tag) {
+            if (*p == '>') {
+                in_tag = false;
+                pending_space = true; // Tags such as <p> separate words
+            }
+            continue;
+        }
+        if (*p == '<') {
+            in_tag = true;
+        } else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            pending_space = true;
+        } else {
+            if (pending_space && n > 0 && n + 2 < dst_len) {
+                dst[n++] = ' ';
+            }
+            pending_space = false;
+            dst[n++] = *p;
+        }
+    }
+    dst[n] = '\0';
+}
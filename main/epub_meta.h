@@ -0,0 +1,34 @@
+#ifndef EPUB_META_H
+#define EPUB_META_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define EPUB_META_TITLE_MAX  256
+#define EPUB_META_AUTHOR_MAX 128
+#define EPUB_META_DESC_MAX   512
+#define EPUB_META_LANG_MAX   16
+#define EPUB_META_ID_MAX     96
+#define EPUB_META_PATH_MAX   128
+
+typedef struct {
+    char title[EPUB_META_TITLE_MAX];
+    char author[EPUB_META_AUTHOR_MAX];
+    char description[EPUB_META_DESC_MAX];   // Plain text, markup stripped, may be truncated
+    char language[EPUB_META_LANG_MAX];      // e.g. "en" or "fr-CA"
+    char identifier[EPUB_META_ID_MAX];      // First dc:identifier, e.g. an ISBN or UUID URN
+    char cover[EPUB_META_PATH_MAX];         // Path of the cover image inside the archive
+} epub_metadata_t;
+
+// Opens the EPUB at `path`, finds its OPF through META-INF/container.xml and
+// extracts the first dc:title, dc:creator, dc:language, dc:identifier and
+// dc:description along with the cover image reference, in one streaming pass.
+// Fields that cannot be found are left as empty strings.
+esp_err_t epub_read_metadata(const char *path, epub_metadata_t *meta);
+
+// Copies `src` into `dst` with HTML tags removed and runs of whitespace
+// collapsed. Descriptions from both OPF files and Calibre contain markup.
+void epub_strip_markup(char *dst, size_t dst_len, const char *src);
+
+#endif // EPUB_META_H
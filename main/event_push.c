@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "event_push.h"
+
+static const char *TAG = "event_push";
+
+static httpd_handle_t g_server = NULL;
+static volatile bool g_has_clients = false;
+
+// Runs on the HTTP server task, which owns the sockets.
+static void send_to_clients(void *arg) {
+    char *json = arg;
+    size_t fd_count = CONFIG_LWIP_MAX_SOCKETS;
+    int fds[CONFIG_LWIP_MAX_SOCKETS];
+
+    if (httpd_get_client_list(g_server, &fd_count, fds) != ESP_OK) {
+        free(json);
+        return;
+    }
+
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)json,
+        .len = strlen(json),
+    };
+    int sent = 0;
+    for (size_t i = 0; i < fd_count && sent < EVENT_PUSH_MAX_CLIENTS; i++) {
+        if (httpd_ws_get_fd_info(g_server, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) {
+            continue;
+        }
+        if (httpd_ws_send_frame_async(g_server, fds[i], &frame) == ESP_OK) {
+            sent++;
+        } else {
+            ESP_LOGD(TAG, "Send to fd %d failed", fds[i]);
+        }
+    }
+    if (sent == 0) {
+        g_has_clients = false;
+    }
+    free(json);
+}
+
+static esp_err_t ws_handler(httpd_req_t *req) {
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "Event client connected");
+        g_has_clients = true;
+        return ESP_OK;
+    }
+
+    // Clients never send anything meaningful; drain the frame and drop it.
+    // The length comes from the client, so it is not trusted with the heap.
+    httpd_ws_frame_t frame = { 0 };
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if (ret != ESP_OK || frame.len == 0) {
+        return ret;
+    }
+    if (frame.len > EVENT_PUSH_MAX_FRAME) {
+        ESP_LOGW(TAG, "Dropping client that sent a %u byte frame", (unsigned)frame.len);
+        return ESP_FAIL;    // Closes the connection
+    }
+    uint8_t buf[EVENT_PUSH_MAX_FRAME];
+    frame.payload = buf;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+esp_err_t event_push_register(httpd_handle_t server) {
+    g_server = server;
+    httpd_uri_t ws_uri = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = ws_handler,
+        .user_ctx = NULL,
+        .is_websocket = true,
+    };
+    return httpd_register_uri_handler(server, &ws_uri);
+}
+
+esp_err_t event_push_send(const char *json) {
+    if (!g_server || !g_has_clients) {
+        return ESP_OK;
+    }
+    char *copy = strdup(json);
+    if (!copy) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = httpd_queue_work(g_server, send_to_clients, copy);
+    if (err != ESP_OK) {
+        free(copy);
+    }
+    return err;
+}
+
+esp_err_t event_push_defer(httpd_work_fn_t fn, void *arg) {
+    if (!g_server || !g_has_clients) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return httpd_queue_work(g_server, fn, arg);
+}
+
+bool event_push_has_clients(void) {
+    return g_has_clients;
+}
@@ -0,0 +1,30 @@
+#ifndef EVENT_PUSH_H
+#define EVENT_PUSH_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Most WebSocket clients that receive pushed events at once
+#define EVENT_PUSH_MAX_CLIENTS 4
+// Largest frame accepted from a client; a longer one closes its connection
+#define EVENT_PUSH_MAX_FRAME   128
+
+// Registers the /ws WebSocket endpoint on `server`. Events are pushed to
+// every client that has completed the handshake.
+esp_err_t event_push_register(httpd_handle_t server);
+
+// Sends a JSON text frame to all connected clients. The message is copied
+// and sent from the HTTP server task, so this may be called from any task.
+// It is a no-op while no client is connected.
+esp_err_t event_push_send(const char *json);
+
+// Runs `fn(arg)` on the HTTP server task, so an event can be built there
+// instead of on the caller, e.g. an esp_timer callback that must stay short.
+// Returns ESP_ERR_INVALID_STATE, without queueing it, while no client is connected.
+esp_err_t event_push_defer(httpd_work_fn_t fn, void *arg);
+
+// True once at least one client has connected; cleared when a send finds none.
+bool event_push_has_clients(void);
+
+#endif // EVENT_PUSH_H
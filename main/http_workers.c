@@ -0,0 +1,110 @@
+/*
+ * Worker pool for slow HTTP handlers.
+ *
+ * esp_http_server runs every handler on its single task, so one client
+ * listing a large library or downloading a book stalls everybody else,
+ * including the cheap /status polls. Handlers registered here are detached
+ * with httpd_req_async_handler_begin() and run on a small pool of worker
+ * tasks instead; the server task is free again as soon as the request is
+ * queued. The socket stays open until the worker completes the request.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+
+#include "http_workers.h"
+#include "metrics.h"
+
+static const char *TAG = "http_workers";
+
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *req);
+    void *user_ctx;
+} http_slot_t;
+
+typedef struct {
+    httpd_req_t *req;       // Async copy owned by the worker
+    const http_slot_t *slot;
+} http_work_t;
+
+static http_slot_t g_slots[HTTP_WORKERS_MAX_HANDLERS];
+static size_t g_slot_count;
+static QueueHandle_t g_queue = NULL;
+
+static void http_worker_task(void *arg) {
+    http_work_t work;
+    while (true) {
+        if (xQueueReceive(g_queue, &work, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        work.req->user_ctx = work.slot->user_ctx;
+        work.slot->handler(work.req);
+        httpd_req_async_handler_complete(work.req);
+    }
+}
+
+static esp_err_t dispatch_handler(httpd_req_t *req) {
+    const http_slot_t *slot = (const http_slot_t *)req->user_ctx;
+    http_work_t work = { .slot = slot };
+    if (httpd_req_async_handler_begin(req, &work.req) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    if (xQueueSend(g_queue, &work, 0) != pdTRUE) {
+        // Answer on the copy: the original is invalid once it has been detached
+        ESP_LOGW(TAG, "All workers busy, rejecting %s", req->uri);
+        httpd_resp_set_status(work.req, "503 Service Unavailable");
+        httpd_resp_set_hdr(work.req, "Retry-After", "1");
+        httpd_resp_send(work.req, "Server busy.", HTTPD_RESP_USE_STRLEN);
+        httpd_req_async_handler_complete(work.req);
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_workers_init(const http_workers_config_t *config) {
+    if (g_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    g_queue = xQueueCreate(config->queue_length, sizeof(http_work_t));
+    if (!g_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < config->worker_count; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "http_worker%u", (unsigned)i);
+        if (xTaskCreatePinnedToCore(http_worker_task, name, config->task_stack_size, NULL,
+                                    config->task_priority, NULL, config->core_id) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start %s", name);
+            if (i > 0) {
+                return ESP_OK;
+            }
+            // Nothing would read the queue; register handlers on the server task instead
+            vQueueDelete(g_queue);
+            g_queue = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_workers_register(httpd_handle_t server, const httpd_uri_t *uri) {
+    if (!g_queue || g_slot_count >= HTTP_WORKERS_MAX_HANDLERS) {
+        // Still serve it, just on the server task
+        ESP_LOGW(TAG, "Running %s on the server task", uri->uri);
+        return metrics_register_handler(server, uri);
+    }
+    httpd_uri_t timed;
+    metrics_wrap_handler(uri, &timed);
+    http_slot_t *slot = &g_slots[g_slot_count++];
+    slot->handler = timed.handler;
+    slot->user_ctx = timed.user_ctx;
+
+    httpd_uri_t dispatched = *uri;
+    dispatched.handler = dispatch_handler;
+    dispatched.user_ctx = slot;
+    return httpd_register_uri_handler(server, &dispatched);
+}
@@ -0,0 +1,31 @@
+#ifndef HTTP_WORKERS_H
+#define HTTP_WORKERS_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_http_server.h"
+
+// Handlers that can be dispatched to the pool
+#define HTTP_WORKERS_MAX_HANDLERS 12
+
+typedef struct {
+    uint32_t worker_count;
+    uint32_t task_stack_size;
+    int task_priority;
+    // Core the workers are pinned to, or tskNO_AFFINITY
+    BaseType_t core_id;
+    // Requests that may wait for a free worker. Beyond that new slow
+    // requests are answered with 503 straight away.
+    uint32_t queue_length;
+} http_workers_config_t;
+
+// Starts the worker tasks. Must be called before http_workers_register().
+esp_err_t http_workers_init(const http_workers_config_t *config);
+
+// Registers a slow handler on `server`. The server task only detaches the
+// request and queues it; a worker runs `uri->handler` (timed for /metrics)
+// while the server goes on answering other clients.
+esp_err_t http_workers_register(httpd_handle_t server, const httpd_uri_t *uri);
+
+#endif // HTTP_WORKERS_H
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "json_stream.h"
+
+static void js_flush(json_stream_t *js) {
+    if (!js->flush) {
+        return;
+    }
+    if (js->err == ESP_OK && js->len > 0) {
+        js->err = js->flush(js->ctx, js->buf, js->len);
+    }
+    js->len = 0;
+}
+
+static void js_write(json_stream_t *js, const char *data, size_t len) {
+    while (len > 0 && js->err == ESP_OK) {
+        size_t space = js->cap - js->len;
+        if (space == 0) {
+            if (!js->flush) {
+                js->err = ESP_ERR_NO_MEM;
+                break;
+            }
+            js_flush(js);
+            continue;
+        }
+        size_t n = len < space ? len : space;
+        memcpy(js->buf + js->len, data, n);
+        js->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void js_putc(json_stream_t *js, char c) {
+    js_write(js, &c, 1);
+}
+
+static void js_write_escaped(json_stream_t *js, const char *s) {
+    js_putc(js, '"');
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        js_write(js, run, s - run);
+        run = s + 1;
+        switch (c) {
+            case '"':  js_write(js, "\\\"", 2); break;
+            case '\\': js_write(js, "\\\\", 2); break;
+            case '\n': js_write(js, "\\n", 2); break;
+            case '\r': js_write(js, "\\r", 2); break;
+            case '\t': js_write(js, "\\t", 2); break;
+            default: {
+                char esc[7];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                js_write(js, esc, 6);
+                break;
+            }
+        }
+    }
+    js_write(js, run, s - run);
+    js_putc(js, '"');
+}
+
+static void js_separator(json_stream_t *js) {
+    if (js->need_comma) {
+        js_putc(js, ',');
+    }
+    js->need_comma = true;
+}
+
+void json_stream_init(json_stream_t *js, char *buf, size_t cap, json_stream_flush_fn_t flush, void *ctx) {
+    js->buf = buf;
+    js->cap = cap;
+    js->len = 0;
+    js->flush = flush;
+    js->ctx = ctx;
+    js->err = ESP_OK;
+    js->need_comma = false;
+}
+
+void json_stream_begin_array(json_stream_t *js) {
+    js_separator(js);
+    js_putc(js, '[');
+    js->need_comma = false;
+}
+
+void json_stream_end_array(json_stream_t *js) {
+    js_putc(js, ']');
+    js->need_comma = true;
+}
+
+void json_stream_begin_object(json_stream_t *js) {
+    js_separator(js);
+    js_putc(js, '{');
+    js->need_comma = false;
+}
+
+void json_stream_end_object(json_stream_t *js) {
+    js_putc(js, '}');
+    js->need_comma = true;
+}
+
+void json_stream_key(json_stream_t *js, const char *key) {
+    js_separator(js);
+    js_putc(js, '"');
+    js_write(js, key, strlen(key));
+    js_write(js, "\":", 2);
+    // The value that follows must not be preceded by a comma
+    js->need_comma = false;
+}
+
+void json_stream_string(json_stream_t *js, const char *key, const char *value) {
+    json_stream_key(js, key);
+    if (value) {
+        js_write_escaped(js, value);
+    } else {
+        js_write(js, "null", 4);
+    }
+    js->need_comma = true;
+}
+
+void json_stream_int(json_stream_t *js, const char *key, int64_t value) {
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%" PRId64, value);
+    json_stream_key(js, key);
+    js_write(js, num, n);
+    js->need_comma = true;
+}
+
+void json_stream_bool(json_stream_t *js, const char *key, bool value) {
+    json_stream_key(js, key);
+    if (value) js_write(js, "true", 4);
+    else js_write(js, "false", 5);
+    js->need_comma = true;
+}
+
+esp_err_t json_stream_finish(json_stream_t *js) {
+    js_flush(js);
+    return js->err;
+}
+
+json_stream_mark_t json_stream_mark(const json_stream_t *js) {
+    return (json_stream_mark_t){ .len = js->len, .need_comma = js->need_comma };
+}
+
+void json_stream_rewind(json_stream_t *js, json_stream_mark_t mark) {
+    js->len = mark.len;
+    js->need_comma = mark.need_comma;
+    js->err = ESP_OK;
+}
@@ -0,0 +1,54 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Called whenever the stream buffer fills up (and on json_stream_finish()).
+typedef esp_err_t (*json_stream_flush_fn_t)(void *ctx, const char *data, size_t len);
+
+// A small fixed-size JSON writer. Output is accumulated in `buf` and handed to
+// `flush` in chunks, so rendering a listing of any length needs only one buffer.
+// After the first flush error every further write is a no-op and `err` is kept.
+// With `flush` NULL the output stays in `buf`, and a write that does not fit
+// fails with ESP_ERR_NO_MEM; json_stream_rewind() can then undo it.
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    json_stream_flush_fn_t flush;
+    void *ctx;
+    esp_err_t err;
+    bool need_comma;
+} json_stream_t;
+
+void json_stream_init(json_stream_t *js, char *buf, size_t cap, json_stream_flush_fn_t flush, void *ctx);
+
+void json_stream_begin_array(json_stream_t *js);
+void json_stream_end_array(json_stream_t *js);
+void json_stream_begin_object(json_stream_t *js);
+void json_stream_end_object(json_stream_t *js);
+
+// Object members. `key` is written verbatim and must not need escaping.
+void json_stream_key(json_stream_t *js, const char *key);
+void json_stream_string(json_stream_t *js, const char *key, const char *value);
+void json_stream_int(json_stream_t *js, const char *key, int64_t value);
+void json_stream_bool(json_stream_t *js, const char *key, bool value);
+
+// Flushes whatever is left in the buffer and returns the first error seen.
+esp_err_t json_stream_finish(json_stream_t *js);
+
+// A position in the buffer of a stream without a flush callback.
+typedef struct {
+    size_t len;
+    bool need_comma;
+} json_stream_mark_t;
+
+json_stream_mark_t json_stream_mark(const json_stream_t *js);
+
+// Drops everything written since `mark` and clears the error.
+void json_stream_rewind(json_stream_t *js, json_stream_mark_t mark);
+
+#endif // JSON_STREAM_H
@@ -0,0 +1,203 @@
+/*
+ * JSON rendering of catalog rows for /list-files and /search.
+ *
+ * Kept apart from the HTTP handlers so the benchmark suite and the host
+ * build time exactly the rows the web UI receives.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "listing.h"
+
+// "cover" is the key to fetch from /cover/<key>; absent when there is no thumbnail
+static void add_cover_key(json_stream_t *js, const catalog_entry_t *entry) {
+    if (entry->thumb >= 0) {
+        char key[9];
+        snprintf(key, sizeof(key), "%08" PRIX32, (uint32_t)entry->thumb);
+        json_stream_string(js, "cover", key);
+    }
+}
+
+static void add_fields(json_stream_t *js, const catalog_entry_t *entry) {
+    json_stream_string(js, "name", entry->name);
+    json_stream_string(js, "title", entry->title ? entry->title : entry->name);
+    json_stream_string(js, "author", entry->author ? entry->author : "");
+    if (entry->description) json_stream_string(js, "description", entry->description);
+    add_cover_key(js, entry);
+    json_stream_int(js, "size", entry->size);
+}
+
+bool listing_add_entry(const catalog_entry_t *entry, void *ctx) {
+    json_stream_t *js = (json_stream_t *)ctx;
+    json_stream_begin_object(js);
+    add_fields(js, entry);
+    json_stream_end_object(js);
+    return js->err == ESP_OK;
+}
+
+bool listing_add_search_entry(const catalog_entry_t *entry, void *ctx) {
+    json_stream_t *js = (json_stream_t *)ctx;
+    json_stream_begin_object(js);
+    json_stream_string(js, "volume", entry->volume);
+    add_fields(js, entry);
+    json_stream_end_object(js);
+    return js->err == ESP_OK;
+}
+
+// --- Pages sent outside the catalog lock ---
+typedef struct listing_spool listing_spool_t;
+
+// Runs the next batch of at most `limit` rows through spool_row()
+typedef esp_err_t (*spool_query_fn_t)(listing_spool_t *spool, uint32_t limit);
+
+struct listing_spool {
+    json_stream_t js;
+    catalog_row_cb_t render;
+    spool_query_fn_t query;
+    const catalog_query_t *list;    // Set for a listing
+    struct search_page *search;     // Set for a search
+    json_stream_flush_fn_t send;
+    void *ctx;
+    uint32_t sent;              // Rows sent so far
+    uint32_t batch;             // Rows in the buffer
+    bool full;                  // The last batch stopped at a row that did not fit
+    char last[128];             // Name of the last row in the buffer
+};
+
+static bool spool_row(const catalog_entry_t *entry, void *ctx) {
+    listing_spool_t *spool = ctx;
+    json_stream_mark_t mark = json_stream_mark(&spool->js);
+    spool->render(entry, &spool->js);
+    if (spool->js.err == ESP_ERR_NO_MEM && !spool->js.flush) {
+        json_stream_rewind(&spool->js, mark);
+        spool->full = true;
+        return false;
+    }
+    if (spool->js.err != ESP_OK) {
+        return false;
+    }
+    spool->batch++;
+    strlcpy(spool->last, entry->name, sizeof(spool->last));
+    return true;
+}
+
+static esp_err_t spool_send(listing_spool_t *spool) {
+    esp_err_t err = spool->js.len ? spool->send(spool->ctx, spool->js.buf, spool->js.len) : ESP_OK;
+    spool->js.len = 0;
+    spool->sent += spool->batch;
+    spool->batch = 0;
+    return err;
+}
+
+// Streams the next row straight to the client, for one too large to buffer
+static esp_err_t spool_stream_row(listing_spool_t *spool) {
+    spool->js.flush = spool->send;
+    spool->js.ctx = spool->ctx;
+    esp_err_t ret = spool->query(spool, 1);
+    esp_err_t err = json_stream_finish(&spool->js);
+    spool->js.flush = NULL;
+    spool->js.err = ESP_OK;
+    spool->sent += spool->batch;
+    spool->batch = 0;
+    spool->full = true;
+    return err != ESP_OK ? err : ret;
+}
+
+static esp_err_t spool_run(listing_spool_t *spool, uint32_t limit) {
+    json_stream_begin_array(&spool->js);
+    esp_err_t ret = ESP_OK;
+    esp_err_t err = ESP_OK;
+    do {
+        spool->full = false;
+        ret = spool->query(spool, limit - spool->sent);
+        if (ret == ESP_ERR_NOT_FOUND && spool->sent == 0) {
+            return ret;     // Nothing has been sent yet
+        }
+        if (spool->full && spool->batch == 0) {
+            err = spool_send(spool);
+            if (err == ESP_OK) {
+                err = spool_stream_row(spool);
+            }
+        } else {
+            err = spool_send(spool);
+        }
+    } while (err == ESP_OK && ret == ESP_OK && spool->full && spool->sent < limit);
+
+    // A later batch that lost its cursor row just ends the page early
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ret = ESP_OK;
+    }
+    if (err == ESP_OK) {
+        json_stream_end_array(&spool->js);
+        err = spool_send(spool);
+    }
+    return err != ESP_OK ? err : ret;
+}
+
+static void spool_init(listing_spool_t *spool, char *buf, size_t cap, json_stream_flush_fn_t send, void *ctx) {
+    memset(spool, 0, sizeof(*spool));
+    json_stream_init(&spool->js, buf, cap, NULL, NULL);
+    spool->send = send;
+    spool->ctx = ctx;
+}
+
+static esp_err_t query_page(listing_spool_t *spool, uint32_t limit) {
+    catalog_query_t query = *spool->list;
+    // spool->last is rewritten by the rows of this batch
+    char after[sizeof(spool->last)];
+    if (spool->sent > 0) {
+        strlcpy(after, spool->last, sizeof(after));
+        query.after = after;
+    }
+    query.limit = limit;
+    return catalog_query(&query, spool_row, spool);
+}
+
+// The ranked ids of a search page, read back in batches
+typedef struct search_page {
+    int64_t ids[CATALOG_SEARCH_MAX_LIMIT];
+    uint32_t count;
+    uint32_t next;
+} search_page_t;
+
+static esp_err_t query_search(listing_spool_t *spool, uint32_t limit) {
+    search_page_t *page = spool->search;
+    uint32_t n = page->count - page->next;
+    uint32_t used;
+    esp_err_t ret = catalog_get_rows(page->ids + page->next, n < limit ? n : limit, spool_row, spool, &used);
+    page->next += used;
+    return ret;
+}
+
+esp_err_t listing_send_page(const catalog_query_t *query, char *buf, size_t cap,
+                            json_stream_flush_fn_t send, void *ctx) {
+    listing_spool_t spool;
+    spool_init(&spool, buf, cap, send, ctx);
+    spool.render = listing_add_entry;
+    spool.query = query_page;
+    spool.list = query;
+    uint32_t limit = query->limit;
+    if (limit == 0 || limit > CATALOG_QUERY_MAX_LIMIT) {
+        limit = CATALOG_QUERY_MAX_LIMIT;
+    }
+    return spool_run(&spool, limit);
+}
+
+esp_err_t listing_send_search(const catalog_search_t *search, char *buf, size_t cap,
+                              json_stream_flush_fn_t send, void *ctx) {
+    // Rank once, then read the rows in batches by id
+    search_page_t page = { 0 };
+    esp_err_t ranked = catalog_search_ids(search, page.ids, &page.count);
+    if (ranked != ESP_OK && ranked != ESP_ERR_TIMEOUT) {
+        return ranked;
+    }
+    listing_spool_t spool;
+    spool_init(&spool, buf, cap, send, ctx);
+    spool.render = listing_add_search_entry;
+    spool.query = query_search;
+    spool.search = &page;
+    esp_err_t ret = spool_run(&spool, page.count);
+    return ret != ESP_OK ? ret : ranked;
+}
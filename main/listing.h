@@ -0,0 +1,31 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdbool.h>
+#include "catalog.h"
+#include "json_stream.h"
+
+// Renders one catalog row as a /list-files object into the json_stream_t
+// passed as `ctx`. Returns false once the stream has failed, so a listing
+// stops early when the client went away.
+bool listing_add_entry(const catalog_entry_t *entry, void *ctx);
+
+// The same for /search results, which also name the row's volume.
+bool listing_add_search_entry(const catalog_entry_t *entry, void *ctx);
+
+// Sends one page of `query` as a /list-files array through `send`. Rows are
+// rendered into `buf` while the catalog lock is held and sent once it has been
+// released, so a slow client never holds up the catalog; when `buf` fills the
+// query resumes after the last row in it. Only a row too large for `buf` on
+// its own is sent with the lock held. Returns ESP_ERR_NOT_FOUND, before
+// anything was sent, if the `after` row is gone.
+esp_err_t listing_send_page(const catalog_query_t *query, char *buf, size_t cap,
+                            json_stream_flush_fn_t send, void *ctx);
+
+// The same for a page of /search results. The page is ranked once, and its
+// rows are then read back in batches by id. Returns ESP_ERR_TIMEOUT once the
+// array is sent if the search was cut short.
+esp_err_t listing_send_search(const catalog_search_t *search, char *buf, size_t cap,
+                              json_stream_flush_fn_t send, void *ctx);
+
+#endif // LISTING_H
@@ -24,27 +24,52 @@
 
 // --- Standard and ESP-IDF Dependencies ---
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_sleep.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_app_desc.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_http_server.h"
 #include "esp_vfs_fat.h"
-#include "esp_spiffs.h"
 #include "sdmmc_cmd.h"
+#include "diskio_sdmmc.h"
+#include "diskio_impl.h"
+#include "driver/sdmmc_host.h"
 #include "cJSON.h"
 
 // --- Local Dependencies ---
 #include "dns_server.h"
+#include "catalog.h"
+#include "json_stream.h"
+#include "listing.h"
+#include "copy_engine.h"
+#include "transfer_queue.h"
+#include "storage_io.h"
+#include "bench.h"
+#include "metrics.h"
+#include "http_workers.h"
+#include "mem_pool.h"
+#include "power.h"
+#include "scanner.h"
+#include "thumbnail.h"
+#include "event_push.h"
+#include "web_assets.h"
 
 // --- USB Host Dependencies (from the official ESP-IDF stack) ---
 #include "esp_usb.h"
@@ -56,8 +81,6 @@
 #include "driver/gpio.h"
 #include "driver/rmt_tx.h"
 #include "led_strip.h"
-#include "miniz.h"
-#include "sqlite3.h"
 
 // --- Bluetooth Dependencies ---
 #include "esp_bt.h"
@@ -86,20 +109,212 @@
 #define PIN_NUM_CLK  18
 #define PIN_NUM_CS   5
 
+// Storage I/O profile. The fast profile clocks the card bus higher, lets the
+// SPI driver move larger DMA transfers, and sizes copy blocks to whole SD
+// clusters in sector-aligned, unbuffered buffers (see storage_io.c).
+// 0 restores the conservative settings the board was brought up with.
+#define STORAGE_FAST_IO 1
+// The reference board uses an SPI-only breakout. Boards that wire all four
+// data lines can use the SDMMC peripheral instead; the S3 routes it through
+// the GPIO matrix, so any free pins work.
+#define SD_USE_SDMMC       0
+#define SDMMC_BUS_WIDTH    4
+#define PIN_NUM_SDMMC_CLK  12
+#define PIN_NUM_SDMMC_CMD  11
+#define PIN_NUM_SDMMC_D0   13
+#define PIN_NUM_SDMMC_D1   14
+#define PIN_NUM_SDMMC_D2   9
+#define PIN_NUM_SDMMC_D3   10
+#if STORAGE_FAST_IO
+// SPI reads through the GPIO matrix are not reliable much above 26 MHz
+#define SD_SPI_FREQ_KHZ       26000
+#define SD_SPI_MAX_TRANSFER   (32 * 1024)
+#define SDMMC_FREQ_KHZ        SDMMC_FREQ_HIGHSPEED
+#define COPY_BLOCK_MAX        (64 * 1024)
+#else
+#define SD_SPI_FREQ_KHZ       SDMMC_FREQ_DEFAULT
+#define SD_SPI_MAX_TRANSFER   4000
+#define SDMMC_FREQ_KHZ        SDMMC_FREQ_DEFAULT
+#define COPY_BLOCK_MAX        COPY_BLOCK_SIZE
+#endif
+// Only used if the card is ever formatted by the firmware
+#define SD_ALLOCATION_UNIT    (64 * 1024)
+#define SD_MAX_FILES          5
+
 // USB mount point
 #define MOUNT_POINT_USB "/usb"
 
-// SPIFFS mount point for web assets
-#define MOUNT_POINT_SPIFFS "/spiffs"
+// Library catalog database (kept on the SD card)
+#define CATALOG_DB_PATH MOUNT_POINT_SD "/catalog.db"
+// Names of merged duplicates, kept outside the database so a rebuild keeps them
+#define CATALOG_ALIASES_PATH MOUNT_POINT_SD "/aliases.txt"
+
+// Size of the buffer JSON listings are rendered into. It is filled with the
+// catalog lock held and sent after, so a page goes out in a few batches of
+// rows; a row with a full description takes about 1 KiB.
+#define LIST_CHUNK_SIZE 4096
+
+// File copy pipeline: block size and number of blocks in flight.
+// Blocks come from DMA-capable internal RAM; the engine shrinks the block
+// size if the full ring cannot be allocated.
+#define COPY_BLOCK_SIZE  (32 * 1024)
+#define COPY_QUEUE_DEPTH 2
+// Re-syncs leave books that are already on the destination alone and pick
+// up interrupted copies where they stopped. Clients can opt out per job.
+#define COPY_SKIP_IDENTICAL true
+#define COPY_RESUME         true
+// Fresh copies reserve the destination's clusters up front in one run, so
+// the FAT is not extended block by block
+#define COPY_PREALLOCATE    true
+
+// BLE is only needed to provision Wi-Fi, and provisioning always ends in a
+// restart. In normal operation it is never started and its controller and
+// Bluedroid memory go back to the heap; the copy ring and the catalog page
+// cache grow into that memory when at least BLE_RECLAIM_MIN_BYTES came back.
+#define BLE_RECLAIM_MIN_BYTES         (32 * 1024)
+#define COPY_QUEUE_DEPTH_RECLAIMED    3
+#define CATALOG_CACHE_KB              16
+#define CATALOG_CACHE_KB_RECLAIMED    64
+
+// Scheduling profile. Wi-Fi and the lwIP task are pinned to core 0 in
+// sdkconfig, so the web server, its workers and the captive-portal DNS
+// responder run there with them. The transfer task and its copy writers, the
+// USB host and MSC client tasks and the SD background work (storage init,
+// scanner, thumbnails, Calibre import) are pinned to core 1, so a long copy
+// never waits behind a handler and a burst of requests never stalls a copy.
+// Priorities only order tasks that share a core:
+//   core 0: httpd 5, HTTP workers 5, DNS 5
+//   core 1: USB host 10, transfer 5 (7 during a batch), MSC 5, storage
+//           init 5, Calibre import 3, scanner 1, thumbnails 1
+// The LED and eject-button tasks sleep almost all the time; either core
+// may run them.
+#if CONFIG_FREERTOS_UNICORE
+#define CORE_NET 0
+#define CORE_IO  0
+#else
+#define CORE_NET 0
+#define CORE_IO  1
+#endif
+
+// USB host library event task and the MSC client's background task
+#define USB_HOST_TASK_STACK_SIZE 4096
+#define USB_HOST_TASK_PRIORITY   10
+#define MSC_TASK_STACK_SIZE      4096
+#define MSC_TASK_PRIORITY        5
+
+// Boot: the web server starts as soon as Wi-Fi is up, while this task mounts
+// the SD card, warms up the catalog and starts the storage services
+// (transfers, thumbnails, scanner, USB host) behind it.
+#define STORAGE_INIT_STACK_SIZE 8192
+#define STORAGE_INIT_PRIORITY   5
+
+// Transfer job task and the largest accepted /transfer-batch body
+#define TRANSFER_TASK_STACK_SIZE 4096
+#define TRANSFER_TASK_PRIORITY   5
+#define TRANSFER_BATCH_PRIORITY  7
+#define TRANSFER_BATCH_MAX_BODY  (16 * 1024)
+
+// Web server capacity. Each phone keeps a few sockets open (page, listing,
+// covers, /ws); LRU purge recycles the oldest idle one when all are taken.
+// The server needs 3 sockets of its own on top and the DNS server 1; the rest
+// of CONFIG_LWIP_MAX_SOCKETS is headroom for sockets still closing.
+#define HTTP_MAX_CLIENTS      WIFI_AP_MAX_STA_CONN
+#define HTTP_MAX_OPEN_SOCKETS (HTTP_MAX_CLIENTS * 3)
+#define HTTP_SERVER_SOCKETS   3
+#define DNS_SERVER_SOCKETS    1
+#define SPARE_SOCKETS         2
+#if HTTP_MAX_OPEN_SOCKETS + HTTP_SERVER_SOCKETS + DNS_SERVER_SOCKETS + SPARE_SOCKETS > CONFIG_LWIP_MAX_SOCKETS
+#error "HTTP_MAX_OPEN_SOCKETS does not fit in CONFIG_LWIP_MAX_SOCKETS"
+#endif
+// Handlers run SQLite queries and EPUB parsing on the server task
+#define HTTP_SERVER_STACK_SIZE 8192
+#define HTTP_SERVER_PRIORITY   5
+// Slow handlers (listings, search, covers, downloads, uploads, benchmarks)
+// run on this pool so /status and the transfer endpoints stay responsive on
+// the server task.
+// They parse EPUBs and run SQLite, so they need the server's stack size.
+#define HTTP_WORKER_COUNT      2
+#define HTTP_WORKER_STACK_SIZE 8192
+#define HTTP_WORKER_PRIORITY   5
+#define HTTP_WORKER_QUEUE_LEN  (HTTP_MAX_CLIENTS * 2)
+
+// How often progress is pushed to /ws clients while a job is running
+#define PROGRESS_PUSH_INTERVAL_MS 250
+
+// Background Calibre metadata.db import
+#define CALIBRE_IMPORT_STACK_SIZE 8192
+#define CALIBRE_IMPORT_PRIORITY   3
+// How long an unmount waits for the import to stop; it checks between batches
+#define CALIBRE_IMPORT_CANCEL_TIMEOUT_MS 3000
+
+// Background catalog scanner; it parses EPUBs and runs SQLite, so it needs
+// the same stack as the import, but runs below everything else.
+#define SCANNER_TASK_STACK_SIZE 8192
+#define SCANNER_TASK_PRIORITY   1
+
+// Cover thumbnails, cached on the SD card and generated at most one per
+// THUMBNAIL_INTERVAL_MS at the scanner's priority
+#define THUMBNAIL_CACHE_DIR       MOUNT_POINT_SD "/THUMBS"
+#define THUMBNAIL_TASK_STACK_SIZE 6144
+#define THUMBNAIL_TASK_PRIORITY   1
+#define THUMBNAIL_INTERVAL_MS     250
+
+// Book download/upload streaming buffer. Uploads run on the workers, so each
+// is staged under its socket number (8.3 names), and the book it replaces is
+// kept aside under the same number until the new one has taken its name.
+#define BOOK_IO_BUFFER_SIZE     (16 * 1024)
+// Pause per buffer while a transfer runs. A 16 KiB SD access takes about a
+// millisecond, so this leaves the copy most of the card.
+#define BOOK_IO_PACE_MS         10
+#define BOOK_UPLOAD_TEMP_FMT    MOUNT_POINT_SD "/UPL%05d.TMP"
+#define BOOK_UPLOAD_BACKUP_FMT  MOUNT_POINT_SD "/OLD%05d.TMP"
+
+// Request buffers reserved at boot so per-request allocations do not chop up
+// the internal heap. I/O blocks (downloads, uploads, covers) stay in DMA
+// capable internal RAM; listing chunks only hold JSON and use PSRAM if fitted.
+// A handler holds at most one block and only workers run the ones that take
+// them (downloads, uploads, covers), so the reserve is one per worker. Beyond
+// that requests fall back to the heap; /metrics reports the pools' peak use
+// and fallbacks, and the heap's largest DMA block.
+#define MEM_IO_POOL_BLOCKS    HTTP_WORKER_COUNT
+#define MEM_CHUNK_POOL_BLOCKS HTTP_WORKER_COUNT
+
+// Catalog compression benchmark (/bench/catalog)
+#define CATALOG_BENCH_PATH          MOUNT_POINT_SD "/CATBENCH.DB"
+#define CATALOG_BENCH_DEFAULT_BOOKS 500
+
+// Sequential throughput benchmark (/bench/storage); the file name is 8.3
+#define STORAGE_BENCH_NAME          "IOBENCH.TMP"
+#define STORAGE_BENCH_DEFAULT_BYTES (4 * 1024 * 1024)
+#define STORAGE_BENCH_MAX_BYTES     (64 * 1024 * 1024)
+
+// Full benchmark suite (/bench): sequential bytes per block size, small files
+// for the IOPS pass, and synthetic books for the catalog and listing timings
+#define BENCH_DEFAULT_BYTES (2 * 1024 * 1024)
+#define BENCH_DEFAULT_FILES 100
+#define BENCH_MAX_FILES     1000
+#define BENCH_DEFAULT_BOOKS 500
 
 
 // LED Strip configuration
 #define LED_STRIP_GPIO              4
 #define LED_STRIP_LED_NUMBERS       8
 #define LED_STRIP_RMT_RES_HZ        (10 * 1000 * 1000) // 10MHz resolution
+#define LED_TASK_STACK_SIZE         2048
+#define LED_TASK_PRIORITY           5
 
 // Eject Button
 #define EJECT_BUTTON_GPIO           33
+#define EJECT_DEBOUNCE_MS           50
+#define EJECT_LONG_PRESS_MS         2000    // Held this long: deep sleep
+#define EJECT_TASK_STACK_SIZE       2048
+#define EJECT_TASK_PRIORITY         10
+
+// Power: the CPU idles at the minimum clock and light-sleeps between Wi-Fi
+// beacons; transfers and open HTTP connections run at the maximum.
+#define POWER_MAX_FREQ_MHZ          240
+#define POWER_MIN_FREQ_MHZ          40
+#define POWER_LIGHT_SLEEP           true
 
 
 // --- GLOBALS ---
@@ -108,6 +323,27 @@ static bool ebook_reader_connected = false;
 static msc_host_device_handle_t device_handle = NULL;
 static led_strip_handle_t g_led_strip;
 static bool g_wifi_configured = false;
+static size_t g_ble_reclaimed = 0;
+
+// Storage comes up in the background; requests that need it get a 503 until then
+typedef enum {
+    STORAGE_INDEXING,
+    STORAGE_READY,
+    STORAGE_UNAVAILABLE,    // Card or catalog failed; handlers report their own errors
+} storage_state_t;
+static volatile storage_state_t g_storage_state = STORAGE_INDEXING;
+// FatFs drive of the mounted SD card ("0:"), empty if unknown
+static char g_sd_fatfs_drive[4] = "";
+// FatFs drive the USB device was registered on, empty while none is mounted
+static char g_usb_fatfs_drive[4] = "";
+// Sector and cluster size of the SD card, zero until it is mounted
+static storage_io_geometry_t g_sd_geometry;
+// Copy settings the transfer queue was started with
+static copy_engine_config_t g_copy_config;
+static mem_pool_t *g_io_pool = NULL;
+static mem_pool_t *g_chunk_pool = NULL;
+// Index of the SD card in the I/O counters of /metrics
+static int g_sd_metrics_mount = -1;
 
 // Event group to signal Wi-Fi connection events
 static EventGroupHandle_t wifi_event_group;
@@ -128,24 +364,19 @@ typedef enum {
     LED_STATE_ERROR,
     LED_STATE_SETUP, // New state for config mode
     LED_STATE_EJECT, // For eject button feedback
+    LED_STATE_COUNT,
 } led_state_t;
 
 volatile led_state_t g_led_state = LED_STATE_INIT;
+static TaskHandle_t g_led_task = NULL;
 
-// --- Transfer Progress Tracking ---
-typedef struct {
-    char filename[256];
-    size_t bytes_transferred;
-    size_t total_bytes;
-    bool active;
-    bool success;
-    char error_msg[128];
-} transfer_progress_t;
-
-static transfer_progress_t g_transfer_progress = {
-    .active = false,
-};
-volatile bool g_cancel_transfer = false;
+// Switches the LED animation. The LED task sleeps until it is told.
+static void led_set_state(led_state_t state) {
+    g_led_state = state;
+    if (g_led_task) {
+        xTaskNotify(g_led_task, state, eSetValueWithOverwrite);
+    }
+}
 
 
 // --- NVS Functions ---
@@ -218,397 +449,1373 @@ esp_err_t load_wifi_credentials(char *ssid, size_t ssid_len, char *password, siz
 
 // --- HELPER FUNCTIONS ---
 
-// Simple helper to extract content from an XML tag.
-// NOTE: This is a very basic parser and will not handle complex XML,
-// but it's sufficient for the simple structure of OPF files.
-static char* parse_xml_tag(const char* xml_buffer, const char* tag) {
-    char start_tag[64];
-    char end_tag[64];
-    snprintf(start_tag, sizeof(start_tag), "<%s", tag);
-    snprintf(end_tag, sizeof(end_tag), "</%s>", tag);
-
-    char *start_ptr = strstr(xml_buffer, start_tag);
-    if (!start_ptr) {
-        return NULL;
+// Decodes %XX escapes in place. '+' means space only in query strings.
+static void url_decode_inplace(char *str, bool plus_is_space) {
+    char *in = str;
+    char *out = str;
+    while (*in) {
+        if (*in == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+            char hex[3] = { in[1], in[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            in += 3;
+        } else if (*in == '+' && plus_is_space) {
+            *out++ = ' ';
+            in++;
+        } else {
+            *out++ = *in++;
+        }
     }
+    *out = '\0';
+}
 
-    // Find the closing '>' of the start tag
-    start_ptr = strstr(start_ptr, ">");
-    if (!start_ptr) {
-        return NULL;
+// --- Status Events ---
+// Progress of the background Calibre import, reported alongside transfers.
+static volatile bool g_import_active = false;
+static volatile uint32_t g_import_done = 0;
+static volatile uint32_t g_import_total = 0;
+// Set before the USB volume is unmounted; the import stops at its next batch
+static volatile bool g_import_cancel = false;
+
+// Builds the /status document. When `event` is set it is tagged with an
+// "event" field so it can be pushed over the /ws channel.
+static cJSON *build_status_json(const char *event) {
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+
+    cJSON *root = cJSON_CreateObject();
+    if (event) {
+        cJSON_AddStringToObject(root, "event", event);
     }
-    start_ptr++; // Move past '>'
+    static const char *const storage_names[] = { "indexing", "ready", "unavailable" };
+    cJSON_AddStringToObject(root, "storage", storage_names[g_storage_state]);
+    cJSON_AddBoolToObject(root, "reader_connected", ebook_reader_connected);
+    cJSON_AddBoolToObject(root, "transfer_active", progress.active);
+    cJSON_AddNumberToObject(root, "queued_jobs", transfer_queue_pending());
+    const char *scanning = scanner_active_volume();
+    if (scanning) {
+        cJSON_AddStringToObject(root, "scanning", scanning);
+    }
+    if (g_import_active) {
+        cJSON *import = cJSON_AddObjectToObject(root, "import");
+        cJSON_AddNumberToObject(import, "done", g_import_done);
+        cJSON_AddNumberToObject(import, "total", g_import_total);
+    }
+    if (progress.active) {
+        cJSON_AddNumberToObject(root, "job_id", progress.job_id);
+        cJSON_AddStringToObject(root, "filename", progress.filename);
+        cJSON_AddNumberToObject(root, "bytes_transferred", progress.bytes_transferred);
+        cJSON_AddNumberToObject(root, "total_bytes", progress.total_bytes);
+        cJSON_AddNumberToObject(root, "file_index", progress.file_index);
+        cJSON_AddNumberToObject(root, "file_count", progress.file_count);
+    }
+    return root;
+}
 
-    char *end_ptr = strstr(start_ptr, end_tag);
-    if (!end_ptr) {
-        return NULL;
+static void push_json(cJSON *root) {
+    char *json_str = cJSON_PrintUnformatted(root);
+    if (json_str) {
+        event_push_send(json_str);
+        cJSON_free(json_str);
+    }
+    cJSON_Delete(root);
+}
+
+static void push_status_event(const char *event) {
+    // Skip building the document entirely when nobody is listening
+    if (!event_push_has_clients()) {
+        return;
+    }
+    push_json(build_status_json(event));
+}
+
+// Progress is sampled on a timer rather than per block so the push rate stays
+// fixed no matter how fast the copy runs. The timer only queues the push: the
+// event is built on the HTTP server task, since taking the transfer lock and
+// allocating cJSON would hold up every other esp_timer callback.
+static esp_timer_handle_t g_progress_timer = NULL;
+// Set while a push is queued, so a busy server task never gets a backlog
+static atomic_flag g_progress_queued = ATOMIC_FLAG_INIT;
+
+static void progress_push_work(void *arg) {
+    atomic_flag_clear(&g_progress_queued);
+    push_status_event("progress");
+}
+
+static void progress_timer_cb(void *arg) {
+    if (!atomic_flag_test_and_set(&g_progress_queued) && event_push_defer(progress_push_work, NULL) != ESP_OK) {
+        atomic_flag_clear(&g_progress_queued);
+    }
+}
+
+// --- Transfer Queue Callbacks ---
+static const char *catalog_volume_for(transfer_volume_t volume, const char **dir) {
+    if (volume == TRANSFER_VOLUME_SD) {
+        *dir = MOUNT_POINT_SD;
+        return CATALOG_VOLUME_SD;
+    }
+    *dir = MOUNT_POINT_USB;
+    return CATALOG_VOLUME_USB;
+}
+
+static void on_transfer_job_started(const transfer_job_info_t *job) {
+    power_acquire(POWER_HOLD_TRANSFER);
+    led_set_state(LED_STATE_TRANSFER);
+    push_status_event("progress");
+    if (g_progress_timer) {
+        esp_timer_start_periodic(g_progress_timer, PROGRESS_PUSH_INTERVAL_MS * 1000);
+    }
+}
+
+static void on_transfer_file_finished(const transfer_job_info_t *job, const char *filename, esp_err_t result) {
+    const char *dir;
+    const char *volume = catalog_volume_for(job->destination, &dir);
+    if (result == ESP_OK) {
+        catalog_update_file(volume, dir, filename);
+        // A copy has its source's content; no need to read it again to hash it
+        const char *source_dir;
+        catalog_copy_hash(catalog_volume_for(job->source, &source_dir), volume, filename);
+    } else {
+        // A partial file may have been left behind or removed
+        scanner_request(volume);
+    }
+    push_status_event("progress");
+}
+
+// The destination already had the file under another name, so there is nothing to index
+static void on_transfer_file_skipped(const transfer_job_info_t *job, const char *filename) {
+    push_status_event("progress");
+}
+
+// Where the catalog has `filename`'s content in another file (an alias), copy that one
+static bool transfer_resolve_source(transfer_volume_t source, const char *filename, char *file, size_t file_size) {
+    const char *dir;
+    return catalog_resolve_name(catalog_volume_for(source, &dir), filename, file, file_size) == ESP_OK;
+}
+
+// A reader that already has a book under another name does not need it again.
+// The catalog only knows what the last scan saw, so the other file must still
+// be there and as large as the source.
+static bool transfer_has_content(const transfer_job_info_t *job, const char *filename) {
+    const char *source_dir, *dest_dir;
+    const char *source = catalog_volume_for(job->source, &source_dir);
+    const char *dest = catalog_volume_for(job->destination, &dest_dir);
+    char existing[128], existing_file[128], source_file[128];
+    if (catalog_find_content(source, filename, dest, existing, sizeof(existing)) != ESP_OK ||
+        catalog_resolve_name(dest, existing, existing_file, sizeof(existing_file)) != ESP_OK ||
+        !transfer_resolve_source(job->source, filename, source_file, sizeof(source_file))) {
+        return false;
+    }
+    char path[256];
+    struct stat source_st, dest_st;
+    snprintf(path, sizeof(path), "%s/%s", source_dir, source_file);
+    if (stat(path, &source_st) != 0) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dest_dir, existing_file);
+    if (stat(path, &dest_st) != 0 || dest_st.st_size != source_st.st_size) {
+        return false;
+    }
+    ESP_LOGI(TAG, "%s has the content of %s already as %s", dest, filename, existing);
+    return true;
+}
+
+static void on_transfer_job_finished(const transfer_job_info_t *job) {
+    power_release(POWER_HOLD_TRANSFER);
+    const char *dir;
+    thumbnail_request(catalog_volume_for(job->destination, &dir));
+    if (g_progress_timer) {
+        esp_timer_stop(g_progress_timer);
     }
+    if (event_push_has_clients()) {
+        cJSON *root = build_status_json("job");
+        cJSON_AddNumberToObject(root, "finished_job_id", job->id);
+        cJSON_AddStringToObject(root, "job_state", transfer_job_state_name(job->state));
+        cJSON_AddNumberToObject(root, "files_done", job->files_done);
+        cJSON_AddNumberToObject(root, "files_skipped", job->files_skipped);
+        cJSON_AddNumberToObject(root, "files_failed", job->files_failed);
+        push_json(root);
+    }
+
+    if (job->files_failed > 0) {
+        led_set_state(LED_STATE_ERROR);
+    } else if (transfer_queue_pending() == 0) {
+        led_set_state(ebook_reader_connected ? LED_STATE_CONNECTED : LED_STATE_IDLE);
+    }
+}
 
-    size_t len = end_ptr - start_ptr;
-    char *value = malloc(len + 1);
-    if (!value) {
+static void init_transfer_queue(void) {
+    transfer_queue_config_t config = {
+        .sd_root = MOUNT_POINT_SD,
+        .usb_root = MOUNT_POINT_USB,
+        .copy_config = {
+            .block_size = COPY_BLOCK_SIZE,
+            .depth = g_ble_reclaimed >= BLE_RECLAIM_MIN_BYTES ? COPY_QUEUE_DEPTH_RECLAIMED : COPY_QUEUE_DEPTH,
+            .writer_priority = -1,
+            .skip_identical = COPY_SKIP_IDENTICAL,
+            .resume = COPY_RESUME,
+            .preallocate = COPY_PREALLOCATE,
+        },
+        .task_stack_size = TRANSFER_TASK_STACK_SIZE,
+        .task_priority = TRANSFER_TASK_PRIORITY,
+        .core_id = CORE_IO,
+        .batch_priority = TRANSFER_BATCH_PRIORITY,
+        .on_job_started = on_transfer_job_started,
+        .on_job_finished = on_transfer_job_finished,
+        .on_file_finished = on_transfer_file_finished,
+        .on_file_skipped = on_transfer_file_skipped,
+        .has_content = transfer_has_content,
+        .resolve_source = transfer_resolve_source,
+    };
+#if STORAGE_FAST_IO
+    if (g_sd_geometry.cluster_size > 0) {
+        config.copy_config.block_size = storage_io_block_size(&g_sd_geometry, COPY_BLOCK_SIZE, COPY_BLOCK_MAX);
+        config.copy_config.align = g_sd_geometry.sector_size;
+        ESP_LOGI(TAG, "Copy blocks: %u bytes, %u-byte aligned",
+                 (unsigned)config.copy_config.block_size, (unsigned)config.copy_config.align);
+    }
+#endif
+    g_copy_config = config.copy_config;
+    ESP_ERROR_CHECK(transfer_queue_init(&config));
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = progress_timer_cb,
+        .name = "progress_push",
+    };
+    if (esp_timer_create(&timer_args, &g_progress_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to create progress timer; only file boundaries will be pushed");
+    }
+}
+
+// Answers 503 and returns true while the SD card and catalog are still
+// coming up, so a page load never waits on the mount.
+static bool storage_starting(httpd_req_t *req) {
+    if (g_storage_state != STORAGE_INDEXING) {
+        return false;
+    }
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "2");
+    httpd_resp_send(req, "Library is indexing.", HTTPD_RESP_USE_STRLEN);
+    return true;
+}
+
+// Reads the whole request body into a NUL-terminated heap buffer.
+// Returns NULL (after sending an error response) if the body is missing,
+// larger than max_len, or the socket fails.
+static char *read_request_body(httpd_req_t *req, size_t max_len) {
+    if (req->content_len == 0) {
+        httpd_resp_send_400(req);
         return NULL;
     }
-    memcpy(value, start_ptr, len);
-    value[len] = '\0';
-
-    // Basic XML unescaping for &amp;, &lt;, &gt;
-    char *p = value;
-    char *q = value;
-    while (*p) {
-        if (*p == '&') {
-            if (strncmp(p, "&amp;", 5) == 0) { *q++ = '&'; p += 5; }
-            else if (strncmp(p, "&lt;", 4) == 0) { *q++ = '<'; p += 4; }
-            else if (strncmp(p, "&gt;", 4) == 0) { *q++ = '>'; p += 4; }
-            else { *q++ = *p++; }
-        } else {
-            *q++ = *p++;
+    if (req->content_len > max_len) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request body too large.");
+        return NULL;
+    }
+    char *body = malloc(req->content_len + 1);
+    if (!body) {
+        httpd_resp_send_500(req);
+        return NULL;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, body + received, req->content_len - received);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                continue;
+            }
+            free(body);
+            return NULL;
         }
+        received += ret;
+    }
+    body[received] = '\0';
+    return body;
+}
+
+static bool parse_volume(const cJSON *item, transfer_volume_t *volume) {
+    if (!cJSON_IsString(item)) {
+        return false;
     }
-    *q = '\0';
+    if (strcmp(item->valuestring, "sd") == 0) *volume = TRANSFER_VOLUME_SD;
+    else if (strcmp(item->valuestring, "usb") == 0) *volume = TRANSFER_VOLUME_USB;
+    else return false;
+    return true;
+}
 
-    return value;
+// Optional "verify" and "overwrite" booleans in a transfer request body
+static uint32_t parse_transfer_flags(const cJSON *json) {
+    uint32_t flags = 0;
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "verify"))) flags |= TRANSFER_FLAG_VERIFY;
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "overwrite"))) flags |= TRANSFER_FLAG_OVERWRITE;
+    return flags;
 }
 
-// Helper to copy file between two filesystems
-static esp_err_t copy_file(const char *source_path, const char *dest_path, transfer_progress_t *progress) {
-    ESP_LOGI(TAG, "Copying from %s to %s", source_path, dest_path);
-    FILE *source_file = fopen(source_path, "rb");
-    if (!source_file) {
-        ESP_LOGE(TAG, "Failed to open source file: %s", source_path);
-        if (progress) snprintf(progress->error_msg, sizeof(progress->error_msg), "Failed to open source file.");
-        return ESP_FAIL;
+static void send_job_queued(httpd_req_t *req, uint32_t job_id) {
+    cJSON *response_json = cJSON_CreateObject();
+    cJSON_AddBoolToObject(response_json, "success", true);
+    cJSON_AddNumberToObject(response_json, "job_id", job_id);
+    cJSON_AddStringToObject(response_json, "message", "Transfer queued.");
+
+    char *json_str = cJSON_PrintUnformatted(response_json);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(response_json);
+}
+
+static bool transfer_volumes_ready(transfer_volume_t source, transfer_volume_t destination) {
+    if (source == TRANSFER_VOLUME_USB || destination == TRANSFER_VOLUME_USB) {
+        return ebook_reader_connected;
     }
+    return true;
+}
 
-    // Get file size for progress tracking
-    struct stat st;
-    if (stat(source_path, &st) == 0) {
-        if(progress) progress->total_bytes = st.st_size;
+static void send_submit_error(httpd_req_t *req, esp_err_t err) {
+    if (err == ESP_ERR_NO_MEM) {
+        httpd_resp_send_err(req, HTTPD_429_TOO_MANY_REQUESTS, "The transfer queue is full.");
     } else {
-        if(progress) progress->total_bytes = 0;
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid transfer request.");
     }
-    if(progress) progress->bytes_transferred = 0;
+}
+
+// --- WEB SERVER HANDLERS (MAIN APP) ---
+static esp_err_t static_file_handler(httpd_req_t *req) {
+    return web_assets_serve(req);
+}
+
+static esp_err_t status_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/json");
+    cJSON *root = build_status_json(NULL);
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
 
+// Sends one rendered chunk of a streamed JSON response.
+static esp_err_t httpd_json_flush(void *ctx, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
 
-    FILE *dest_file = fopen(dest_path, "wb");
-    if (!dest_file) {
-        ESP_LOGE(TAG, "Failed to open destination file: %s", dest_path);
-        if (progress) snprintf(progress->error_msg, sizeof(progress->error_msg), "Failed to open destination file.");
-        fclose(source_file);
+// Query parameters:
+//   type   - "sd" or "usb" (required)
+//   after  - name of the last row of the previous page (omit for the first page)
+//   limit  - page size, capped at CATALOG_QUERY_MAX_LIMIT
+//   sort   - name|title|author|size|mtime, prefix with '-' for descending
+//   q      - case-insensitive substring filter on name, title and author
+// The total number of matching rows is returned in the X-Total-Count header.
+// 404 means the `after` row has gone since; the client reloads from the top.
+static esp_err_t list_files_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char buf[512];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK) {
+        httpd_resp_send_400(req);
         return ESP_FAIL;
     }
 
-    // Increase buffer size for faster copies
-    char *buffer = malloc(4096);
-    if (buffer == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for copy buffer");
-        if (progress) snprintf(progress->error_msg, sizeof(progress->error_msg), "Memory allocation failed.");
-        fclose(source_file);
-        fclose(dest_file);
+    char param[32];
+    if (httpd_query_key_value(buf, "type", param, sizeof(param)) != ESP_OK) {
+        httpd_resp_send_400(req);
         return ESP_FAIL;
     }
 
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, 4096, source_file)) > 0) {
-        if (g_cancel_transfer) {
-            ESP_LOGW(TAG, "Transfer cancelled by user.");
-            snprintf(progress->error_msg, sizeof(progress->error_msg), "Transfer cancelled.");
-            free(buffer);
-            fclose(source_file);
-            fclose(dest_file);
-            // Optionally delete the partially copied file
-            remove(dest_path);
-            return ESP_FAIL;
-        }
-        if (fwrite(buffer, 1, bytes_read, dest_file) != bytes_read) {
-            ESP_LOGE(TAG, "Failed to write to destination file");
-            if (progress) snprintf(progress->error_msg, sizeof(progress->error_msg), "Write error on destination.");
-            free(buffer);
-            fclose(source_file);
-            fclose(dest_file);
-            return ESP_FAIL;
-        }
-        if (progress) {
-            progress->bytes_transferred += bytes_read;
+    // Listings come straight from the catalog; the background scanner keeps
+    // it in step with the card and pushes a "scan" event when it changes.
+    bool is_sd = (strcmp(param, "sd") == 0);
+    const char *volume = is_sd ? CATALOG_VOLUME_SD : CATALOG_VOLUME_USB;
+
+    if (!is_sd && !ebook_reader_connected) {
+         httpd_resp_set_type(req, "application/json");
+         httpd_resp_set_hdr(req, "X-Total-Count", "0");
+         httpd_resp_send(req, "[]", 2);
+         return ESP_OK;
+    }
+
+    catalog_query_t query = { .volume = volume };
+    char sort_key[16] = "";
+    char filter[96] = "";
+    char after[128] = "";
+    if (httpd_query_key_value(buf, "after", after, sizeof(after)) == ESP_OK) {
+        url_decode_inplace(after, true);
+        query.after = after;
+    }
+    if (httpd_query_key_value(buf, "limit", param, sizeof(param)) == ESP_OK) {
+        query.limit = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(buf, "sort", sort_key, sizeof(sort_key)) == ESP_OK) {
+        url_decode_inplace(sort_key, true);
+    }
+    if (httpd_query_key_value(buf, "q", filter, sizeof(filter)) == ESP_OK) {
+        url_decode_inplace(filter, true);
+        query.filter = filter;
+    }
+    catalog_parse_sort(sort_key, &query.sort, &query.descending);
+
+    uint32_t total = 0;
+    if (catalog_count(&query, &total) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char *chunk = mem_pool_alloc(g_chunk_pool);
+    if (!chunk) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char total_str[12];
+    snprintf(total_str, sizeof(total_str), "%u", (unsigned)total);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "X-Total-Count", total_str);
+
+    // Rows are rendered into a fixed chunk buffer and sent each time it fills,
+    // once the catalog lock is released, so memory use does not grow with the
+    // size of the library and a slow phone does not stall the catalog.
+    esp_err_t ret = listing_send_page(&query, chunk, LIST_CHUNK_SIZE, httpd_json_flush, req);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        // Nothing has been sent yet
+        mem_pool_free(g_chunk_pool, chunk);
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to stream file list");
+        mem_pool_free(g_chunk_pool, chunk);
+        // Terminate the chunked response so the socket is not left hanging
+        httpd_resp_send_chunk(req, NULL, 0);
+        return ESP_FAIL;
+    }
+    mem_pool_free(g_chunk_pool, chunk);
+
+    httpd_resp_send_chunk(req, NULL, 0); // End response
+    return ESP_OK;
+}
+
+// Ranked full-text search: GET /search?q=<text>[&type=sd|usb][&offset=N][&limit=N]
+static esp_err_t search_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char buf[256];
+    char text[CATALOG_SEARCH_MAX_QUERY] = "";
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK ||
+        httpd_query_key_value(buf, "q", text, sizeof(text)) != ESP_OK) {
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+    url_decode_inplace(text, true);
+
+    catalog_search_t search = { .text = text };
+    char param[32];
+    if (httpd_query_key_value(buf, "type", param, sizeof(param)) == ESP_OK) {
+        if (strcmp(param, "sd") == 0) {
+            search.volume = CATALOG_VOLUME_SD;
+        } else if (strcmp(param, "usb") == 0) {
+            if (!ebook_reader_connected) {
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_set_hdr(req, "X-Total-Count", "0");
+                httpd_resp_send(req, "[]", 2);
+                return ESP_OK;
+            }
+            search.volume = CATALOG_VOLUME_USB;
         }
     }
+    if (httpd_query_key_value(buf, "offset", param, sizeof(param)) == ESP_OK) {
+        search.offset = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(buf, "limit", param, sizeof(param)) == ESP_OK) {
+        search.limit = strtoul(param, NULL, 10);
+    }
+
+    uint32_t total = 0;
+    esp_err_t ret = catalog_search_count(&search, &total);
+    if (ret == ESP_ERR_INVALID_STATE || ret == ESP_FAIL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char *chunk = mem_pool_alloc(g_chunk_pool);
+    if (!chunk) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    char total_str[12];
+    snprintf(total_str, sizeof(total_str), "%u", (unsigned)total);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "X-Total-Count", total_str);
 
-    free(buffer);
-    fclose(source_file);
-    fclose(dest_file);
-    ESP_LOGI(TAG, "File copied successfully");
-    if (progress) progress->success = true;
+    ret = listing_send_search(&search, chunk, LIST_CHUNK_SIZE, httpd_json_flush, req);
+    mem_pool_free(g_chunk_pool, chunk);
+    if (ret == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Search results truncated");
+    }
+    httpd_resp_send_chunk(req, NULL, 0); // End response
     return ESP_OK;
 }
 
-// --- WEB SERVER HANDLERS (MAIN APP) ---
-static esp_err_t static_file_handler(httpd_req_t *req) {
-    char filepath[512];
-    snprintf(filepath, sizeof(filepath), "%s%s", MOUNT_POINT_SPIFFS, req->uri);
+static bool duplicates_add_entry(const catalog_duplicate_t *dup, void *ctx) {
+    json_stream_t *js = (json_stream_t *)ctx;
+    json_stream_begin_object(js);
+    json_stream_int(js, "group", dup->group);
+    json_stream_string(js, "name", dup->name);
+    json_stream_int(js, "size", dup->size);
+    json_stream_bool(js, "keep", dup->keep);
+    json_stream_end_object(js);
+    return js->err == ESP_OK;
+}
 
-    // Default to index.html if root is requested
-    if (strcmp(req->uri, "/") == 0) {
-        snprintf(filepath, sizeof(filepath), "%s/index.html", MOUNT_POINT_SPIFFS);
+// Books stored more than once under different names: GET /duplicates?type=sd|usb
+// Rows with the same "group" have the same content; "keep" marks the file a
+// merge would keep. Books still waiting to be hashed are not matched yet;
+// their number is returned in the X-Unhashed-Count header.
+static esp_err_t duplicates_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char buf[64];
+    char param[8];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK ||
+        httpd_query_key_value(buf, "type", param, sizeof(param)) != ESP_OK) {
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
     }
+    const char *volume = strcmp(param, "sd") == 0 ? CATALOG_VOLUME_SD : CATALOG_VOLUME_USB;
 
-    struct stat path_stat;
-    if (stat(filepath, &path_stat) == -1) {
-        ESP_LOGE(TAG, "File not found: %s", filepath);
-        httpd_resp_send_404(req);
+    uint32_t unhashed = 0;
+    catalog_count_unhashed(volume, &unhashed);
+    char *chunk = mem_pool_alloc(g_chunk_pool);
+    if (!chunk) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    char unhashed_str[12];
+    snprintf(unhashed_str, sizeof(unhashed_str), "%u", (unsigned)unhashed);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "X-Unhashed-Count", unhashed_str);
+
+    json_stream_t js;
+    json_stream_init(&js, chunk, LIST_CHUNK_SIZE, httpd_json_flush, req);
+    json_stream_begin_array(&js);
+    esp_err_t ret = catalog_query_duplicates(volume, duplicates_add_entry, &js);
+    json_stream_end_array(&js);
+    if (json_stream_finish(&js) != ESP_OK || ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to stream duplicates");
+    }
+    mem_pool_free(g_chunk_pool, chunk);
+    httpd_resp_send_chunk(req, NULL, 0); // End response
+    return ret;
+}
+
+// Keeps one file of every group of duplicates on the SD card and removes the
+// rest: POST /duplicates/merge. The removed names stay listed as aliases of
+// the kept file and can still be downloaded and transferred.
+static esp_err_t duplicates_merge_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    // Files must not disappear under a copy
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    if (progress.active || transfer_queue_pending() > 0) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_send(req, "A transfer is running.", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    catalog_merge_stats_t stats;
+    esp_err_t ret = catalog_merge_duplicates(CATALOG_VOLUME_SD, MOUNT_POINT_SD, &stats);
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "complete", ret == ESP_OK);
+    cJSON_AddNumberToObject(root, "merged", stats.merged);
+    cJSON_AddNumberToObject(root, "stale", stats.stale);
+    cJSON_AddNumberToObject(root, "bytes_freed", (double)stats.bytes_freed);
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    if (stats.stale > 0) {
+        // Hash the changed files again so the next merge can use them
+        scanner_request(CATALOG_VOLUME_SD);
+    }
+    if (stats.merged > 0 && event_push_has_clients()) {
+        cJSON *event = build_status_json("scan");
+        cJSON_AddStringToObject(event, "scanned", CATALOG_VOLUME_SD);
+        push_json(event);
+    }
+    return ESP_OK;
+}
+
+// Queues a single file. Body: {"source":"sd","destination":"usb","filename":"book.epub"}
+// plus optional "verify" and "overwrite" flags.
+static esp_err_t transfer_file_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char *content = read_request_body(req, 512);
+    if (!content) {
         return ESP_FAIL;
     }
 
-    // Set content type based on file extension
-    const char *type = "text/plain";
-    if (strstr(filepath, ".html")) type = "text/html";
-    else if (strstr(filepath, ".css")) type = "text/css";
-    else if (strstr(filepath, ".js")) type = "application/javascript";
-    httpd_resp_set_type(req, type);
+    cJSON *json = cJSON_Parse(content);
+    free(content);
+    if (!json) {
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+
+    transfer_volume_t source, destination;
+    const cJSON *filename = cJSON_GetObjectItem(json, "filename");
+    if (!parse_volume(cJSON_GetObjectItem(json, "source"), &source) ||
+        !parse_volume(cJSON_GetObjectItem(json, "destination"), &destination) ||
+        !cJSON_IsString(filename)) {
+        cJSON_Delete(json);
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+
+    if (!transfer_volumes_ready(source, destination)) {
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "E-Reader not connected.");
+        return ESP_FAIL;
+    }
+
+    const char *files[] = { filename->valuestring };
+    uint32_t job_id = 0;
+    esp_err_t err = transfer_queue_submit(source, destination, files, 1, parse_transfer_flags(json), &job_id);
+    cJSON_Delete(json);
+    if (err != ESP_OK) {
+        send_submit_error(req, err);
+        return ESP_FAIL;
+    }
+
+    send_job_queued(req, job_id);
+    return ESP_OK;
+}
 
-    // Open and send file
-    FILE *fd = fopen(filepath, "r");
-    if (!fd) {
-        ESP_LOGE(TAG, "Failed to open file for reading: %s", filepath);
+// Queues many files as one job. Body: {"source":"sd","destination":"usb","files":["a.epub","b.pdf"]}
+// plus the same optional flags as /transfer-file.
+static esp_err_t transfer_batch_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char *content = read_request_body(req, TRANSFER_BATCH_MAX_BODY);
+    if (!content) {
+        return ESP_FAIL;
+    }
+
+    cJSON *json = cJSON_Parse(content);
+    free(content);
+    if (!json) {
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+
+    transfer_volume_t source, destination;
+    const cJSON *files_json = cJSON_GetObjectItem(json, "files");
+    int count = cJSON_IsArray(files_json) ? cJSON_GetArraySize(files_json) : 0;
+    if (!parse_volume(cJSON_GetObjectItem(json, "source"), &source) ||
+        !parse_volume(cJSON_GetObjectItem(json, "destination"), &destination) ||
+        count <= 0 || count > TRANSFER_BATCH_MAX_FILES) {
+        cJSON_Delete(json);
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+
+    if (!transfer_volumes_ready(source, destination)) {
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "E-Reader not connected.");
+        return ESP_FAIL;
+    }
+
+    const char **files = calloc(count, sizeof(char *));
+    if (!files) {
+        cJSON_Delete(json);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
+    int i = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, files_json) {
+        files[i++] = cJSON_IsString(item) ? item->valuestring : NULL;
+    }
 
-    char *chunk = malloc(1024);
-    size_t chunk_size;
-    do {
-        chunk_size = fread(chunk, 1, 1024, fd);
-        if (chunk_size > 0) {
-            if (httpd_resp_send_chunk(req, chunk, chunk_size) != ESP_OK) {
-                fclose(fd);
-                free(chunk);
-                ESP_LOGE(TAG, "File sending failed!");
-                return ESP_FAIL;
-            }
-        }
-    } while (chunk_size > 0);
+    uint32_t job_id = 0;
+    esp_err_t err = transfer_queue_submit(source, destination, files, count, parse_transfer_flags(json), &job_id);
+    free(files);
+    cJSON_Delete(json);
+    if (err != ESP_OK) {
+        send_submit_error(req, err);
+        return ESP_FAIL;
+    }
 
+    send_job_queued(req, job_id);
+    return ESP_OK;
+}
+
+// Reports per-file results for a job: GET /transfer-status?job=<id>
+static esp_err_t transfer_status_handler(httpd_req_t *req) {
+    char buf[64];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK ||
+        httpd_query_key_value(buf, "job", param, sizeof(param)) != ESP_OK) {
+        httpd_resp_send_400(req);
+        return ESP_FAIL;
+    }
+
+    char chunk[256];
+    json_stream_t js;
+    json_stream_init(&js, chunk, sizeof(chunk), httpd_json_flush, req);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = transfer_queue_render_job(strtoul(param, NULL, 10), &js);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    json_stream_finish(&js);
     httpd_resp_send_chunk(req, NULL, 0); // End response
-    fclose(fd);
-    free(chunk);
     return ESP_OK;
 }
 
-static esp_err_t status_handler(httpd_req_t *req) {
+// Cancels the running job, or a specific one with ?job=<id>
+static esp_err_t transfer_cancel_handler(httpd_req_t *req) {
+    ESP_LOGI(TAG, "Received request to cancel transfer");
+    uint32_t job_id = 0;
+    char buf[64];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK &&
+        httpd_query_key_value(buf, "job", param, sizeof(param)) == ESP_OK) {
+        job_id = strtoul(param, NULL, 10);
+    }
+    if (transfer_queue_cancel(job_id) != ESP_OK) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    httpd_resp_send(req, "OK", HTTPD_200_OK);
+    return ESP_OK;
+}
+
+// Handler to report the current file transfer progress
+static esp_err_t transfer_progress_handler(httpd_req_t *req) {
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    if (!progress.active) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+
     httpd_resp_set_type(req, "application/json");
     cJSON *root = cJSON_CreateObject();
-    cJSON_AddBoolToObject(root, "reader_connected", ebook_reader_connected);
-    cJSON_AddBoolToObject(root, "transfer_active", g_transfer_progress.active);
-    if (g_transfer_progress.active) {
-        cJSON_AddStringToObject(root, "filename", g_transfer_progress.filename);
-        cJSON_AddNumberToObject(root, "bytes_transferred", g_transfer_progress.bytes_transferred);
-        cJSON_AddNumberToObject(root, "total_bytes", g_transfer_progress.total_bytes);
+    cJSON_AddNumberToObject(root, "job_id", progress.job_id);
+    cJSON_AddStringToObject(root, "filename", progress.filename);
+    cJSON_AddNumberToObject(root, "bytes_transferred", progress.bytes_transferred);
+    cJSON_AddNumberToObject(root, "total_bytes", progress.total_bytes);
+    cJSON_AddNumberToObject(root, "file_index", progress.file_index);
+    cJSON_AddNumberToObject(root, "file_count", progress.file_count);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+// Adds one half of a benchmark result to `parent` under `key`.
+static void add_bench_mode(cJSON *parent, const char *key, const catalog_bench_mode_t *mode) {
+    cJSON *obj = cJSON_AddObjectToObject(parent, key);
+    cJSON_AddNumberToObject(obj, "db_bytes", mode->db_bytes);
+    cJSON_AddNumberToObject(obj, "text_bytes", mode->text_bytes);
+    cJSON_AddNumberToObject(obj, "insert_us", (double)mode->insert_us);
+    cJSON_AddNumberToObject(obj, "page_us", (double)mode->page_us);
+}
+
+// Compares plain and compressed description storage: GET /bench/catalog[?books=N]
+// Runs for several seconds on a large library; the catalog lock is released
+// between its steps, so listings and scans carry on meanwhile.
+static esp_err_t bench_catalog_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    uint32_t books = CATALOG_BENCH_DEFAULT_BOOKS;
+    char buf[64];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK &&
+        httpd_query_key_value(buf, "books", param, sizeof(param)) == ESP_OK) {
+        books = strtoul(param, NULL, 10);
     }
+
+    catalog_bench_result_t result;
+    esp_err_t ret = catalog_bench_compression(CATALOG_BENCH_PATH, books, &result);
+    if (ret == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid number of books.");
+        return ESP_FAIL;
+    } else if (ret != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "books", result.books);
+    cJSON_AddNumberToObject(root, "page_size", CATALOG_BENCH_PAGE_SIZE);
+    add_bench_mode(root, "plain", &result.plain);
+    add_bench_mode(root, "compressed", &result.compressed);
     char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json_str, strlen(json_str));
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(root);
     return ESP_OK;
 }
 
-static esp_err_t list_files_handler(httpd_req_t *req) {
-    char buf[128];
-    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) != ESP_OK) {
-        httpd_resp_send_400(req);
+static void add_storage_bench_pattern(cJSON *parent, const char *key, const storage_io_bench_pattern_t *p) {
+    cJSON *obj = cJSON_AddObjectToObject(parent, key);
+    cJSON_AddNumberToObject(obj, "block_size", p->block_size);
+    cJSON_AddBoolToObject(obj, "aligned", p->aligned);
+    cJSON_AddNumberToObject(obj, "write_us", (double)p->write_us);
+    cJSON_AddNumberToObject(obj, "read_us", (double)p->read_us);
+    cJSON_AddNumberToObject(obj, "write_kbps", p->write_kbps);
+    cJSON_AddNumberToObject(obj, "read_kbps", p->read_kbps);
+}
+
+// Sequential write/read throughput of a volume with the original small
+// buffered blocks and with the copy engine's aligned cluster-sized blocks:
+// GET /bench/storage[?volume=sd|usb][&bytes=N]. Don't run it during a transfer.
+static esp_err_t bench_storage_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char volume[8] = CATALOG_VOLUME_SD;
+    uint32_t bytes = STORAGE_BENCH_DEFAULT_BYTES;
+    char buf[64];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK) {
+        httpd_query_key_value(buf, "volume", volume, sizeof(volume));
+        if (httpd_query_key_value(buf, "bytes", param, sizeof(param)) == ESP_OK) {
+            bytes = strtoul(param, NULL, 10);
+        }
+    }
+    bool usb = strcmp(volume, CATALOG_VOLUME_USB) == 0;
+    if ((!usb && strcmp(volume, CATALOG_VOLUME_SD) != 0) || bytes == 0 || bytes > STORAGE_BENCH_MAX_BYTES) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid volume or size.");
+        return ESP_FAIL;
+    }
+    const char *drive = usb ? g_usb_fatfs_drive : g_sd_fatfs_drive;
+    storage_io_geometry_t geometry;
+    if (!drive[0] || storage_io_get_geometry(drive, &geometry) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Volume not mounted.");
+        return ESP_FAIL;
+    }
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    if (progress.active || transfer_queue_pending() > 0) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "A transfer is running.");
         return ESP_FAIL;
     }
 
-    char param[32];
-    if (httpd_query_key_value(buf, "type", param, sizeof(param)) != ESP_OK) {
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%s", usb ? MOUNT_POINT_USB : MOUNT_POINT_SD, STORAGE_BENCH_NAME);
+    size_t block = storage_io_block_size(&geometry, COPY_BLOCK_SIZE, COPY_BLOCK_MAX);
+    storage_io_bench_result_t result;
+    esp_err_t ret = storage_io_bench(path, bytes, block, geometry.sector_size, &result);
+    if (ret != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "volume", volume);
+    cJSON_AddBoolToObject(root, "fast_io", STORAGE_FAST_IO);
+    cJSON_AddStringToObject(root, "bus", usb ? "usb-msc" : SD_USE_SDMMC ? "sdmmc" : "sdspi");
+    cJSON_AddNumberToObject(root, "sector_size", geometry.sector_size);
+    cJSON_AddNumberToObject(root, "cluster_size", geometry.cluster_size);
+    cJSON_AddNumberToObject(root, "bytes", result.file_bytes);
+    add_storage_bench_pattern(root, "baseline", &result.baseline);
+    add_storage_bench_pattern(root, "tuned", &result.tuned);
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+// --- Benchmark Suite ---
+static void add_bench_volume(cJSON *parent, const bench_volume_result_t *volume) {
+    cJSON *obj = cJSON_CreateObject();
+    cJSON_AddStringToObject(obj, "volume", volume->name);
+    cJSON_AddStringToObject(obj, "result", esp_err_to_name(volume->result));
+    cJSON_AddNumberToObject(obj, "cluster_size", volume->cluster_size);
+    cJSON *seq = cJSON_AddArrayToObject(obj, "sequential");
+    for (size_t i = 0; i < volume->sequential_count; i++) {
+        const storage_io_bench_pattern_t *p = &volume->sequential[i];
+        cJSON *row = cJSON_CreateObject();
+        cJSON_AddNumberToObject(row, "block_size", p->block_size);
+        cJSON_AddNumberToObject(row, "write_kbps", p->write_kbps);
+        cJSON_AddNumberToObject(row, "read_kbps", p->read_kbps);
+        cJSON_AddItemToArray(seq, row);
+    }
+    cJSON *small = cJSON_AddObjectToObject(obj, "small_files");
+    cJSON_AddNumberToObject(small, "files", volume->small_files.files);
+    cJSON_AddNumberToObject(small, "file_bytes", volume->small_files.file_bytes);
+    cJSON_AddNumberToObject(small, "create_per_s", volume->small_files.create_per_s);
+    cJSON_AddNumberToObject(small, "read_per_s", volume->small_files.read_per_s);
+    cJSON_AddNumberToObject(small, "delete_per_s", volume->small_files.delete_per_s);
+    cJSON_AddItemToArray(parent, obj);
+}
+
+// Set while the suite runs; two at once would share the synthetic rows and files
+static atomic_flag g_bench_running = ATOMIC_FLAG_INIT;
+
+// Runs every benchmark and reports the firmware build alongside, so results
+// from different boards and builds can be compared:
+// GET /bench[?bytes=N][&files=N][&books=N]. Takes a minute or more, so it runs
+// on an HTTP worker rather than the server task.
+static esp_err_t bench_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    bench_config_t config = {
+        .sequential_bytes = BENCH_DEFAULT_BYTES,
+        .small_files = BENCH_DEFAULT_FILES,
+        .books = BENCH_DEFAULT_BOOKS,
+        .copy_config = g_copy_config,
+        .list_row = listing_add_entry,
+    };
+    char buf[96];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK) {
+        if (httpd_query_key_value(buf, "bytes", param, sizeof(param)) == ESP_OK) {
+            config.sequential_bytes = strtoul(param, NULL, 10);
+        }
+        if (httpd_query_key_value(buf, "files", param, sizeof(param)) == ESP_OK) {
+            config.small_files = strtoul(param, NULL, 10);
+        }
+        if (httpd_query_key_value(buf, "books", param, sizeof(param)) == ESP_OK) {
+            config.books = strtoul(param, NULL, 10);
+        }
+    }
+    if (config.sequential_bytes == 0 || config.sequential_bytes > STORAGE_BENCH_MAX_BYTES ||
+        config.small_files > BENCH_MAX_FILES || config.books == 0 || config.books > CATALOG_BENCH_MAX_BOOKS) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid benchmark size.");
+        return ESP_FAIL;
+    }
+    if (g_sd_fatfs_drive[0]) {
+        config.volumes[config.volume_count++] = (bench_volume_t){ CATALOG_VOLUME_SD, MOUNT_POINT_SD, g_sd_fatfs_drive };
+    }
+    if (ebook_reader_connected && g_usb_fatfs_drive[0]) {
+        config.volumes[config.volume_count++] = (bench_volume_t){ CATALOG_VOLUME_USB, MOUNT_POINT_USB, g_usb_fatfs_drive };
+    }
+    if (config.volume_count == 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No volume mounted.");
+        return ESP_FAIL;
+    }
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    if (progress.active || transfer_queue_pending() > 0) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "A transfer is running.");
+        return ESP_FAIL;
+    }
+
+    if (atomic_flag_test_and_set(&g_bench_running)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "A benchmark is running.");
+        return ESP_FAIL;
+    }
+
+    // Too large for a worker's stack
+    bench_result_t *result = malloc(sizeof(*result));
+    esp_err_t ret = result ? bench_run_suite(&config, result) : ESP_ERR_NO_MEM;
+    atomic_flag_clear(&g_bench_running);
+    if (ret != ESP_OK) {
+        free(result);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    const esp_app_desc_t *app = esp_app_get_description();
+    cJSON *root = cJSON_CreateObject();
+    cJSON *build = cJSON_AddObjectToObject(root, "build");
+    cJSON_AddStringToObject(build, "version", app->version);
+    cJSON_AddStringToObject(build, "idf", app->idf_ver);
+    cJSON_AddStringToObject(build, "date", app->date);
+    cJSON_AddBoolToObject(build, "fast_io", STORAGE_FAST_IO);
+    cJSON_AddStringToObject(build, "sd_bus", SD_USE_SDMMC ? "sdmmc" : "sdspi");
+
+    cJSON_AddNumberToObject(root, "sequential_bytes", result->sequential_bytes);
+    cJSON *volumes = cJSON_AddArrayToObject(root, "volumes");
+    for (size_t i = 0; i < result->volume_count; i++) {
+        add_bench_volume(volumes, &result->volumes[i]);
+    }
+
+    const bench_copy_result_t *copy = &result->copy;
+    cJSON *copy_obj = cJSON_AddObjectToObject(root, "copy");
+    cJSON_AddStringToObject(copy_obj, "result", esp_err_to_name(copy->result));
+    if (copy->source) {
+        cJSON_AddStringToObject(copy_obj, "source", copy->source);
+        cJSON_AddStringToObject(copy_obj, "destination", copy->destination);
+    }
+    cJSON_AddNumberToObject(copy_obj, "bytes", copy->bytes);
+    cJSON_AddNumberToObject(copy_obj, "block_size", copy->block_size);
+    cJSON_AddNumberToObject(copy_obj, "us", (double)copy->us);
+    cJSON_AddNumberToObject(copy_obj, "kbps", copy->kbps);
+
+    const bench_catalog_result_t *cat = &result->catalog;
+    cJSON *cat_obj = cJSON_AddObjectToObject(root, "catalog");
+    cJSON_AddStringToObject(cat_obj, "result", esp_err_to_name(cat->result));
+    cJSON_AddNumberToObject(cat_obj, "books", cat->books);
+    cJSON_AddNumberToObject(cat_obj, "populate_us", (double)cat->populate_us);
+    cJSON_AddNumberToObject(cat_obj, "count_us", (double)cat->count_us);
+    cJSON_AddNumberToObject(cat_obj, "page_us", (double)cat->page_us);
+    cJSON_AddNumberToObject(cat_obj, "filter_us", (double)cat->filter_us);
+    cJSON_AddNumberToObject(cat_obj, "search_us", (double)cat->search_us);
+    cJSON *list_obj = cJSON_AddObjectToObject(root, "list_files");
+    cJSON_AddNumberToObject(list_obj, "page_size", CATALOG_BENCH_PAGE_SIZE);
+    cJSON_AddNumberToObject(list_obj, "first_page_us", (double)cat->list_first_us);
+    cJSON_AddNumberToObject(list_obj, "page_us", (double)cat->list_page_us);
+    cJSON_AddNumberToObject(list_obj, "page_bytes", cat->list_page_bytes);
+    free(result);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+// --- Book Download/Upload ---
+// Extracts and validates the filename from /books/<name>.
+static esp_err_t book_name_from_uri(httpd_req_t *req, char *name, size_t len) {
+    const char *start = req->uri + strlen("/books/");
+    size_t name_len = strcspn(start, "?");
+    if (name_len == 0 || name_len >= len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(name, start, name_len);
+    name[name_len] = '\0';
+    url_decode_inplace(name, false);
+    return transfer_queue_is_valid_filename(name) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static const char *book_mime_type(const char *name) {
+    const char *ext = strrchr(name, '.');
+    if (!ext) return "application/octet-stream";
+    if (strcasecmp(ext, ".epub") == 0) return "application/epub+zip";
+    if (strcasecmp(ext, ".pdf") == 0) return "application/pdf";
+    if (strcasecmp(ext, ".mobi") == 0) return "application/x-mobipocket-ebook";
+    if (strcasecmp(ext, ".txt") == 0) return "text/plain";
+    return "application/octet-stream";
+}
+
+// Parses a single "bytes=" range against a file of `size` bytes.
+// Supports "a-b", "a-" and "-n". Returns false if unsatisfiable or malformed.
+static bool parse_byte_range(const char *header, long size, long *start, long *end) {
+    if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',')) {
+        return false;
+    }
+    const char *spec = header + 6;
+    char *dash;
+    if (*spec == '-') {
+        long suffix = strtol(spec + 1, &dash, 10);
+        if (suffix <= 0 || size == 0) return false;
+        *start = suffix >= size ? 0 : size - suffix;
+        *end = size - 1;
+        return true;
+    }
+    *start = strtol(spec, &dash, 10);
+    if (*dash != '-' || *start < 0 || *start >= size) return false;
+    *end = dash[1] ? strtol(dash + 1, NULL, 10) : size - 1;
+    if (*end < *start) return false;
+    if (*end >= size) *end = size - 1;
+    return true;
+}
+
+// Book streams run on the HTTP workers, on the other core from the transfer
+// task, so priorities cannot order them. While a transfer is running or
+// queued they pause after each buffer instead, so the copy keeps most of the
+// SD card's time.
+static void book_io_pace(void) {
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    if (progress.active || transfer_queue_pending() > 0) {
+        vTaskDelay(pdMS_TO_TICKS(BOOK_IO_PACE_MS));
+    }
+}
+
+static esp_err_t send_all(httpd_req_t *req, const char *data, size_t len) {
+    while (len > 0) {
+        int sent = httpd_send(req, data, len);
+        if (sent == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+// GET /books/<name>, with optional "Range: bytes=..." for resumable downloads
+static esp_err_t book_download_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char name[128];
+    if (book_name_from_uri(req, name, sizeof(name)) != ESP_OK) {
         httpd_resp_send_400(req);
         return ESP_FAIL;
     }
-
-    const char *mount_path = (strcmp(param, "sd") == 0) ? MOUNT_POINT_SD : MOUNT_POINT_USB;
-
-    if (strcmp(param, "usb") == 0 && !ebook_reader_connected) {
-         httpd_resp_set_type(req, "application/json");
-         httpd_resp_send(req, "[]", 2);
-         return ESP_OK;
+
+    // Names merged away as duplicates are served from the file that was kept
+    char file[128];
+    if (catalog_resolve_name(CATALOG_VOLUME_SD, name, file, sizeof(file)) != ESP_OK) {
+        strlcpy(file, name, sizeof(file));
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", MOUNT_POINT_SD, file);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    long size = st.st_size;
+    long start = 0;
+    long end = size - 1;
+    bool partial = false;
+
+    char range[64];
+    if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK) {
+        if (!parse_byte_range(range, size, &start, &end)) {
+            fclose(f);
+            char content_range[32];
+            snprintf(content_range, sizeof(content_range), "bytes */%ld", size);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", content_range);
+            httpd_resp_send(req, NULL, 0);
+            return ESP_OK;
+        }
+        partial = true;
+    }
+    if (start > 0 && fseek(f, start, SEEK_SET) != 0) {
+        fclose(f);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
     }
 
-    DIR *d = opendir(mount_path);
-    if (!d) {
-        ESP_LOGE(TAG, "Failed to open directory: %s", mount_path);
+    char *buf = mem_pool_alloc(g_io_pool);
+    if (!buf) {
+        fclose(f);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    cJSON *root = cJSON_CreateArray();
-    struct dirent *dir;
-    while ((dir = readdir(d)) != NULL) {
-        if (dir->d_type == DT_REG) { // If it's a regular file
-            if (strstr(dir->d_name, ".epub") || strstr(dir->d_name, ".mobi") || strstr(dir->d_name, ".pdf") || strstr(dir->d_name, ".txt")) {
-                cJSON *file_obj = cJSON_CreateObject();
-                cJSON_AddStringToObject(file_obj, "name", dir->d_name);
-
-                // For EPUBs, try to parse metadata
-                if (strstr(dir->d_name, ".epub")) {
-                    char full_path[512];
-                    snprintf(full_path, sizeof(full_path), "%s/%s", mount_path, dir->d_name);
-
-                    mz_zip_archive zip_archive;
-                    memset(&zip_archive, 0, sizeof(zip_archive));
-
-                    if (mz_zip_reader_init_file(&zip_archive, full_path, 0)) {
-                        char *opf_content = NULL;
-                        size_t opf_size = 0;
-
-                        // Try common OPF paths
-                        const char* opf_paths[] = {"OEBPS/content.opf", "content.opf", "OPS/content.opf"};
-                        for (int i = 0; i < sizeof(opf_paths)/sizeof(opf_paths[0]); i++) {
-                            int file_index = mz_zip_reader_locate_file(&zip_archive, opf_paths[i], NULL, 0);
-                            if (file_index >= 0) {
-                                opf_content = mz_zip_reader_extract_file_to_heap(&zip_archive, file_index, &opf_size, 0);
-                                break;
-                            }
-                        }
-
-                        if (opf_content) {
-                            char *title = parse_xml_tag(opf_content, "dc:title");
-                            char *author = parse_xml_tag(opf_content, "dc:creator");
-
-                            cJSON_AddStringToObject(file_obj, "title", title ? title : dir->d_name);
-                            cJSON_AddStringToObject(file_obj, "author", author ? author : "Unknown");
-
-                            if (title) free(title);
-                            if (author) free(author);
-                            free(opf_content);
-                        } else {
-                             cJSON_AddStringToObject(file_obj, "title", dir->d_name);
-                             cJSON_AddStringToObject(file_obj, "author", "Unknown");
-                        }
-                        mz_zip_reader_end(&zip_archive);
-                    } else {
-                        cJSON_AddStringToObject(file_obj, "title", dir->d_name);
-                        cJSON_AddStringToObject(file_obj, "author", "Unknown");
-                    }
-                } else {
-                    // For other file types, just use the filename
-                    cJSON_AddStringToObject(file_obj, "title", dir->d_name);
-                    cJSON_AddStringToObject(file_obj, "author", "");
-                }
-                cJSON_AddItemToArray(root, file_obj);
-            }
+    // The headers are written by hand so the response carries a real
+    // Content-Length instead of being chunked; download managers need it to resume.
+    long remaining = size > 0 ? end - start + 1 : 0;
+    int header_len = snprintf(buf, BOOK_IO_BUFFER_SIZE,
+                              "HTTP/1.1 %s\r\n"
+                              "Content-Type: %s\r\n"
+                              "Content-Length: %ld\r\n"
+                              "Accept-Ranges: bytes\r\n"
+                              "Content-Disposition: attachment; filename=\"%s\"\r\n",
+                              partial ? "206 Partial Content" : "200 OK",
+                              book_mime_type(name), remaining, name);
+    if (partial) {
+        header_len += snprintf(buf + header_len, BOOK_IO_BUFFER_SIZE - header_len,
+                               "Content-Range: bytes %ld-%ld/%ld\r\n", start, end, size);
+    }
+    header_len += snprintf(buf + header_len, BOOK_IO_BUFFER_SIZE - header_len, "\r\n");
+
+    esp_err_t ret = send_all(req, buf, header_len);
+    while (ret == ESP_OK && remaining > 0) {
+        book_io_pace();
+        size_t want = remaining < BOOK_IO_BUFFER_SIZE ? remaining : BOOK_IO_BUFFER_SIZE;
+        size_t got = fread(buf, 1, want, f);
+        if (got == 0) {
+            ESP_LOGE(TAG, "Read error while sending %s", name);
+            ret = ESP_FAIL;
+            break;
         }
+        metrics_count_io(g_sd_metrics_mount, false, got);
+        ret = send_all(req, buf, got);
+        remaining -= got;
     }
-    closedir(d);
-
-    httpd_resp_set_type(req, "application/json");
-    char *json_str = cJSON_PrintUnformatted(root);
-    httpd_resp_send(req, json_str, strlen(json_str));
-    free(json_str);
-    cJSON_Delete(root);
 
-    return ESP_OK;
+    mem_pool_free(g_io_pool, buf);
+    fclose(f);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Download of %s interrupted", name);
+    }
+    return ret;
 }
 
-static esp_err_t transfer_file_handler(httpd_req_t *req) {
-    if (g_transfer_progress.active) {
-        httpd_resp_send_err(req, HTTPD_429_TOO_MANY_REQUESTS, "A file transfer is already in progress.");
+// PUT or POST /books/<name>. The body is streamed to a temporary file on the
+// SD card and renamed into place once complete, so a dropped upload never
+// leaves a truncated book in the library.
+static esp_err_t book_upload_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    char name[128];
+    if (book_name_from_uri(req, name, sizeof(name)) != ESP_OK || !catalog_is_book_file(name)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid book name.");
         return ESP_FAIL;
     }
-
-    g_led_state = LED_STATE_TRANSFER;
-
-    char content[256];
-    int ret = httpd_req_recv(req, content, sizeof(content) - 1);
-    if (ret <= 0) {
-        g_led_state = ebook_reader_connected ? LED_STATE_CONNECTED : LED_STATE_IDLE;
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_411_LENGTH_REQUIRED, "Content-Length required.");
         return ESP_FAIL;
     }
-    content[ret] = '\0';
 
-    cJSON *json = cJSON_Parse(content);
-    if (!json) {
-        httpd_resp_send_400(req);
-        g_led_state = ebook_reader_connected ? LED_STATE_CONNECTED : LED_STATE_IDLE;
+    int sockfd = httpd_req_to_sockfd(req);
+    char temp[32];
+    snprintf(temp, sizeof(temp), BOOK_UPLOAD_TEMP_FMT, sockfd);
+    FILE *f = fopen(temp, "wb");
+    if (!f) {
+        httpd_resp_send_500(req);
         return ESP_FAIL;
     }
-
-    const char *source = cJSON_GetObjectItem(json, "source")->valuestring;
-    const char *destination = cJSON_GetObjectItem(json, "destination")->valuestring;
-    const char *filename = cJSON_GetObjectItem(json, "filename")->valuestring;
-
-    if (!source || !destination || !filename) {
-        cJSON_Delete(json);
-        httpd_resp_send_400(req);
-        g_led_state = ebook_reader_connected ? LED_STATE_CONNECTED : LED_STATE_IDLE;
+    char *buf = mem_pool_alloc(g_io_pool);
+    if (!buf) {
+        fclose(f);
+        remove(temp);
+        httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    // Initialize progress tracking
-    g_transfer_progress.active = true;
-    g_cancel_transfer = false; // Reset cancel flag
-    strlcpy(g_transfer_progress.filename, filename, sizeof(g_transfer_progress.filename));
-    g_transfer_progress.bytes_transferred = 0;
-    g_transfer_progress.total_bytes = 0;
-    g_transfer_progress.success = false;
-    g_transfer_progress.error_msg[0] = '\0';
-
-    char source_path[256];
-    char dest_path[256];
-
-    snprintf(source_path, sizeof(source_path), "%s/%s", (strcmp(source, "sd") == 0) ? MOUNT_POINT_SD : MOUNT_POINT_USB, filename);
-    snprintf(dest_path, sizeof(dest_path), "%s/%s", (strcmp(destination, "sd") == 0) ? MOUNT_POINT_SD : MOUNT_POINT_USB, filename);
-
-    esp_err_t res = copy_file(source_path, dest_path, &g_transfer_progress);
-
-    cJSON_Delete(json);
+    esp_err_t ret = ESP_OK;
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        // Fill the whole buffer before writing so FATFS sees large, cluster-sized writes
+        size_t filled = 0;
+        size_t want = remaining < BOOK_IO_BUFFER_SIZE ? remaining : BOOK_IO_BUFFER_SIZE;
+        while (filled < want) {
+            int got = httpd_req_recv(req, buf + filled, want - filled);
+            if (got == HTTPD_SOCK_ERR_TIMEOUT) {
+                continue;
+            }
+            if (got <= 0) {
+                ret = ESP_FAIL;
+                break;
+            }
+            filled += got;
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+        book_io_pace();
+        if (fwrite(buf, 1, filled, f) != filled) {
+            ret = ESP_ERR_NO_MEM; // Card full or write error
+            break;
+        }
+        metrics_count_io(g_sd_metrics_mount, true, filled);
+        remaining -= filled;
+    }
+    mem_pool_free(g_io_pool, buf);
 
-    // Set LED state back based on connection status
-    g_led_state = ebook_reader_connected ? LED_STATE_CONNECTED : LED_STATE_IDLE;
-    if (res != ESP_OK) {
-        g_led_state = LED_STATE_ERROR; // Indicate error on LED
+    if (fclose(f) != 0 && ret == ESP_OK) {
+        ret = ESP_ERR_NO_MEM;
+    }
+    if (ret != ESP_OK) {
+        remove(temp);
+        ESP_LOGW(TAG, "Upload of %s failed", name);
+        if (ret == ESP_ERR_NO_MEM) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Write error on SD card.");
+        }
+        return ESP_FAIL;
     }
 
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", MOUNT_POINT_SD, name);
+    // FATFS does not rename over an existing file, so move the old copy
+    // aside and put it back if the new one cannot take its name
+    char backup[32];
+    snprintf(backup, sizeof(backup), BOOK_UPLOAD_BACKUP_FMT, sockfd);
+    remove(backup);
+    bool replaced = rename(path, backup) == 0;
+    if (rename(temp, path) != 0) {
+        if (replaced && rename(backup, path) != 0) {
+            ESP_LOGE(TAG, "Could not restore %s; the previous copy is in %s", name, backup);
+        }
+        remove(temp);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store file.");
+        return ESP_FAIL;
+    }
+    if (replaced) {
+        remove(backup);
+    }
+    catalog_update_file(CATALOG_VOLUME_SD, MOUNT_POINT_SD, name);
+    thumbnail_request(CATALOG_VOLUME_SD);
+    ESP_LOGI(TAG, "Uploaded %s (%u bytes)", name, (unsigned)req->content_len);
 
     cJSON *response_json = cJSON_CreateObject();
-    cJSON_AddBoolToObject(response_json, "success", res == ESP_OK);
-    cJSON_AddStringToObject(response_json, "message", res == ESP_OK ? "File transfer complete!" : g_transfer_progress.error_msg);
-
+    cJSON_AddBoolToObject(response_json, "success", true);
+    cJSON_AddStringToObject(response_json, "name", name);
+    cJSON_AddNumberToObject(response_json, "size", req->content_len);
     char *json_str = cJSON_PrintUnformatted(response_json);
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json_str, strlen(json_str));
-    free(json_str);
+    cJSON_free(json_str);
     cJSON_Delete(response_json);
-
-    // Deactivate progress tracking after sending response
-    g_transfer_progress.active = false;
-
-    return ESP_OK;
-}
-
-static esp_err_t transfer_cancel_handler(httpd_req_t *req) {
-    ESP_LOGI(TAG, "Received request to cancel transfer");
-    g_cancel_transfer = true;
-    httpd_resp_send(req, "OK", HTTPD_200_OK);
     return ESP_OK;
 }
 
-// Handler to report the current file transfer progress
-static esp_err_t transfer_progress_handler(httpd_req_t *req) {
-    if (!g_transfer_progress.active) {
+// --- Cover Thumbnails ---
+// GET /cover/<key>, with the key taken from a listing's "cover" field. Keys
+// are content hashes, so the response can be cached indefinitely.
+static esp_err_t cover_handler(httpd_req_t *req) {
+    if (storage_starting(req)) {
+        return ESP_OK;
+    }
+    const char *key_str = req->uri + strlen("/cover/");
+    char *end;
+    unsigned long key = strtoul(key_str, &end, 16);
+    if (end - key_str != 8 || (*end != '\0' && *end != '?')) {
         httpd_resp_send_404(req);
         return ESP_OK;
     }
 
-    httpd_resp_set_type(req, "application/json");
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "filename", g_transfer_progress.filename);
-    cJSON_AddNumberToObject(root, "bytes_transferred", g_transfer_progress.bytes_transferred);
-    cJSON_AddNumberToObject(root, "total_bytes", g_transfer_progress.total_bytes);
-
-    char *json_str = cJSON_PrintUnformatted(root);
-    httpd_resp_send(req, json_str, strlen(json_str));
-    free(json_str);
-    cJSON_Delete(root);
+    char path[64];
+    thumbnail_cache_path(key, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    char *buf = mem_pool_alloc(g_io_pool);
+    if (!buf) {
+        fclose(f);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
 
-    return ESP_OK;
+    httpd_resp_set_type(req, "image/bmp");
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+    esp_err_t ret = ESP_OK;
+    size_t got;
+    while (ret == ESP_OK && (got = fread(buf, 1, BOOK_IO_BUFFER_SIZE, f)) > 0) {
+        ret = httpd_resp_send_chunk(req, buf, got);
+    }
+    mem_pool_free(g_io_pool, buf);
+    fclose(f);
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return ret;
 }
 
 static esp_err_t sleep_handler(httpd_req_t *req) {
@@ -619,12 +1826,8 @@ static esp_err_t sleep_handler(httpd_req_t *req) {
     vTaskDelay(pdMS_TO_TICKS(100));
 
     ESP_LOGI(TAG, "Unmounting filesystems before sleep...");
-    // Unmount SPIFFS. The label "storage" is defined in init_spiffs.
-    if (esp_vfs_spiffs_unregister("storage") == ESP_OK) {
-        ESP_LOGI(TAG, "SPIFFS unmounted successfully.");
-    } else {
-        ESP_LOGE(TAG, "Failed to unmount SPIFFS.");
-    }
+    // Close the catalog before its filesystem goes away
+    catalog_close();
     // Unmount SD card
     if (esp_vfs_fat_sdcard_unmount(MOUNT_POINT_SD, NULL) == ESP_OK) {
          ESP_LOGI(TAG, "SD card unmounted successfully.");
@@ -642,35 +1845,109 @@ static esp_err_t sleep_handler(httpd_req_t *req) {
 
 
 // --- WEB SERVER SETUP (MAIN APP) ---
+// Every open client socket keeps the CPU at full clock, so requests are
+// served at full speed and the device only idles once all clients are gone.
+static esp_err_t http_open_socket(httpd_handle_t hd, int sockfd) {
+    power_acquire(POWER_HOLD_HTTP);
+    return ESP_OK;
+}
+
+// Owning close_fn means closing the socket ourselves
+static void http_close_socket(httpd_handle_t hd, int sockfd) {
+    power_release(POWER_HOLD_HTTP);
+    close(sockfd);
+}
+
 static httpd_handle_t start_webserver(void) {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 24;
+    config.stack_size = HTTP_SERVER_STACK_SIZE;
+    config.task_priority = HTTP_SERVER_PRIORITY;
+    config.core_id = CORE_NET;
+    config.max_open_sockets = HTTP_MAX_OPEN_SOCKETS;
+    config.lru_purge_enable = true;
+    config.open_fn = http_open_socket;
+    config.close_fn = http_close_socket;
+
+    const http_workers_config_t workers = {
+        .worker_count = HTTP_WORKER_COUNT,
+        .task_stack_size = HTTP_WORKER_STACK_SIZE,
+        .task_priority = HTTP_WORKER_PRIORITY,
+        .core_id = CORE_NET,
+        .queue_length = HTTP_WORKER_QUEUE_LEN,
+    };
+    if (http_workers_init(&workers) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start HTTP workers; all requests will run on the server task");
+    }
 
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Handlers for dynamic content
         httpd_uri_t status_uri = { "/status", HTTP_GET, status_handler, NULL };
-        httpd_register_uri_handler(server, &status_uri);
+        metrics_register_handler(server, &status_uri);
 
         httpd_uri_t list_uri = { "/list-files", HTTP_GET, list_files_handler, NULL };
-        httpd_register_uri_handler(server, &list_uri);
+        http_workers_register(server, &list_uri);
+
+        httpd_uri_t search_uri = { "/search", HTTP_GET, search_handler, NULL };
+        http_workers_register(server, &search_uri);
+
+        httpd_uri_t duplicates_uri = { "/duplicates", HTTP_GET, duplicates_handler, NULL };
+        http_workers_register(server, &duplicates_uri);
+
+        httpd_uri_t merge_uri = { "/duplicates/merge", HTTP_POST, duplicates_merge_handler, NULL };
+        http_workers_register(server, &merge_uri);
 
         httpd_uri_t transfer_uri = { "/transfer-file", HTTP_POST, transfer_file_handler, NULL };
-        httpd_register_uri_handler(server, &transfer_uri);
+        metrics_register_handler(server, &transfer_uri);
+
+        httpd_uri_t batch_uri = { "/transfer-batch", HTTP_POST, transfer_batch_handler, NULL };
+        metrics_register_handler(server, &batch_uri);
+
+        httpd_uri_t job_status_uri = { "/transfer-status", HTTP_GET, transfer_status_handler, NULL };
+        metrics_register_handler(server, &job_status_uri);
+
+        // Server-pushed status, progress and job events
+        event_push_register(server);
+
+        // Heap, task, I/O and request latency counters; not timed itself
+        metrics_register(server);
 
         httpd_uri_t progress_uri = { "/transfer-progress", HTTP_GET, transfer_progress_handler, NULL };
-        httpd_register_uri_handler(server, &progress_uri);
+        metrics_register_handler(server, &progress_uri);
 
         httpd_uri_t cancel_uri = { "/transfer-cancel", HTTP_POST, transfer_cancel_handler, NULL };
-        httpd_register_uri_handler(server, &cancel_uri);
+        metrics_register_handler(server, &cancel_uri);
 
         httpd_uri_t sleep_uri = { "/enter-sleep", HTTP_POST, sleep_handler, NULL };
-        httpd_register_uri_handler(server, &sleep_uri);
+        metrics_register_handler(server, &sleep_uri);
+
+        httpd_uri_t bench_catalog_uri = { "/bench/catalog", HTTP_GET, bench_catalog_handler, NULL };
+        http_workers_register(server, &bench_catalog_uri);
+
+        httpd_uri_t bench_storage_uri = { "/bench/storage", HTTP_GET, bench_storage_handler, NULL };
+        http_workers_register(server, &bench_storage_uri);
+
+        httpd_uri_t bench_uri = { "/bench", HTTP_GET, bench_handler, NULL };
+        http_workers_register(server, &bench_uri);
 
         // Handler for all other URIs (serves static files)
+        httpd_uri_t book_get_uri = { "/books/*", HTTP_GET, book_download_handler, NULL };
+        http_workers_register(server, &book_get_uri);
+
+        httpd_uri_t book_put_uri = { "/books/*", HTTP_PUT, book_upload_handler, NULL };
+        http_workers_register(server, &book_put_uri);
+
+        httpd_uri_t book_post_uri = { "/books/*", HTTP_POST, book_upload_handler, NULL };
+        http_workers_register(server, &book_post_uri);
+
+        httpd_uri_t cover_uri = { "/cover/*", HTTP_GET, cover_handler, NULL };
+        http_workers_register(server, &cover_uri);
+
         httpd_uri_t static_uri = { "/*", HTTP_GET, static_file_handler, NULL };
-        httpd_register_uri_handler(server, &static_uri);
+        metrics_register_handler(server, &static_uri);
     }
     return server;
 }
@@ -1039,6 +2316,21 @@ void init_ble(void)
     ESP_LOGI(GATTS_TAG, "BLE Initialized successfully");
 }
 
+// Returns the memory of the never-started BT controller and Bluedroid host to
+// the heap. BLE cannot be brought up again until the next reboot.
+static void release_ble(void) {
+    size_t before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    esp_err_t ret = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+    if (ret != ESP_OK) {
+        ESP_LOGW(GATTS_TAG, "Failed to release BT memory: %s", esp_err_to_name(ret));
+        return;
+    }
+    size_t after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    g_ble_reclaimed = after > before ? after - before : 0;
+    metrics_set_reclaimed("ble", g_ble_reclaimed);
+    ESP_LOGI(GATTS_TAG, "BLE not needed; reclaimed %u bytes", (unsigned)g_ble_reclaimed);
+}
+
 
 static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
     switch (event) {
@@ -1205,86 +2497,181 @@ void init_wifi(void) {
     }
 }
 
-// --- SPIFFS SETUP ---
-void init_spiffs(void) {
-    ESP_LOGI(TAG, "Initializing SPIFFS");
-
-    esp_vfs_spiffs_conf_t conf = {
-      .base_path = MOUNT_POINT_SPIFFS,
-      .partition_label = "storage",
-      .max_files = 5,
-      .format_if_mount_failed = true
-    };
-
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-        }
-        g_led_state = LED_STATE_ERROR;
-        return;
-    }
-
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info(conf.partition_label, &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-        g_led_state = LED_STATE_ERROR;
-    } else {
-        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
-    }
-}
-
 // --- SD CARD SETUP ---
-void init_sd_card(void) {
-    esp_err_t ret;
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024
-    };
-    sdmmc_card_t *card;
-    const char mount_point[] = MOUNT_POINT_SD;
-    ESP_LOGI(TAG, "Initializing SD card");
-
+#if SD_USE_SDMMC
+static esp_err_t mount_sd_card(const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **card) {
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    host.max_freq_khz = SDMMC_FREQ_KHZ;
+
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = SDMMC_BUS_WIDTH;
+    slot_config.clk = PIN_NUM_SDMMC_CLK;
+    slot_config.cmd = PIN_NUM_SDMMC_CMD;
+    slot_config.d0 = PIN_NUM_SDMMC_D0;
+    slot_config.d1 = PIN_NUM_SDMMC_D1;
+    slot_config.d2 = PIN_NUM_SDMMC_D2;
+    slot_config.d3 = PIN_NUM_SDMMC_D3;
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    return esp_vfs_fat_sdmmc_mount(MOUNT_POINT_SD, &host, &slot_config, mount_config, card);
+}
+#else
+static esp_err_t mount_sd_card(const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **card) {
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.max_freq_khz = SD_SPI_FREQ_KHZ;
     spi_bus_config_t bus_cfg = {
         .mosi_io_num = PIN_NUM_MOSI,
         .miso_io_num = PIN_NUM_MISO,
         .sclk_io_num = PIN_NUM_CLK,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
-        .max_transfer_sz = 4000,
+        .max_transfer_sz = SD_SPI_MAX_TRANSFER,
     };
-    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
+    esp_err_t ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize spi bus.");
-        g_led_state = LED_STATE_ERROR;
-        return;
+        return ret;
     }
 
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
     slot_config.gpio_cs = PIN_NUM_CS;
     slot_config.host_id = host.slot;
 
-    ret = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &card);
+    return esp_vfs_fat_sdspi_mount(MOUNT_POINT_SD, &host, &slot_config, mount_config, card);
+}
+#endif
 
-    if (ret != ESP_OK) {
+// Mounts the card and opens the catalog. Returns ESP_OK once listings can
+// be served from it.
+esp_err_t init_sd_card(void) {
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = SD_MAX_FILES,
+        .allocation_unit_size = SD_ALLOCATION_UNIT
+    };
+    sdmmc_card_t *card;
+    ESP_LOGI(TAG, "Initializing SD card");
+
+    if (mount_sd_card(&mount_config, &card) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to mount SD card VFS");
-        g_led_state = LED_STATE_ERROR;
+        led_set_state(LED_STATE_ERROR);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "SD card %s mounted at %s: %llu MiB, %d-bit bus at %d kHz%s", card->cid.name, MOUNT_POINT_SD,
+             (unsigned long long)card->csd.capacity * card->csd.sector_size / (1024 * 1024),
+             1 << card->log_bus_width, card->real_freq_khz, card->is_ddr ? " DDR" : "");
+    esp_err_t ret = catalog_open(CATALOG_DB_PATH, CATALOG_ALIASES_PATH);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open library catalog; listings will be unavailable");
     } else {
-        ESP_LOGI(TAG, "SD card mounted successfully at %s", mount_point);
+        catalog_set_cache_size(g_ble_reclaimed >= BLE_RECLAIM_MIN_BYTES ? CATALOG_CACHE_KB_RECLAIMED
+                                                                        : CATALOG_CACHE_KB);
+        // Pull the index pages into the cache before the first listing asks
+        catalog_query_t query = { .volume = CATALOG_VOLUME_SD };
+        uint32_t books = 0;
+        if (catalog_count(&query, &books) == ESP_OK) {
+            ESP_LOGI(TAG, "Catalog ready: %u book(s) on the SD card", (unsigned)books);
+        }
+    }
+    BYTE pdrv = ff_diskio_get_pdrv_card(card);
+    if (pdrv != 0xFF) {
+        snprintf(g_sd_fatfs_drive, sizeof(g_sd_fatfs_drive), "%u:", (unsigned)pdrv);
+        if (storage_io_get_geometry(g_sd_fatfs_drive, &g_sd_geometry) == ESP_OK) {
+            ESP_LOGI(TAG, "SD card: %u-byte sectors, %u-byte clusters",
+                     (unsigned)g_sd_geometry.sector_size, (unsigned)g_sd_geometry.cluster_size);
+        }
+    }
+    return ret;
+}
+
+// --- Catalog Scanner ---
+// Scans and thumbnail generation wait while the card is busy with a transfer
+static bool card_busy_with_transfer(void) {
+    transfer_progress_t progress;
+    transfer_queue_get_progress(&progress);
+    return progress.active || transfer_queue_pending() > 0;
+}
+
+static void on_scan_finished(const char *volume, esp_err_t result, const catalog_sync_stats_t *stats) {
+    if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) {
+        ESP_LOGW(TAG, "Scan of %s failed: %s", volume, esp_err_to_name(result));
+    }
+    // Clients only need to reload a listing that actually changed
+    if ((stats->parsed > 0 || stats->removed > 0) && event_push_has_clients()) {
+        cJSON *root = build_status_json("scan");
+        cJSON_AddStringToObject(root, "scanned", volume);
+        push_json(root);
+    }
+    if (result == ESP_OK) {
+        thumbnail_request(volume);
+    }
+}
+
+static void init_scanner(void) {
+    scanner_config_t config = {
+        .task_stack_size = SCANNER_TASK_STACK_SIZE,
+        .task_priority = SCANNER_TASK_PRIORITY,
+        .core_id = CORE_IO,
+        .is_busy = card_busy_with_transfer,
+        .on_scan_finished = on_scan_finished,
+    };
+    ESP_ERROR_CHECK(scanner_init(&config));
+    scanner_add_volume(CATALOG_VOLUME_SD, MOUNT_POINT_SD, g_sd_fatfs_drive[0] ? g_sd_fatfs_drive : NULL);
+    // The MSC VFS does not expose its FatFs drive, so the reader is walked with stat()
+    scanner_add_volume(CATALOG_VOLUME_USB, MOUNT_POINT_USB, NULL);
+    scanner_request(CATALOG_VOLUME_SD);
+}
+
+static void on_thumbnails_generated(const char *volume, uint32_t count) {
+    if (event_push_has_clients()) {
+        cJSON *root = build_status_json("covers");
+        cJSON_AddStringToObject(root, "covers", volume);
+        push_json(root);
     }
 }
 
+static void init_thumbnails(void) {
+    thumbnail_config_t config = {
+        .task_stack_size = THUMBNAIL_TASK_STACK_SIZE,
+        .task_priority = THUMBNAIL_TASK_PRIORITY,
+        .core_id = CORE_IO,
+        .cache_dir = THUMBNAIL_CACHE_DIR,
+        .min_interval_ms = THUMBNAIL_INTERVAL_MS,
+        .is_busy = card_busy_with_transfer,
+        .on_generated = on_thumbnails_generated,
+    };
+    ESP_ERROR_CHECK(thumbnail_init(&config));
+    thumbnail_add_volume(CATALOG_VOLUME_SD, MOUNT_POINT_SD);
+    thumbnail_add_volume(CATALOG_VOLUME_USB, MOUNT_POINT_USB);
+}
+
 // --- Calibre DB Import ---
-void import_from_calibre_db(const char* usb_mount_path) {
-    char db_path[256];
+static bool calibre_import_progress(uint32_t done, uint32_t total, void *ctx) {
+    g_import_done = done;
+    g_import_total = total;
+    push_status_event("import");
+    return !g_import_cancel;
+}
+
+static void calibre_import_task(void *arg) {
+    char db_path[64];
+    snprintf(db_path, sizeof(db_path), "%s/metadata.db", MOUNT_POINT_USB);
+
+    ESP_LOGI(TAG, "Found Calibre database at %s. Importing.", db_path);
+    esp_err_t ret = catalog_import_calibre(CATALOG_VOLUME_USB, db_path, calibre_import_progress, NULL);
+    if (ret == ESP_ERR_INVALID_STATE && g_import_cancel) {
+        ESP_LOGI(TAG, "Calibre import cancelled");
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Calibre import failed");
+    }
+    g_import_active = false;
+    push_status_event("import");
+    vTaskDelete(NULL);
+}
+
+// Starts the import on its own task so the MSC client task is not blocked.
+static void start_calibre_import(const char *usb_mount_path) {
+    char db_path[64];
     snprintf(db_path, sizeof(db_path), "%s/metadata.db", usb_mount_path);
 
     struct stat st;
@@ -1292,86 +2679,92 @@ void import_from_calibre_db(const char* usb_mount_path) {
         ESP_LOGI(TAG, "Calibre metadata.db not found at %s. Skipping import.", db_path);
         return;
     }
-
-    ESP_LOGI(TAG, "Found Calibre database at %s. Attempting to import.", db_path);
-
-    sqlite3 *db;
-    int rc = sqlite3_open(db_path, &db);
-    if (rc) {
-        ESP_LOGE(TAG, "Can't open database: %s", sqlite3_errmsg(db));
-        return;
-    } else {
-        ESP_LOGI(TAG, "Opened database successfully");
-    }
-
-    sqlite3_stmt *res;
-    const char *sql = "SELECT b.title, a.name as author, b.path, d.name as filename, d.format "
-                      "FROM books b "
-                      "LEFT JOIN books_authors_link bal ON b.id = bal.book "
-                      "LEFT JOIN authors a ON bal.author = a.id "
-                      "LEFT JOIN data d ON b.id = d.book "
-                      "WHERE d.format IN ('EPUB', 'MOBI', 'PDF', 'TXT') "
-                      "ORDER BY b.title";
-
-    rc = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-    if (rc != SQLITE_OK) {
-        ESP_LOGE(TAG, "Failed to execute statement: %s", sqlite3_errmsg(db));
-        sqlite3_close(db);
+    if (g_import_active) {
         return;
     }
 
-    ESP_LOGI(TAG, "--- Calibre Book Import ---");
-    while (sqlite3_step(res) == SQLITE_ROW) {
-        const unsigned char *title = sqlite3_column_text(res, 0);
-        const unsigned char *author = sqlite3_column_text(res, 1);
-        const unsigned char *path = sqlite3_column_text(res, 2);
-        const unsigned char *filename = sqlite3_column_text(res, 3);
-        const unsigned char *format = sqlite3_column_text(res, 4);
-
-        char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s/%s", usb_mount_path, path, filename);
-
-        ESP_LOGI(TAG, "Title: %s, Author: %s, Format: %s, Path: %s",
-            title ? (char*)title : "N/A",
-            author ? (char*)author : "N/A",
-            format ? (char*)format : "N/A",
-            full_path
-        );
+    g_import_active = true;
+    g_import_cancel = false;
+    g_import_done = 0;
+    g_import_total = 0;
+    if (xTaskCreatePinnedToCore(calibre_import_task, "calibre_import", CALIBRE_IMPORT_STACK_SIZE, NULL,
+                                CALIBRE_IMPORT_PRIORITY, NULL, CORE_IO) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start Calibre import task");
+        g_import_active = false;
     }
-    ESP_LOGI(TAG, "--- End of Import ---");
+}
 
-    sqlite3_finalize(res);
-    sqlite3_close(db);
+// Stops a running import and waits for it to close metadata.db.
+static esp_err_t cancel_calibre_import(void) {
+    g_import_cancel = true;
+    TickType_t start = xTaskGetTickCount();
+    while (g_import_active) {
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(CALIBRE_IMPORT_CANCEL_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "Calibre import still running after %d ms", CALIBRE_IMPORT_CANCEL_TIMEOUT_MS);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return ESP_OK;
 }
 
 
 // --- USB HOST SETUP ---
+// Stops everything that has files open on the USB volume (transfers to or
+// from it, the Calibre import, the scanner and thumbnails) and waits until
+// they have closed them. Must be called before unmounting.
+static esp_err_t release_usb_volume(void) {
+    esp_err_t copy = transfer_queue_release_volume(TRANSFER_VOLUME_USB);
+    esp_err_t import = cancel_calibre_import();
+    esp_err_t scan = scanner_cancel(CATALOG_VOLUME_USB);
+    esp_err_t thumbs = thumbnail_cancel(CATALOG_VOLUME_USB);
+    return copy == ESP_ERR_TIMEOUT || import == ESP_ERR_TIMEOUT || scan == ESP_ERR_TIMEOUT ||
+           thumbs == ESP_ERR_TIMEOUT ? ESP_ERR_TIMEOUT : ESP_OK;
+}
+
 static void msc_event_cb(const msc_host_event_t *event, void *arg)
 {
     if (event->event == MSC_DEVICE_CONNECTED) {
         ESP_LOGI(TAG, "MSC device connected");
+        // Released on disconnect; light sleep would suspend the USB host
+        power_acquire(POWER_HOLD_USB);
         ebook_reader_connected = true;
-        g_led_state = LED_STATE_CONNECTED;
+        led_set_state(LED_STATE_CONNECTED);
         ESP_ERROR_CHECK(msc_host_install_device(event->device, &device_handle));
 
+        // vfs_msc_mount registers the device on the next free FatFs drive
+        BYTE pdrv = 0xFF;
+        ff_diskio_get_drive(&pdrv);
         // Mount the filesystem
         if (vfs_msc_mount(MOUNT_POINT_USB, device_handle) == ESP_OK) {
+            if (pdrv != 0xFF) {
+                snprintf(g_usb_fatfs_drive, sizeof(g_usb_fatfs_drive), "%u:", (unsigned)pdrv);
+            }
             ESP_LOGI(TAG, "MSC device mounted at %s", MOUNT_POINT_USB);
+            // A different reader may have been plugged in; re-check it
+            thumbnail_resume(CATALOG_VOLUME_USB);
+            scanner_resume(CATALOG_VOLUME_USB);
             // Attempt to import from Calibre DB
-            import_from_calibre_db(MOUNT_POINT_USB);
+            start_calibre_import(MOUNT_POINT_USB);
+            push_status_event("status");
         } else {
             ESP_LOGE(TAG, "Failed to mount MSC device");
-            g_led_state = LED_STATE_ERROR;
+            led_set_state(LED_STATE_ERROR);
         }
 
     } else if (event->event == MSC_DEVICE_DISCONNECTED) {
         ESP_LOGI(TAG, "MSC device disconnected");
         ebook_reader_connected = false;
-        g_led_state = LED_STATE_IDLE;
+        led_set_state(LED_STATE_IDLE);
+        // The device is gone either way, so unmount even if a task is stuck on it
+        release_usb_volume();
         // Unmount the filesystem
         vfs_msc_unmount(MOUNT_POINT_USB);
+        g_usb_fatfs_drive[0] = '\0';
         ESP_LOGI(TAG, "MSC device unmounted");
         msc_host_uninstall_device(device_handle);
+        power_release(POWER_HOLD_USB);
+        push_status_event("status");
     }
 }
 
@@ -1398,103 +2791,122 @@ void init_usb_host() {
     ESP_ERROR_CHECK(usb_host_install(&host_config));
 
     // Create a task to handle USB library events
-    xTaskCreate(usb_host_lib_task, "usb_host", 4096, NULL, 10, NULL);
+    xTaskCreatePinnedToCore(usb_host_lib_task, "usb_host", USB_HOST_TASK_STACK_SIZE, NULL,
+                            USB_HOST_TASK_PRIORITY, NULL, CORE_IO);
 
     ESP_LOGI(TAG, "Installing MSC client");
     const msc_host_driver_config_t msc_config = {
         .create_backround_task = true,
-        .task_priority = 5,
-        .stack_size = 4096,
+        .task_priority = MSC_TASK_PRIORITY,
+        .stack_size = MSC_TASK_STACK_SIZE,
+        .core_id = CORE_IO,
         .callback = msc_event_cb,
     };
     ESP_ERROR_CHECK(msc_host_install(&msc_config));
 }
 
 // --- LED STRIP ---
-static void led_status_task(void *pvParameters) {
-    uint8_t brightness = 0;
-    bool increasing = true;
+// Every animation is a table of frames built once at startup. All pixels
+// show the same colour, so a frame is one colour and how long it is held.
+// The task only wakes to show the next frame or when the state changes;
+// solid colours are a single frame held until then.
+typedef struct {
+    uint8_t r, g, b;
+    uint16_t hold_ms;       // 0: hold until the state changes
+} led_frame_t;
 
-    while (1) {
-        switch (g_led_state) {
-            case LED_STATE_IDLE: // Slow breathing white
-                if (increasing) {
-                    brightness += 1;
-                    if (brightness >= 80) increasing = false;
-                } else {
-                    brightness -= 1;
-                    if (brightness <= 5) increasing = true;
-                }
-                for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                    // Set all LEDs to a white color with the current brightness
-                    led_strip_set_pixel(g_led_strip, i, brightness, brightness, brightness);
-                }
-                led_strip_refresh(g_led_strip);
-                vTaskDelay(pdMS_TO_TICKS(35));
-                break;
+typedef struct {
+    const led_frame_t *frames;
+    size_t count;
+    led_state_t next;       // State after the last frame; itself to loop
+} led_animation_t;
+
+// Breathing ramps: brightness from lo to hi and back in `step`s
+#define LED_IDLE_RAMP_FRAMES     (2 * (80 - 5) / 1)
+#define LED_SETUP_RAMP_FRAMES    (2 * (100 - 0) / 2)
+#define LED_TRANSFER_RAMP_FRAMES (2 * (150 - 0) / 10)
+
+static led_frame_t g_led_idle_frames[LED_IDLE_RAMP_FRAMES];
+static led_frame_t g_led_setup_frames[LED_SETUP_RAMP_FRAMES];
+static led_frame_t g_led_transfer_frames[LED_TRANSFER_RAMP_FRAMES];
+static const led_frame_t LED_OFF_FRAME = { 0, 0, 0, 0 };
+static const led_frame_t LED_GREEN_FRAME = { 0, 128, 0, 0 };
+static const led_frame_t LED_RED_FRAME = { 128, 0, 0, 0 };
+static const led_frame_t LED_EJECT_FRAMES[] = {
+    { 0, 255, 0, 150 }, { 0, 0, 0, 150 }, { 0, 255, 0, 150 }, { 0, 0, 0, 150 },
+};
+static led_animation_t g_led_animations[LED_STATE_COUNT];
 
-            case LED_STATE_SETUP: // Pulsing purple
-                if (increasing) {
-                    brightness += 2;
-                    if (brightness >= 100) increasing = false;
-                } else {
-                    brightness -= 2;
-                    if (brightness <= 0) increasing = true;
-                }
-                for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                    led_strip_set_pixel(g_led_strip, i, brightness, 0, brightness);
-                }
-                led_strip_refresh(g_led_strip);
-                vTaskDelay(pdMS_TO_TICKS(20));
-                break;
+// Fills `frames` with a triangle from lo to hi and back; each channel in
+// `mask` (0 or 1) follows the brightness.
+static size_t led_build_ramp(led_frame_t *frames, int lo, int hi, int step, uint16_t hold_ms,
+                             uint8_t r_mask, uint8_t g_mask, uint8_t b_mask) {
+    size_t n = 0;
+    for (int level = lo; level < hi; level += step) {
+        frames[n++] = (led_frame_t){ level * r_mask, level * g_mask, level * b_mask, hold_ms };
+    }
+    for (int level = hi; level > lo; level -= step) {
+        frames[n++] = (led_frame_t){ level * r_mask, level * g_mask, level * b_mask, hold_ms };
+    }
+    return n;
+}
 
-            case LED_STATE_CONNECTED: // Solid Green
-                for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                    led_strip_set_pixel(g_led_strip, i, 0, 128, 0); // Green
-                }
-                led_strip_refresh(g_led_strip);
-                vTaskDelay(pdMS_TO_TICKS(500)); // Sleep to prevent busy-looping
-                break;
+static void led_build_animations(void) {
+    led_animation_t *a = g_led_animations;
+    a[LED_STATE_INIT] = (led_animation_t){ &LED_OFF_FRAME, 1, LED_STATE_INIT };
+    // Slow breathing white
+    a[LED_STATE_IDLE] = (led_animation_t){ g_led_idle_frames,
+        led_build_ramp(g_led_idle_frames, 5, 80, 1, 35, 1, 1, 1), LED_STATE_IDLE };
+    // Pulsing purple
+    a[LED_STATE_SETUP] = (led_animation_t){ g_led_setup_frames,
+        led_build_ramp(g_led_setup_frames, 0, 100, 2, 20, 1, 0, 1), LED_STATE_SETUP };
+    // Pulsing white, same 0.9 s period as before at half the frame rate, so
+    // the task steals less time from a running copy
+    a[LED_STATE_TRANSFER] = (led_animation_t){ g_led_transfer_frames,
+        led_build_ramp(g_led_transfer_frames, 0, 150, 10, 30, 1, 1, 1), LED_STATE_TRANSFER };
+    a[LED_STATE_CONNECTED] = (led_animation_t){ &LED_GREEN_FRAME, 1, LED_STATE_CONNECTED };
+    a[LED_STATE_ERROR] = (led_animation_t){ &LED_RED_FRAME, 1, LED_STATE_ERROR };
+    // Two quick green blinks, then back to idle
+    a[LED_STATE_EJECT] = (led_animation_t){ LED_EJECT_FRAMES,
+        sizeof(LED_EJECT_FRAMES) / sizeof(LED_EJECT_FRAMES[0]), LED_STATE_IDLE };
+}
 
-            case LED_STATE_TRANSFER: // Pulsing White
-                 if (increasing) {
-                    brightness += 5;
-                    if (brightness >= 150) increasing = false;
-                } else {
-                    brightness -= 5;
-                    if (brightness <= 0) increasing = true;
-                }
-                for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                    led_strip_set_pixel(g_led_strip, i, brightness, brightness, brightness);
-                }
-                led_strip_refresh(g_led_strip);
-                vTaskDelay(pdMS_TO_TICKS(15));
-                break;
+static void led_show(const led_frame_t *frame) {
+    for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
+        led_strip_set_pixel(g_led_strip, i, frame->r, frame->g, frame->b);
+    }
+    led_strip_refresh(g_led_strip);
+}
 
-            case LED_STATE_ERROR: // Solid Red
-                for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                    led_strip_set_pixel(g_led_strip, i, 128, 0, 0); // Red
-                }
-                led_strip_refresh(g_led_strip);
-                vTaskDelay(pdMS_TO_TICKS(500));
-                break;
+static void led_status_task(void *pvParameters) {
+    // Published before the state is read, so no led_set_state() is missed
+    g_led_task = xTaskGetCurrentTaskHandle();
+    led_state_t state = g_led_state;
+    size_t index = 0;
+    led_frame_t shown = { 0, 0, 0, 0 };   // led_strip_clear() left the strip dark
 
-            case LED_STATE_EJECT: // Quick Green Blink
-                for (int j=0; j<2; j++) {
-                    for (int i = 0; i < LED_STRIP_LED_NUMBERS; i++) {
-                        led_strip_set_pixel(g_led_strip, i, 0, 255, 0); // Green
-                    }
-                    led_strip_refresh(g_led_strip);
-                    vTaskDelay(pdMS_TO_TICKS(150));
-                    led_strip_clear(g_led_strip);
-                    vTaskDelay(pdMS_TO_TICKS(150));
-                }
-                g_led_state = LED_STATE_IDLE; // Revert to idle state
-                break;
+    while (1) {
+        const led_animation_t *anim = &g_led_animations[state < LED_STATE_COUNT ? state : LED_STATE_INIT];
+        const led_frame_t *frame = &anim->frames[index];
+        if (frame->r != shown.r || frame->g != shown.g || frame->b != shown.b) {
+            led_show(frame);
+            shown = *frame;
+        }
 
-            default:
-                 vTaskDelay(pdMS_TO_TICKS(100));
-                 break;
+        bool last = index + 1 >= anim->count;
+        TickType_t wait = frame->hold_ms > 0 ? pdMS_TO_TICKS(frame->hold_ms) : portMAX_DELAY;
+        uint32_t requested;
+        if (xTaskNotifyWait(0, UINT32_MAX, &requested, wait) == pdTRUE) {
+            state = (led_state_t)requested;
+            index = 0;
+        } else if (!last) {
+            index++;
+        } else {
+            index = 0;
+            if (anim->next != state) {
+                state = anim->next;
+                g_led_state = state;
+            }
         }
     }
 }
@@ -1521,11 +2933,57 @@ void init_led_strip(void) {
     ESP_ERROR_CHECK(rmt_enable(led_chan));
 
     led_strip_clear(g_led_strip);
+    led_build_animations();
 }
 
 
 // --- Eject/Sleep Button Task ---
+// The button is a level interrupt that also serves as the light sleep wake
+// source. The ISR masks it and wakes the task; the task waits for the level
+// it expects next (press, then release) the same way, so nothing polls.
+static TaskHandle_t g_button_task = NULL;
+
+static void eject_button_isr(void *arg) {
+    gpio_intr_disable(EJECT_BUTTON_GPIO);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(g_button_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Arms the interrupt for `level` and returns true once it is seen, false if
+// `timeout` passes first
+static bool eject_button_wait(gpio_int_type_t level, TickType_t timeout) {
+    gpio_set_intr_type(EJECT_BUTTON_GPIO, level);
+    gpio_intr_enable(EJECT_BUTTON_GPIO);
+    if (ulTaskNotifyTake(pdTRUE, timeout) == 0) {
+        gpio_intr_disable(EJECT_BUTTON_GPIO);
+        return false;
+    }
+    // Let the contacts settle
+    vTaskDelay(pdMS_TO_TICKS(EJECT_DEBOUNCE_MS));
+    return true;
+}
+
+static void enter_deep_sleep(void) {
+    ESP_LOGI(TAG, "Long press detected. Entering deep sleep.");
+
+    ESP_LOGI(TAG, "Unmounting filesystems before sleep...");
+    catalog_close();
+    // Unmount SD card
+    if (esp_vfs_fat_sdcard_unmount(MOUNT_POINT_SD, NULL) == ESP_OK) {
+         ESP_LOGI(TAG, "SD card unmounted successfully.");
+    } else {
+         ESP_LOGE(TAG, "Failed to unmount SD card.");
+    }
+
+    // Turn off LEDs before sleeping
+    led_strip_clear(g_led_strip);
+    esp_deep_sleep_start();
+    // This function does not return
+}
+
 void eject_button_task(void *pvParameters) {
+    g_button_task = xTaskGetCurrentTaskHandle();
     gpio_config_t io_conf = {};
     io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.mode = GPIO_MODE_INPUT;
@@ -1534,58 +2992,88 @@ void eject_button_task(void *pvParameters) {
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
 
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+        err = gpio_isr_handler_add(EJECT_BUTTON_GPIO, eject_button_isr, NULL);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install eject button interrupt: %s", esp_err_to_name(err));
+        vTaskDelete(NULL);
+    }
+    // Shares the interrupt's level setting, so whichever edge the task is
+    // waiting for also ends a light sleep
+    gpio_wakeup_enable(EJECT_BUTTON_GPIO, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
     ESP_LOGI(TAG, "Eject/Sleep button task started on GPIO %d", EJECT_BUTTON_GPIO);
 
     while (1) {
-        if (gpio_get_level(EJECT_BUTTON_GPIO) == 0) {
-            // Button is pressed, start checking for long press
-            vTaskDelay(pdMS_TO_TICKS(50)); // Debounce
-            int long_press_counter = 0;
-            while (gpio_get_level(EJECT_BUTTON_GPIO) == 0) {
-                long_press_counter++;
-                vTaskDelay(pdMS_TO_TICKS(50));
-                if (long_press_counter > 40) { // 40 * 50ms = 2 seconds
-                    ESP_LOGI(TAG, "Long press detected. Entering deep sleep.");
-
-                    ESP_LOGI(TAG, "Unmounting filesystems before sleep...");
-                    // Unmount SPIFFS. The label "storage" is defined in init_spiffs.
-                    if (esp_vfs_spiffs_unregister("storage") == ESP_OK) {
-                        ESP_LOGI(TAG, "SPIFFS unmounted successfully.");
-                    } else {
-                        ESP_LOGE(TAG, "Failed to unmount SPIFFS.");
-                    }
-                    // Unmount SD card
-                    if (esp_vfs_fat_sdcard_unmount(MOUNT_POINT_SD, NULL) == ESP_OK) {
-                         ESP_LOGI(TAG, "SD card unmounted successfully.");
-                    } else {
-                         ESP_LOGE(TAG, "Failed to unmount SD card.");
-                    }
-
-                    // Turn off LEDs before sleeping
-                    led_strip_clear(g_led_strip);
-                    esp_deep_sleep_start();
-                    // This function does not return
-                }
-            }
+        eject_button_wait(GPIO_INTR_LOW_LEVEL, portMAX_DELAY);
+        if (gpio_get_level(EJECT_BUTTON_GPIO) != 0) {
+            continue; // A glitch, not a press
+        }
+        if (!eject_button_wait(GPIO_INTR_HIGH_LEVEL, pdMS_TO_TICKS(EJECT_LONG_PRESS_MS))) {
+            enter_deep_sleep();
+        }
 
-            // If we get here, it was a short press
-            ESP_LOGI(TAG, "Short press detected.");
-            if (ebook_reader_connected) {
-                ESP_LOGI(TAG, "Unmounting USB drive...");
-                vfs_msc_unmount(MOUNT_POINT_USB);
-                // The msc_event_cb will set ebook_reader_connected to false
-                // and the LED state to IDLE. We will override it here for feedback.
-                g_led_state = LED_STATE_EJECT;
-            } else {
-                ESP_LOGW(TAG, "Eject button pressed, but no USB drive connected.");
+        // If we get here, it was a short press
+        ESP_LOGI(TAG, "Short press detected.");
+        if (ebook_reader_connected) {
+            ESP_LOGI(TAG, "Unmounting USB drive...");
+            if (release_usb_volume() != ESP_OK) {
+                // Unmounting now could cut off a file mid-read; press again once it lets go
+                ESP_LOGW(TAG, "USB drive still in use, not ejecting");
+                thumbnail_resume(CATALOG_VOLUME_USB);
+                scanner_resume(CATALOG_VOLUME_USB);
+                led_set_state(LED_STATE_ERROR);
+                continue;
             }
+            vfs_msc_unmount(MOUNT_POINT_USB);
+            // The msc_event_cb will set ebook_reader_connected to false
+            // and the LED state to IDLE. We will override it here for feedback.
+            led_set_state(LED_STATE_EJECT);
+        } else {
+            ESP_LOGW(TAG, "Eject button pressed, but no USB drive connected.");
         }
-        vTaskDelay(pdMS_TO_TICKS(20)); // Poll every 20ms
     }
 }
 
 
 // --- MAIN APPLICATION ENTRY POINT ---
+// Brings up everything that lives on the SD card while the web server is
+// already answering. /status reports "indexing" until this is done.
+static void storage_init_task(void *arg) {
+    esp_err_t ret = init_sd_card();
+    init_transfer_queue();
+    // Thumbnails first, so the first scan can hand its results over
+    init_thumbnails();
+    init_scanner();
+    // Last: a reader plugged in at boot is scanned and imported right away
+    init_usb_host();
+    g_storage_state = ret == ESP_OK ? STORAGE_READY : STORAGE_UNAVAILABLE;
+    metrics_mark_boot("storage");
+    push_status_event("status");
+    vTaskDelete(NULL);
+}
+
+// Reserves the request buffer pools. Runs before Wi-Fi and BLE take their
+// share of the heap, so the reserves come from one unfragmented region.
+static void init_memory_pools(void) {
+    mem_pool_install_json_hooks();
+    ESP_LOGI(TAG, "Internal heap before pool setup: %u bytes free, largest DMA block %u, %u%% fragmented",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL),
+             (unsigned)mem_pool_internal_fragmentation());
+    g_io_pool = mem_pool_create("io", BOOK_IO_BUFFER_SIZE, MEM_IO_POOL_BLOCKS,
+                                MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    uint32_t chunk_caps = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0 ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+    g_chunk_pool = mem_pool_create("chunk", LIST_CHUNK_SIZE, MEM_CHUNK_POOL_BLOCKS, chunk_caps | MALLOC_CAP_8BIT);
+    ESP_LOGI(TAG, "Internal heap after pool setup: %u bytes free, largest DMA block %u, %u%% fragmented",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL),
+             (unsigned)mem_pool_internal_fragmentation());
+}
+
 void app_main(void) {
     // Initialize NVS
     esp_err_t ret = nvs_flash_init();
@@ -1595,33 +3083,48 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(ret);
 
+    init_memory_pools();
+
     // Initialize LED strip early so we can show status
     init_led_strip();
-    xTaskCreate(led_status_task, "led_status_task", 2048, NULL, 5, NULL);
-
-    // Initialize BLE for configuration
-    init_ble();
+    xTaskCreate(led_status_task, "led_status_task", LED_TASK_STACK_SIZE, NULL, LED_TASK_PRIORITY, NULL);
 
     init_wifi();
 
     if (g_wifi_configured) {
         // Normal operation
         ESP_LOGI(TAG, "Starting main application...");
-        init_spiffs();
-        init_sd_card();
-        init_usb_host();
+        metrics_mark_boot("wifi");
+        release_ble();
+        const power_config_t power = {
+            .max_freq_mhz = POWER_MAX_FREQ_MHZ,
+            .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+            .light_sleep = POWER_LIGHT_SLEEP,
+        };
+        power_init(&power);
+        g_sd_metrics_mount = metrics_add_mount(CATALOG_VOLUME_SD, MOUNT_POINT_SD);
+        metrics_add_mount(CATALOG_VOLUME_USB, MOUNT_POINT_USB);
+        led_set_state(LED_STATE_IDLE);
+        if (xTaskCreatePinnedToCore(storage_init_task, "storage_init", STORAGE_INIT_STACK_SIZE, NULL,
+                                    STORAGE_INIT_PRIORITY, NULL, CORE_IO) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start storage init task");
+            g_storage_state = STORAGE_UNAVAILABLE;
+            led_set_state(LED_STATE_ERROR);
+        }
         start_webserver();
+        metrics_mark_boot("http");
         ESP_LOGI(TAG, "E-Book Librarian is running!");
-        g_led_state = LED_STATE_IDLE;
     } else {
         // Configuration mode
         ESP_LOGI(TAG, "Starting configuration portal...");
-        g_led_state = LED_STATE_SETUP; // Set LED to setup mode
-        start_dns_server();
+        led_set_state(LED_STATE_SETUP); // Set LED to setup mode
+        // BLE provisioning is offered alongside the captive portal
+        init_ble();
+        start_dns_server(CORE_NET);
         start_captive_portal_server();
         ESP_LOGI(TAG, "Captive portal is running. Connect to the Wi-Fi AP to configure.");
     }
 
     // Start the eject button monitoring task
-    xTaskCreate(eject_button_task, "eject_button_task", 2048, NULL, 10, NULL);
+    xTaskCreate(eject_button_task, "eject_button_task", EJECT_TASK_STACK_SIZE, NULL, EJECT_TASK_PRIORITY, NULL);
 }
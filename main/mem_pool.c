@@ -0,0 +1,148 @@
+/*
+ * Fixed-size buffer pools and cJSON allocation hooks.
+ *
+ * The firmware runs for days on internal RAM alone. Request buffers that are
+ * malloc'd and freed between long-lived Wi-Fi, BLE and SQLite allocations
+ * slowly chop the heap into pieces too small for the next DMA buffer or
+ * Wi-Fi frame. Pools keep the big, frequently used I/O buffers in one
+ * reserved region, and cJSON's many small nodes go to PSRAM when it is fitted.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "mem_pool.h"
+
+static const char *TAG = "mem_pool";
+
+struct mem_pool {
+    const char *name;
+    size_t block_size;
+    uint32_t blocks;
+    uint32_t caps;
+    uint8_t *base;
+    QueueHandle_t free_blocks;      // Pointers to the blocks that are not in use
+    atomic_uint in_use;
+    atomic_uint peak_in_use;
+    atomic_uint fallbacks;
+};
+
+static struct mem_pool g_pools[MEM_POOL_MAX_POOLS];
+static atomic_uint g_pool_count;
+
+// --- Pools ---
+mem_pool_t *mem_pool_create(const char *name, size_t block_size, uint32_t blocks, uint32_t caps) {
+    unsigned index = atomic_fetch_add(&g_pool_count, 1);
+    if (index >= MEM_POOL_MAX_POOLS) {
+        atomic_fetch_sub(&g_pool_count, 1);
+        return NULL;
+    }
+    mem_pool_t *pool = &g_pools[index];
+    pool->name = name;
+    pool->block_size = block_size;
+    pool->blocks = blocks;
+    pool->caps = caps;
+    pool->base = heap_caps_malloc(block_size * blocks, caps);
+    pool->free_blocks = xQueueCreate(blocks, sizeof(void *));
+    if (!pool->base || !pool->free_blocks) {
+        ESP_LOGE(TAG, "Failed to reserve %u x %u bytes for pool %s", (unsigned)blocks, (unsigned)block_size, name);
+        // Leave the slot registered but empty; every allocation falls back
+        heap_caps_free(pool->base);
+        pool->base = NULL;
+        pool->blocks = 0;
+        return pool;
+    }
+    for (uint32_t i = 0; i < blocks; i++) {
+        void *block = pool->base + i * block_size;
+        xQueueSend(pool->free_blocks, &block, 0);
+    }
+    ESP_LOGI(TAG, "Pool %s: %u x %u bytes", name, (unsigned)blocks, (unsigned)block_size);
+    return pool;
+}
+
+static bool pool_owns(const mem_pool_t *pool, const void *block) {
+    const uint8_t *p = block;
+    return pool->base && p >= pool->base && p < pool->base + pool->block_size * pool->blocks;
+}
+
+void *mem_pool_alloc(mem_pool_t *pool) {
+    void *block = NULL;
+    if (pool->blocks > 0 && xQueueReceive(pool->free_blocks, &block, 0) == pdTRUE) {
+        unsigned in_use = atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed) + 1;
+        unsigned peak = atomic_load_explicit(&pool->peak_in_use, memory_order_relaxed);
+        while (in_use > peak &&
+               !atomic_compare_exchange_weak_explicit(&pool->peak_in_use, &peak, in_use, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+        }
+        return block;
+    }
+    atomic_fetch_add_explicit(&pool->fallbacks, 1, memory_order_relaxed);
+    return heap_caps_malloc(pool->block_size, pool->caps);
+}
+
+void mem_pool_free(mem_pool_t *pool, void *block) {
+    if (!block) {
+        return;
+    }
+    if (pool_owns(pool, block)) {
+        atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+        xQueueSend(pool->free_blocks, &block, 0);
+    } else {
+        heap_caps_free(block);
+    }
+}
+
+size_t mem_pool_count(void) {
+    unsigned count = atomic_load(&g_pool_count);
+    return count < MEM_POOL_MAX_POOLS ? count : MEM_POOL_MAX_POOLS;
+}
+
+void mem_pool_get_stats(size_t index, mem_pool_stats_t *stats) {
+    const mem_pool_t *pool = &g_pools[index];
+    stats->name = pool->name;
+    stats->block_size = pool->block_size;
+    stats->blocks = pool->blocks;
+    stats->in_use = atomic_load_explicit(&pool->in_use, memory_order_relaxed);
+    stats->peak_in_use = atomic_load_explicit(&pool->peak_in_use, memory_order_relaxed);
+    stats->fallbacks = atomic_load_explicit(&pool->fallbacks, memory_order_relaxed);
+}
+
+// --- Metadata ---
+#define META_CAPS_PSRAM   (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define META_CAPS_DEFAULT (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+void *mem_pool_meta_alloc(size_t size) {
+    return heap_caps_malloc_prefer(size, 2, META_CAPS_PSRAM, META_CAPS_DEFAULT);
+}
+
+void *mem_pool_meta_realloc(void *ptr, size_t size) {
+    return heap_caps_realloc_prefer(ptr, size, 2, META_CAPS_PSRAM, META_CAPS_DEFAULT);
+}
+
+void mem_pool_meta_free(void *ptr) {
+    heap_caps_free(ptr);
+}
+
+static void *json_malloc(size_t size) {
+    return mem_pool_meta_alloc(size);
+}
+
+static void json_free(void *ptr) {
+    mem_pool_meta_free(ptr);
+}
+
+void mem_pool_install_json_hooks(void) {
+    cJSON_Hooks hooks = { .malloc_fn = json_malloc, .free_fn = json_free };
+    cJSON_InitHooks(&hooks);
+}
+
+uint32_t mem_pool_internal_fragmentation(void) {
+    size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    return free_bytes > 0 ? (uint32_t)(100 - (uint64_t)largest * 100 / free_bytes) : 0;
+}
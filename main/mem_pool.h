@@ -0,0 +1,60 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Pools that can exist at once
+#define MEM_POOL_MAX_POOLS  4
+
+// --- Fixed-size block pools ---
+// All blocks of a pool are carved out of one allocation made at startup, so
+// buffers that are taken and returned on every request never fragment the
+// heap. When a pool is empty the block comes from the heap instead (with the
+// same capabilities) and is counted as a fallback.
+typedef struct mem_pool mem_pool_t;
+
+typedef struct {
+    const char *name;
+    size_t block_size;
+    uint32_t blocks;
+    uint32_t in_use;
+    uint32_t peak_in_use;
+    uint32_t fallbacks;     // Allocations the pool could not serve
+} mem_pool_stats_t;
+
+// Creates a pool of `blocks` blocks of `block_size` bytes from memory with
+// `caps` (MALLOC_CAP_*). If the reserve cannot be allocated the pool is
+// still returned and serves every block from the heap. Returns NULL only
+// when MEM_POOL_MAX_POOLS pools already exist.
+mem_pool_t *mem_pool_create(const char *name, size_t block_size, uint32_t blocks, uint32_t caps);
+
+// Takes a block; falls back to the heap when the pool is exhausted, so it
+// only returns NULL if that fails too. Safe from any task.
+void *mem_pool_alloc(mem_pool_t *pool);
+
+// Returns a block obtained from mem_pool_alloc(). NULL is ignored.
+void mem_pool_free(mem_pool_t *pool, void *block);
+
+size_t mem_pool_count(void);
+void mem_pool_get_stats(size_t index, mem_pool_stats_t *stats);
+
+// --- Metadata allocations ---
+// Parser state, archive directories and JSON documents are never DMA'd, so
+// they go to PSRAM when the board has it and to internal RAM otherwise,
+// leaving internal memory to the I/O buffers and the network stack.
+void *mem_pool_meta_alloc(size_t size);
+void *mem_pool_meta_realloc(void *ptr, size_t size);
+void mem_pool_meta_free(void *ptr);
+
+// Routes cJSON allocations to PSRAM when present, like other metadata.
+// Call once at startup before cJSON is used.
+void mem_pool_install_json_hooks(void);
+
+// Fragmentation of the internal heap in percent: how much of the free memory
+// is not part of the largest free block.
+uint32_t mem_pool_internal_fragmentation(void);
+
+#endif // MEM_POOL_H
@@ -0,0 +1,414 @@
+/*
+ * Runtime metrics in Prometheus text format.
+ *
+ * Counters are plain relaxed atomics bumped where the work happens (a copy
+ * block, a download chunk, a finished request), so recording costs a few
+ * instructions and no locks. Everything else (heap, tasks) is sampled only
+ * when /metrics is scraped. Rates such as throughput or CPU share are left to
+ * the scraper: every time-based value is a monotonically increasing counter.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "metrics.h"
+#include "mem_pool.h"
+
+static const char *TAG = "metrics";
+
+typedef struct {
+    char name[8];
+    char prefix[16];
+    size_t prefix_len;
+    atomic_uint_least64_t bytes_read;
+    atomic_uint_least64_t bytes_written;
+} metrics_mount_t;
+
+typedef struct {
+    char uri[32];
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    void *user_ctx;
+    // Counts per bucket, not cumulative; the +Inf bucket is `count`
+    atomic_uint_least32_t buckets[METRICS_LATENCY_BUCKET_COUNT];
+    atomic_uint_least32_t count;
+    atomic_uint_least32_t errors;
+    atomic_uint_least64_t sum_us;
+} metrics_endpoint_t;
+
+static const uint32_t LATENCY_BOUNDS_US[METRICS_LATENCY_BUCKET_COUNT] = METRICS_LATENCY_BUCKETS_US;
+
+static metrics_mount_t g_mounts[METRICS_MAX_MOUNTS];
+static atomic_int g_mount_count;
+static metrics_endpoint_t g_endpoints[METRICS_MAX_ENDPOINTS];
+static size_t g_endpoint_count;
+
+static atomic_uint_least32_t g_transfer_files;
+static atomic_uint_least64_t g_transfer_bytes;
+static atomic_uint_least64_t g_transfer_us;
+
+typedef struct {
+    const char *source;
+    size_t bytes;
+} metrics_reclaimed_t;
+
+// Written once at boot, before the server is started
+static metrics_reclaimed_t g_reclaimed[METRICS_MAX_RECLAIMED];
+static size_t g_reclaimed_count;
+
+typedef struct {
+    const char *phase;
+    atomic_uint_least64_t us;   // Stored last; 0 while the slot is being filled
+} metrics_boot_phase_t;
+
+static metrics_boot_phase_t g_boot_phases[METRICS_MAX_BOOT_PHASES];
+static atomic_uint g_boot_phase_count;
+static atomic_bool g_first_response_seen;
+
+// --- Recording ---
+int metrics_add_mount(const char *name, const char *prefix) {
+    int index = atomic_load(&g_mount_count);
+    if (index >= METRICS_MAX_MOUNTS) {
+        return -1;
+    }
+    metrics_mount_t *mount = &g_mounts[index];
+    strlcpy(mount->name, name, sizeof(mount->name));
+    strlcpy(mount->prefix, prefix, sizeof(mount->prefix));
+    mount->prefix_len = strlen(mount->prefix);
+    atomic_store(&g_mount_count, index + 1);
+    return index;
+}
+
+int metrics_mount_for_path(const char *path) {
+    int count = atomic_load(&g_mount_count);
+    for (int i = 0; i < count; i++) {
+        const metrics_mount_t *mount = &g_mounts[i];
+        if (strncmp(path, mount->prefix, mount->prefix_len) == 0 &&
+            (path[mount->prefix_len] == '/' || path[mount->prefix_len] == '\0')) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void metrics_count_io(int mount, bool write, size_t bytes) {
+    if (mount < 0 || mount >= METRICS_MAX_MOUNTS) {
+        return;
+    }
+    atomic_fetch_add_explicit(write ? &g_mounts[mount].bytes_written : &g_mounts[mount].bytes_read, bytes,
+                              memory_order_relaxed);
+}
+
+void metrics_count_transfer(size_t bytes, int64_t us) {
+    atomic_fetch_add_explicit(&g_transfer_files, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_transfer_bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_transfer_us, us > 0 ? (uint64_t)us : 0, memory_order_relaxed);
+}
+
+void metrics_set_reclaimed(const char *source, size_t bytes) {
+    if (g_reclaimed_count < METRICS_MAX_RECLAIMED) {
+        g_reclaimed[g_reclaimed_count++] = (metrics_reclaimed_t){ .source = source, .bytes = bytes };
+    }
+}
+
+void metrics_mark_boot(const char *phase) {
+    uint64_t now = esp_timer_get_time();
+    unsigned index = atomic_fetch_add(&g_boot_phase_count, 1);
+    if (index >= METRICS_MAX_BOOT_PHASES) {
+        return;
+    }
+    g_boot_phases[index].phase = phase;
+    atomic_store(&g_boot_phases[index].us, now > 0 ? now : 1);
+    ESP_LOGI(TAG, "Boot phase %s done after %u ms", phase, (unsigned)(now / 1000));
+}
+
+static esp_err_t metered_handler(httpd_req_t *req) {
+    metrics_endpoint_t *endpoint = (metrics_endpoint_t *)req->user_ctx;
+    req->user_ctx = endpoint->user_ctx;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = endpoint->handler(req);
+    uint64_t us = esp_timer_get_time() - start;
+
+    for (int i = 0; i < METRICS_LATENCY_BUCKET_COUNT; i++) {
+        if (us <= LATENCY_BOUNDS_US[i]) {
+            atomic_fetch_add_explicit(&endpoint->buckets[i], 1, memory_order_relaxed);
+            break;
+        }
+    }
+    atomic_fetch_add_explicit(&endpoint->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&endpoint->sum_us, us, memory_order_relaxed);
+    if (ret != ESP_OK) {
+        atomic_fetch_add_explicit(&endpoint->errors, 1, memory_order_relaxed);
+    }
+    if (!atomic_load_explicit(&g_first_response_seen, memory_order_relaxed) &&
+        !atomic_exchange(&g_first_response_seen, true)) {
+        metrics_mark_boot("first_response");
+    }
+    return ret;
+}
+
+// Handlers are registered once at startup from a single task, so the
+// endpoint table itself needs no lock.
+void metrics_wrap_handler(const httpd_uri_t *uri, httpd_uri_t *wrapped) {
+    *wrapped = *uri;
+    if (g_endpoint_count >= METRICS_MAX_ENDPOINTS) {
+        ESP_LOGW(TAG, "No histogram slot left for %s", uri->uri);
+        return;
+    }
+    metrics_endpoint_t *endpoint = &g_endpoints[g_endpoint_count++];
+    strlcpy(endpoint->uri, uri->uri, sizeof(endpoint->uri));
+    endpoint->method = uri->method;
+    endpoint->handler = uri->handler;
+    endpoint->user_ctx = uri->user_ctx;
+    wrapped->handler = metered_handler;
+    wrapped->user_ctx = endpoint;
+}
+
+esp_err_t metrics_register_handler(httpd_handle_t server, const httpd_uri_t *uri) {
+    httpd_uri_t wrapped;
+    metrics_wrap_handler(uri, &wrapped);
+    return httpd_register_uri_handler(server, &wrapped);
+}
+
+// --- Rendering ---
+typedef struct {
+    httpd_req_t *req;
+    char *buf;
+    size_t len;
+    esp_err_t err;
+} metrics_writer_t;
+
+static void writer_flush(metrics_writer_t *w) {
+    if (w->len > 0 && w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void emit(metrics_writer_t *w, const char *fmt, ...) {
+    for (int attempt = 0; attempt < 2 && w->err == ESP_OK; attempt++) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(w->buf + w->len, METRICS_CHUNK_SIZE - w->len, fmt, args);
+        va_end(args);
+        if (n >= 0 && (size_t)n < METRICS_CHUNK_SIZE - w->len) {
+            w->len += n;
+            return;
+        }
+        // Didn't fit: send what is there and retry into the empty buffer
+        writer_flush(w);
+    }
+}
+
+// Prometheus wants seconds; print microsecond counters without going through floats
+static void emit_seconds(metrics_writer_t *w, const char *name, const char *labels, uint64_t us) {
+    emit(w, "%s%s %llu.%06llu\n", name, labels, (unsigned long long)(us / 1000000),
+         (unsigned long long)(us % 1000000));
+}
+
+static const char *method_name(httpd_method_t method) {
+    switch (method) {
+        case HTTP_GET: return "GET";
+        case HTTP_POST: return "POST";
+        case HTTP_PUT: return "PUT";
+        case HTTP_DELETE: return "DELETE";
+        default: return "OTHER";
+    }
+}
+
+static void render_heap(metrics_writer_t *w) {
+    emit(w, "# HELP librarian_heap_free_bytes Free heap.\n# TYPE librarian_heap_free_bytes gauge\n");
+    emit(w, "librarian_heap_free_bytes{region=\"internal\"} %u\n",
+         (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    emit(w, "librarian_heap_free_bytes{region=\"psram\"} %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    emit(w, "# HELP librarian_heap_min_free_bytes Lowest free heap since boot.\n"
+            "# TYPE librarian_heap_min_free_bytes gauge\n");
+    emit(w, "librarian_heap_min_free_bytes{region=\"internal\"} %u\n",
+         (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    emit(w, "librarian_heap_min_free_bytes{region=\"psram\"} %u\n",
+         (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    emit(w, "# HELP librarian_heap_largest_dma_block_bytes Largest DMA-capable block that can be allocated.\n"
+            "# TYPE librarian_heap_largest_dma_block_bytes gauge\n");
+    emit(w, "librarian_heap_largest_dma_block_bytes %u\n",
+         (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    emit(w, "# HELP librarian_heap_fragmentation_percent Free internal heap outside the largest free block.\n"
+            "# TYPE librarian_heap_fragmentation_percent gauge\n");
+    emit(w, "librarian_heap_fragmentation_percent %u\n", (unsigned)mem_pool_internal_fragmentation());
+    emit(w, "# HELP librarian_heap_reclaimed_bytes Heap returned at boot by subsystems that are not needed.\n"
+            "# TYPE librarian_heap_reclaimed_bytes gauge\n");
+    for (size_t i = 0; i < g_reclaimed_count; i++) {
+        emit(w, "librarian_heap_reclaimed_bytes{source=\"%s\"} %u\n", g_reclaimed[i].source,
+             (unsigned)g_reclaimed[i].bytes);
+    }
+}
+
+static void render_pools(metrics_writer_t *w) {
+    size_t count = mem_pool_count();
+    emit(w, "# HELP librarian_pool_blocks Blocks reserved per buffer pool.\n# TYPE librarian_pool_blocks gauge\n");
+    for (size_t i = 0; i < count; i++) {
+        mem_pool_stats_t st;
+        mem_pool_get_stats(i, &st);
+        emit(w, "librarian_pool_blocks{pool=\"%s\",block_bytes=\"%u\"} %u\n", st.name, (unsigned)st.block_size,
+             (unsigned)st.blocks);
+    }
+    emit(w, "# HELP librarian_pool_in_use Pool blocks currently handed out.\n# TYPE librarian_pool_in_use gauge\n");
+    for (size_t i = 0; i < count; i++) {
+        mem_pool_stats_t st;
+        mem_pool_get_stats(i, &st);
+        emit(w, "librarian_pool_in_use{pool=\"%s\"} %u\n", st.name, (unsigned)st.in_use);
+    }
+    emit(w, "# HELP librarian_pool_peak_in_use Most pool blocks handed out at once.\n"
+            "# TYPE librarian_pool_peak_in_use gauge\n");
+    for (size_t i = 0; i < count; i++) {
+        mem_pool_stats_t st;
+        mem_pool_get_stats(i, &st);
+        emit(w, "librarian_pool_peak_in_use{pool=\"%s\"} %u\n", st.name, (unsigned)st.peak_in_use);
+    }
+    emit(w, "# HELP librarian_pool_fallbacks_total Allocations served by the heap because the pool was empty.\n"
+            "# TYPE librarian_pool_fallbacks_total counter\n");
+    for (size_t i = 0; i < count; i++) {
+        mem_pool_stats_t st;
+        mem_pool_get_stats(i, &st);
+        emit(w, "librarian_pool_fallbacks_total{pool=\"%s\"} %u\n", st.name, (unsigned)st.fallbacks);
+    }
+}
+
+static void render_boot(metrics_writer_t *w) {
+    unsigned count = atomic_load(&g_boot_phase_count);
+    if (count > METRICS_MAX_BOOT_PHASES) {
+        count = METRICS_MAX_BOOT_PHASES;
+    }
+    emit(w, "# HELP librarian_boot_seconds Time from boot until each startup phase completed.\n"
+            "# TYPE librarian_boot_seconds gauge\n");
+    for (unsigned i = 0; i < count; i++) {
+        uint64_t us = atomic_load(&g_boot_phases[i].us);
+        if (us > 0) {
+            char labels[32];
+            snprintf(labels, sizeof(labels), "{phase=\"%s\"}", g_boot_phases[i].phase);
+            emit_seconds(w, "librarian_boot_seconds", labels, us);
+        }
+    }
+}
+
+static void render_tasks(metrics_writer_t *w) {
+    UBaseType_t count = uxTaskGetNumberOfTasks();
+    // A few spare entries in case tasks start while the snapshot is taken
+    TaskStatus_t *tasks = malloc((count + 4) * sizeof(TaskStatus_t));
+    if (!tasks) {
+        return;
+    }
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    count = uxTaskGetSystemState(tasks, count + 4, &total);
+
+    emit(w, "# HELP librarian_cpu_seconds_total Run-time clock the task counters are measured against.\n"
+            "# TYPE librarian_cpu_seconds_total counter\n");
+    emit_seconds(w, "librarian_cpu_seconds_total", "", total);
+    emit(w, "# HELP librarian_task_cpu_seconds_total Time each task has spent running.\n"
+            "# TYPE librarian_task_cpu_seconds_total counter\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        char labels[48];
+        snprintf(labels, sizeof(labels), "{task=\"%s\"}", tasks[i].pcTaskName);
+        emit_seconds(w, "librarian_task_cpu_seconds_total", labels, tasks[i].ulRunTimeCounter);
+    }
+    emit(w, "# HELP librarian_task_stack_free_bytes Smallest amount of stack a task has had left.\n"
+            "# TYPE librarian_task_stack_free_bytes gauge\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        emit(w, "librarian_task_stack_free_bytes{task=\"%s\"} %u\n", tasks[i].pcTaskName,
+             (unsigned)tasks[i].usStackHighWaterMark);
+    }
+    free(tasks);
+}
+
+static void render_io(metrics_writer_t *w) {
+    emit(w, "# HELP librarian_storage_bytes_total Bytes moved by transfers, downloads and uploads.\n"
+            "# TYPE librarian_storage_bytes_total counter\n");
+    int count = atomic_load(&g_mount_count);
+    for (int i = 0; i < count; i++) {
+        const metrics_mount_t *mount = &g_mounts[i];
+        emit(w, "librarian_storage_bytes_total{volume=\"%s\",direction=\"read\"} %llu\n", mount->name,
+             (unsigned long long)atomic_load_explicit(&mount->bytes_read, memory_order_relaxed));
+        emit(w, "librarian_storage_bytes_total{volume=\"%s\",direction=\"write\"} %llu\n", mount->name,
+             (unsigned long long)atomic_load_explicit(&mount->bytes_written, memory_order_relaxed));
+    }
+
+    emit(w, "# HELP librarian_transfer_files_total Files the transfer queue has copied.\n"
+            "# TYPE librarian_transfer_files_total counter\n");
+    emit(w, "librarian_transfer_files_total %u\n",
+         (unsigned)atomic_load_explicit(&g_transfer_files, memory_order_relaxed));
+    emit(w, "# HELP librarian_transfer_bytes_total Bytes the transfer queue has copied.\n"
+            "# TYPE librarian_transfer_bytes_total counter\n");
+    emit(w, "librarian_transfer_bytes_total %llu\n",
+         (unsigned long long)atomic_load_explicit(&g_transfer_bytes, memory_order_relaxed));
+    emit(w, "# HELP librarian_transfer_seconds_total Time spent copying those bytes.\n"
+            "# TYPE librarian_transfer_seconds_total counter\n");
+    emit_seconds(w, "librarian_transfer_seconds_total", "",
+                 atomic_load_explicit(&g_transfer_us, memory_order_relaxed));
+}
+
+static void render_http(metrics_writer_t *w) {
+    emit(w, "# HELP librarian_http_request_duration_seconds Time spent in each handler.\n"
+            "# TYPE librarian_http_request_duration_seconds histogram\n");
+    for (size_t i = 0; i < g_endpoint_count; i++) {
+        const metrics_endpoint_t *endpoint = &g_endpoints[i];
+        const char *method = method_name(endpoint->method);
+        uint32_t cumulative = 0;
+        for (int b = 0; b < METRICS_LATENCY_BUCKET_COUNT; b++) {
+            cumulative += atomic_load_explicit(&endpoint->buckets[b], memory_order_relaxed);
+            emit(w, "librarian_http_request_duration_seconds_bucket{handler=\"%s\",method=\"%s\",le=\"%u.%06u\"} %u\n",
+                 endpoint->uri, method, (unsigned)(LATENCY_BOUNDS_US[b] / 1000000),
+                 (unsigned)(LATENCY_BOUNDS_US[b] % 1000000), (unsigned)cumulative);
+        }
+        uint32_t count = atomic_load_explicit(&endpoint->count, memory_order_relaxed);
+        emit(w, "librarian_http_request_duration_seconds_bucket{handler=\"%s\",method=\"%s\",le=\"+Inf\"} %u\n",
+             endpoint->uri, method, (unsigned)count);
+        char labels[64];
+        snprintf(labels, sizeof(labels), "{handler=\"%s\",method=\"%s\"}", endpoint->uri, method);
+        emit_seconds(w, "librarian_http_request_duration_seconds_sum", labels,
+                     atomic_load_explicit(&endpoint->sum_us, memory_order_relaxed));
+        emit(w, "librarian_http_request_duration_seconds_count%s %u\n", labels, (unsigned)count);
+    }
+
+    emit(w, "# HELP librarian_http_request_errors_total Requests whose handler returned an error.\n"
+            "# TYPE librarian_http_request_errors_total counter\n");
+    for (size_t i = 0; i < g_endpoint_count; i++) {
+        const metrics_endpoint_t *endpoint = &g_endpoints[i];
+        emit(w, "librarian_http_request_errors_total{handler=\"%s\",method=\"%s\"} %u\n", endpoint->uri,
+             method_name(endpoint->method), (unsigned)atomic_load_explicit(&endpoint->errors, memory_order_relaxed));
+    }
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    metrics_writer_t w = { .req = req, .buf = malloc(METRICS_CHUNK_SIZE) };
+    if (!w.buf) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    emit(&w, "# HELP librarian_uptime_seconds Time since boot.\n# TYPE librarian_uptime_seconds counter\n");
+    emit_seconds(&w, "librarian_uptime_seconds", "", esp_timer_get_time());
+    render_heap(&w);
+    render_pools(&w);
+    render_boot(&w);
+    render_tasks(&w);
+    render_io(&w);
+    render_http(&w);
+    writer_flush(&w);
+    free(w.buf);
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return w.err;
+}
+
+esp_err_t metrics_register(httpd_handle_t server) {
+    httpd_uri_t metrics_uri = { "/metrics", HTTP_GET, metrics_handler, NULL };
+    return httpd_register_uri_handler(server, &metrics_uri);
+}
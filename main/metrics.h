@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Mounts whose I/O is counted, and endpoints with a latency histogram
+#define METRICS_MAX_MOUNTS    2
+#define METRICS_MAX_ENDPOINTS 24
+
+// Upper bounds of the request latency buckets, in microseconds. Requests
+// slower than the last bound only show up in the +Inf bucket.
+#define METRICS_LATENCY_BUCKETS_US { 1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, \
+                                     1000000, 2500000, 5000000, 10000000 }
+#define METRICS_LATENCY_BUCKET_COUNT 12
+
+// Size of the buffer the /metrics response is rendered into, chunk by chunk
+#define METRICS_CHUNK_SIZE 1024
+
+// Names a mount whose traffic is reported under `name` (e.g. "sd"), for every
+// path starting with `prefix`. Returns its index, or -1 if the table is full.
+int metrics_add_mount(const char *name, const char *prefix);
+
+// Index of the mount `path` lives on, or -1; resolve once per file, not per block.
+int metrics_mount_for_path(const char *path);
+
+// Counts `bytes` read from or written to a mount. Safe from any task and
+// cheap enough for every block; a negative `mount` is ignored.
+void metrics_count_io(int mount, bool write, size_t bytes);
+
+// Counts one copied file and how long the copy took.
+void metrics_count_transfer(size_t bytes, int64_t us);
+
+// Records heap returned by a subsystem that is shut down at boot (e.g. "ble"),
+// so builds can be compared on /metrics. Up to METRICS_MAX_RECLAIMED sources.
+#define METRICS_MAX_RECLAIMED 2
+void metrics_set_reclaimed(const char *source, size_t bytes);
+
+// Startup phases kept for /metrics, including the automatic "first_response"
+#define METRICS_MAX_BOOT_PHASES 6
+
+// Records that startup `phase` (a string literal such as "wifi") has just
+// completed, as time since boot. The first HTTP response served through a
+// metered handler is recorded as "first_response". Safe from any task.
+void metrics_mark_boot(const char *phase);
+
+// Fills `wrapped` with a copy of `uri` whose handler records how long each
+// request takes, for callers that register or dispatch it themselves.
+void metrics_wrap_handler(const httpd_uri_t *uri, httpd_uri_t *wrapped);
+
+// Registers `uri` on `server` behind a wrapper that records how long each
+// request takes. The handler still sees its own user_ctx.
+esp_err_t metrics_register_handler(httpd_handle_t server, const httpd_uri_t *uri);
+
+// Registers GET /metrics (Prometheus text format) on `server`.
+esp_err_t metrics_register(httpd_handle_t server);
+
+#endif // METRICS_H
@@ -0,0 +1,61 @@
+/*
+ * Power management.
+ *
+ * The library boxes run on battery and spend most of their time waiting for
+ * someone to walk up. With esp_pm the CPU drops to min_freq_mhz and the chip
+ * light-sleeps between Wi-Fi beacons whenever nothing holds a lock. Work that
+ * needs the full clock holds one for exactly as long as it runs.
+ */
+
+#include "esp_log.h"
+#include "esp_pm.h"
+
+#include "power.h"
+
+static const char *TAG = "power";
+
+static const struct {
+    const char *name;
+    esp_pm_lock_type_t type;
+} HOLD_LOCKS[POWER_HOLD_COUNT] = {
+    [POWER_HOLD_TRANSFER] = { "transfer", ESP_PM_CPU_FREQ_MAX },
+    [POWER_HOLD_HTTP] = { "http", ESP_PM_CPU_FREQ_MAX },
+    [POWER_HOLD_USB] = { "usb", ESP_PM_NO_LIGHT_SLEEP },
+};
+
+static esp_pm_lock_handle_t g_locks[POWER_HOLD_COUNT];
+
+esp_err_t power_init(const power_config_t *config) {
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = config->max_freq_mhz,
+        .min_freq_mhz = config->min_freq_mhz,
+        .light_sleep_enable = config->light_sleep,
+    };
+    esp_err_t ret = esp_pm_configure(&pm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Power management not available: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    for (int i = 0; i < POWER_HOLD_COUNT; i++) {
+        ret = esp_pm_lock_create(HOLD_LOCKS[i].type, 0, HOLD_LOCKS[i].name, &g_locks[i]);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create %s lock: %s", HOLD_LOCKS[i].name, esp_err_to_name(ret));
+            g_locks[i] = NULL;
+        }
+    }
+    ESP_LOGI(TAG, "Idle at %d MHz%s, %d MHz while busy", config->min_freq_mhz,
+             config->light_sleep ? " with light sleep" : "", config->max_freq_mhz);
+    return ESP_OK;
+}
+
+void power_acquire(power_hold_t hold) {
+    if (hold < POWER_HOLD_COUNT && g_locks[hold]) {
+        esp_pm_lock_acquire(g_locks[hold]);
+    }
+}
+
+void power_release(power_hold_t hold) {
+    if (hold < POWER_HOLD_COUNT && g_locks[hold]) {
+        esp_pm_lock_release(g_locks[hold]);
+    }
+}
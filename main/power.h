@@ -0,0 +1,33 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Reasons to keep the chip awake. Transfers and open HTTP connections run at
+// full clock; a mounted USB reader only keeps the chip out of light sleep,
+// since the USB host cannot keep the bus alive through it.
+typedef enum {
+    POWER_HOLD_TRANSFER,
+    POWER_HOLD_HTTP,
+    POWER_HOLD_USB,
+    POWER_HOLD_COUNT,
+} power_hold_t;
+
+typedef struct {
+    int max_freq_mhz;       // Clock while any full-clock hold is taken
+    int min_freq_mhz;       // Clock when idle
+    bool light_sleep;       // Enter light sleep automatically when idle
+} power_config_t;
+
+// Enables dynamic frequency scaling. Without CONFIG_PM_ENABLE this returns
+// ESP_ERR_NOT_SUPPORTED and every hold is a no-op.
+esp_err_t power_init(const power_config_t *config);
+
+// Holds nest; each power_acquire() needs a matching power_release(). Safe
+// from any task.
+void power_acquire(power_hold_t hold);
+void power_release(power_hold_t hold);
+
+#endif // POWER_H
@@ -0,0 +1,373 @@
+/*
+ * Background catalog scanner.
+ *
+ * A low-priority task walks a volume's root directory and reports every book
+ * file to the catalog, which only opens files whose size or mtime changed.
+ * Work is committed in small batches; between batches the catalog lock is
+ * released and the scan waits for any transfer to finish, so it never holds
+ * up a copy or a listing for long.
+ *
+ * On volumes with a known FatFs drive the walk uses f_readdir(), which returns
+ * size and timestamp with each entry. Going through readdir() and stat()
+ * instead makes FatFs search the directory from the start for every file,
+ * which turns a rescan of a large library quadratic.
+ *
+ * Once a scan is complete the books that have no content hash yet are read
+ * and hashed, one at a time, outside the catalog lock.
+ *
+ * A volume about to be unmounted is cancelled. The task claims a volume
+ * through g_guard before it opens anything on it and releases it when it is
+ * done, and scanner_cancel() waits for the release (see volume_guard.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ff.h"
+#include "mbedtls/sha256.h"
+
+#include "scanner.h"
+#include "volume_guard.h"
+
+static const char *TAG = "scanner";
+
+typedef struct {
+    const char *volume;
+    const char *dir_path;
+    char fatfs_path[8];         // e.g. "0:/", empty if unknown
+    volatile bool cancel;       // Set by scanner_cancel(), cleared by scanner_resume()
+} scanner_volume_t;
+
+static scanner_config_t g_config;
+static TaskHandle_t g_task = NULL;
+static scanner_volume_t g_volumes[SCANNER_MAX_VOLUMES];
+static int g_volume_count = 0;
+static const char *volatile g_active = NULL;
+
+static volume_guard_t g_guard = VOLUME_GUARD_INITIALIZER;
+
+// --- Directory Walk ---
+typedef struct {
+    const scanner_volume_t *vol;
+    bool use_fatfs;
+    FF_DIR ff_dir;
+    FILINFO info;
+    DIR *dir;
+} dir_walk_t;
+
+// Same conversion the FatFs VFS applies in stat(), so times read here match
+// the ones catalog_update_file() stores.
+static int64_t fat_time_to_unix(WORD fdate, WORD ftime) {
+    struct tm tm = {
+        .tm_mday = fdate & 0x1f,
+        .tm_mon = ((fdate >> 5) & 0x0f) - 1,
+        .tm_year = (fdate >> 9) + 80,
+        .tm_sec = (ftime & 0x1f) * 2,
+        .tm_min = (ftime >> 5) & 0x3f,
+        .tm_hour = ftime >> 11,
+        .tm_isdst = -1,
+    };
+    return mktime(&tm);
+}
+
+static esp_err_t walk_open(dir_walk_t *walk, const scanner_volume_t *vol) {
+    memset(walk, 0, sizeof(*walk));
+    walk->vol = vol;
+    if (vol->fatfs_path[0] != '\0') {
+        if (f_opendir(&walk->ff_dir, vol->fatfs_path) == FR_OK) {
+            walk->use_fatfs = true;
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "f_opendir(%s) failed, falling back to readdir", vol->fatfs_path);
+    }
+    walk->dir = opendir(vol->dir_path);
+    if (!walk->dir) {
+        ESP_LOGE(TAG, "Failed to open directory: %s", vol->dir_path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Returns 1 and fills in the next regular file, 0 at the end of the
+// directory, or -1 on a read error.
+static int walk_next(dir_walk_t *walk, const char **name, int64_t *size, int64_t *mtime) {
+    if (walk->use_fatfs) {
+        while (true) {
+            if (f_readdir(&walk->ff_dir, &walk->info) != FR_OK) {
+                return -1;
+            }
+            if (walk->info.fname[0] == '\0') {
+                return 0;
+            }
+            if (walk->info.fattrib & AM_DIR) {
+                continue;
+            }
+            *name = walk->info.fname;
+            *size = walk->info.fsize;
+            *mtime = fat_time_to_unix(walk->info.fdate, walk->info.ftime);
+            return 1;
+        }
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(walk->dir)) != NULL) {
+        if (entry->d_type != DT_REG || !catalog_is_book_file(entry->d_name)) {
+            continue;
+        }
+        char full_path[512];
+        snprintf(full_path, sizeof(full_path), "%s/%s", walk->vol->dir_path, entry->d_name);
+        struct stat st;
+        if (stat(full_path, &st) != 0) {
+            continue;
+        }
+        *name = entry->d_name;
+        *size = st.st_size;
+        *mtime = st.st_mtime;
+        return 1;
+    }
+    return 0;
+}
+
+static void walk_close(dir_walk_t *walk) {
+    if (walk->use_fatfs) {
+        f_closedir(&walk->ff_dir);
+    } else if (walk->dir) {
+        closedir(walk->dir);
+    }
+}
+
+// --- Scanning ---
+static void wait_until_idle(const scanner_volume_t *vol) {
+    while (g_config.is_busy && g_config.is_busy() && !vol->cancel) {
+        vTaskDelay(pdMS_TO_TICKS(SCANNER_BUSY_POLL_MS));
+    }
+}
+
+static esp_err_t scan_volume(scanner_volume_t *vol, catalog_sync_stats_t *stats) {
+    wait_until_idle(vol);
+
+    catalog_sync_t *sync;
+    esp_err_t ret = catalog_sync_begin(vol->volume, &sync);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    dir_walk_t walk;
+    if (walk_open(&walk, vol) != ESP_OK) {
+        catalog_sync_finish(sync, false, stats);
+        return ESP_FAIL;
+    }
+
+    int64_t start = esp_timer_get_time();
+    uint32_t batch_files = 0, batch_parses = 0;
+    bool complete = false;
+    while (!vol->cancel) {
+        const char *name;
+        int64_t size, mtime;
+        int found = walk_next(&walk, &name, &size, &mtime);
+        if (found <= 0) {
+            complete = found == 0;
+            break;
+        }
+        if (!catalog_is_book_file(name)) {
+            continue;
+        }
+
+        bool parsed = false;
+        catalog_sync_file(sync, vol->dir_path, name, size, mtime, &parsed);
+        batch_files++;
+        if (parsed) batch_parses++;
+
+        if (batch_files >= SCANNER_BATCH_FILES || batch_parses >= SCANNER_BATCH_PARSES) {
+            catalog_sync_yield(sync);
+            batch_files = 0;
+            batch_parses = 0;
+            wait_until_idle(vol);
+            // Let equal-priority tasks in even when nothing else is waiting
+            vTaskDelay(1);
+        }
+    }
+    walk_close(&walk);
+
+    ret = catalog_sync_finish(sync, complete && !vol->cancel, stats);
+    ESP_LOGI(TAG, "Scan of %s %s in %lld ms", vol->volume, complete ? "finished" : "stopped",
+             (long long)((esp_timer_get_time() - start) / 1000));
+    if (ret == ESP_OK && !complete) {
+        ret = vol->cancel ? ESP_ERR_INVALID_STATE : ESP_FAIL;
+    }
+    return ret;
+}
+
+// --- Hashing ---
+static bool rescan_pending(void) {
+    return ulTaskNotifyValueClear(NULL, 0) != 0;
+}
+
+// Hashes one file, pausing while the volume is busy. Returns ESP_ERR_INVALID_STATE
+// if it gave up to let something else run, ESP_FAIL if the file could not be read.
+static esp_err_t hash_file(scanner_volume_t *vol, const char *path, uint8_t *buf, uint8_t digest[CATALOG_HASH_SIZE]) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    esp_err_t ret = ESP_OK;
+    size_t got;
+    while ((got = fread(buf, 1, SCANNER_HASH_BLOCK, f)) > 0) {
+        mbedtls_sha256_update(&sha, buf, got);
+        wait_until_idle(vol);
+        if (vol->cancel || rescan_pending()) {
+            ret = ESP_ERR_INVALID_STATE;
+            break;
+        }
+    }
+    if (ret == ESP_OK && ferror(f)) {
+        ret = ESP_FAIL;
+    }
+    if (ret == ESP_OK) {
+        mbedtls_sha256_finish(&sha, digest);
+    }
+    mbedtls_sha256_free(&sha);
+    fclose(f);
+    return ret;
+}
+
+static void hash_volume(scanner_volume_t *vol) {
+    uint8_t *buf = malloc(SCANNER_HASH_BLOCK);
+    if (!buf) {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    uint32_t hashed = 0;
+    catalog_hash_job_t job;
+    while (!vol->cancel && !rescan_pending() && catalog_next_hash_job(vol->volume, &job) == ESP_OK) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", vol->dir_path, job.name);
+        uint8_t digest[CATALOG_HASH_SIZE];
+        esp_err_t ret = hash_file(vol, path, buf, digest);
+        // A read error on a volume being unmounted says nothing about the file
+        if (ret == ESP_ERR_INVALID_STATE || vol->cancel) {
+            break;
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to hash %s", path);
+        }
+        catalog_set_hash(&job, ret == ESP_OK ? digest : NULL);
+        hashed++;
+        vTaskDelay(1);
+    }
+    free(buf);
+    if (hashed > 0) {
+        ESP_LOGI(TAG, "Hashed %u book(s) on %s in %lld ms", (unsigned)hashed, vol->volume,
+                 (long long)((esp_timer_get_time() - start) / 1000));
+    }
+}
+
+// --- Task ---
+static void scanner_task(void *arg) {
+    while (true) {
+        uint32_t pending = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &pending, portMAX_DELAY);
+        for (int i = 0; i < g_volume_count; i++) {
+            scanner_volume_t *vol = &g_volumes[i];
+            if (!(pending & (1u << i)) || !volume_guard_claim(&g_guard, &vol->cancel)) {
+                continue;
+            }
+            catalog_sync_stats_t stats = { 0 };
+            g_active = vol->volume;
+            esp_err_t ret = scan_volume(vol, &stats);
+            g_active = NULL;
+            if (g_config.on_scan_finished) {
+                g_config.on_scan_finished(vol->volume, ret, &stats);
+            }
+            if (ret == ESP_OK) {
+                hash_volume(vol);
+            }
+            volume_guard_release(&g_guard, &vol->cancel);
+        }
+    }
+}
+
+// --- Public API ---
+esp_err_t scanner_init(const scanner_config_t *config) {
+    if (g_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    g_config = *config;
+    esp_err_t ret = volume_guard_init(&g_guard);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (xTaskCreatePinnedToCore(scanner_task, "scanner", g_config.task_stack_size, NULL,
+                                g_config.task_priority, &g_task, g_config.core_id) != pdPASS) {
+        g_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t scanner_add_volume(const char *volume, const char *dir_path, const char *fatfs_drive) {
+    if (g_volume_count >= SCANNER_MAX_VOLUMES) {
+        return ESP_ERR_NO_MEM;
+    }
+    scanner_volume_t *vol = &g_volumes[g_volume_count];
+    vol->volume = volume;
+    vol->dir_path = dir_path;
+    vol->fatfs_path[0] = '\0';
+    if (fatfs_drive) {
+        snprintf(vol->fatfs_path, sizeof(vol->fatfs_path), "%s/", fatfs_drive);
+    }
+    vol->cancel = false;
+    g_volume_count++;
+    return ESP_OK;
+}
+
+static int volume_index(const char *volume) {
+    for (int i = 0; i < g_volume_count; i++) {
+        if (strcmp(g_volumes[i].volume, volume) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void scanner_request(const char *volume) {
+    int i = volume_index(volume);
+    if (g_task && i >= 0) {
+        xTaskNotify(g_task, 1u << i, eSetBits);
+    }
+}
+
+esp_err_t scanner_cancel(const char *volume) {
+    int i = volume_index(volume);
+    if (!g_task || i < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = volume_guard_cancel(&g_guard, &g_volumes[i].cancel, SCANNER_CANCEL_TIMEOUT_MS);
+    ulTaskNotifyValueClear(g_task, 1u << i);
+    if (ret == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Scanner still busy on %s after %d ms", volume, SCANNER_CANCEL_TIMEOUT_MS);
+    }
+    return ret;
+}
+
+void scanner_resume(const char *volume) {
+    int i = volume_index(volume);
+    if (!g_task || i < 0) {
+        return;
+    }
+    volume_guard_resume(&g_guard, &g_volumes[i].cancel);
+    xTaskNotify(g_task, 1u << i, eSetBits);
+}
+
+const char *scanner_active_volume(void) {
+    return g_active;
+}
@@ -0,0 +1,67 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "catalog.h"
+
+// Volumes the scanner can be asked to walk
+#define SCANNER_MAX_VOLUMES 2
+// Files reported to the catalog per transaction, and how many of those may
+// need parsing, before the scanner commits and yields
+#define SCANNER_BATCH_FILES  64
+#define SCANNER_BATCH_PARSES 4
+// How often a paused scan checks whether it may continue
+#define SCANNER_BUSY_POLL_MS 200
+// Read size while hashing books after a scan
+#define SCANNER_HASH_BLOCK   (16 * 1024)
+// How long scanner_cancel() waits for the task to let go of the volume. One
+// batch of parses, or a wait for the catalog lock, normally takes far less.
+#define SCANNER_CANCEL_TIMEOUT_MS 3000
+
+typedef struct {
+    uint32_t task_stack_size;
+    int task_priority;
+    // Core the task is pinned to, or tskNO_AFFINITY
+    BaseType_t core_id;
+    // Polled between batches; the scan waits while it returns true, e.g.
+    // while a transfer is using the card. Optional.
+    bool (*is_busy)(void);
+    // Runs on the scanner task after each scan. Optional.
+    void (*on_scan_finished)(const char *volume, esp_err_t result, const catalog_sync_stats_t *stats);
+} scanner_config_t;
+
+// Starts the scanner task. Must be called once before any other function.
+esp_err_t scanner_init(const scanner_config_t *config);
+
+// Describes a volume that may be scanned. `fatfs_drive` (e.g. "0:") lets the
+// walk read sizes and times from the directory entries in a single pass
+// instead of calling stat() per file, which rescans the directory each time.
+// Pass NULL when the volume's FatFs drive is not known.
+esp_err_t scanner_add_volume(const char *volume, const char *dir_path, const char *fatfs_drive);
+
+// After every complete scan the scanner also hashes the volume's new and
+// changed books for the catalog's duplicate detection, pausing like the scan
+// while the volume is busy and giving way to any rescan that is requested.
+
+// Schedules a rescan of `volume`. Requests made while one is already pending
+// are merged; a request during a scan of the same volume runs it again after.
+void scanner_request(const char *volume);
+
+// Stops scanning `volume` before it is unmounted. A scan or hash pass in
+// progress is abandoned at its next file or batch without sweeping any rows,
+// and this blocks until the task has closed everything it had open on the
+// volume. Returns ESP_ERR_TIMEOUT if that took longer than
+// SCANNER_CANCEL_TIMEOUT_MS. Requests are ignored until scanner_resume().
+esp_err_t scanner_cancel(const char *volume);
+
+// Undoes scanner_cancel() once `volume` is mounted again, and schedules a
+// rescan of it.
+void scanner_resume(const char *volume);
+
+// Name of the volume being scanned, or NULL when idle.
+const char *scanner_active_volume(void);
+
+#endif // SCANNER_H
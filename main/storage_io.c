@@ -0,0 +1,218 @@
+/*
+ * Storage geometry and sequential throughput.
+ *
+ * FatFs hands whole, sector-aligned runs of a write straight to the disk
+ * driver and only stages partial sectors through the file's sector buffer.
+ * Copies therefore go fastest when each block is a whole number of clusters,
+ * starts on a sector boundary in DMA-capable memory and is not split up by
+ * stdio. The benchmark here measures that pattern against the small buffered
+ * blocks the firmware used to copy with, on whichever volume it is pointed at.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ff.h"
+
+#include "storage_io.h"
+
+static const char *TAG = "storage_io";
+
+esp_err_t storage_io_get_geometry(const char *drive, storage_io_geometry_t *geometry) {
+    FATFS *fs;
+    DWORD free_clusters;
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK) {
+        return ESP_FAIL;
+    }
+#if FF_MAX_SS != FF_MIN_SS
+    geometry->sector_size = fs->ssize;
+#else
+    geometry->sector_size = FF_MAX_SS;
+#endif
+    geometry->cluster_size = (uint32_t)fs->csize * geometry->sector_size;
+    return ESP_OK;
+}
+
+size_t storage_io_block_size(const storage_io_geometry_t *geometry, size_t preferred, size_t max) {
+    size_t cluster = geometry->cluster_size;
+    if (cluster == 0) {
+        return preferred;
+    }
+    size_t size = (preferred + cluster - 1) / cluster * cluster;
+    if (size > max) {
+        size = max / cluster * cluster;
+    }
+    return size > 0 ? size : cluster;
+}
+
+void *storage_io_alloc(size_t size, size_t align) {
+    return heap_caps_aligned_alloc(align, size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+}
+
+static uint32_t kbps(uint32_t bytes, int64_t us) {
+    return us > 0 ? (uint32_t)((uint64_t)bytes * 1000000 / 1024 / us) : 0;
+}
+
+static void fill_pattern(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 31 + 7);
+    }
+}
+
+// The write is synced before the clock stops so the figure includes getting
+// the data onto the medium, not just into FatFs.
+esp_err_t storage_io_measure_sequential(const char *path, uint32_t file_bytes, uint8_t *buf, size_t block,
+                                        bool unbuffered, storage_io_bench_pattern_t *out) {
+    out->block_size = block;
+    fill_pattern(buf, block);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+    if (unbuffered) {
+        setvbuf(f, NULL, _IONBF, 0);
+    }
+    int64_t start = esp_timer_get_time();
+    uint32_t done = 0;
+    bool ok = true;
+    while (ok && done < file_bytes) {
+        size_t n = file_bytes - done < block ? file_bytes - done : block;
+        ok = fwrite(buf, 1, n, f) == n;
+        done += n;
+    }
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    out->write_us = esp_timer_get_time() - start;
+    if (!ok) {
+        ESP_LOGE(TAG, "Write to %s failed", path);
+        return ESP_FAIL;
+    }
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    if (unbuffered) {
+        setvbuf(f, NULL, _IONBF, 0);
+    }
+    start = esp_timer_get_time();
+    done = 0;
+    size_t got;
+    while ((got = fread(buf, 1, block, f)) > 0) {
+        done += got;
+    }
+    fclose(f);
+    out->read_us = esp_timer_get_time() - start;
+    if (done != file_bytes) {
+        ESP_LOGE(TAG, "Read back %u of %u bytes", (unsigned)done, (unsigned)file_bytes);
+        return ESP_FAIL;
+    }
+
+    out->write_kbps = kbps(file_bytes, out->write_us);
+    out->read_kbps = kbps(file_bytes, out->read_us);
+    return ESP_OK;
+}
+
+static uint32_t ops_per_s(uint32_t ops, int64_t us) {
+    return us > 0 ? (uint32_t)((uint64_t)ops * 1000000 / us) : 0;
+}
+
+esp_err_t storage_io_measure_small_files(const char *dir, uint32_t files, uint32_t file_bytes,
+                                         storage_io_small_files_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->files = files;
+    out->file_bytes = file_bytes;
+    uint8_t *buf = malloc(file_bytes > 0 ? file_bytes : 1);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    fill_pattern(buf, file_bytes);
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s", dir);
+        free(buf);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = ESP_OK;
+    char path[64];
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files && ret == ESP_OK; i++) {
+        snprintf(path, sizeof(path), "%s/F%05u.TMP", dir, (unsigned)i);
+        FILE *f = fopen(path, "wb");
+        if (!f || fwrite(buf, 1, file_bytes, f) != file_bytes) {
+            ret = ESP_FAIL;
+        }
+        if (f && fclose(f) != 0) {
+            ret = ESP_FAIL;
+        }
+    }
+    out->create_per_s = ops_per_s(files, esp_timer_get_time() - start);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files && ret == ESP_OK; i++) {
+        snprintf(path, sizeof(path), "%s/F%05u.TMP", dir, (unsigned)i);
+        FILE *f = fopen(path, "rb");
+        if (!f || fread(buf, 1, file_bytes, f) != file_bytes) {
+            ret = ESP_FAIL;
+        }
+        if (f) fclose(f);
+    }
+    out->read_per_s = ops_per_s(files, esp_timer_get_time() - start);
+
+    // Always runs, so a failed pass does not leave the directory behind
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/F%05u.TMP", dir, (unsigned)i);
+        remove(path);
+    }
+    out->delete_per_s = ops_per_s(files, esp_timer_get_time() - start);
+    rmdir(dir);
+    free(buf);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Small-file pass in %s failed", dir);
+        out->create_per_s = out->read_per_s = out->delete_per_s = 0;
+    }
+    return ret;
+}
+
+esp_err_t storage_io_bench(const char *path, uint32_t file_bytes, size_t tuned_block, size_t align,
+                           storage_io_bench_result_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->file_bytes = file_bytes;
+
+    uint8_t *buf = malloc(STORAGE_IO_BASELINE_BLOCK);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = storage_io_measure_sequential(path, file_bytes, buf, STORAGE_IO_BASELINE_BLOCK, false, &out->baseline);
+    free(buf);
+    remove(path);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    buf = storage_io_alloc(tuned_block, align);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    out->tuned.aligned = true;
+    ret = storage_io_measure_sequential(path, file_bytes, buf, tuned_block, true, &out->tuned);
+    heap_caps_free(buf);
+    remove(path);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "%s: baseline %u/%u KiB/s, tuned %u/%u KiB/s (write/read)", path,
+                 (unsigned)out->baseline.write_kbps, (unsigned)out->baseline.read_kbps,
+                 (unsigned)out->tuned.write_kbps, (unsigned)out->tuned.read_kbps);
+    }
+    return ret;
+}
@@ -0,0 +1,73 @@
+#ifndef STORAGE_IO_H
+#define STORAGE_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Geometry of a mounted FatFs volume, as far as I/O alignment is concerned
+typedef struct {
+    uint32_t sector_size;
+    uint32_t cluster_size;
+} storage_io_geometry_t;
+
+// Reads the sector and cluster size of the FatFs drive `drive` (e.g. "0:").
+esp_err_t storage_io_get_geometry(const char *drive, storage_io_geometry_t *geometry);
+
+// Rounds `preferred` up to a whole number of clusters (clusters are powers of
+// two), without going over `max` unless a single cluster is already larger.
+size_t storage_io_block_size(const storage_io_geometry_t *geometry, size_t preferred, size_t max);
+
+// Allocates a DMA-capable internal buffer whose start is aligned to `align`
+// bytes, so the SD and MSC drivers can transfer straight from it. Free with
+// heap_caps_free().
+void *storage_io_alloc(size_t size, size_t align);
+
+// Sequential throughput of one access pattern
+typedef struct {
+    uint32_t block_size;
+    bool aligned;               // DMA-capable, aligned block and unbuffered streams
+    int64_t write_us;
+    int64_t read_us;
+    uint32_t write_kbps;        // KiB per second
+    uint32_t read_kbps;
+} storage_io_bench_pattern_t;
+
+typedef struct {
+    uint32_t file_bytes;
+    storage_io_bench_pattern_t baseline;    // Small stdio-buffered blocks from malloc()
+    storage_io_bench_pattern_t tuned;       // Cluster-sized, aligned, unbuffered blocks
+} storage_io_bench_result_t;
+
+// Block size of the baseline pattern, the buffer the original copy loop used
+#define STORAGE_IO_BASELINE_BLOCK 4096
+
+// Times writing `file_bytes` to `path` in `block` sized pieces from `buf`,
+// including the final sync, and reading it back. `unbuffered` turns off stdio
+// buffering on both streams. The file is left in place; `aligned` is not set.
+esp_err_t storage_io_measure_sequential(const char *path, uint32_t file_bytes, uint8_t *buf, size_t block,
+                                        bool unbuffered, storage_io_bench_pattern_t *out);
+
+// Small-file operations per second: each create writes and closes one file,
+// each read opens, reads and closes one, each delete removes one.
+typedef struct {
+    uint32_t files;
+    uint32_t file_bytes;
+    uint32_t create_per_s;
+    uint32_t read_per_s;
+    uint32_t delete_per_s;
+} storage_io_small_files_t;
+
+// Creates `files` files of `file_bytes` each in a scratch directory `dir`
+// (created and removed by the call), then reads and deletes them.
+esp_err_t storage_io_measure_small_files(const char *dir, uint32_t files, uint32_t file_bytes,
+                                         storage_io_small_files_t *out);
+
+// Writes and reads back a `file_bytes` scratch file at `path` with both
+// access patterns and removes it. `tuned_block` and `align` describe the
+// tuned pattern, normally the copy engine's block size and the sector size.
+esp_err_t storage_io_bench(const char *path, uint32_t file_bytes, size_t tuned_block, size_t align,
+                           storage_io_bench_result_t *out);
+
+#endif // STORAGE_IO_H
@@ -0,0 +1,393 @@
+/*
+ * Cover thumbnails.
+ *
+ * A low-priority task picks books from the catalog whose OPF names a cover,
+ * streams the image out of the EPUB with miniz's pull iterator and decodes it
+ * with the TJpgDec decoder in ROM, using its 1/2..1/8 DCT scaling to do most
+ * of the downscaling for free. The result is written to the cache directory
+ * as a 16-bit BMP, which browsers display natively; there is no JPEG encoder
+ * on the device.
+ *
+ * Thumbnails are keyed by the CRC-32 the zip directory already stores for the
+ * cover, so no extra hashing is needed, books that share a cover share one
+ * file, and a cached thumbnail survives a catalog rebuild.
+ *
+ * Cancelling works as in the scanner: the task claims a volume through
+ * g_guard before it opens a book there and releases it afterwards, and
+ * thumbnail_cancel() waits for the release.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_rom_tjpgd.h"
+#include "miniz.h"
+
+#include "catalog.h"
+#include "thumbnail.h"
+#include "volume_guard.h"
+
+static const char *TAG = "thumbnail";
+
+// Work area TJpgDec needs for its Huffman and quantisation tables
+#define TJPGD_WORK_SIZE 3100
+
+typedef struct {
+    const char *volume;
+    const char *dir_path;
+    volatile bool cancel;       // Set by thumbnail_cancel(), cleared by thumbnail_resume()
+} thumbnail_volume_t;
+
+static thumbnail_config_t g_config;
+static TaskHandle_t g_task = NULL;
+static thumbnail_volume_t g_volumes[THUMBNAIL_MAX_VOLUMES];
+static int g_volume_count = 0;
+
+static volume_guard_t g_guard = VOLUME_GUARD_INITIALIZER;
+
+// --- Decoding ---
+typedef struct {
+    mz_zip_reader_extract_iter_state *iter;
+    const thumbnail_volume_t *vol;
+    uint16_t *pixels;           // RGB565, top row first
+    uint32_t src_width, src_height;     // Size after TJpgDec's scaling
+    uint32_t width, height;             // Size of the thumbnail
+} decode_ctx_t;
+
+static uint32_t jpeg_input(esp_rom_tjpgd_dec_t *dec, uint8_t *buf, uint32_t len) {
+    decode_ctx_t *ctx = (decode_ctx_t *)dec->device;
+    if (buf) {
+        return mz_zip_reader_extract_iter_read(ctx->iter, buf, len);
+    }
+    // A NULL buffer asks for the data to be skipped
+    uint8_t skip[64];
+    uint32_t done = 0;
+    while (done < len) {
+        uint32_t want = len - done < sizeof(skip) ? len - done : sizeof(skip);
+        size_t got = mz_zip_reader_extract_iter_read(ctx->iter, skip, want);
+        if (got == 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+// Nearest-neighbour sampling from each decoded block: every thumbnail pixel
+// takes the source pixel at floor(t * src / dst), which lies in exactly one block.
+static uint32_t jpeg_output(esp_rom_tjpgd_dec_t *dec, void *bitmap, esp_rom_tjpgd_rect_t *rect) {
+    decode_ctx_t *ctx = (decode_ctx_t *)dec->device;
+    if (ctx->vol->cancel) {
+        return 0;
+    }
+    const uint8_t *rgb = (const uint8_t *)bitmap;
+    uint32_t block_width = rect->right - rect->left + 1;
+    uint32_t ty = (rect->top * ctx->height + ctx->src_height - 1) / ctx->src_height;
+    for (; ty < ctx->height; ty++) {
+        uint32_t sy = ty * ctx->src_height / ctx->height;
+        if (sy > rect->bottom) {
+            break;
+        }
+        uint32_t tx = (rect->left * ctx->width + ctx->src_width - 1) / ctx->src_width;
+        for (; tx < ctx->width; tx++) {
+            uint32_t sx = tx * ctx->src_width / ctx->width;
+            if (sx > rect->right) {
+                break;
+            }
+            const uint8_t *p = rgb + ((sy - rect->top) * block_width + (sx - rect->left)) * 3;
+            ctx->pixels[ty * ctx->width + tx] = ((p[0] & 0xf8) << 8) | ((p[1] & 0xfc) << 3) | (p[2] >> 3);
+        }
+    }
+    return 1;
+}
+
+// Fits the cover into the thumbnail box without ever scaling it up, then
+// picks the coarsest TJpgDec scale that still leaves at least that many pixels.
+static void plan_scaling(decode_ctx_t *ctx, uint32_t width, uint32_t height, uint8_t *scale) {
+    ctx->width = width;
+    ctx->height = height;
+    if (width > THUMBNAIL_MAX_WIDTH || height > THUMBNAIL_MAX_HEIGHT) {
+        if (width * THUMBNAIL_MAX_HEIGHT > height * THUMBNAIL_MAX_WIDTH) {
+            ctx->width = THUMBNAIL_MAX_WIDTH;
+            ctx->height = height * THUMBNAIL_MAX_WIDTH / width;
+        } else {
+            ctx->height = THUMBNAIL_MAX_HEIGHT;
+            ctx->width = width * THUMBNAIL_MAX_HEIGHT / height;
+        }
+        if (ctx->width == 0) ctx->width = 1;
+        if (ctx->height == 0) ctx->height = 1;
+    }
+    *scale = 0;
+    while (*scale < 3 && (width >> (*scale + 1)) >= ctx->width && (height >> (*scale + 1)) >= ctx->height) {
+        (*scale)++;
+    }
+    ctx->src_width = width >> *scale;
+    ctx->src_height = height >> *scale;
+}
+
+// --- BMP Output ---
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+#define BMP_HEADER_SIZE (14 + 40 + 12)
+
+// Writes a bottom-up 16-bit BI_BITFIELDS bitmap. The file is written under a
+// temporary name and renamed, so a partial thumbnail is never served.
+static esp_err_t write_bmp(const char *path, const uint16_t *pixels, uint32_t width, uint32_t height) {
+    uint32_t stride = (width * 2 + 3) & ~3u;
+    uint32_t image_size = stride * height;
+    uint8_t header[BMP_HEADER_SIZE] = { 'B', 'M' };
+    put_le32(header + 2, BMP_HEADER_SIZE + image_size);
+    put_le32(header + 10, BMP_HEADER_SIZE);
+    put_le32(header + 14, 40);
+    put_le32(header + 18, width);
+    put_le32(header + 22, height);
+    put_le16(header + 26, 1);           // Planes
+    put_le16(header + 28, 16);          // Bits per pixel
+    put_le32(header + 30, 3);           // BI_BITFIELDS
+    put_le32(header + 34, image_size);
+    put_le32(header + 38, 2835);        // 72 DPI
+    put_le32(header + 42, 2835);
+    put_le32(header + 54, 0xf800);      // Red, green and blue masks
+    put_le32(header + 58, 0x07e0);
+    put_le32(header + 62, 0x001f);
+
+    char tmp_path[128];
+    snprintf(tmp_path, sizeof(tmp_path), "%.*s.TMP", (int)(strlen(path) - 4), path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to create %s", tmp_path);
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    static const uint8_t padding[2] = { 0 };
+    for (uint32_t y = height; ok && y-- > 0;) {
+        ok = fwrite(pixels + y * width, 2, width, f) == width &&
+             (stride == width * 2 || fwrite(padding, 1, stride - width * 2, f) == stride - width * 2);
+    }
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// --- Generation ---
+static esp_err_t decode_cover(mz_zip_archive *zip, int index, const thumbnail_volume_t *vol, const char *thumb_path) {
+    decode_ctx_t ctx = { .vol = vol };
+    void *work = malloc(TJPGD_WORK_SIZE);
+    ctx.iter = mz_zip_reader_extract_iter_new(zip, index, 0);
+    if (!work || !ctx.iter) {
+        free(work);
+        if (ctx.iter) mz_zip_reader_extract_iter_free(ctx.iter);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+    esp_rom_tjpgd_dec_t dec;
+    esp_rom_tjpgd_result_t res = esp_rom_tjpgd_prepare(&dec, jpeg_input, work, TJPGD_WORK_SIZE, &ctx);
+    if (res == JDR_OK) {
+        uint8_t scale;
+        plan_scaling(&ctx, dec.width, dec.height, &scale);
+        ctx.pixels = calloc(ctx.width * ctx.height, sizeof(uint16_t));
+        if (!ctx.pixels) {
+            ret = ESP_ERR_NO_MEM;
+        } else {
+            res = esp_rom_tjpgd_decomp(&dec, jpeg_output, scale);
+            if (res == JDR_OK) {
+                ret = write_bmp(thumb_path, ctx.pixels, ctx.width, ctx.height);
+            } else if (res == JDR_INTR) {
+                ret = ESP_ERR_INVALID_STATE;
+            }
+            free(ctx.pixels);
+        }
+    }
+    if (res == JDR_INP) {
+        // The book could not be read, which says nothing about the cover
+        ret = ESP_ERR_INVALID_RESPONSE;
+    }
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        // PNG and progressive JPEG covers end up here
+        ESP_LOGD(TAG, "Cannot decode cover (%d)", res);
+    }
+    mz_zip_reader_extract_iter_free(ctx.iter);
+    free(work);
+    return ret;
+}
+
+// Returns ESP_OK with the cache key, ESP_ERR_NOT_SUPPORTED if the book has no
+// usable JPEG cover, ESP_ERR_INVALID_RESPONSE if reading the cover failed, or
+// another error if the run should stop and try again later.
+static esp_err_t make_thumbnail(const thumbnail_volume_t *vol, const catalog_thumb_job_t *job, uint32_t *key) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", vol->dir_path, job->name);
+
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_reader_init_file(&zip, path, 0)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+    int index = mz_zip_reader_locate_file(&zip, job->cover, NULL, 0);
+    mz_zip_archive_file_stat st;
+    if (index >= 0 && mz_zip_reader_file_stat(&zip, index, &st)) {
+        *key = st.m_crc32;
+        char thumb_path[128];
+        thumbnail_cache_path(*key, thumb_path, sizeof(thumb_path));
+        struct stat cached;
+        if (stat(thumb_path, &cached) == 0) {
+            ret = ESP_OK;
+        } else {
+            ret = decode_cover(&zip, index, vol, thumb_path);
+        }
+    }
+    mz_zip_reader_end(&zip);
+    return ret;
+}
+
+static void wait_until_idle(const thumbnail_volume_t *vol) {
+    while (g_config.is_busy && g_config.is_busy() && !vol->cancel) {
+        vTaskDelay(pdMS_TO_TICKS(THUMBNAIL_BUSY_POLL_MS));
+    }
+}
+
+static void run_volume(thumbnail_volume_t *vol) {
+    if (mkdir(g_config.cache_dir, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s", g_config.cache_dir);
+        return;
+    }
+
+    uint32_t generated = 0;
+    int64_t last_id = 0;
+    while (!vol->cancel) {
+        wait_until_idle(vol);
+        catalog_thumb_job_t job;
+        if (catalog_next_thumbnail_job(vol->volume, last_id, &job) != ESP_OK) {
+            break;
+        }
+        last_id = job.id;
+        uint32_t key = 0;
+        esp_err_t ret = make_thumbnail(vol, &job, &key);
+        if (ret == ESP_OK) {
+            catalog_set_thumbnail(&job, key);
+            generated++;
+        } else if (ret == ESP_ERR_NOT_SUPPORTED) {
+            catalog_set_thumbnail(&job, -1);
+        } else if (ret == ESP_ERR_INVALID_RESPONSE) {
+            // Left without a thumbnail so the next run tries it again
+            ESP_LOGW(TAG, "Failed to read the cover of %s", job.name);
+        } else {
+            // Out of memory, card trouble or cancelled: leave the rest for the next request
+            ESP_LOGW(TAG, "Stopping thumbnails for %s: %s", vol->volume, esp_err_to_name(ret));
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(g_config.min_interval_ms));
+    }
+
+    if (generated > 0) {
+        ESP_LOGI(TAG, "Generated %u thumbnail(s) for %s", (unsigned)generated, vol->volume);
+        if (g_config.on_generated) {
+            g_config.on_generated(vol->volume, generated);
+        }
+    }
+}
+
+static void thumbnail_task(void *arg) {
+    while (true) {
+        uint32_t pending = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &pending, portMAX_DELAY);
+        for (int i = 0; i < g_volume_count; i++) {
+            if ((pending & (1u << i)) && volume_guard_claim(&g_guard, &g_volumes[i].cancel)) {
+                run_volume(&g_volumes[i]);
+                volume_guard_release(&g_guard, &g_volumes[i].cancel);
+            }
+        }
+    }
+}
+
+// --- Public API ---
+esp_err_t thumbnail_init(const thumbnail_config_t *config) {
+    if (g_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    g_config = *config;
+    esp_err_t ret = volume_guard_init(&g_guard);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (xTaskCreatePinnedToCore(thumbnail_task, "thumbnail", g_config.task_stack_size, NULL,
+                                g_config.task_priority, &g_task, g_config.core_id) != pdPASS) {
+        g_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t thumbnail_add_volume(const char *volume, const char *dir_path) {
+    if (g_volume_count >= THUMBNAIL_MAX_VOLUMES) {
+        return ESP_ERR_NO_MEM;
+    }
+    g_volumes[g_volume_count].volume = volume;
+    g_volumes[g_volume_count].dir_path = dir_path;
+    g_volumes[g_volume_count].cancel = false;
+    g_volume_count++;
+    return ESP_OK;
+}
+
+static int volume_index(const char *volume) {
+    for (int i = 0; i < g_volume_count; i++) {
+        if (strcmp(g_volumes[i].volume, volume) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void thumbnail_request(const char *volume) {
+    int i = volume_index(volume);
+    if (g_task && i >= 0) {
+        xTaskNotify(g_task, 1u << i, eSetBits);
+    }
+}
+
+esp_err_t thumbnail_cancel(const char *volume) {
+    int i = volume_index(volume);
+    if (!g_task || i < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = volume_guard_cancel(&g_guard, &g_volumes[i].cancel, THUMBNAIL_CANCEL_TIMEOUT_MS);
+    ulTaskNotifyValueClear(g_task, 1u << i);
+    if (ret == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Still busy on %s after %d ms", volume, THUMBNAIL_CANCEL_TIMEOUT_MS);
+    }
+    return ret;
+}
+
+void thumbnail_resume(const char *volume) {
+    int i = volume_index(volume);
+    if (i < 0) {
+        return;
+    }
+    volume_guard_resume(&g_guard, &g_volumes[i].cancel);
+}
+
+void thumbnail_cache_path(uint32_t key, char *path, size_t len) {
+    snprintf(path, len, "%s/%08lX.BMP", g_config.cache_dir, (unsigned long)key);
+}
@@ -0,0 +1,59 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Volumes whose books can have thumbnails generated
+#define THUMBNAIL_MAX_VOLUMES 2
+// Thumbnails are scaled to fit this box, keeping the cover's aspect ratio
+#define THUMBNAIL_MAX_WIDTH  96
+#define THUMBNAIL_MAX_HEIGHT 144
+// How often a paused run checks whether it may continue
+#define THUMBNAIL_BUSY_POLL_MS 200
+// How long thumbnail_cancel() waits for the task to let go of the volume
+#define THUMBNAIL_CANCEL_TIMEOUT_MS 3000
+
+typedef struct {
+    uint32_t task_stack_size;
+    int task_priority;
+    // Core the task is pinned to, or tskNO_AFFINITY
+    BaseType_t core_id;
+    // Directory the thumbnails are written to. It is created if missing.
+    const char *cache_dir;
+    // Minimum gap between two generated thumbnails
+    uint32_t min_interval_ms;
+    // Polled before each thumbnail; generation waits while it returns true,
+    // e.g. while a transfer is using the card. Optional.
+    bool (*is_busy)(void);
+    // Runs on the thumbnail task when a run produced new thumbnails. Optional.
+    void (*on_generated)(const char *volume, uint32_t count);
+} thumbnail_config_t;
+
+// Starts the thumbnail task. Must be called once before any other function.
+esp_err_t thumbnail_init(const thumbnail_config_t *config);
+
+// Describes a volume whose books may get thumbnails.
+esp_err_t thumbnail_add_volume(const char *volume, const char *dir_path);
+
+// Schedules thumbnails for every book on `volume` that has a cover but no
+// thumbnail yet. Requests made while one is pending are merged.
+void thumbnail_request(const char *volume);
+
+// Stops generating for `volume` before it is unmounted, and blocks until the
+// task has closed the book it was reading there. Returns ESP_ERR_TIMEOUT if
+// that took longer than THUMBNAIL_CANCEL_TIMEOUT_MS. Requests are ignored
+// until thumbnail_resume().
+esp_err_t thumbnail_cancel(const char *volume);
+
+// Undoes thumbnail_cancel() once `volume` is mounted again.
+void thumbnail_resume(const char *volume);
+
+// Path of the cached thumbnail with the given key. Keys are the CRC-32 of the
+// cover image, so a file's contents never change once written.
+void thumbnail_cache_path(uint32_t key, char *path, size_t len);
+
+#endif // THUMBNAIL_H
@@ -0,0 +1,536 @@
+/*
+ * Asynchronous transfer jobs.
+ *
+ * HTTP handlers only validate a request and queue a job; a dedicated task
+ * works through the queue one job at a time and copies each file with the
+ * copy engine. Jobs stay in a small table after they finish so clients can
+ * collect per-file results, and are recycled oldest-first.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "transfer_queue.h"
+#include "metrics.h"
+
+#define TRANSFER_JOB_SLOTS (TRANSFER_QUEUE_DEPTH + 1 + TRANSFER_JOB_HISTORY)
+
+static const char *TAG = "transfer_queue";
+
+typedef struct {
+    const char *name;               // Points into transfer_job_t.names
+    transfer_file_state_t state;
+    char *error;                    // Only allocated for failed files
+} transfer_file_t;
+
+typedef struct {
+    uint32_t id;
+    transfer_volume_t source;
+    transfer_volume_t destination;
+    transfer_job_state_t state;
+    bool cancel_requested;
+    uint32_t flags;
+    size_t file_count;
+    size_t files_done;
+    size_t files_skipped;
+    size_t files_failed;
+    transfer_file_t *files;
+    char *names;                    // All filenames, NUL separated
+} transfer_job_t;
+
+static transfer_queue_config_t g_config;
+static QueueHandle_t g_job_queue = NULL;
+static SemaphoreHandle_t g_lock = NULL;
+static transfer_job_t *g_jobs[TRANSFER_JOB_SLOTS];
+static uint32_t g_next_job_id = 1;
+
+// Written by the copy engine while a file is in flight
+static transfer_progress_t g_progress = { .active = false };
+static volatile bool g_cancel = false;
+
+static const char *volume_name(transfer_volume_t volume) {
+    return volume == TRANSFER_VOLUME_SD ? "sd" : "usb";
+}
+
+static const char *volume_root(transfer_volume_t volume) {
+    return volume == TRANSFER_VOLUME_SD ? g_config.sd_root : g_config.usb_root;
+}
+
+const char *transfer_job_state_name(transfer_job_state_t state) {
+    switch (state) {
+        case TRANSFER_JOB_QUEUED:    return "queued";
+        case TRANSFER_JOB_RUNNING:   return "running";
+        case TRANSFER_JOB_DONE:      return "done";
+        case TRANSFER_JOB_FAILED:    return "failed";
+        case TRANSFER_JOB_CANCELLED: return "cancelled";
+        default:                     return "unknown";
+    }
+}
+
+static const char *file_state_name(transfer_file_state_t state) {
+    switch (state) {
+        case TRANSFER_FILE_PENDING:   return "pending";
+        case TRANSFER_FILE_COPYING:   return "copying";
+        case TRANSFER_FILE_DONE:      return "done";
+        case TRANSFER_FILE_FAILED:    return "failed";
+        case TRANSFER_FILE_CANCELLED: return "cancelled";
+        case TRANSFER_FILE_SKIPPED:   return "skipped";
+        default:                      return "unknown";
+    }
+}
+
+static bool job_is_finished(const transfer_job_t *job) {
+    return job->state != TRANSFER_JOB_QUEUED && job->state != TRANSFER_JOB_RUNNING;
+}
+
+bool transfer_queue_is_valid_filename(const char *name) {
+    size_t len = strlen(name);
+    return len > 0 && len < 200 &&
+           strchr(name, '/') == NULL && strchr(name, '\\') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+static void free_job(transfer_job_t *job) {
+    if (!job) {
+        return;
+    }
+    for (size_t i = 0; i < job->file_count; i++) {
+        free(job->files[i].error);
+    }
+    free(job->files);
+    free(job->names);
+    free(job);
+}
+
+static transfer_job_t *find_job(uint32_t job_id) {
+    for (int i = 0; i < TRANSFER_JOB_SLOTS; i++) {
+        if (g_jobs[i] && g_jobs[i]->id == job_id) {
+            return g_jobs[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns a free slot index, recycling the oldest finished job if needed.
+// Must be called with the lock held.
+static int claim_slot(void) {
+    int oldest = -1;
+    for (int i = 0; i < TRANSFER_JOB_SLOTS; i++) {
+        if (!g_jobs[i]) {
+            return i;
+        }
+        if (job_is_finished(g_jobs[i]) && (oldest < 0 || g_jobs[i]->id < g_jobs[oldest]->id)) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0) {
+        free_job(g_jobs[oldest]);
+        g_jobs[oldest] = NULL;
+    }
+    return oldest;
+}
+
+static void fill_info(const transfer_job_t *job, transfer_job_info_t *info) {
+    info->id = job->id;
+    info->source = job->source;
+    info->destination = job->destination;
+    info->state = job->state;
+    info->file_count = job->file_count;
+    info->files_done = job->files_done;
+    info->files_skipped = job->files_skipped;
+    info->files_failed = job->files_failed;
+}
+
+// --- Transfer Task ---
+static void run_job(transfer_job_t *job) {
+    transfer_job_info_t info;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    job->state = TRANSFER_JOB_RUNNING;
+    g_cancel = false;
+    memset(&g_progress, 0, sizeof(g_progress));
+    g_progress.active = true;
+    g_progress.job_id = job->id;
+    g_progress.file_count = job->file_count;
+    fill_info(job, &info);
+    xSemaphoreGive(g_lock);
+
+    ESP_LOGI(TAG, "Job %u started: %u file(s) %s -> %s", (unsigned)job->id, (unsigned)job->file_count,
+             volume_name(job->source), volume_name(job->destination));
+    if (g_config.on_job_started) g_config.on_job_started(&info);
+
+    copy_engine_config_t copy_config = g_config.copy_config;
+    if (job->flags & TRANSFER_FLAG_VERIFY) {
+        copy_config.verify = true;
+    }
+    if (job->flags & TRANSFER_FLAG_OVERWRITE) {
+        copy_config.skip_identical = false;
+        copy_config.resume = false;
+    }
+    // One ring for the whole job; the engine allocates per file if this fails
+    copy_engine_alloc_buffer(&copy_config);
+
+    // Batches run long enough that scans, thumbnails and the USB client
+    // tasks sharing this core should wait for them
+    bool boosted = job->file_count > 1 && g_config.batch_priority > g_config.task_priority;
+    if (boosted) {
+        vTaskPrioritySet(NULL, g_config.batch_priority);
+    }
+
+    for (size_t i = 0; i < job->file_count; i++) {
+        transfer_file_t *file = &job->files[i];
+
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        if (job->cancel_requested) {
+            for (size_t j = i; j < job->file_count; j++) {
+                job->files[j].state = TRANSFER_FILE_CANCELLED;
+            }
+            xSemaphoreGive(g_lock);
+            break;
+        }
+        file->state = TRANSFER_FILE_COPYING;
+        g_progress.file_index = i;
+        strlcpy(g_progress.filename, file->name, sizeof(g_progress.filename));
+        g_progress.bytes_transferred = 0;
+        g_progress.total_bytes = 0;
+        g_progress.success = false;
+        g_progress.skipped = false;
+        g_progress.error_msg[0] = '\0';
+        xSemaphoreGive(g_lock);
+
+        char source_name[128];
+        if (!g_config.resolve_source ||
+            !g_config.resolve_source(job->source, file->name, source_name, sizeof(source_name))) {
+            strlcpy(source_name, file->name, sizeof(source_name));
+        }
+        char source_path[256];
+        char dest_path[256];
+        snprintf(source_path, sizeof(source_path), "%s/%s", volume_root(job->source), source_name);
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", volume_root(job->destination), file->name);
+
+        int64_t started = esp_timer_get_time();
+        esp_err_t res;
+        bool held_elsewhere = !(job->flags & TRANSFER_FLAG_OVERWRITE) && g_config.has_content &&
+                              g_config.has_content(&info, file->name);
+        if (held_elsewhere) {
+            ESP_LOGI(TAG, "%s is already on %s, skipping", file->name, volume_name(job->destination));
+            g_progress.skipped = true;
+            g_progress.success = true;
+            res = ESP_OK;
+        } else {
+            res = copy_engine_copy(source_path, dest_path, &copy_config, &g_progress, &g_cancel);
+        }
+        if (res == ESP_OK && !g_progress.skipped) {
+            metrics_count_transfer(g_progress.bytes_transferred - g_progress.resumed_from,
+                                   esp_timer_get_time() - started);
+        }
+
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        if (res == ESP_OK && g_progress.skipped) {
+            file->state = TRANSFER_FILE_SKIPPED;
+            job->files_done++;
+            job->files_skipped++;
+        } else if (res == ESP_OK) {
+            file->state = TRANSFER_FILE_DONE;
+            job->files_done++;
+        } else if (g_cancel) {
+            file->state = TRANSFER_FILE_CANCELLED;
+        } else {
+            file->state = TRANSFER_FILE_FAILED;
+            file->error = strdup(g_progress.error_msg);
+            job->files_failed++;
+        }
+        g_progress.files_done = job->files_done;
+        g_progress.files_failed = job->files_failed;
+        fill_info(job, &info);
+        xSemaphoreGive(g_lock);
+
+        if (held_elsewhere) {
+            if (g_config.on_file_skipped) g_config.on_file_skipped(&info, file->name);
+        } else if (g_config.on_file_finished) {
+            g_config.on_file_finished(&info, file->name, res);
+        }
+    }
+    copy_engine_free_buffer(&copy_config);
+    if (boosted) {
+        vTaskPrioritySet(NULL, g_config.task_priority);
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (job->cancel_requested) {
+        job->state = TRANSFER_JOB_CANCELLED;
+    } else {
+        job->state = job->files_failed ? TRANSFER_JOB_FAILED : TRANSFER_JOB_DONE;
+    }
+    g_progress.active = false;
+    g_progress.success = job->state == TRANSFER_JOB_DONE;
+    fill_info(job, &info);
+    xSemaphoreGive(g_lock);
+
+    ESP_LOGI(TAG, "Job %u %s: %u done (%u skipped), %u failed", (unsigned)job->id,
+             transfer_job_state_name(info.state), (unsigned)info.files_done, (unsigned)info.files_skipped,
+             (unsigned)info.files_failed);
+    if (g_config.on_job_finished) g_config.on_job_finished(&info);
+}
+
+static void transfer_task(void *arg) {
+    uint32_t job_id;
+    while (1) {
+        if (xQueueReceive(g_job_queue, &job_id, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        // The queue carries IDs rather than pointers: a job cancelled while
+        // still queued counts as finished and its slot may already be reused.
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        transfer_job_t *job = find_job(job_id);
+        bool runnable = job && job->state == TRANSFER_JOB_QUEUED;
+        xSemaphoreGive(g_lock);
+        if (runnable) {
+            run_job(job);
+        }
+    }
+}
+
+// --- Public API ---
+esp_err_t transfer_queue_init(const transfer_queue_config_t *config) {
+    if (g_job_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    g_config = *config;
+    g_lock = xSemaphoreCreateMutex();
+    g_job_queue = xQueueCreate(TRANSFER_QUEUE_DEPTH, sizeof(uint32_t));
+    if (!g_lock || !g_job_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(transfer_task, "transfer_task", g_config.task_stack_size, NULL,
+                                g_config.task_priority, NULL, g_config.core_id) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t transfer_queue_submit(transfer_volume_t source, transfer_volume_t destination,
+                                const char *const *files, size_t count, uint32_t flags, uint32_t *job_id) {
+    if (!g_job_queue || count == 0 || count > TRANSFER_BATCH_MAX_FILES || source == destination) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Pack all names into one allocation
+    size_t names_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!files[i] || !transfer_queue_is_valid_filename(files[i])) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        names_len += strlen(files[i]) + 1;
+    }
+
+    transfer_job_t *job = calloc(1, sizeof(transfer_job_t));
+    if (job) {
+        job->files = calloc(count, sizeof(transfer_file_t));
+        job->names = malloc(names_len);
+    }
+    if (!job || !job->files || !job->names) {
+        free_job(job);
+        return ESP_ERR_NO_MEM;
+    }
+
+    char *p = job->names;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(files[i]) + 1;
+        memcpy(p, files[i], len);
+        job->files[i].name = p;
+        job->files[i].state = TRANSFER_FILE_PENDING;
+        p += len;
+    }
+    job->file_count = count;
+    job->source = source;
+    job->destination = destination;
+    job->flags = flags;
+    job->state = TRANSFER_JOB_QUEUED;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    int slot = claim_slot();
+    if (slot < 0) {
+        xSemaphoreGive(g_lock);
+        free_job(job);
+        return ESP_ERR_NO_MEM;
+    }
+    job->id = g_next_job_id++;
+    g_jobs[slot] = job;
+    if (xQueueSend(g_job_queue, &job->id, 0) != pdTRUE) {
+        g_jobs[slot] = NULL;
+        xSemaphoreGive(g_lock);
+        free_job(job);
+        return ESP_ERR_NO_MEM;
+    }
+    if (job_id) *job_id = job->id;
+    xSemaphoreGive(g_lock);
+
+    ESP_LOGI(TAG, "Queued job %u with %u file(s)", (unsigned)job->id, (unsigned)count);
+    return ESP_OK;
+}
+
+esp_err_t transfer_queue_cancel(uint32_t job_id) {
+    if (!g_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (job_id == 0) {
+        job_id = g_progress.active ? g_progress.job_id : 0;
+    }
+    transfer_job_t *job = job_id ? find_job(job_id) : NULL;
+    if (job && !job_is_finished(job)) {
+        job->cancel_requested = true;
+        if (job->state == TRANSFER_JOB_QUEUED) {
+            job->state = TRANSFER_JOB_CANCELLED;
+            for (size_t i = 0; i < job->file_count; i++) {
+                job->files[i].state = TRANSFER_FILE_CANCELLED;
+            }
+        } else {
+            // Stops the copy engine at its next block
+            g_cancel = true;
+        }
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(g_lock);
+    return ret;
+}
+
+esp_err_t transfer_queue_release_volume(transfer_volume_t volume) {
+    if (!g_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t running = 0;
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    for (int i = 0; i < TRANSFER_JOB_SLOTS; i++) {
+        transfer_job_t *job = g_jobs[i];
+        if (!job || job_is_finished(job) || (job->source != volume && job->destination != volume)) {
+            continue;
+        }
+        job->cancel_requested = true;
+        if (job->state == TRANSFER_JOB_QUEUED) {
+            job->state = TRANSFER_JOB_CANCELLED;
+            for (size_t j = 0; j < job->file_count; j++) {
+                job->files[j].state = TRANSFER_FILE_CANCELLED;
+            }
+        } else {
+            g_cancel = true;
+            running = job->id;
+        }
+    }
+    xSemaphoreGive(g_lock);
+    if (running) {
+        ESP_LOGI(TAG, "Cancelled job %u, it uses %s", (unsigned)running, volume_name(volume));
+    }
+
+    // The running job is finished once run_job() has left its file loop
+    TickType_t start = xTaskGetTickCount();
+    while (running) {
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        transfer_job_t *job = find_job(running);
+        bool stopped = !job || job_is_finished(job);
+        xSemaphoreGive(g_lock);
+        if (stopped) {
+            break;
+        }
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(TRANSFER_RELEASE_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "Job %u still running after %d ms", (unsigned)running, TRANSFER_RELEASE_TIMEOUT_MS);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return ESP_OK;
+}
+
+void transfer_queue_get_progress(transfer_progress_t *out) {
+    if (!g_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    *out = g_progress;
+    xSemaphoreGive(g_lock);
+}
+
+size_t transfer_queue_pending(void) {
+    return g_job_queue ? uxQueueMessagesWaiting(g_job_queue) : 0;
+}
+
+// Copies a job, with its file names and errors, into a single allocation.
+// Must be called with g_lock held.
+static transfer_job_t *snapshot_job(const transfer_job_t *job) {
+    size_t strings = 0;
+    for (size_t i = 0; i < job->file_count; i++) {
+        strings += strlen(job->files[i].name) + 1;
+        if (job->files[i].error) {
+            strings += strlen(job->files[i].error) + 1;
+        }
+    }
+    transfer_job_t *copy = malloc(sizeof(*copy) + job->file_count * sizeof(transfer_file_t) + strings);
+    if (!copy) {
+        return NULL;
+    }
+    *copy = *job;
+    copy->files = (transfer_file_t *)(copy + 1);
+    copy->names = (char *)(copy->files + job->file_count);
+    char *p = copy->names;
+    for (size_t i = 0; i < job->file_count; i++) {
+        const transfer_file_t *file = &job->files[i];
+        size_t len = strlen(file->name) + 1;
+        copy->files[i] = (transfer_file_t){ .name = memcpy(p, file->name, len), .state = file->state };
+        p += len;
+        if (file->error) {
+            len = strlen(file->error) + 1;
+            copy->files[i].error = memcpy(p, file->error, len);
+            p += len;
+        }
+    }
+    return copy;
+}
+
+esp_err_t transfer_queue_render_job(uint32_t job_id, json_stream_t *js) {
+    if (!g_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // json_stream flushes to the socket as it fills, and a slow client must
+    // not hold up the transfer task, so the job is rendered from a copy
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    transfer_job_t *found = find_job(job_id);
+    transfer_job_t *job = found ? snapshot_job(found) : NULL;
+    xSemaphoreGive(g_lock);
+    if (!job) {
+        return found ? ESP_ERR_NO_MEM : ESP_ERR_NOT_FOUND;
+    }
+
+    json_stream_begin_object(js);
+    json_stream_int(js, "id", job->id);
+    json_stream_string(js, "state", transfer_job_state_name(job->state));
+    json_stream_string(js, "source", volume_name(job->source));
+    json_stream_string(js, "destination", volume_name(job->destination));
+    json_stream_int(js, "file_count", job->file_count);
+    json_stream_int(js, "files_done", job->files_done);
+    json_stream_int(js, "files_skipped", job->files_skipped);
+    json_stream_int(js, "files_failed", job->files_failed);
+    json_stream_key(js, "files");
+    json_stream_begin_array(js);
+    for (size_t i = 0; i < job->file_count; i++) {
+        json_stream_begin_object(js);
+        json_stream_string(js, "name", job->files[i].name);
+        json_stream_string(js, "state", file_state_name(job->files[i].state));
+        if (job->files[i].error) {
+            json_stream_string(js, "error", job->files[i].error);
+        }
+        json_stream_end_object(js);
+    }
+    json_stream_end_array(js);
+    json_stream_end_object(js);
+    free(job);
+    return ESP_OK;
+}
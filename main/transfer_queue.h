@@ -0,0 +1,123 @@
+#ifndef TRANSFER_QUEUE_H
+#define TRANSFER_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "copy_engine.h"
+#include "json_stream.h"
+
+// Most files accepted in a single batch job
+#define TRANSFER_BATCH_MAX_FILES 100
+// Jobs that may wait in the queue behind the running one
+#define TRANSFER_QUEUE_DEPTH     8
+// Finished jobs kept around so clients can fetch their results
+#define TRANSFER_JOB_HISTORY     4
+// How long transfer_queue_release_volume() waits for the running job to stop.
+// The copy engine checks for a cancel between blocks.
+#define TRANSFER_RELEASE_TIMEOUT_MS 3000
+
+typedef enum {
+    TRANSFER_VOLUME_SD,
+    TRANSFER_VOLUME_USB,
+} transfer_volume_t;
+
+typedef enum {
+    TRANSFER_JOB_QUEUED,
+    TRANSFER_JOB_RUNNING,
+    TRANSFER_JOB_DONE,        // Every file copied
+    TRANSFER_JOB_FAILED,      // At least one file failed
+    TRANSFER_JOB_CANCELLED,
+} transfer_job_state_t;
+
+typedef enum {
+    TRANSFER_FILE_PENDING,
+    TRANSFER_FILE_COPYING,
+    TRANSFER_FILE_DONE,
+    TRANSFER_FILE_FAILED,
+    TRANSFER_FILE_CANCELLED,
+    TRANSFER_FILE_SKIPPED,    // Destination already identical
+} transfer_file_state_t;
+
+// Per-job options for transfer_queue_submit()
+#define TRANSFER_FLAG_VERIFY    (1u << 0)   // CRC-check every copied file
+#define TRANSFER_FLAG_OVERWRITE (1u << 1)   // Copy in full even if the destination looks identical or partial
+
+// Summary handed to the job callbacks. Only valid for the duration of the call.
+typedef struct {
+    uint32_t id;
+    transfer_volume_t source;
+    transfer_volume_t destination;
+    transfer_job_state_t state;
+    size_t file_count;
+    size_t files_done;        // Includes skipped files
+    size_t files_skipped;
+    size_t files_failed;
+} transfer_job_info_t;
+
+typedef struct {
+    const char *sd_root;
+    const char *usb_root;
+    copy_engine_config_t copy_config;
+    uint32_t task_stack_size;
+    int task_priority;
+    // Core the transfer task (and its copy writers) is pinned to, or tskNO_AFFINITY
+    BaseType_t core_id;
+    // Priority while a job of more than one file runs, so a batch keeps the
+    // card ahead of other work on its core. 0 leaves task_priority in place.
+    int batch_priority;
+    // All callbacks run on the transfer task and are optional
+    void (*on_job_started)(const transfer_job_info_t *job);
+    void (*on_job_finished)(const transfer_job_info_t *job);
+    void (*on_file_finished)(const transfer_job_info_t *job, const char *filename, esp_err_t result);
+    // Called instead of on_file_finished for a file has_content() skipped:
+    // nothing was written to the destination under `filename`.
+    void (*on_file_skipped)(const transfer_job_info_t *job, const char *filename);
+    // Asked before each file of a job without TRANSFER_FLAG_OVERWRITE. Returning
+    // true means the destination already has this content under some name,
+    // and the file is skipped. Optional.
+    bool (*has_content)(const transfer_job_info_t *job, const char *filename);
+    // Maps a requested filename to the file on `source` that holds its content,
+    // e.g. the file a catalog alias was merged into. Returns false to use the
+    // name as it is. Optional.
+    bool (*resolve_source)(transfer_volume_t source, const char *filename, char *file, size_t file_size);
+} transfer_queue_config_t;
+
+// Starts the transfer task. Must be called once before any other function.
+esp_err_t transfer_queue_init(const transfer_queue_config_t *config);
+
+// Queues a copy of `count` files from `source` to `destination` and returns
+// immediately. Filenames must be plain names inside the volume root. `flags`
+// is a mask of TRANSFER_FLAG_* adjusting `copy_config` for this job.
+// Returns ESP_ERR_INVALID_ARG for bad names, ESP_ERR_NO_MEM if the queue is full.
+esp_err_t transfer_queue_submit(transfer_volume_t source, transfer_volume_t destination,
+                                const char *const *files, size_t count, uint32_t flags, uint32_t *job_id);
+
+// Cancels a queued or running job. `job_id` 0 means the running job.
+esp_err_t transfer_queue_cancel(uint32_t job_id);
+
+// Cancels every queued or running job that reads or writes `volume` and waits
+// until the running one has closed its files. Must be called before the
+// volume is unmounted. Returns ESP_ERR_TIMEOUT if the job has not stopped
+// within TRANSFER_RELEASE_TIMEOUT_MS.
+esp_err_t transfer_queue_release_volume(transfer_volume_t volume);
+
+// Copies the progress of the running job (or the idle state) into `out`.
+void transfer_queue_get_progress(transfer_progress_t *out);
+
+// Number of jobs waiting to run, not counting the active one.
+size_t transfer_queue_pending(void);
+
+// Writes a JSON object describing the job and each of its files. The job is
+// copied under the queue's lock and streamed after it is released.
+// Returns ESP_ERR_NOT_FOUND if the job is unknown or has been forgotten.
+esp_err_t transfer_queue_render_job(uint32_t job_id, json_stream_t *js);
+
+const char *transfer_job_state_name(transfer_job_state_t state);
+
+// True if `name` is a plain filename that cannot escape a volume root.
+bool transfer_queue_is_valid_filename(const char *name);
+
+#endif // TRANSFER_QUEUE_H
@@ -0,0 +1,62 @@
+/*
+ * Volume claims shared by the scanner and the thumbnail task.
+ *
+ * Claim and release both happen under the guard's lock, together with the
+ * cancel flag, so volume_guard_cancel() knows whether it has to wait for a
+ * release and a cancel can never slip in between a claim and the task
+ * opening its first file.
+ */
+
+#include "volume_guard.h"
+
+esp_err_t volume_guard_init(volume_guard_t *guard) {
+    guard->claimed = NULL;
+    guard->cancel_waiting = false;
+    guard->released = xSemaphoreCreateBinary();
+    return guard->released ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+bool volume_guard_claim(volume_guard_t *guard, volatile bool *cancel) {
+    portENTER_CRITICAL(&guard->lock);
+    bool claimed = !*cancel;
+    if (claimed) {
+        guard->claimed = cancel;
+    }
+    portEXIT_CRITICAL(&guard->lock);
+    return claimed;
+}
+
+void volume_guard_release(volume_guard_t *guard, volatile bool *cancel) {
+    portENTER_CRITICAL(&guard->lock);
+    guard->claimed = NULL;
+    bool wake = *cancel && guard->cancel_waiting;
+    portEXIT_CRITICAL(&guard->lock);
+    if (wake) {
+        xSemaphoreGive(guard->released);
+    }
+}
+
+esp_err_t volume_guard_cancel(volume_guard_t *guard, volatile bool *cancel, uint32_t timeout_ms) {
+    // Drop a release left over from a cancel that timed out
+    xSemaphoreTake(guard->released, 0);
+    portENTER_CRITICAL(&guard->lock);
+    *cancel = true;
+    bool wait = guard->claimed == cancel;
+    guard->cancel_waiting = wait;
+    portEXIT_CRITICAL(&guard->lock);
+
+    esp_err_t ret = ESP_OK;
+    if (wait && xSemaphoreTake(guard->released, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        ret = ESP_ERR_TIMEOUT;
+    }
+    portENTER_CRITICAL(&guard->lock);
+    guard->cancel_waiting = false;
+    portEXIT_CRITICAL(&guard->lock);
+    return ret;
+}
+
+void volume_guard_resume(volume_guard_t *guard, volatile bool *cancel) {
+    portENTER_CRITICAL(&guard->lock);
+    *cancel = false;
+    portEXIT_CRITICAL(&guard->lock);
+}
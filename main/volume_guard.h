@@ -0,0 +1,46 @@
+#ifndef VOLUME_GUARD_H
+#define VOLUME_GUARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// --- Volume claims for background tasks ---
+// A background task claims a volume before it opens anything on it and
+// releases it once everything is closed again. Cancelling a volume before it
+// is unmounted stops further claims and waits for the current one to be
+// released, so the unmount never pulls files out from under the task.
+//
+// Each volume is identified by its cancel flag, which the task also polls to
+// abandon its work early. One guard serves one task; that task holds at most
+// one claim at a time.
+typedef struct {
+    portMUX_TYPE lock;          // Guards claimed, cancel_waiting and the cancel flags
+    volatile bool *claimed;     // Cancel flag of the claimed volume, NULL if none
+    bool cancel_waiting;
+    SemaphoreHandle_t released; // Given on the release a cancel waits for
+} volume_guard_t;
+
+#define VOLUME_GUARD_INITIALIZER { .lock = portMUX_INITIALIZER_UNLOCKED }
+
+// Creates the guard's semaphore. Call once, before the task starts.
+esp_err_t volume_guard_init(volume_guard_t *guard);
+
+// Marks the volume as in use, unless it has been cancelled. Returns whether
+// the task may go ahead.
+bool volume_guard_claim(volume_guard_t *guard, volatile bool *cancel);
+
+// Called by the task once nothing is open on the volume any more.
+void volume_guard_release(volume_guard_t *guard, volatile bool *cancel);
+
+// Sets the volume's cancel flag and, if the task holds the volume, blocks
+// until it is released. Returns ESP_ERR_TIMEOUT if that took longer than
+// `timeout_ms`; the flag stays set either way.
+esp_err_t volume_guard_cancel(volume_guard_t *guard, volatile bool *cancel, uint32_t timeout_ms);
+
+// Clears the cancel flag so the volume can be claimed again.
+void volume_guard_resume(volume_guard_t *guard, volatile bool *cancel);
+
+#endif // VOLUME_GUARD_H
@@ -0,0 +1,55 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "web_assets.h"
+
+static const char *TAG = "web_assets";
+
+// Longest If-None-Match value we compare; longer headers simply miss the cache
+#define WEB_ASSETS_IF_NONE_MATCH_MAX 64
+
+static const web_asset_t *find_asset(const char *uri) {
+    if (strcmp(uri, "/") == 0) {
+        uri = "/index.html";
+    }
+    // Ignore any query string
+    size_t len = strcspn(uri, "?");
+    for (size_t i = 0; i < web_assets_count; i++) {
+        const web_asset_t *asset = &web_assets_table[i];
+        if (strlen(asset->uri) == len && strncmp(asset->uri, uri, len) == 0) {
+            return asset;
+        }
+    }
+    return NULL;
+}
+
+static bool etag_matches(httpd_req_t *req, const web_asset_t *asset) {
+    char value[WEB_ASSETS_IF_NONE_MATCH_MAX];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strstr(value, asset->etag) != NULL;
+}
+
+esp_err_t web_assets_serve(httpd_req_t *req) {
+    const web_asset_t *asset = find_asset(req->uri);
+    if (!asset) {
+        ESP_LOGW(TAG, "Asset not found: %s", req->uri);
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+    if (etag_matches(req, asset)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // Every asset is stored pre-compressed; all browsers we target accept gzip.
+    // The payload is sent straight from memory-mapped flash in one response.
+    httpd_resp_set_type(req, asset->mime);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->data, asset->size);
+}
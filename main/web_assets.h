@@ -0,0 +1,27 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// One pre-compressed file of the web UI. The table is generated at build time
+// by tools/pack_web_assets.py and lives in flash alongside the code.
+typedef struct {
+    const char *uri;
+    const char *mime;
+    const char *etag;           // Includes the surrounding quotes
+    const char *cache_control;
+    const uint8_t *data;        // gzip-compressed payload
+    size_t size;
+} web_asset_t;
+
+extern const web_asset_t web_assets_table[];
+extern const size_t web_assets_count;
+
+// Serves the asset for req->uri ("/" maps to /index.html) with its ETag.
+// A matching If-None-Match gets 304.
+esp_err_t web_assets_serve(httpd_req_t *req);
+
+#endif // WEB_ASSETS_H
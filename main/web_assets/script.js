@@ -1,19 +1,47 @@
 const { createApp } = Vue
 
+// Also the largest page /search will return
+const PAGE_SIZE = 50;
+const SCROLL_LOAD_THRESHOLD_PX = 200;
+const EVENT_RECONNECT_MS = 3000;
+
 createApp({
     data() {
         return {
             localFiles: [],
             ereaderFiles: [],
+            // Paging state for each listing, keyed by the /list-files type
+            pages: {
+                sd: { total: 0, loading: false, generation: 0 },
+                usb: { total: 0, loading: false, generation: 0 },
+            },
+            searchQuery: '',
+            sortKey: 'title',
+            searchDebounce: null,
             isEReaderConnected: false,
+            storage: 'indexing', // indexing, ready, unavailable
             status: 'idle', // idle, connected, transferring
             transfer: {
                 active: false,
+                jobId: 0,
                 filename: '',
                 progress: 0,
+                fileIndex: 0,
+                fileCount: 0,
+                queued: 0,
                 error: ''
             },
+            // Jobs submitted from this page whose results have not been reported yet
+            submittedJobs: [],
+            upload: { active: false, progress: 0 },
+            importProgress: null,
+            scanningVolume: null,
+            selectedFiles: [],
+            checkingJobs: false,
+            lastRunningJob: 0,
             pollingInterval: null,
+            eventSocket: null,
+            reconnectTimer: null,
         }
     },
     computed: {
@@ -27,60 +55,219 @@ createApp({
         async fetchData() {
             try {
                 const response = await fetch('/status');
-                const data = await response.json();
-                this.isEReaderConnected = data.reader_connected;
-                if (data.transfer_active) {
-                    this.transfer.active = true;
-                    this.transfer.filename = data.filename;
-                    this.transfer.progress = data.total_bytes > 0 ? (data.bytes_transferred / data.total_bytes) * 100 : 0;
-                } else {
-                    if (this.transfer.active) {
-                        // Transfer just finished, refresh file lists
-                        this.fetchFileLists();
-                    }
-                    this.transfer.active = false;
-                }
+                this.applyStatus(await response.json());
             } catch (error) {
                 console.error('Error fetching status:', error);
             }
         },
-        async fetchFileLists() {
+        // Applies a /status document, whether polled or pushed over /ws.
+        applyStatus(data) {
+            const wasIndexing = this.storage === 'indexing';
+            this.storage = data.storage || 'ready';
+            if (wasIndexing && this.storage !== 'indexing') {
+                // The card finished mounting; listings asked for earlier got a 503
+                this.fetchFileLists();
+            }
+            this.isEReaderConnected = data.reader_connected;
+            this.transfer.queued = data.queued_jobs || 0;
+            const wasImporting = this.importProgress !== null;
+            this.importProgress = data.import || null;
+            if (wasImporting && !this.importProgress) {
+                // Calibre titles and authors have just been applied
+                this.resetList('usb');
+            }
+            const wasScanning = this.scanningVolume;
+            this.scanningVolume = data.scanning || null;
+            if (data.event === 'scan') {
+                // The scanner found new, changed or deleted books
+                this.resetList(data.scanned);
+            } else if (data.event === 'covers') {
+                // New thumbnails were generated in the background
+                this.resetList(data.covers);
+            } else if (wasScanning && wasScanning !== this.scanningVolume) {
+                this.resetList(wasScanning);
+            }
+            const runningJob = data.transfer_active ? data.job_id : 0;
+            if (data.transfer_active) {
+                this.transfer.active = true;
+                this.transfer.jobId = data.job_id;
+                this.transfer.filename = data.filename;
+                this.transfer.fileIndex = data.file_index;
+                this.transfer.fileCount = data.file_count;
+                this.transfer.progress = data.total_bytes > 0 ? (data.bytes_transferred / data.total_bytes) * 100 : 0;
+            } else {
+                if (this.transfer.active) {
+                    // Transfer just finished, refresh file lists
+                    this.fetchFileLists();
+                }
+                this.transfer.active = false;
+                this.transfer.jobId = 0;
+            }
+            // Job results only change when a job ends, so skip the lookups otherwise
+            if (data.event === 'job' || runningJob !== this.lastRunningJob) {
+                this.checkFinishedJobs(runningJob);
+            }
+            this.lastRunningJob = runningJob;
+        },
+        // Opens the push channel. While it is up the status poll is stopped;
+        // if it drops we poll until a reconnect succeeds.
+        connectEvents() {
+            const ws = new WebSocket(`ws://${location.host}/ws`);
+            ws.onopen = () => {
+                this.stopPolling();
+                this.fetchData();
+            };
+            ws.onmessage = (message) => {
+                const data = JSON.parse(message.data);
+                const wasConnected = this.isEReaderConnected;
+                this.applyStatus(data);
+                if (data.event === 'status' && wasConnected !== this.isEReaderConnected) {
+                    this.fetchFileLists();
+                }
+            };
+            ws.onclose = () => {
+                this.eventSocket = null;
+                this.startPolling();
+                this.reconnectTimer = setTimeout(() => this.connectEvents(), EVENT_RECONNECT_MS);
+            };
+            this.eventSocket = ws;
+        },
+        startPolling() {
+            if (!this.pollingInterval) {
+                this.pollingInterval = setInterval(this.fetchData, 1000);
+            }
+        },
+        stopPolling() {
+            clearInterval(this.pollingInterval);
+            this.pollingInterval = null;
+        },
+        // Reports the outcome of any submitted job that is no longer queued or running.
+        async checkFinishedJobs(runningJob) {
+            if (this.checkingJobs) return;
+            this.checkingJobs = true;
+            for (const jobId of [...this.submittedJobs]) {
+                if (jobId === runningJob) continue;
+                try {
+                    const response = await fetch('/transfer-status?job=' + jobId);
+                    if (!response.ok) {
+                        this.forgetJob(jobId);
+                        continue;
+                    }
+                    const job = await response.json();
+                    if (job.state === 'queued' || job.state === 'running') continue;
+                    this.forgetJob(jobId);
+                    const failed = job.files.filter(f => f.state === 'failed');
+                    if (failed.length > 0) {
+                        this.transfer.error = failed.map(f => `${f.name}: ${f.error}`).join('; ');
+                    }
+                    this.fetchFileLists();
+                } catch (error) {
+                    console.error('Error fetching job status:', error);
+                }
+            }
+            this.checkingJobs = false;
+        },
+        forgetJob(jobId) {
+            const index = this.submittedJobs.indexOf(jobId);
+            if (index >= 0) this.submittedJobs.splice(index, 1);
+        },
+        filesFor(type) {
+            return type === 'sd' ? this.localFiles : this.ereaderFiles;
+        },
+        // Fetches the next page of a listing and appends it.
+        async loadPage(type) {
+            const page = this.pages[type];
+            const files = this.filesFor(type);
+            if (page.loading || (files.length > 0 && files.length >= page.total)) return;
+
+            page.loading = true;
+            const generation = page.generation;
+            const params = new URLSearchParams({
+                type,
+                limit: PAGE_SIZE,
+            });
+            // With a query the list shows ranked full-text matches instead.
+            // Listings continue after the last row shown; ranked results have
+            // no such order, so search pages by position.
+            let url = '/list-files?';
+            if (this.searchQuery) {
+                url = '/search?';
+                params.set('q', this.searchQuery);
+                params.set('offset', files.length);
+            } else {
+                params.set('sort', this.sortKey);
+                if (files.length > 0) params.set('after', files[files.length - 1].name);
+            }
+
             try {
-                const [localRes, ereaderRes] = await Promise.all([
-                    fetch('/list-files?type=sd'),
-                    fetch('/list-files?type=usb')
-                ]);
-                this.localFiles = await localRes.json();
-                this.ereaderFiles = await ereaderRes.json();
+                const response = await fetch(url + params.toString());
+                // The row this page continues after is gone, so the list is stale
+                if (response.status === 404 && params.has('after')) {
+                    if (generation === page.generation) this.resetList(type);
+                    return;
+                }
+                // 503 while the library is indexing; reloaded once /status says it is ready
+                if (!response.ok) return;
+                const items = await response.json();
+                // Drop the result if the list was reset while we were waiting
+                if (generation !== page.generation) return;
+                page.total = parseInt(response.headers.get('X-Total-Count') || items.length, 10);
+                files.push(...items);
             } catch (error) {
-                console.error('Error fetching file lists:', error);
+                console.error('Error fetching file list:', error);
+            } finally {
+                if (generation === page.generation) page.loading = false;
             }
         },
-        async performTransfer(source, destination, filename) {
-            if (this.transfer.active) return;
-
-            this.transfer.active = true;
-            this.transfer.filename = filename;
-            this.transfer.progress = 0;
+        // Clears a listing and loads its first page again.
+        resetList(type) {
+            const page = this.pages[type];
+            page.generation++;
+            page.total = 0;
+            page.loading = false;
+            this.filesFor(type).splice(0);
+            return this.loadPage(type);
+        },
+        async fetchFileLists() {
+            await Promise.all([this.resetList('sd'), this.resetList('usb')]);
+        },
+        onListScroll(type, event) {
+            const el = event.target;
+            if (el.scrollTop + el.clientHeight >= el.scrollHeight - SCROLL_LOAD_THRESHOLD_PX) {
+                this.loadPage(type);
+            }
+        },
+        onSearchInput() {
+            clearTimeout(this.searchDebounce);
+            this.searchDebounce = setTimeout(() => this.fetchFileLists(), 300);
+        },
+        async submitTransfer(url, payload) {
             this.transfer.error = '';
-
             try {
-                const response = await fetch('/transfer-file', {
+                const response = await fetch(url, {
                     method: 'POST',
                     headers: { 'Content-Type': 'application/json' },
-                    body: JSON.stringify({ source, destination, filename })
+                    body: JSON.stringify(payload)
                 });
+                if (!response.ok) {
+                    this.transfer.error = (await response.text()) || 'The transfer could not be queued.';
+                    return;
+                }
                 const result = await response.json();
-                if (!result.success) {
+                if (result.success) {
+                    this.submittedJobs.push(result.job_id);
+                } else {
                     this.transfer.error = result.message;
                 }
             } catch (error) {
                 console.error('Transfer error:', error);
-                this.transfer.error = 'A network error occurred during the transfer.';
-            } finally {
-                this.transfer.active = false;
-                // The polling will handle the final state update and file list refresh
+                this.transfer.error = 'A network error occurred while queueing the transfer.';
             }
+            // The polling will pick up progress and the final result
+            this.fetchData();
+        },
+        performTransfer(source, destination, filename) {
+            return this.submitTransfer('/transfer-file', { source, destination, filename });
         },
         transferToEReader(filename) {
             this.performTransfer('sd', 'usb', filename);
@@ -88,16 +275,48 @@ createApp({
         transferToLibrary(filename) {
             this.performTransfer('usb', 'sd', filename);
         },
+        async transferSelected() {
+            if (this.selectedFiles.length === 0) return;
+            const files = this.selectedFiles.splice(0);
+            await this.submitTransfer('/transfer-batch', { source: 'sd', destination: 'usb', files });
+        },
         async cancelTransfer() {
             if (!this.transfer.active) return;
             try {
-                await fetch('/transfer-cancel', { method: 'POST' });
+                await fetch('/transfer-cancel?job=' + this.transfer.jobId, { method: 'POST' });
                 // The backend will stop the transfer. The polling will update the state.
             } catch (error) {
                 console.error('Error cancelling transfer:', error);
                 this.transfer.error = 'Failed to send cancel request.';
             }
         },
+        // Streams a book to the SD card with PUT /books/<name>. XHR is used
+        // instead of fetch for its upload progress events.
+        uploadBook(event) {
+            const file = event.target.files[0];
+            event.target.value = '';
+            if (!file) return;
+            this.upload.active = true;
+            this.upload.progress = 0;
+            const xhr = new XMLHttpRequest();
+            xhr.open('PUT', '/books/' + encodeURIComponent(file.name));
+            xhr.upload.onprogress = (e) => {
+                if (e.lengthComputable) this.upload.progress = Math.round((e.loaded / e.total) * 100);
+            };
+            xhr.onload = () => {
+                this.upload.active = false;
+                if (xhr.status === 200) {
+                    this.resetList('sd');
+                } else {
+                    this.transfer.error = xhr.responseText || 'Upload failed.';
+                }
+            };
+            xhr.onerror = () => {
+                this.upload.active = false;
+                this.transfer.error = 'A network error occurred during the upload.';
+            };
+            xhr.send(file);
+        },
         async enterSleepMode() {
             if (confirm('Are you sure you want to put the device to sleep? You will need to press the RESET button on the board to wake it up.')) {
                 try {
@@ -115,9 +334,15 @@ createApp({
     mounted() {
         this.fetchData();
         this.fetchFileLists();
-        this.pollingInterval = setInterval(this.fetchData, 1000); // Poll for status updates
+        this.startPolling(); // Until the push channel is up
+        this.connectEvents();
     },
     beforeUnmount() {
-        clearInterval(this.pollingInterval);
+        this.stopPolling();
+        clearTimeout(this.reconnectTimer);
+        if (this.eventSocket) {
+            this.eventSocket.onclose = null;
+            this.eventSocket.close();
+        }
     }
 }).mount('#app')
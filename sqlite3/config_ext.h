@@ -8,7 +8,7 @@
 #define SQLITE_DISABLE_DIRSYNC               1
 #define SQLITE_SECURE_DELETE                 0
 #define SQLITE_DEFAULT_LOOKASIDE        512,64
-#define YYSTACKDEPTH                        20
+#define YYSTACKDEPTH                         0
 #define SQLITE_SMALL_STACK                   1
 #define SQLITE_SORTER_PMASZ                  4
 #define SQLITE_DEFAULT_CACHE_SIZE           -1
@@ -21,6 +21,7 @@
 #define SQLITE_OMIT_WAL                      1
 #define SQLITE_DISABLE_FTS3_UNICODE          1
 #define SQLITE_DISABLE_FTS4_DEFERRED         1
+#define SQLITE_ENABLE_FTS5                   1
 #define SQLITE_LIKE_DOESNT_MATCH_BLOBS       1
 #define SQLITE_DEFAULT_FOREIGN_KEYS          1
 #define SQLITE_DEFAULT_LOCKING_MODE          1
@@ -23,7 +23,12 @@
 #include <sys/param.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sdkconfig.h>
+#include <esp_heap_caps.h>
 #include "shox96_0_2.h"
+extern "C" {
+#include "unishox1.h"
+}
 
 #undef dbg_printf
 //#define dbg_printf(...) Serial.printf(__VA_ARGS__)
@@ -69,6 +74,33 @@ uint64_t decode_unsigned_varint(const uint8_t *data, int &decoded_bytes) {
 # define SQLITE_ESP32VFS_BUFFERSZ 8192
 #endif
 
+/*
+** Size of the read-ahead cache kept for each main database file, in bytes.
+** Reads are served from one aligned block of this size, so it should be a
+** multiple of the FAT cluster and MSC block size. Set to 0 to disable.
+*/
+#ifndef SQLITE_ESP32VFS_CACHESZ
+# define SQLITE_ESP32VFS_CACHESZ 32768
+#endif
+
+/*
+** Sector size reported to SQLite when the filesystem does not tell us.
+** SD cards and USB mass storage both use 512-byte logical blocks.
+*/
+#ifndef SQLITE_ESP32VFS_SECTORSZ
+# define SQLITE_ESP32VFS_SECTORSZ 512
+#endif
+
+/*
+** Largest sector size reported, kept at config_ext.h's page size. FATFS
+** gives the cluster size as st_blksize, and SQLite both pads journal
+** headers to the sector size and grows the page size of new databases to
+** match it (up to SQLITE_MAX_DEFAULT_PAGE_SIZE, 32 KiB here).
+*/
+#ifndef SQLITE_ESP32VFS_MAXSECTORSZ
+# define SQLITE_ESP32VFS_MAXSECTORSZ 512
+#endif
+
 /*
 ** The maximum pathname length supported by this VFS.
 */
@@ -86,8 +118,38 @@ struct ESP32File {
   char *aBuffer;                  /* Pointer to malloc'd buffer */
   int nBuffer;                    /* Valid bytes of data in zBuffer */
   sqlite3_int64 iBufferOfst;      /* Offset in file of zBuffer[0] */
+
+  char *aCache;                   /* Read-ahead block, main databases only */
+  int nCache;                     /* Valid bytes in aCache, 0 if empty */
+  sqlite3_int64 iCacheOfst;       /* Offset in file of aCache[0] */
+  int iSectorSize;                /* Reported by xSectorSize */
 };
 
+/*
+** The read-ahead block is large, so place it in PSRAM when the board has
+** it and keep internal RAM for the page cache and stacks.
+*/
+static char *ESP32CacheAlloc(void){
+#if CONFIG_SPIRAM
+  char *p = (char *)heap_caps_malloc(SQLITE_ESP32VFS_CACHESZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if( p ) return p;
+#endif
+  return (char *)heap_caps_malloc(SQLITE_ESP32VFS_CACHESZ, MALLOC_CAP_8BIT);
+}
+
+/*
+** Copy the part of a write that overlaps the read-ahead block into it, so
+** the cache never holds stale data.
+*/
+static void ESP32CachePatch(ESP32File *p, const void *zBuf, int iAmt, sqlite3_int64 iOfst){
+  if( !p->nCache ) return;
+  sqlite3_int64 iStart = MAX(iOfst, p->iCacheOfst);
+  sqlite3_int64 iEnd = MIN(iOfst + iAmt, p->iCacheOfst + p->nCache);
+  if( iStart<iEnd ){
+    memcpy(&p->aCache[iStart - p->iCacheOfst], (const char *)zBuf + (iStart - iOfst), iEnd - iStart);
+  }
+}
+
 /*
 ** Write directly to the file passed as the first argument. Even if the
 ** file has a write-buffer (ESP32File.aBuffer), ignore it.
@@ -112,8 +174,10 @@ static int ESP32DirectWrite(
   nWrite = fwrite(zBuf, 1, iAmt, p->fp); // write(p->fd, zBuf, iAmt);
   if( nWrite!=iAmt ){
     //Serial.println("Write error");
+    p->nCache = 0;
     return SQLITE_IOERR_WRITE;
   }
+  ESP32CachePatch(p, zBuf, iAmt, iOfst);
 
   //Serial.println("fn:DirectWrite:Success");
 
@@ -145,11 +209,45 @@ static int ESP32Close(sqlite3_file *pFile){
   ESP32File *p = (ESP32File*)pFile;
   rc = ESP32FlushBuffer(p);
   sqlite3_free(p->aBuffer);
+  heap_caps_free(p->aCache);
   fclose(p->fp);
   //Serial.println("fn:Close:Success");
   return rc;
 }
 
+/*
+** Read data through the read-ahead block. Each miss loads one aligned
+** SQLITE_ESP32VFS_CACHESZ block, so scanning a database turns into a few
+** large transfers instead of one small fseek+fread per page.
+*/
+static int ESP32CachedRead(ESP32File *p, void *zBuf, int iAmt, sqlite_int64 iOfst){
+  char *z = (char *)zBuf;
+  while( iAmt>0 ){
+    if( iOfst<p->iCacheOfst || iOfst>=p->iCacheOfst+p->nCache ){
+      sqlite3_int64 iBlock = iOfst - (iOfst % SQLITE_ESP32VFS_CACHESZ);
+      p->nCache = 0;
+      if( fseek(p->fp, iBlock, SEEK_SET)!=0 ){
+        return SQLITE_IOERR_READ;
+      }
+      int nRead = fread(p->aCache, 1, SQLITE_ESP32VFS_CACHESZ, p->fp);
+      if( nRead<=0 || iBlock+nRead<=iOfst ){
+        /* Past the end of the file: SQLite expects the rest zero-filled */
+        memset(z, 0, iAmt);
+        return ferror(p->fp) ? SQLITE_IOERR_READ : SQLITE_IOERR_SHORT_READ;
+      }
+      p->iCacheOfst = iBlock;
+      p->nCache = nRead;
+    }
+    int nAvail = (int)(p->iCacheOfst + p->nCache - iOfst);
+    int nCopy = MIN(nAvail, iAmt);
+    memcpy(z, &p->aCache[iOfst - p->iCacheOfst], nCopy);
+    z += nCopy;
+    iOfst += nCopy;
+    iAmt -= nCopy;
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Read data from a file.
 */
@@ -176,6 +274,11 @@ static int ESP32Read(
     return rc;
   }
 
+  /* Requests as large as the block gain nothing from caching */
+  if( p->aCache && iAmt<SQLITE_ESP32VFS_CACHESZ ){
+    return ESP32CachedRead(p, zBuf, iAmt, iOfst);
+  }
+
   ofst = fseek(p->fp, iOfst, SEEK_SET); //lseek(p->fd, iOfst, SEEK_SET);
   //if( ofst != 0 ){
   //  return SQLITE_IOERR_READ;
@@ -186,6 +289,7 @@ static int ESP32Read(
     //Serial.println("fn:Read:Success");
     return SQLITE_OK;
   }else if( nRead>=0 ){
+    memset((char *)zBuf + nRead, 0, iAmt - nRead);
     return SQLITE_IOERR_SHORT_READ;
   }
 
@@ -327,22 +431,42 @@ static int ESP32CheckReservedLock(sqlite3_file *pFile, int *pResOut){
 }
 
 /*
-** No xFileControl() verbs are implemented by this VFS.
+** No xFileControl() verbs are implemented by this VFS. SQLITE_NOTFOUND
+** matters: returning SQLITE_OK for SQLITE_FCNTL_PRAGMA would tell SQLite
+** the VFS handled every PRAGMA itself, silently turning them into no-ops.
 */
 static int ESP32FileControl(sqlite3_file *pFile, int op, void *pArg){
-  return SQLITE_OK;
+  return SQLITE_NOTFOUND;
 }
 
 /*
-** The xSectorSize() and xDeviceCharacteristics() methods. These two
-** may return special values allowing SQLite to optimize file-system 
-** access to some extent. But it is also safe to simply return 0.
+** The xSectorSize() and xDeviceCharacteristics() methods. The sector size
+** is the block size of the underlying device, which SQLite uses to align
+** journal writes. FAT gives no atomic-write guarantees, but the config
+** enables SQLITE_POWERSAFE_OVERWRITE and a block write never touches
+** bytes outside itself.
 */
 static int ESP32SectorSize(sqlite3_file *pFile){
-  return 0;
+  return ((ESP32File *)pFile)->iSectorSize;
 }
 static int ESP32DeviceCharacteristics(sqlite3_file *pFile){
-  return 0;
+  return SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+/*
+** Block size of the device holding fp, capped at SQLITE_ESP32VFS_MAXSECTORSZ.
+** Only trusted when it is a power of two in SQLite's accepted range;
+** otherwise use the compile-time default.
+*/
+static int ESP32QuerySectorSize(FILE *fp){
+  struct stat st;
+  if( fstat(fileno(fp), &st)==0 ){
+    int n = (int)st.st_blksize;
+    if( n>=512 && n<=65536 && (n & (n-1))==0 ){
+      return n>SQLITE_ESP32VFS_MAXSECTORSZ ? SQLITE_ESP32VFS_MAXSECTORSZ : n;
+    }
+  }
+  return SQLITE_ESP32VFS_SECTORSZ;
 }
 
 #ifndef F_OK
@@ -486,6 +610,11 @@ static int ESP32Open(
     return SQLITE_CANTOPEN;
   }
   p->aBuffer = aBuf;
+  p->iSectorSize = ESP32QuerySectorSize(p->fp);
+  if( SQLITE_ESP32VFS_CACHESZ>0 && (flags&SQLITE_OPEN_MAIN_DB) ){
+    /* Without a cache every page is read separately; that is slow but works */
+    p->aCache = ESP32CacheAlloc();
+  }
 
   if( pOutFlags ){
     *pOutFlags = flags;
@@ -708,55 +837,97 @@ static void shox96_0_2d(sqlite3_context *context, int argc, sqlite3_value **argv
   //}
 } 
 
+// Unishox1 does not reproduce every input: some runs of digits and a '.'
+// after CJK text come back changed and longer. Such text is stored as-is,
+// so unishox1d() only ever has to decode to the length that was promised.
+static bool unishox1_round_trips(const char *in, int nIn, const char *packed, int nPacked) {
+  char *check = (char *) malloc(nIn);
+  if (!check) {
+    return false;
+  }
+  int n = unishox1_decompress_n(packed, nPacked, check, nIn, NULL);
+  bool same = n == nIn && memcmp(check, in, nIn) == 0;
+  free(check);
+  return same;
+}
+
+// unishox1c(text) stores text as a Unishox-compressed blob prefixed with the
+// varint length of the original. Text that would not get any smaller (short
+// or binary strings) is returned unchanged, so a column may hold both forms;
+// unishox1d() decodes blobs and passes every other value through as-is.
 static void unishox1c(sqlite3_context *context, int argc, sqlite3_value **argv) {
-  int nIn, nOut;
-  long int nOut2;
-  const unsigned char *inBuf;
+  int nIn;
+  int nOut;
+  const char *inBuf;
   unsigned char *outBuf;
-	unsigned char vInt[9];
-	int vIntLen;
+  unsigned char vInt[9];
+  int vIntLen;
 
   assert( argc==1 );
+  if (sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+    sqlite3_result_value(context, argv[0]);
+    return;
+  }
+  inBuf = (const char *) sqlite3_value_text(argv[0]);
   nIn = sqlite3_value_bytes(argv[0]);
-  inBuf = (unsigned char *) sqlite3_value_blob(argv[0]);
-  nOut = 13 + nIn + (nIn+999)/1000;
   vIntLen = encode_unsigned_varint(vInt, (uint64_t) nIn);
 
-  outBuf = (unsigned char *) malloc( nOut+vIntLen );
-	memcpy(outBuf, vInt, vIntLen);
-  nOut2 = shox96_0_2_compress((const char *) inBuf, nIn, (char *) &outBuf[vIntLen], NULL);
-  sqlite3_result_blob(context, outBuf, nOut2+vIntLen, free);
+  // Bytes that are not valid UTF-8 cost up to three bytes each
+  outBuf = (unsigned char *) malloc(vIntLen + 3 * nIn + 16);
+  if (!outBuf) {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  memcpy(outBuf, vInt, vIntLen);
+  nOut = unishox1_compress(inBuf, nIn, (char *) &outBuf[vIntLen], NULL);
+  if (nOut + vIntLen >= nIn || !unishox1_round_trips(inBuf, nIn, (const char *) &outBuf[vIntLen], nOut)) {
+    free(outBuf);
+    sqlite3_result_value(context, argv[0]);
+    return;
+  }
+  sqlite3_result_blob(context, outBuf, nOut + vIntLen, free);
 }
 
 static void unishox1d(sqlite3_context *context, int argc, sqlite3_value **argv) {
-  unsigned int nIn, nOut, rc;
+  int nIn;
+  int nOut;
   const unsigned char *inBuf;
-  unsigned char *outBuf;
-  long int nOut2;
-  uint64_t inBufLen64;
-	int vIntLen;
+  char *outBuf;
+  int vIntLen;
 
   assert( argc==1 );
-
-  if (sqlite3_value_type(argv[0]) != SQLITE_BLOB)
-	  return;
-
+  if (sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+    sqlite3_result_value(context, argv[0]);
+    return;
+  }
   nIn = sqlite3_value_bytes(argv[0]);
-  if (nIn < 2){
+  if (nIn < 2) {
     return;
   }
-  inBuf = (unsigned char *) sqlite3_value_blob(argv[0]);
-  inBufLen64 = decode_unsigned_varint(inBuf, vIntLen);
-	nOut = (unsigned int) inBufLen64;
-  outBuf = (unsigned char *) malloc( nOut );
-  //nOut2 = (long int)nOut;
-  nOut2 = shox96_0_2_decompress((const char *) (inBuf + vIntLen), nIn - vIntLen, (char *) outBuf, NULL);
-  //if( rc!=Z_OK ){
-  //  free(outBuf);
-  //}else{
-    sqlite3_result_blob(context, outBuf, nOut2, free);
-  //}
-} 
+  inBuf = (const unsigned char *) sqlite3_value_blob(argv[0]);
+  uint64_t nOut64 = decode_unsigned_varint(inBuf, vIntLen);
+  // The prefix sizes the buffer, so a damaged one must not size it past
+  // what SQLite would hold in a value anyway
+  if (vIntLen >= nIn || nOut64 == 0 ||
+      nOut64 > (uint64_t) sqlite3_limit(sqlite3_context_db_handle(context), SQLITE_LIMIT_LENGTH, -1)) {
+    return;
+  }
+  nOut = (int) nOut64;
+  outBuf = (char *) malloc(nOut + 1);
+  if (!outBuf) {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  // Decode into exactly the length the prefix promised; a blob that would
+  // write past it is treated like any other malformed one
+  nOut = unishox1_decompress_n((const char *) (inBuf + vIntLen), nIn - vIntLen, outBuf, nOut, NULL);
+  if (nOut < 0) {
+    free(outBuf);
+    return;
+  }
+  outBuf[nOut] = '\0';
+  sqlite3_result_text(context, outBuf, nOut, free);
+}
 
 int registerFunctions(sqlite3 *db, const char **pzErrMsg, const struct sqlite3_api_routines *pThunk) {
   sqlite3_create_function(db, "shox96_0_2c", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, 0, shox96_0_2c, 0, 0);
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
 
 #include "unishox1.h"
@@ -401,7 +402,7 @@ int matchLine(const char *in, int len, int l, char *out, int *ol, struct us_lnk_
           last_len = 0;
           *ol = last_ol;
         }*/
-        printf("Len: %d, Dist: %d, Line: %d\n", last_len, last_dist, last_ctx);
+        //printf("Len: %d, Dist: %d, Line: %d\n", last_len, last_dist, last_ctx);
         j += last_len;
       }
     }
@@ -569,7 +570,7 @@ int unishox1_compress(const char *in, int len, char *out, struct us_lnk_lst *pre
           state = SHX_STATE_1;
           ol = append_bits(out, ol, BACK_FROM_UNI_CODE, BACK_FROM_UNI_CODE_LEN, state);
         }
-        printf("Bin:%d:%x\n", (unsigned char) c_in, (unsigned char) c_in);
+        //printf("Bin:%d:%x\n", (unsigned char) c_in, (unsigned char) c_in);
         ol = append_bits(out, ol, BIN_CODE, BIN_CODE_LEN, state);
         ol = encodeCount(out, ol, (unsigned char) c_in);
       }
@@ -684,6 +685,11 @@ int32_t readUnicode(const char *in, int *bit_no_p, int len) {
   return 0;
 }
 
+// Bytes writeUTF8() writes for `uni`
+static int utf8Len(int uni) {
+  return uni < (1 << 11) ? 2 : (uni < (1 << 16) ? 3 : 4);
+}
+
 void writeUTF8(char *out, int *ol, int uni) {
   if (uni < (1 << 11)) {
     out[(*ol)++] = (0xC0 + (uni >> 6));
@@ -701,7 +707,9 @@ void writeUTF8(char *out, int *ol, int uni) {
   }
 }
 
-int decodeRepeat(const char *in, int len, char *out, int ol, int *bit_no, struct us_lnk_lst *prev_lines) {
+// Returns the new output length, or -1 if the copy would not fit in `olen`
+// bytes or would start before the output.
+int decodeRepeat(const char *in, int len, char *out, int ol, int olen, int *bit_no, struct us_lnk_lst *prev_lines) {
   if (prev_lines) {
     int dict_len = readCount(in, bit_no, len) + NICE_LEN;
     int dist = readCount(in, bit_no, len);
@@ -709,18 +717,26 @@ int decodeRepeat(const char *in, int len, char *out, int ol, int *bit_no, struct
     struct us_lnk_lst *cur_line = prev_lines;
     while (ctx--)
       cur_line = cur_line->previous;
+    if (dict_len > olen - ol)
+      return -1;
     memmove(out + ol, cur_line->data + dist, dict_len);
     ol += dict_len;
   } else {
     int dict_len = readCount(in, bit_no, len) + NICE_LEN;
     int dist = readCount(in, bit_no, len) + NICE_LEN - 1;
-    memcpy(out + ol, out + ol - dist, dict_len);
+    if (dict_len > olen - ol || dist > ol)
+      return -1;
+    // Only a damaged stream makes the copy overlap itself
+    memmove(out + ol, out + ol - dist, dict_len);
     ol += dict_len;
   }
   return ol;
 }
 
-int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *prev_lines) {
+// Fails the decode when `n` more bytes would not fit in the output
+#define SHX_ROOM(n) do { if ((n) > olen - ol) return -1; } while (0)
+
+int unishox1_decompress_n(const char *in, int len, char *out, int olen, struct us_lnk_lst *prev_lines) {
 
   int dstate;
   int bit_no;
@@ -735,7 +751,8 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
   int prev_uni = 0;
 
   len <<= 3;
-  out[ol] = 0;
+  if (olen > 0)
+    out[ol] = 0;
   while (bit_no < len) {
     int h, v;
     char c = 0;
@@ -796,9 +813,12 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
     }
     if (v == 0 && h == SHX_SET1A) {
       if (is_upper) {
+        SHX_ROOM(1);
         out[ol++] = readCount(in, &bit_no, len);
       } else {
-        ol = decodeRepeat(in, len, out, ol, &bit_no, prev_lines);
+        ol = decodeRepeat(in, len, out, ol, olen, &bit_no, prev_lines);
+        if (ol < 0)
+          return -1;
       }
       continue;
     }
@@ -811,28 +831,38 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
             break;
           switch (spl_code_idx) {
             case 1:
+              SHX_ROOM(1);
               out[ol++] = ' ';
               break;
             case 0:
-              ol = decodeRepeat(in, len, out, ol, &bit_no, prev_lines);
+              ol = decodeRepeat(in, len, out, ol, olen, &bit_no, prev_lines);
+              if (ol < 0)
+                return -1;
               break;
             case 3:
+              SHX_ROOM(1);
               out[ol++] = ',';
               break;
             case 4:
-              if (prev_uni > 0x3000)
+              if (prev_uni > 0x3000) {
+                SHX_ROOM(utf8Len(0x3002));
                 writeUTF8(out, &ol, 0x3002);
-              else
+              } else {
+                SHX_ROOM(1);
                 out[ol++] = '.';
+              }
               break;
             case 5:
+              SHX_ROOM(1);
               out[ol++] = 13;
               break;
             case 6:
+              SHX_ROOM(1);
               out[ol++] = 10;
           }
         } else {
           prev_uni += delta;
+          SHX_ROOM(utf8Len(prev_uni));
           writeUTF8(out, &ol, prev_uni);
         }
       } while (is_upper);
@@ -852,6 +882,7 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
       if (h == SHX_SET1B) {
          switch (v) {
            case 9:
+             SHX_ROOM(2);
              out[ol++] = '\r';
              out[ol++] = '\n';
              continue;
@@ -859,10 +890,14 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
              if (is_upper) { // rpt
                int count = readCount(in, &bit_no, len);
                count += 4;
+               if (ol == 0)
+                 return -1;
+               SHX_ROOM(count);
                char rpt_c = out[ol - 1];
                while (count--)
                  out[ol++] = rpt_c;
              } else {
+               SHX_ROOM(1);
                out[ol++] = '\n';
              }
              continue;
@@ -871,6 +906,7 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
          }
       }
     }
+    SHX_ROOM(1);
     out[ol++] = c;
   }
 
@@ -878,6 +914,16 @@ int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *p
 
 }
 
+#undef SHX_ROOM
+
+int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *prev_lines) {
+  return unishox1_decompress_n(in, len, out, INT_MAX, prev_lines);
+}
+
+// Command line tool, only built on the host. The firmware calls
+// unishox1_compress()/unishox1_decompress() through esp32.cpp.
+#ifdef UNISHOX_CLI
+
 int is_empty(const char *s) {
   while (*s != '\0') {
     if (!isspace((unsigned char)*s))
@@ -1174,4 +1220,6 @@ printf("\nElapsed: %0.3lf ms\n", timedifference(tStart, getTimeVal()));
 return 0;
 
 }
+#endif // UNISHOX_CLI
+
 #pragma GCC diagnostic pop
@@ -27,5 +27,8 @@ struct us_lnk_lst {
 
 extern int unishox1_compress(const char *in, int len, char *out, struct us_lnk_lst *prev_lines);
 extern int unishox1_decompress(const char *in, int len, char *out, struct us_lnk_lst *prev_lines);
+// As unishox1_decompress(), but writes at most `olen` bytes (no terminator)
+// and returns -1 if the input would decode to more or is malformed.
+extern int unishox1_decompress_n(const char *in, int len, char *out, int olen, struct us_lnk_lst *prev_lines);
 
 #endif
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Packs the web UI into a C source file holding a const asset table.
+
+Every file under the source directories is gzip-compressed and emitted as a
+const byte array, together with a `web_assets_table` entry giving its URI,
+MIME type, ETag and Cache-Control value (see main/web_assets.h). The arrays
+live in flash and are served straight from the memory-mapped image, so the
+firmware needs no filesystem for its UI. Output is deterministic (gzip
+mtime 0), so unchanged assets keep their ETag across builds.
+"""
+import argparse
+import gzip
+import hashlib
+import os
+import sys
+
+MIME_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.svg': 'image/svg+xml',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+}
+
+# Pinned third-party files never change under the same name
+IMMUTABLE_CACHE = 'public, max-age=31536000, immutable'
+# Our own assets keep stable names, so browsers revalidate with the ETag
+REVALIDATE_CACHE = 'no-cache'
+
+BYTES_PER_LINE = 16
+
+
+def collect(src_dirs, exclude):
+    assets = {}
+    for src in src_dirs:
+        for root, _, files in os.walk(src):
+            for name in sorted(files):
+                path = os.path.join(root, name)
+                rel = os.path.relpath(path, src).replace(os.sep, '/')
+                if rel in exclude:
+                    continue
+                assets[rel] = path
+    return assets
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), BYTES_PER_LINE):
+        lines.append('    ' + ' '.join('0x%02x,' % b for b in data[i:i + BYTES_PER_LINE]))
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--out', required=True, help='generated C file')
+    parser.add_argument('--exclude', action='append', default=[], help='relative path to skip')
+    parser.add_argument('src', nargs='+', help='asset source directories')
+    args = parser.parse_args()
+
+    assets = collect(args.src, set(args.exclude))
+
+    arrays = []
+    entries = []
+    for index, (rel, path) in enumerate(sorted(assets.items())):
+        ext = os.path.splitext(rel)[1].lower()
+        mime = MIME_TYPES.get(ext)
+        if mime is None:
+            sys.exit('pack_web_assets: no MIME type for %s' % rel)
+
+        with open(path, 'rb') as f:
+            data = f.read()
+        packed = gzip.compress(data, compresslevel=9, mtime=0)
+        etag = hashlib.sha256(data).hexdigest()[:16]
+        cache = IMMUTABLE_CACHE if rel.startswith('vendor/') else REVALIDATE_CACHE
+
+        arrays.append('// %s (%d bytes, %d gzipped)\nstatic const uint8_t asset_%d[] = {\n%s\n};\n'
+                      % (rel, len(data), len(packed), index, c_bytes(packed)))
+        entries.append('    { "/%s", "%s", "\\"%s\\"", "%s", asset_%d, sizeof(asset_%d) },'
+                       % (rel, mime, etag, cache, index, index))
+
+    with open(args.out, 'w') as f:
+        f.write('// Generated by tools/pack_web_assets.py. Do not edit.\n')
+        f.write('#include "web_assets.h"\n\n')
+        f.write('\n'.join(arrays))
+        f.write('\nconst web_asset_t web_assets_table[] = {\n%s\n};\n' % '\n'.join(entries))
+        f.write('const size_t web_assets_count = sizeof(web_assets_table) / sizeof(web_assets_table[0]);\n')
+
+
+if __name__ == '__main__':
+    main()